@@ -78,6 +78,10 @@ esac
 mkdir -p "${buildroot}/dist${LIBDIR}"
 cp "${buildroot}/libparameter_storage_manager.so" "${buildroot}/dist${LIBDIR}/"
 
+# copy the caching wasi-nn backends, found first through LD_LIBRARY_PATH
+mkdir -p "${buildroot}/dist/usr/lib/edge-device-core/wasi-nn"
+cp "${buildroot}"/src/evp-agent/wasi-nn/libwasi_nn_*.so "${buildroot}/dist/usr/lib/edge-device-core/wasi-nn/"
+
 mkdir -p "${buildroot}/dist/etc/udev/rules.d/"
 install -m 644 "${MESON_SOURCE_ROOT}/udev/60-edc.rules" "${buildroot}/dist/etc/udev/rules.d/"
 
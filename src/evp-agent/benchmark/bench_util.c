@@ -0,0 +1,55 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_util.h"
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint8_t *read_module(const char *path, uint32_t *sizep)
+{
+    FILE *fp = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long size;
+
+    if (fp == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0 || size > UINT32_MAX ||
+        fseek(fp, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "failed to get the size of %s\n", path);
+        goto end;
+    }
+    buf = malloc(size);
+    if (buf == NULL) {
+        fprintf(stderr, "failed to allocate %ld bytes\n", size);
+        goto end;
+    }
+    if (fread(buf, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "failed to read %s\n", path);
+        free(buf);
+        buf = NULL;
+        goto end;
+    }
+    *sizep = (uint32_t)size;
+
+end:
+    fclose(fp);
+    return buf;
+}
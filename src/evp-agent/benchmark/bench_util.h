@@ -0,0 +1,22 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+/*
+ * Helpers shared by the benchmarks.
+ */
+
+#include <stdint.h>
+
+/* CLOCK_MONOTONIC, in nanoseconds */
+uint64_t now_ns(void);
+
+/* Reads a whole module file into a malloc()ed buffer, NULL on error */
+uint8_t *read_module(const char *path, uint32_t *sizep);
+
+#endif /* __BENCH_UTIL_H__ */
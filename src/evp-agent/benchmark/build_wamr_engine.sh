@@ -0,0 +1,23 @@
+#!/bin/sh
+# SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+#
+# SPDX-License-Identifier: Apache-2.0
+
+# Build the WAMR runtime library in a given engine configuration.
+#
+# usage: build_wamr_engine.sh <wamr source dir> <build dir> <output library> \
+#                             [cmake definitions...]
+
+set -e
+
+src_dir=$1
+build_dir=$2
+output=$3
+shift 3
+
+cmake -S "$src_dir" -B "$build_dir" \
+	-DCMAKE_BUILD_TYPE=Release \
+	-DCMAKE_POSITION_INDEPENDENT_CODE=ON \
+	"$@" > "$build_dir.log"
+cmake --build "$build_dir" --target vmlib >> "$build_dir.log"
+cp "$build_dir/libvmlib.a" "$output"
@@ -0,0 +1,39 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Stand-ins for the agent sources that need the device, the ESF and
+ * senscord, so that a benchmark links the rest of the agent with the link
+ * arguments of the product: no proxy, no configuration (so no pooled HTTPS
+ * connections), and no senscord bridge natives to wrap.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <evp/agent_config.h>
+#include <wasm_export.h>
+
+#include "esf.h"
+#include "frame_share.h"
+
+bool evp_agent_esf_get_proxy(const char **host, const char **port, const char **username,
+                             const char **password)
+{
+    return false;
+}
+
+struct config *evp_agent_esf_read_config(enum config_key key)
+{
+    return NULL;
+}
+
+NativeSymbol *evp_agent_frame_share_senscord_natives(NativeSymbol *native_symbols,
+                                                     uint32_t n_native_symbols)
+{
+    return native_symbols;
+}
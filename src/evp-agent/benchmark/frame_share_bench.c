@@ -0,0 +1,212 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * senscord zero-copy frame benchmark.
+ *
+ * Feeds frames from a fake senscord stream to a wasm module, once copied
+ * into its linear memory as the senscord WAMR bridge does, and once through
+ * the zero-copy natives of the agent (frame_share.c). The stream buffers are
+ * either shared memory, which can be mapped into the module, or private
+ * memory, which exercises the copy fallback.
+ *
+ * usage: frame_share_bench <frame_kernels.wasm> <shared|private> [frame_size] [iterations]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "bench_util.h"
+#include "frame_share.h"
+#include "senscord_stream_fake.h"
+
+#define BENCH_WASM_STACK_SIZE 32678
+/* Room for the frame windows of the zero-copy natives */
+#define BENCH_WASM_HEAP_SIZE (8 * 1024 * 1024)
+#define BENCH_ERROR_BUF_SIZE 128
+
+/* VGA RGB888, the usual input tensor source */
+#define BENCH_DEFAULT_FRAME_SIZE (640 * 480 * 3)
+#define BENCH_DEFAULT_ITERATIONS 2000
+#define BENCH_STREAM 1
+#define BENCH_STREAM_BUFFERS 4
+
+/* The copy path of the senscord WAMR bridge: get, copy, release */
+static int32_t bench_copy_get_frame(wasm_exec_env_t exec_env, uint64_t stream, void *buf,
+                                    uint32_t size)
+{
+    struct evp_frame_share_frame frame;
+    int ret;
+
+    ret = senscord_stream_fake.get_frame(stream, 0, 1000, &frame);
+    if (ret) {
+        return ret;
+    }
+    if (frame.size > size) {
+        senscord_stream_fake.release_frame(stream, &frame);
+        return -ENOSPC;
+    }
+    memcpy(buf, frame.data, frame.size);
+    senscord_stream_fake.release_frame(stream, &frame);
+    return (int32_t)frame.size;
+}
+
+static NativeSymbol g_bench_natives[] = {
+    {"bench_copy_get_frame", bench_copy_get_frame, "(I*~)i", NULL},
+};
+
+static int run_kernel(wasm_exec_env_t exec_env, wasm_module_inst_t inst, const char *mode,
+                      const char *name, size_t frame_size, uint32_t iterations)
+{
+    wasm_function_inst_t func = wasm_runtime_lookup_function(inst, name);
+    struct evp_frame_share_stats before, after;
+    uint32_t argv[1];
+
+    if (func == NULL) {
+        fprintf(stderr, "%s is not exported by the module\n", name);
+        return -1;
+    }
+
+    /* Warm up: first touch of the frame buffer and of the windows */
+    argv[0] = BENCH_STREAM_BUFFERS;
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+
+    evp_agent_frame_share_stats(&before);
+    argv[0] = iterations;
+    uint64_t t0 = now_ns();
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+    uint64_t elapsed = now_ns() - t0;
+    evp_agent_frame_share_stats(&after);
+
+    if ((int32_t)argv[0] < 0) {
+        fprintf(stderr, "%s failed: %s\n", name, strerror(-(int32_t)argv[0]));
+        return -1;
+    }
+
+    printf("buffers=%s kernel=%s frame_bytes=%zu frames=%" PRIu32 " us_per_frame=%.1f "
+           "frames_per_sec=%.0f mapped=%" PRIu64 " copied=%" PRIu64 " remaps=%" PRIu64 "\n",
+           mode, name, frame_size, iterations, elapsed / 1000.0 / iterations,
+           elapsed > 0 ? iterations * 1e9 / elapsed : 0.0, after.mapped - before.mapped,
+           after.copied - before.copied, after.remaps - before.remaps);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct senscord_stream_fake_config config = {
+        .frame_size = BENCH_DEFAULT_FRAME_SIZE,
+        .buffers = BENCH_STREAM_BUFFERS,
+    };
+    char error_buf[BENCH_ERROR_BUF_SIZE];
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    RuntimeInitArgs init_args;
+    wasm_module_inst_t inst = NULL;
+    wasm_exec_env_t exec_env = NULL;
+    wasm_module_t module = NULL;
+    NativeSymbol *natives;
+    uint32_t n_natives;
+    uint8_t *buf = NULL;
+    uint32_t size = 0;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <module> <shared|private> [frame_size] [iterations]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    config.shared = strcmp(argv[2], "shared") == 0;
+    if (argc > 3) {
+        config.frame_size = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        iterations = (uint32_t)strtoul(argv[4], NULL, 0);
+    }
+
+    if (senscord_stream_fake_open(&config) != 0) {
+        fprintf(stderr, "failed to open the fake stream\n");
+        return EXIT_FAILURE;
+    }
+    evp_agent_frame_share_set_source(&senscord_stream_fake);
+
+    natives = evp_agent_frame_share_natives(&n_natives);
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.mem_alloc_type = Alloc_With_System_Allocator;
+    init_args.native_module_name = EVP_FRAME_SHARE_MODULE_NAME;
+    init_args.native_symbols = natives;
+    init_args.n_native_symbols = n_natives;
+
+    if (!wasm_runtime_full_init(&init_args)) {
+        fprintf(stderr, "wasm_runtime_full_init failed\n");
+        goto out_close_stream;
+    }
+    if (!wasm_runtime_register_natives("env", g_bench_natives,
+                                       sizeof(g_bench_natives) / sizeof(g_bench_natives[0]))) {
+        fprintf(stderr, "wasm_runtime_register_natives failed\n");
+        goto out_destroy_runtime;
+    }
+
+    buf = read_module(argv[1], &size);
+    if (buf == NULL) {
+        goto out_destroy_runtime;
+    }
+
+    module = wasm_runtime_load(buf, size, error_buf, sizeof(error_buf));
+    if (module == NULL) {
+        fprintf(stderr, "wasm_runtime_load failed: %s\n", error_buf);
+        goto out_free_buf;
+    }
+
+    inst = wasm_runtime_instantiate(module, BENCH_WASM_STACK_SIZE, BENCH_WASM_HEAP_SIZE,
+                                    error_buf, sizeof(error_buf));
+    if (inst == NULL) {
+        fprintf(stderr, "wasm_runtime_instantiate failed: %s\n", error_buf);
+        goto out_unload;
+    }
+
+    /* Issued by the senscord bridge in the agent, see frame_kernels.c */
+    evp_agent_frame_share_stream_opened(inst, BENCH_STREAM);
+
+    exec_env = wasm_runtime_create_exec_env(inst, BENCH_WASM_STACK_SIZE);
+    if (exec_env == NULL) {
+        fprintf(stderr, "wasm_runtime_create_exec_env failed\n");
+        goto out_deinstantiate;
+    }
+
+    ret = EXIT_SUCCESS;
+    if (run_kernel(exec_env, inst, argv[2], "bench_frames_copy", config.frame_size,
+                   iterations) != 0 ||
+        run_kernel(exec_env, inst, argv[2], "bench_frames_zero_copy", config.frame_size,
+                   iterations) != 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    wasm_runtime_destroy_exec_env(exec_env);
+out_deinstantiate:
+    evp_agent_frame_share_instance_destroyed(inst);
+    wasm_runtime_deinstantiate(inst);
+out_unload:
+    wasm_runtime_unload(module);
+out_free_buf:
+    free(buf);
+out_destroy_runtime:
+    wasm_runtime_destroy();
+out_close_stream:
+    senscord_stream_fake_close();
+    return ret;
+}
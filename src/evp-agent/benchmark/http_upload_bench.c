@@ -0,0 +1,239 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Plain HTTP upload benchmark.
+ *
+ * Uploads blobs to a loopback HTTP server that discards them, as on the
+ * local console path, and reports the CPU time of the uploading thread per
+ * GiB sent. The source is either an in-memory blob the body callback hands
+ * over, or a file it reads into the buffer it is given. The client mode
+ * sends them the way the HTTP client of the agent does, one send per piece
+ * of its BENCH_CLIENT_BUFFER buffer; the direct modes go through
+ * http_upload.h, with or without MSG_ZEROCOPY.
+ *
+ * usage: http_upload_bench <client|direct|zerocopy> <memory|file> [MiB]
+ */
+
+#define _GNU_SOURCE /* for RUSAGE_THREAD */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <webclient/webclient.h>
+
+#include "http_upload.h"
+#include "metrics.h"
+
+#define BENCH_DEFAULT_MIB 4096
+#define BENCH_BLOB_BYTES (64 * 1024 * 1024)
+/* The buffer of the blob requests of the agent */
+#define BENCH_CLIENT_BUFFER 4096
+#define BENCH_SERVER_BUFFER (1024 * 1024)
+#define BENCH_URL_SIZE 64
+
+struct source {
+    const unsigned char *memory;
+    int fd;
+    size_t off;
+};
+
+/* Reads each request to its end, and answers 201 */
+static void *server(void *arg)
+{
+    static const char created[] = "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+    int lfd = *(int *)arg;
+    char *buf = malloc(BENCH_SERVER_BUFFER);
+
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        size_t len = 0, left = 0;
+        char *end = NULL;
+        ssize_t n;
+
+        if (fd < 0) {
+            break;
+        }
+        while (end == NULL && (n = recv(fd, buf + len, 4096 - 1 - len, 0)) > 0) {
+            len += n;
+            buf[len] = '\0';
+            end = strstr(buf, "\r\n\r\n");
+        }
+        if (end != NULL) {
+            const char *cl = strcasestr(buf, "Content-Length:");
+
+            left = cl != NULL ? strtoull(cl + 15, NULL, 10) : 0;
+            left -= len - (end + 4 - buf);
+            while (left > 0 && (n = recv(fd, buf, BENCH_SERVER_BUFFER, 0)) > 0) {
+                left -= n;
+            }
+            send(fd, created, sizeof(created) - 1, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int body(void *buffer, size_t *sizep, const void **datap, size_t reqsize, void *arg)
+{
+    struct source *src = arg;
+    size_t n = *sizep < reqsize ? *sizep : reqsize;
+    ssize_t r;
+
+    if (src->memory != NULL) {
+        *datap = src->memory + src->off;
+    }
+    else {
+        r = pread(src->fd, buffer, n, src->off);
+        if (r <= 0) {
+            return -EIO;
+        }
+        n = r;
+    }
+    src->off += n;
+    *sizep = n;
+    return 0;
+}
+
+/* The way the HTTP client of the agent sends it */
+static int client_upload(struct webclient_context *ctx, int port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    char buffer[BENCH_CLIENT_BUFFER], head[256];
+    size_t left = ctx->bodylen;
+    int fd, n, ret = 0;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        return -errno;
+    }
+    n = snprintf(head, sizeof(head),
+                 "PUT /blob HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: %zu\r\n"
+                 "Connection: close\r\n\r\n",
+                 ctx->bodylen);
+    if (send(fd, head, n, MSG_NOSIGNAL) != n) {
+        ret = -EIO;
+    }
+    while (ret == 0 && left > 0) {
+        const void *data = buffer;
+        size_t size = sizeof(buffer);
+
+        ret = ctx->body_callback(buffer, &size, &data, left, ctx->body_callback_arg);
+        if (ret == 0 && send(fd, data, size, MSG_NOSIGNAL) != (ssize_t)size) {
+            ret = -EIO;
+        }
+        left -= size;
+    }
+    if (ret == 0 && recv(fd, buffer, sizeof(buffer), 0) <= 0) {
+        ret = -EIO;
+    }
+    close(fd);
+    ctx->http_status = ret == 0 ? 201 : 0;
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addrlen = sizeof(addr);
+    struct source src = {.fd = -1};
+    unsigned char *memory = NULL;
+    char url[BENCH_URL_SIZE], path[] = "/tmp/http_upload_bench.XXXXXX";
+    uint64_t total, sent = 0, cpu, start;
+    pthread_t thread;
+    bool client;
+    int lfd;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <client|direct|zerocopy> <memory|file> [MiB]\n", argv[0]);
+        return 1;
+    }
+    client = strcmp(argv[1], "client") == 0;
+    total = (uint64_t)(argc > 3 ? strtoul(argv[3], NULL, 10) : BENCH_DEFAULT_MIB) << 20;
+    setenv("EVP_HTTP_ZEROCOPY_MIN_BYTES", strcmp(argv[1], "zerocopy") == 0 ? "65536" : "0", 1);
+    if (evp_agent_http_upload_init() != 0) {
+        return 1;
+    }
+
+    memory = malloc(BENCH_BLOB_BYTES);
+    if (memory == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_BLOB_BYTES; i++) {
+        memory[i] = i * 31 + (i >> 12);
+    }
+    if (strcmp(argv[2], "file") == 0) {
+        src.fd = mkstemp(path);
+        if (src.fd < 0 || write(src.fd, memory, BENCH_BLOB_BYTES) != BENCH_BLOB_BYTES) {
+            return 1;
+        }
+        unlink(path);
+    }
+    else {
+        src.memory = memory;
+    }
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(lfd, 4) != 0 || getsockname(lfd, (struct sockaddr *)&addr, &addrlen) != 0) {
+        return 1;
+    }
+    pthread_create(&thread, NULL, server, &lfd);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u/blob", ntohs(addr.sin_port));
+
+    cpu = evp_agent_thread_cpu_us();
+    start = evp_agent_now_us();
+    while (sent < total) {
+        struct webclient_context ctx = {
+            .method = "PUT",
+            .url = url,
+            .bodylen = BENCH_BLOB_BYTES,
+            .body_callback = body,
+            .body_callback_arg = &src,
+        };
+        int ret;
+
+        src.off = 0;
+        ret = client ? client_upload(&ctx, ntohs(addr.sin_port)) : evp_agent_http_upload(&ctx);
+        if (ret != 0 || ctx.http_status != 201) {
+            fprintf(stderr, "upload failed: %d (HTTP %u)\n", ret, ctx.http_status);
+            return 1;
+        }
+        sent += BENCH_BLOB_BYTES;
+    }
+    cpu = evp_agent_thread_cpu_us() - cpu;
+    start = evp_agent_now_us() - start;
+
+    printf("mode=%s\n", argv[1]);
+    printf("source=%s\n", argv[2]);
+    printf("mib=%" PRIu64 "\n", sent >> 20);
+    printf("cpu_ms_per_gib=%.1f\n", cpu / 1000.0 / (sent / (double)(1 << 30)));
+    printf("mib_per_sec=%.1f\n", (sent >> 20) * 1e6 / start);
+
+    shutdown(lfd, SHUT_RDWR);
+    close(lfd);
+    pthread_join(thread, NULL);
+    if (src.fd >= 0) {
+        close(src.fd);
+    }
+    free(memory);
+    return 0;
+}
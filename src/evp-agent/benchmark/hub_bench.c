@@ -0,0 +1,800 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * End to end benchmark of the agent against a loopback hub.
+ *
+ * The EVP agent library runs in a child process, with the configuration of
+ * the ESF stubbed out to point it at the hub stand-in of hub_fake.h, which
+ * runs in the parent along with the HTTP server the module is downloaded
+ * from and the blobs are uploaded to. The MQTT buffers, store and telemetry
+ * batching of the agent are linked in, as in the product. The parent then
+ * drives, through the hub protocol only:
+ *
+ * - deploy: deployments of the module of kernels/hub_module.c and empty
+ *   deployments, in turn. The first deployment is reported as cold,
+ * - echo: configuration to telemetry round trips through the module,
+ * - flood: telemetries from the module, as fast as the agent sends them.
+ *   The module has no clock, so there is no per-message latency, only the
+ *   time to the first and to the last message,
+ * - upload: blob PUTs from the module to the HTTP server.
+ *
+ * For each, messages per second, latency percentiles, and the CPU use and
+ * the RSS of the agent process are reported.
+ *
+ * usage: hub_bench <hub_module.wasm> [deploys] [echoes] [flood] [uploads] [upload KiB]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <evp/agent.h>
+#include <evp/agent_config.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/sha256.h>
+#include <parson.h>
+
+#include "bench_util.h"
+#include "hub_fake.h"
+#include "metrics.h"
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
+#include "telemetry_batch.h"
+
+#define BENCH_DEFAULT_DEPLOYS 10
+#define BENCH_DEFAULT_ECHOES 1000
+#define BENCH_DEFAULT_FLOOD 10000
+#define BENCH_DEFAULT_UPLOADS 20
+#define BENCH_DEFAULT_UPLOAD_KIB 1024
+#define BENCH_CONNECT_TIMEOUT_MS 30000
+#define BENCH_DEPLOY_TIMEOUT_MS 60000
+#define BENCH_ECHO_TIMEOUT_MS 10000
+#define BENCH_FLOOD_TIMEOUT_MS 120000
+#define BENCH_UPLOAD_TIMEOUT_MS 60000
+#define BENCH_MANIFEST_SIZE 2048
+#define BENCH_MESSAGE_SIZE 512
+#define BENCH_ID_SIZE 64
+#define BENCH_MODULE_PATH "/hub_module.wasm"
+#define BENCH_INSTANCE "bench"
+
+#define TOPIC_ATTRIBUTES "v1/devices/me/attributes"
+#define TOPIC_TELEMETRY "v1/devices/me/telemetry"
+#define TOPIC_REQUEST TOPIC_ATTRIBUTES "/request/"
+#define TOPIC_RESPONSE TOPIC_ATTRIBUTES "/response/"
+
+/* State of the agent as seen by the hub */
+static struct {
+    struct hub_fake *hub;
+    char deployment_id[BENCH_ID_SIZE];
+    bool deployed;
+    uint64_t echo;
+    uint64_t flood;
+    uint64_t flood_first_ns;
+    uint32_t upload_status;
+    bool upload_done;
+    size_t uploaded;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} g_hub = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+/* Configuration of the agent in the child */
+static struct {
+    char mqtt_port[8];
+    volatile sig_atomic_t stop;
+} g_agent;
+
+struct proc_sample {
+    uint64_t ns;
+    uint64_t ticks;
+};
+
+/*
+ * Configuration of the agent, in place of the ESF one of config.c: the hub
+ * without TLS, and nothing else.
+ */
+
+int load_config_impl(struct config *config, void **vpp, size_t *sizep)
+{
+    *vpp = config->value;
+    *sizep = config->size;
+    return 0;
+}
+
+void unload_config_impl(struct config *config, void *vp0, size_t size)
+{
+}
+
+struct config *get_config_impl(enum config_key key)
+{
+    struct config *config;
+    const char *value;
+
+    switch (key) {
+        case EVP_CONFIG_MQTT_HOST:
+            value = "127.0.0.1";
+            break;
+        case EVP_CONFIG_MQTT_PORT:
+            value = g_agent.mqtt_port;
+            break;
+        case EVP_CONFIG_IOT_PLATFORM:
+            value = "tb";
+            break;
+        default:
+            return NULL;
+    }
+
+    config = malloc(sizeof(*config));
+    if (config == NULL) {
+        return NULL;
+    }
+    config->key = key;
+    config->value = strdup(value);
+    config->size = strlen(value) + 1;
+    config->free = free;
+    if (config->value == NULL) {
+        free(config);
+        return NULL;
+    }
+    return config;
+}
+
+bool config_is_pk_file(enum config_key key)
+{
+    return key == EVP_CONFIG_PK_FILE;
+}
+
+static void agent_stop(int sig)
+{
+    g_agent.stop = 1;
+}
+
+static int agent_run(const char *dir, int port_fd)
+{
+    struct evp_agent_context *ctxt;
+    char path[PATH_MAX];
+    uint16_t port;
+    int ret;
+
+    if (read(port_fd, &port, sizeof(port)) != sizeof(port)) {
+        return EXIT_FAILURE;
+    }
+    close(port_fd);
+    snprintf(g_agent.mqtt_port, sizeof(g_agent.mqtt_port), "%u", port);
+    signal(SIGTERM, agent_stop);
+
+    snprintf(path, sizeof(path), "%s/evp_data", dir);
+    setenv("EVP_DATA_DIR", path, 1);
+    snprintf(path, sizeof(path), "%s/mqtt-store", dir);
+    setenv("EVP_MQTT_STORE_DIR", path, 1);
+    setenv("EVP_MQTT_STORE_MAX_BYTES", "8388608", 0);
+    /* Batching is off by default, the hub stand-in takes arrays */
+    setenv("EVP_TELEMETRY_BATCH_BYTES", "4096", 0);
+    /* Round trips are not held back by the batching, the flood is */
+    setenv("EVP_TELEMETRY_URGENT_KEYS", BENCH_INSTANCE "/echo," BENCH_INSTANCE "/upload", 0);
+
+    ctxt = evp_agent_setup("hub_bench");
+
+    ret = evp_agent_mqtt_buffers_init();
+    if (ret)
+        goto out_deinit;
+
+    ret = evp_agent_mqtt_store_init();
+    if (ret)
+        goto out_deinit;
+
+    ret = evp_agent_telemetry_batch_init();
+    if (ret)
+        goto out_deinit;
+
+    ret = evp_agent_start(ctxt);
+    if (ret)
+        goto out_deinit;
+
+    ret = evp_agent_connect(ctxt);
+    if (ret)
+        goto out_stop;
+
+    while (ret == 0 && !g_agent.stop) {
+        ret = evp_agent_loop(ctxt);
+        evp_agent_metrics_poll();
+    }
+
+    evp_agent_disconnect(ctxt);
+out_stop:
+    evp_agent_stop(ctxt);
+    evp_agent_metrics_report();
+out_deinit:
+    evp_agent_telemetry_batch_deinit();
+    evp_agent_mqtt_store_deinit();
+    evp_agent_mqtt_buffers_deinit();
+    evp_agent_metrics_deinit();
+    evp_agent_free(ctxt);
+
+    return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void telemetry_entry(JSON_Object *o)
+{
+    if (json_object_has_value_of_type(o, BENCH_INSTANCE "/echo", JSONNumber)) {
+        g_hub.echo = (uint64_t)json_object_get_number(o, BENCH_INSTANCE "/echo");
+    }
+    if (json_object_has_value(o, BENCH_INSTANCE "/flood")) {
+        if (g_hub.flood++ == 0) {
+            g_hub.flood_first_ns = now_ns();
+        }
+    }
+    if (json_object_has_value_of_type(o, BENCH_INSTANCE "/upload", JSONNumber)) {
+        g_hub.upload_status = (uint32_t)json_object_get_number(o, BENCH_INSTANCE "/upload");
+        g_hub.upload_done = true;
+    }
+}
+
+static void deployment_status(JSON_Value *status)
+{
+    JSON_Value *parsed = NULL;
+    JSON_Object *o;
+    const char *id, *reconcile;
+
+    if (json_value_get_type(status) == JSONString) {
+        parsed = json_parse_string(json_value_get_string(status));
+        status = parsed;
+    }
+    o = json_value_get_object(status);
+    id = json_object_get_string(o, "deploymentId");
+    reconcile = json_object_get_string(o, "reconcileStatus");
+    if (id != NULL && reconcile != NULL && strcmp(id, g_hub.deployment_id) == 0 &&
+        strcmp(reconcile, "ok") == 0) {
+        g_hub.deployed = true;
+    }
+    json_value_free(parsed);
+}
+
+static void hub_publish(void *user, const char *topic, const char *payload, size_t size)
+{
+    static const char shared[] = "{\"shared\":{}}";
+    JSON_Value *value, *status;
+    JSON_Array *array;
+    char response[BENCH_MESSAGE_SIZE];
+
+    if (strncmp(topic, TOPIC_REQUEST, strlen(TOPIC_REQUEST)) == 0) {
+        snprintf(response, sizeof(response), TOPIC_RESPONSE "%s", topic + strlen(TOPIC_REQUEST));
+        hub_fake_publish(g_hub.hub, response, shared, sizeof(shared) - 1);
+        return;
+    }
+    if (strcmp(topic, TOPIC_TELEMETRY) != 0 && strcmp(topic, TOPIC_ATTRIBUTES) != 0) {
+        return;
+    }
+
+    /* The payload is NUL-terminated by the hub */
+    value = json_parse_string(payload);
+    if (value == NULL) {
+        fprintf(stderr, "unparsable publish on %s: %.*s\n", topic, (int)size, payload);
+        return;
+    }
+
+    pthread_mutex_lock(&g_hub.lock);
+    if (strcmp(topic, TOPIC_TELEMETRY) == 0) {
+        /* A batch, or a single telemetry */
+        array = json_value_get_array(value);
+        if (array != NULL) {
+            for (size_t i = 0; i < json_array_get_count(array); i++) {
+                telemetry_entry(json_array_get_object(array, i));
+            }
+        }
+        else {
+            telemetry_entry(json_value_get_object(value));
+        }
+    }
+    else {
+        status = json_object_get_value(json_value_get_object(value), "deploymentStatus");
+        if (status != NULL) {
+            deployment_status(status);
+        }
+    }
+    pthread_cond_broadcast(&g_hub.cond);
+    pthread_mutex_unlock(&g_hub.lock);
+
+    json_value_free(value);
+}
+
+static void hub_upload(void *user, const char *path, size_t size)
+{
+    pthread_mutex_lock(&g_hub.lock);
+    g_hub.uploaded += size;
+    pthread_mutex_unlock(&g_hub.lock);
+}
+
+/* Waits on g_hub.cond, with g_hub.lock held, returns false on timeout */
+static bool hub_wait(const struct timespec *deadline)
+{
+    return pthread_cond_timedwait(&g_hub.cond, &g_hub.lock, deadline) != ETIMEDOUT;
+}
+
+static void deadline_in(struct timespec *deadline, unsigned int ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static void proc_sample(pid_t pid, struct proc_sample *s)
+{
+    unsigned long utime = 0, stime = 0;
+    char path[64], buf[1024], *p;
+    FILE *fp;
+
+    s->ns = now_ns();
+    s->ticks = 0;
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return;
+    }
+    /* The fields after the command, which may contain spaces */
+    if (fgets(buf, sizeof(buf), fp) != NULL && (p = strrchr(buf, ')')) != NULL &&
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+        s->ticks = utime + stime;
+    }
+    fclose(fp);
+}
+
+static void proc_memory(pid_t pid, unsigned long *rss_kb, unsigned long *hwm_kb)
+{
+    char path[64], line[256];
+    FILE *fp;
+
+    *rss_kb = *hwm_kb = 0;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        sscanf(line, "VmRSS: %lu", rss_kb);
+        sscanf(line, "VmHWM: %lu", hwm_kb);
+    }
+    fclose(fp);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(uint64_t *samples, size_t n, unsigned int pct)
+{
+    if (n == 0) {
+        return 0;
+    }
+    qsort(samples, n, sizeof(*samples), compare_u64);
+    return samples[(n - 1) * pct / 100] / 1e6;
+}
+
+/* Prints the rates and latencies of a scenario, without the line feed */
+static void report(const char *scenario, pid_t pid, const struct proc_sample *before,
+                   uint64_t msgs, uint64_t *samples, size_t n)
+{
+    struct proc_sample after;
+    unsigned long rss_kb, hwm_kb;
+    double elapsed;
+
+    proc_sample(pid, &after);
+    proc_memory(pid, &rss_kb, &hwm_kb);
+    elapsed = (after.ns - before->ns) / 1e9;
+
+    printf("scenario=%s msgs=%" PRIu64 " msgs_per_sec=%.1f", scenario, msgs,
+           elapsed > 0 ? msgs / elapsed : 0.0);
+    if (samples != NULL) {
+        printf(" p50_ms=%.2f p99_ms=%.2f", percentile_ms(samples, n, 50),
+               percentile_ms(samples, n, 99));
+    }
+    printf(" cpu_pct=%.1f rss_kb=%lu hwm_kb=%lu",
+           elapsed > 0 ? 100.0 * (after.ticks - before->ticks) / sysconf(_SC_CLK_TCK) / elapsed
+                       : 0.0,
+           rss_kb, hwm_kb);
+}
+
+static int publish_attributes(const char *payload)
+{
+    int ret = hub_fake_publish(g_hub.hub, TOPIC_ATTRIBUTES, payload, strlen(payload));
+
+    if (ret) {
+        fprintf(stderr, "failed to publish to the agent: %s\n", strerror(-ret));
+    }
+    return ret;
+}
+
+static int publish_config(const char *topic, const char *value)
+{
+    unsigned char b64[BENCH_MESSAGE_SIZE];
+    char payload[BENCH_MESSAGE_SIZE * 2];
+    size_t len;
+
+    if (mbedtls_base64_encode(b64, sizeof(b64), &len, (const unsigned char *)value,
+                              strlen(value)) != 0) {
+        return -EINVAL;
+    }
+    snprintf(payload, sizeof(payload), "{\"configuration/" BENCH_INSTANCE "/%s\":\"%s\"}", topic,
+             b64);
+    return publish_attributes(payload);
+}
+
+/* Deploys the module, or nothing if hash is NULL, and waits for the agent to reconcile */
+static int deploy(const char *id, const char *url, const char *hash, uint64_t *ns)
+{
+    char manifest[BENCH_MANIFEST_SIZE];
+    struct timespec deadline;
+    uint64_t t0;
+    int ret = 0;
+
+    if (hash != NULL) {
+        snprintf(manifest, sizeof(manifest),
+                 "{\"deployment\":{\"deploymentId\":\"%s\",\"instanceSpecs\":{"
+                 "\"" BENCH_INSTANCE "\":{\"moduleId\":\"hub-module\",\"publish\":{},"
+                 "\"subscribe\":{}}},\"modules\":{\"hub-module\":{\"entryPoint\":\"main\","
+                 "\"moduleImpl\":\"wasm\",\"downloadUrl\":\"%s\",\"hash\":\"%s\"}},"
+                 "\"publishTopics\":{},\"subscribeTopics\":{}}}",
+                 id, url, hash);
+    }
+    else {
+        snprintf(manifest, sizeof(manifest),
+                 "{\"deployment\":{\"deploymentId\":\"%s\",\"instanceSpecs\":{},\"modules\":{},"
+                 "\"publishTopics\":{},\"subscribeTopics\":{}}}",
+                 id);
+    }
+
+    pthread_mutex_lock(&g_hub.lock);
+    snprintf(g_hub.deployment_id, sizeof(g_hub.deployment_id), "%s", id);
+    g_hub.deployed = false;
+    pthread_mutex_unlock(&g_hub.lock);
+
+    t0 = now_ns();
+    if (publish_attributes(manifest)) {
+        return -1;
+    }
+
+    deadline_in(&deadline, BENCH_DEPLOY_TIMEOUT_MS);
+    pthread_mutex_lock(&g_hub.lock);
+    while (!g_hub.deployed) {
+        if (!hub_wait(&deadline)) {
+            fprintf(stderr, "deployment %s not reconciled\n", id);
+            ret = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_hub.lock);
+
+    *ns = now_ns() - t0;
+    return ret;
+}
+
+static int run_deploy(pid_t pid, unsigned int n, const char *url, const char *hash)
+{
+    uint64_t *samples = calloc(n, sizeof(*samples));
+    struct proc_sample before;
+    char id[BENCH_ID_SIZE];
+    uint64_t cold = 0, ns;
+    int ret = 0;
+
+    if (samples == NULL) {
+        return -1;
+    }
+
+    proc_sample(pid, &before);
+    for (unsigned int i = 0; i < n && ret == 0; i++) {
+        snprintf(id, sizeof(id), "bench-%u", i);
+        ret = deploy(id, url, hash, i == 0 ? &cold : &samples[i - 1]);
+        if (ret == 0) {
+            snprintf(id, sizeof(id), "bench-%u-empty", i);
+            ret = deploy(id, url, NULL, &ns);
+        }
+    }
+    if (ret == 0) {
+        report("deploy", pid, &before, 2 * n, samples, n - 1);
+        printf(" cold_ms=%.2f\n", cold / 1e6);
+        /* The module stays for the next scenarios */
+        ret = deploy("bench", url, hash, &ns);
+    }
+
+    free(samples);
+    return ret;
+}
+
+static int run_echo(pid_t pid, unsigned int n)
+{
+    uint64_t *samples = calloc(n, sizeof(*samples));
+    struct proc_sample before;
+    struct timespec deadline;
+    char value[32];
+    int ret = 0;
+
+    if (samples == NULL) {
+        return -1;
+    }
+
+    /* Values start at 1, the first round trip waits for the module to start */
+    for (unsigned int i = 0; i <= n && ret == 0; i++) {
+        uint64_t t0 = now_ns();
+
+        snprintf(value, sizeof(value), "%u", i + 1);
+        ret = publish_config("echo", value);
+        if (ret) {
+            break;
+        }
+
+        deadline_in(&deadline, i == 0 ? BENCH_DEPLOY_TIMEOUT_MS : BENCH_ECHO_TIMEOUT_MS);
+        pthread_mutex_lock(&g_hub.lock);
+        while (g_hub.echo != i + 1) {
+            if (!hub_wait(&deadline)) {
+                fprintf(stderr, "no echo of %s\n", value);
+                ret = -1;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&g_hub.lock);
+
+        if (i == 0) {
+            proc_sample(pid, &before);
+        }
+        else {
+            samples[i - 1] = now_ns() - t0;
+        }
+    }
+    if (ret == 0) {
+        report("echo", pid, &before, n, samples, n);
+        printf("\n");
+    }
+
+    free(samples);
+    return ret;
+}
+
+static int run_flood(pid_t pid, unsigned int n)
+{
+    struct proc_sample before;
+    struct timespec deadline;
+    uint64_t t0, first = 0, last;
+    char value[32];
+    int ret = 0;
+
+    pthread_mutex_lock(&g_hub.lock);
+    g_hub.flood = 0;
+    pthread_mutex_unlock(&g_hub.lock);
+
+    proc_sample(pid, &before);
+    t0 = now_ns();
+    snprintf(value, sizeof(value), "%u", n);
+    if (publish_config("flood", value)) {
+        return -1;
+    }
+
+    deadline_in(&deadline, BENCH_FLOOD_TIMEOUT_MS);
+    pthread_mutex_lock(&g_hub.lock);
+    while (g_hub.flood < n) {
+        if (!hub_wait(&deadline)) {
+            fprintf(stderr, "%" PRIu64 " telemetries of %u received\n", g_hub.flood, n);
+            ret = -1;
+            break;
+        }
+    }
+    if (g_hub.flood > 0) {
+        first = g_hub.flood_first_ns - t0;
+    }
+    pthread_mutex_unlock(&g_hub.lock);
+    last = now_ns() - t0;
+
+    if (ret == 0) {
+        report("flood", pid, &before, n, NULL, 0);
+        printf(" first_ms=%.2f last_ms=%.2f\n", first / 1e6, last / 1e6);
+    }
+    return ret;
+}
+
+static int run_upload(pid_t pid, unsigned int n, size_t size)
+{
+    uint64_t *samples = calloc(n, sizeof(*samples));
+    struct proc_sample before;
+    struct timespec deadline;
+    char value[BENCH_MESSAGE_SIZE / 2];
+    uint64_t t0, elapsed;
+    int ret = 0;
+
+    if (samples == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_hub.lock);
+    g_hub.uploaded = 0;
+    pthread_mutex_unlock(&g_hub.lock);
+
+    proc_sample(pid, &before);
+    t0 = now_ns();
+    for (unsigned int i = 0; i < n && ret == 0; i++) {
+        uint64_t start = now_ns();
+
+        pthread_mutex_lock(&g_hub.lock);
+        g_hub.upload_done = false;
+        pthread_mutex_unlock(&g_hub.lock);
+
+        /* A new URL each time, or the configuration would not change */
+        snprintf(value, sizeof(value), "http://127.0.0.1:%u/upload/%u %zu",
+                 hub_fake_http_port(g_hub.hub), i, size);
+        ret = publish_config("upload", value);
+        if (ret) {
+            break;
+        }
+
+        deadline_in(&deadline, BENCH_UPLOAD_TIMEOUT_MS);
+        pthread_mutex_lock(&g_hub.lock);
+        while (!g_hub.upload_done) {
+            if (!hub_wait(&deadline)) {
+                fprintf(stderr, "upload %u not done\n", i);
+                ret = -1;
+                break;
+            }
+        }
+        if (ret == 0 && g_hub.upload_status / 100 != 2) {
+            fprintf(stderr, "upload %u failed: HTTP status %" PRIu32 "\n", i, g_hub.upload_status);
+            ret = -1;
+        }
+        pthread_mutex_unlock(&g_hub.lock);
+
+        samples[i] = now_ns() - start;
+    }
+    elapsed = now_ns() - t0;
+
+    if (ret == 0) {
+        report("upload", pid, &before, n, samples, n);
+        printf(" mib_per_sec=%.1f uploaded_bytes=%zu\n",
+               elapsed > 0 ? (double)n * size / (1 << 20) / (elapsed / 1e9) : 0.0,
+               g_hub.uploaded);
+    }
+
+    free(samples);
+    return ret;
+}
+
+static int wait_connected(pid_t pid)
+{
+    uint64_t deadline = now_ns() + BENCH_CONNECT_TIMEOUT_MS * 1000000ull;
+
+    while (!hub_fake_connected(g_hub.hub)) {
+        if (now_ns() > deadline || waitpid(pid, NULL, WNOHANG) != 0) {
+            fprintf(stderr, "the agent did not connect\n");
+            return -1;
+        }
+        usleep(10000);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct hub_fake_ops ops = {
+        .publish = hub_publish,
+        .upload = hub_upload,
+    };
+    unsigned int deploys = BENCH_DEFAULT_DEPLOYS;
+    unsigned int echoes = BENCH_DEFAULT_ECHOES;
+    unsigned int flood = BENCH_DEFAULT_FLOOD;
+    unsigned int uploads = BENCH_DEFAULT_UPLOADS;
+    size_t upload_size = BENCH_DEFAULT_UPLOAD_KIB * 1024;
+    char dir[] = "/tmp/hub_bench.XXXXXX";
+    char url[BENCH_MESSAGE_SIZE], hash[65], cmd[sizeof(dir) + 16];
+    unsigned char digest[32];
+    uint8_t *module;
+    uint32_t module_size = 0;
+    int fds[2];
+    uint16_t port;
+    pid_t pid;
+    int status, ret = EXIT_FAILURE;
+
+    if (argc < 2) {
+        fprintf(stderr,
+                "usage: %s <hub_module.wasm> [deploys] [echoes] [flood] [uploads] "
+                "[upload KiB]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 2) {
+        deploys = strtoul(argv[2], NULL, 0);
+    }
+    if (argc > 3) {
+        echoes = strtoul(argv[3], NULL, 0);
+    }
+    if (argc > 4) {
+        flood = strtoul(argv[4], NULL, 0);
+    }
+    if (argc > 5) {
+        uploads = strtoul(argv[5], NULL, 0);
+    }
+    if (argc > 6) {
+        upload_size = strtoul(argv[6], NULL, 0) * 1024;
+    }
+    if (deploys == 0) {
+        deploys = 1;
+    }
+
+    module = read_module(argv[1], &module_size);
+    if (module == NULL) {
+        return EXIT_FAILURE;
+    }
+    mbedtls_sha256(module, module_size, digest, 0);
+    for (size_t i = 0; i < sizeof(digest); i++) {
+        snprintf(&hash[i * 2], 3, "%02x", digest[i]);
+    }
+
+    if (mkdtemp(dir) == NULL || pipe(fds) != 0) {
+        fprintf(stderr, "failed to set up: %s\n", strerror(errno));
+        goto out_free_module;
+    }
+
+    /* Before any thread of the hub */
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        goto out_free_module;
+    }
+    if (pid == 0) {
+        close(fds[1]);
+        _exit(agent_run(dir, fds[0]));
+    }
+    close(fds[0]);
+
+    if (hub_fake_start(&ops, NULL, &g_hub.hub) != 0) {
+        fprintf(stderr, "failed to start the hub\n");
+        close(fds[1]);
+        goto out_wait;
+    }
+    hub_fake_set_blob(g_hub.hub, BENCH_MODULE_PATH, module, module_size);
+    snprintf(url, sizeof(url), "http://127.0.0.1:%u" BENCH_MODULE_PATH,
+             hub_fake_http_port(g_hub.hub));
+    port = hub_fake_mqtt_port(g_hub.hub);
+    if (write(fds[1], &port, sizeof(port)) != sizeof(port)) {
+        fprintf(stderr, "failed to start the agent\n");
+    }
+    close(fds[1]);
+
+    if (wait_connected(pid) == 0 && run_deploy(pid, deploys, url, hash) == 0 &&
+        run_echo(pid, echoes) == 0 && run_flood(pid, flood) == 0 &&
+        run_upload(pid, uploads, upload_size) == 0) {
+        ret = EXIT_SUCCESS;
+    }
+
+out_wait:
+    kill(pid, SIGTERM);
+    if (waitpid(pid, &status, 0) == pid && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+        fprintf(stderr, "the agent exited abnormally\n");
+    }
+    if (g_hub.hub != NULL) {
+        hub_fake_stop(g_hub.hub);
+    }
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir);
+    }
+out_free_module:
+    free(module);
+    return ret;
+}
@@ -0,0 +1,752 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for accept4, pipe2 and strcasestr */
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "hub_fake.h"
+
+#define HUB_FAKE_MAX_CONNS 32
+#define HUB_FAKE_MAX_BLOBS 8
+#define HUB_FAKE_PATH_MAX 256
+#define HUB_FAKE_LINE_MAX 1024
+#define HUB_FAKE_READ_SIZE 65536
+
+/* MQTT control packet types */
+#define MQTT_CONNECT 1
+#define MQTT_PUBLISH 3
+#define MQTT_PUBREL 6
+#define MQTT_SUBSCRIBE 8
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_PINGREQ 12
+#define MQTT_DISCONNECT 14
+
+struct hub_blob {
+    char path[HUB_FAKE_PATH_MAX];
+    const void *data;
+    size_t size;
+};
+
+struct hub_fake {
+    struct hub_fake_ops ops;
+    void *user;
+    int mqtt_listen;
+    int http_listen;
+    uint16_t mqtt_port;
+    uint16_t http_port;
+    int stop_pipe[2];
+    pthread_t thread;
+    /* The MQTT connection of the agent, -1 if none */
+    int mqtt_fd;
+    bool connected;
+    int conns[HUB_FAKE_MAX_CONNS];
+    unsigned int n_conns;
+    struct hub_blob blobs[HUB_FAKE_MAX_BLOBS];
+    unsigned int n_blobs;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* Serializes the packets written to the MQTT connection */
+    pthread_mutex_t write_lock;
+};
+
+struct hub_conn {
+    struct hub_fake *hub;
+    int fd;
+};
+
+/* Buffered reads of an HTTP connection */
+struct reader {
+    int fd;
+    size_t start;
+    size_t end;
+    char buf[HUB_FAKE_READ_SIZE];
+};
+
+static int read_full(int fd, void *buf, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = read(fd, (uint8_t *)buf + done, size - done);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = send(fd, (const uint8_t *)buf + done, size - done, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static int listen_loopback(uint16_t *port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void conn_add(struct hub_fake *hub, int fd)
+{
+    pthread_mutex_lock(&hub->lock);
+    hub->conns[hub->n_conns++] = fd;
+    pthread_mutex_unlock(&hub->lock);
+}
+
+static void conn_remove(struct hub_fake *hub, int fd)
+{
+    pthread_mutex_lock(&hub->lock);
+    for (unsigned int i = 0; i < hub->n_conns; i++) {
+        if (hub->conns[i] == fd) {
+            hub->conns[i] = hub->conns[--hub->n_conns];
+            break;
+        }
+    }
+    if (hub->mqtt_fd == fd) {
+        hub->mqtt_fd = -1;
+        hub->connected = false;
+    }
+    close(fd);
+    pthread_cond_broadcast(&hub->cond);
+    pthread_mutex_unlock(&hub->lock);
+}
+
+static int mqtt_ack(int fd, uint8_t type, const uint8_t *id)
+{
+    uint8_t packet[4] = {type, 2, id[0], id[1]};
+
+    return write_full(fd, packet, sizeof(packet));
+}
+
+static int mqtt_suback(int fd, const uint8_t *buf, size_t len)
+{
+    uint8_t packet[HUB_FAKE_LINE_MAX];
+    size_t n = 4;
+
+    /* Packet id, then the filters with their QoS */
+    for (size_t off = 2; off + 2 < len && n < sizeof(packet);) {
+        size_t filter_len = (buf[off] << 8) | buf[off + 1];
+
+        off += 2 + filter_len;
+        if (off >= len) {
+            break;
+        }
+        packet[n++] = buf[off] > 1 ? 1 : buf[off];
+        off++;
+    }
+    if (n - 2 > 127) {
+        return -1;
+    }
+    packet[0] = 0x90;
+    packet[1] = n - 2;
+    packet[2] = buf[0];
+    packet[3] = buf[1];
+
+    return write_full(fd, packet, n);
+}
+
+static int mqtt_received(struct hub_fake *hub, int fd, uint8_t flags, uint8_t *buf, size_t len)
+{
+    unsigned int qos = (flags >> 1) & 3;
+    size_t topic_len, off;
+    char *topic;
+
+    if (len < 2) {
+        return -1;
+    }
+    topic_len = (buf[0] << 8) | buf[1];
+    off = 2 + topic_len + (qos ? 2 : 0);
+    if (off > len) {
+        return -1;
+    }
+    if (qos != 0 && mqtt_ack(fd, qos == 1 ? 0x40 : 0x50, buf + 2 + topic_len)) {
+        return -1;
+    }
+
+    topic = strndup((const char *)buf + 2, topic_len);
+    if (topic == NULL) {
+        return -1;
+    }
+    /* The buffer has room for a terminating NUL */
+    buf[len] = '\0';
+    if (hub->ops.publish != NULL) {
+        hub->ops.publish(hub->user, topic, (const char *)buf + off, len - off);
+    }
+    free(topic);
+
+    return 0;
+}
+
+static void *mqtt_conn_thread(void *arg)
+{
+    struct hub_conn *conn = arg;
+    struct hub_fake *hub = conn->hub;
+    static const uint8_t connack[] = {0x20, 2, 0, 0};
+    static const uint8_t pingresp[] = {0xd0, 0};
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    int fd = conn->fd;
+    int ret = 0;
+
+    free(conn);
+    while (ret == 0) {
+        uint8_t header, b;
+        size_t len = 0;
+        unsigned int shift = 0;
+
+        if (read_full(fd, &header, 1)) {
+            break;
+        }
+        do {
+            if (shift > 21 || read_full(fd, &b, 1)) {
+                goto out;
+            }
+            len |= (size_t)(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+
+        if (len + 1 > cap) {
+            uint8_t *p = realloc(buf, len + 1);
+
+            if (p == NULL) {
+                break;
+            }
+            buf = p;
+            cap = len + 1;
+        }
+        if (read_full(fd, buf, len)) {
+            break;
+        }
+
+        switch (header >> 4) {
+            case MQTT_CONNECT:
+                ret = write_full(fd, connack, sizeof(connack));
+                pthread_mutex_lock(&hub->lock);
+                hub->connected = true;
+                pthread_cond_broadcast(&hub->cond);
+                pthread_mutex_unlock(&hub->lock);
+                break;
+            case MQTT_PUBLISH:
+                ret = mqtt_received(hub, fd, header & 0x0f, buf, len);
+                break;
+            case MQTT_PUBREL:
+                ret = len < 2 ? -1 : mqtt_ack(fd, 0x70, buf);
+                break;
+            case MQTT_SUBSCRIBE:
+                ret = len < 2 ? -1 : mqtt_suback(fd, buf, len);
+                break;
+            case MQTT_UNSUBSCRIBE:
+                ret = len < 2 ? -1 : mqtt_ack(fd, 0xb0, buf);
+                break;
+            case MQTT_PINGREQ:
+                ret = write_full(fd, pingresp, sizeof(pingresp));
+                break;
+            case MQTT_DISCONNECT:
+                ret = -1;
+                break;
+            default:
+                /* Acknowledgements of the QoS 0 publishes of the hub: none */
+                break;
+        }
+    }
+
+out:
+    free(buf);
+    conn_remove(hub, fd);
+    return NULL;
+}
+
+static int reader_fill(struct reader *r)
+{
+    ssize_t n;
+
+    if (r->start == r->end) {
+        r->start = r->end = 0;
+    }
+    if (r->end == sizeof(r->buf)) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    do {
+        n = read(r->fd, r->buf + r->end, sizeof(r->buf) - r->end);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return -1;
+    }
+    r->end += n;
+
+    return 0;
+}
+
+/* Reads a line without its CRLF */
+static int reader_line(struct reader *r, char *line, size_t size)
+{
+    for (;;) {
+        char *nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+
+        if (nl != NULL) {
+            size_t len = nl - (r->buf + r->start);
+
+            if (len > 0 && nl[-1] == '\r') {
+                len--;
+            }
+            if (len >= size) {
+                return -1;
+            }
+            memcpy(line, r->buf + r->start, len);
+            line[len] = '\0';
+            r->start = nl + 1 - r->buf;
+            return 0;
+        }
+        if (r->end - r->start >= HUB_FAKE_LINE_MAX || reader_fill(r)) {
+            return -1;
+        }
+    }
+}
+
+static int reader_skip(struct reader *r, size_t size)
+{
+    while (size > 0) {
+        size_t n;
+
+        if (r->start == r->end && reader_fill(r)) {
+            return -1;
+        }
+        n = r->end - r->start < size ? r->end - r->start : size;
+        r->start += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* Reads a chunked body, returns its size or -1 */
+static ssize_t reader_chunked(struct reader *r)
+{
+    char line[HUB_FAKE_LINE_MAX];
+    size_t total = 0;
+
+    for (;;) {
+        size_t size;
+
+        if (reader_line(r, line, sizeof(line))) {
+            return -1;
+        }
+        size = strtoul(line, NULL, 16);
+        if (size == 0) {
+            break;
+        }
+        if (reader_skip(r, size) || reader_line(r, line, sizeof(line))) {
+            return -1;
+        }
+        total += size;
+    }
+
+    /* Trailers */
+    do {
+        if (reader_line(r, line, sizeof(line))) {
+            return -1;
+        }
+    } while (line[0] != '\0');
+
+    return total;
+}
+
+static const struct hub_blob *blob_lookup(struct hub_fake *hub, const char *path)
+{
+    const struct hub_blob *blob = NULL;
+
+    pthread_mutex_lock(&hub->lock);
+    for (unsigned int i = 0; i < hub->n_blobs; i++) {
+        if (strcmp(hub->blobs[i].path, path) == 0) {
+            blob = &hub->blobs[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    return blob;
+}
+
+static int http_get(struct hub_fake *hub, int fd, const char *path, bool head)
+{
+    const struct hub_blob *blob = blob_lookup(hub, path);
+    char response[HUB_FAKE_LINE_MAX];
+    int len;
+
+    if (blob == NULL) {
+        static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+        return write_full(fd, not_found, sizeof(not_found) - 1);
+    }
+
+    len = snprintf(response, sizeof(response),
+                   "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                   "Content-Length: %zu\r\n\r\n",
+                   blob->size);
+    if (write_full(fd, response, len)) {
+        return -1;
+    }
+
+    return head ? 0 : write_full(fd, blob->data, blob->size);
+}
+
+static void *http_conn_thread(void *arg)
+{
+    struct hub_conn *conn = arg;
+    struct hub_fake *hub = conn->hub;
+    static const char created[] = "HTTP/1.1 201 Created\r\nContent-Length: 0\r\n\r\n";
+    static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    char method[16], path[HUB_FAKE_PATH_MAX], line[HUB_FAKE_LINE_MAX];
+    struct reader *r = malloc(sizeof(*r));
+    int fd = conn->fd;
+
+    free(conn);
+    if (r == NULL) {
+        goto out;
+    }
+    r->fd = fd;
+    r->start = r->end = 0;
+
+    for (;;) {
+        bool chunked = false, close_conn = false, expect = false;
+        size_t length = 0;
+        ssize_t size;
+
+        if (reader_line(r, line, sizeof(line)) ||
+            sscanf(line, "%15s %255s", method, path) != 2) {
+            break;
+        }
+        for (;;) {
+            if (reader_line(r, line, sizeof(line))) {
+                goto out;
+            }
+            if (line[0] == '\0') {
+                break;
+            }
+            if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                length = strtoul(line + 15, NULL, 10);
+            }
+            else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                chunked = strcasestr(line + 18, "chunked") != NULL;
+            }
+            else if (strncasecmp(line, "Connection:", 11) == 0) {
+                close_conn = strcasestr(line + 11, "close") != NULL;
+            }
+            else if (strncasecmp(line, "Expect:", 7) == 0) {
+                expect = strcasestr(line + 7, "100-continue") != NULL;
+            }
+        }
+
+        if (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0) {
+            if (http_get(hub, fd, path, method[0] == 'H')) {
+                break;
+            }
+        }
+        else {
+            if (expect && write_full(fd, cont, sizeof(cont) - 1)) {
+                break;
+            }
+            size = chunked ? reader_chunked(r) : (reader_skip(r, length) ? -1 : (ssize_t)length);
+            if (size < 0 || write_full(fd, created, sizeof(created) - 1)) {
+                break;
+            }
+            if (hub->ops.upload != NULL) {
+                hub->ops.upload(hub->user, path, size);
+            }
+        }
+
+        if (close_conn) {
+            break;
+        }
+    }
+
+out:
+    free(r);
+    conn_remove(hub, fd);
+    return NULL;
+}
+
+static void conn_spawn(struct hub_fake *hub, int listen_fd, void *(*fn)(void *))
+{
+    struct hub_conn *conn;
+    pthread_t thread;
+    int one = 1;
+    int fd;
+
+    fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_mutex_lock(&hub->lock);
+    if (hub->n_conns == HUB_FAKE_MAX_CONNS) {
+        pthread_mutex_unlock(&hub->lock);
+        close(fd);
+        return;
+    }
+    if (fn == mqtt_conn_thread) {
+        /* A reconnect replaces the previous connection */
+        if (hub->mqtt_fd >= 0) {
+            shutdown(hub->mqtt_fd, SHUT_RDWR);
+        }
+        hub->mqtt_fd = fd;
+        hub->connected = false;
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    conn = malloc(sizeof(*conn));
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+    conn->hub = hub;
+    conn->fd = fd;
+    conn_add(hub, fd);
+    if (pthread_create(&thread, NULL, fn, conn) != 0) {
+        free(conn);
+        conn_remove(hub, fd);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void *hub_thread(void *arg)
+{
+    struct hub_fake *hub = arg;
+
+    for (;;) {
+        struct pollfd fds[] = {
+            {.fd = hub->stop_pipe[0], .events = POLLIN},
+            {.fd = hub->mqtt_listen, .events = POLLIN},
+            {.fd = hub->http_listen, .events = POLLIN},
+        };
+
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            conn_spawn(hub, hub->mqtt_listen, mqtt_conn_thread);
+        }
+        if (fds[2].revents & POLLIN) {
+            conn_spawn(hub, hub->http_listen, http_conn_thread);
+        }
+    }
+
+    return NULL;
+}
+
+int hub_fake_start(const struct hub_fake_ops *ops, void *user, struct hub_fake **hubp)
+{
+    struct hub_fake *hub = calloc(1, sizeof(*hub));
+    int ret;
+
+    if (hub == NULL) {
+        return -ENOMEM;
+    }
+    hub->ops = *ops;
+    hub->user = user;
+    hub->mqtt_fd = -1;
+    pthread_mutex_init(&hub->lock, NULL);
+    pthread_mutex_init(&hub->write_lock, NULL);
+    pthread_cond_init(&hub->cond, NULL);
+
+    hub->mqtt_listen = listen_loopback(&hub->mqtt_port);
+    hub->http_listen = listen_loopback(&hub->http_port);
+    if (hub->mqtt_listen < 0 || hub->http_listen < 0 || pipe2(hub->stop_pipe, O_CLOEXEC) != 0) {
+        ret = -errno;
+        goto err;
+    }
+
+    ret = -pthread_create(&hub->thread, NULL, hub_thread, hub);
+    if (ret) {
+        close(hub->stop_pipe[0]);
+        close(hub->stop_pipe[1]);
+        goto err;
+    }
+
+    *hubp = hub;
+    return 0;
+
+err:
+    if (hub->mqtt_listen >= 0) {
+        close(hub->mqtt_listen);
+    }
+    if (hub->http_listen >= 0) {
+        close(hub->http_listen);
+    }
+    free(hub);
+    return ret;
+}
+
+void hub_fake_stop(struct hub_fake *hub)
+{
+    char c = 0;
+
+    if (write(hub->stop_pipe[1], &c, 1) != 1) {
+        fprintf(stderr, "failed to stop the hub: %s\n", strerror(errno));
+    }
+    pthread_join(hub->thread, NULL);
+
+    /* Wake up the connection threads and wait for them */
+    pthread_mutex_lock(&hub->lock);
+    for (unsigned int i = 0; i < hub->n_conns; i++) {
+        shutdown(hub->conns[i], SHUT_RDWR);
+    }
+    while (hub->n_conns != 0) {
+        pthread_cond_wait(&hub->cond, &hub->lock);
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    close(hub->mqtt_listen);
+    close(hub->http_listen);
+    close(hub->stop_pipe[0]);
+    close(hub->stop_pipe[1]);
+    pthread_cond_destroy(&hub->cond);
+    pthread_mutex_destroy(&hub->write_lock);
+    pthread_mutex_destroy(&hub->lock);
+    free(hub);
+}
+
+uint16_t hub_fake_mqtt_port(const struct hub_fake *hub)
+{
+    return hub->mqtt_port;
+}
+
+uint16_t hub_fake_http_port(const struct hub_fake *hub)
+{
+    return hub->http_port;
+}
+
+bool hub_fake_connected(struct hub_fake *hub)
+{
+    bool connected;
+
+    pthread_mutex_lock(&hub->lock);
+    connected = hub->connected;
+    pthread_mutex_unlock(&hub->lock);
+
+    return connected;
+}
+
+int hub_fake_publish(struct hub_fake *hub, const char *topic, const void *payload, size_t size)
+{
+    size_t topic_len = strlen(topic);
+    size_t remaining = 2 + topic_len + size;
+    uint8_t header[8];
+    size_t n = 0;
+    int fd, ret;
+
+    header[n++] = 0x30;
+    do {
+        header[n] = remaining & 0x7f;
+        remaining >>= 7;
+        if (remaining) {
+            header[n] |= 0x80;
+        }
+        n++;
+    } while (remaining);
+    header[n++] = topic_len >> 8;
+    header[n++] = topic_len & 0xff;
+
+    pthread_mutex_lock(&hub->lock);
+    fd = hub->connected ? hub->mqtt_fd : -1;
+    pthread_mutex_unlock(&hub->lock);
+    if (fd < 0) {
+        return -ENOTCONN;
+    }
+
+    pthread_mutex_lock(&hub->write_lock);
+    ret = write_full(fd, header, n) || write_full(fd, topic, topic_len) ||
+                  write_full(fd, payload, size)
+              ? -EPIPE
+              : 0;
+    pthread_mutex_unlock(&hub->write_lock);
+
+    return ret;
+}
+
+int hub_fake_set_blob(struct hub_fake *hub, const char *path, const void *data, size_t size)
+{
+    struct hub_blob *blob;
+    int ret = 0;
+
+    if (strlen(path) >= HUB_FAKE_PATH_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    pthread_mutex_lock(&hub->lock);
+    if (hub->n_blobs == HUB_FAKE_MAX_BLOBS) {
+        ret = -ENOSPC;
+    }
+    else {
+        blob = &hub->blobs[hub->n_blobs++];
+        snprintf(blob->path, sizeof(blob->path), "%s", path);
+        blob->data = data;
+        blob->size = size;
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    return ret;
+}
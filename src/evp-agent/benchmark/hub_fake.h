@@ -0,0 +1,43 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __BENCH_HUB_FAKE_H__
+#define __BENCH_HUB_FAKE_H__
+
+/*
+ * Loopback stand-in for the hub.
+ *
+ * An MQTT 3.1.1 endpoint for one agent, on 127.0.0.1, which acknowledges
+ * whatever the agent sends (QoS 0 and 1) and hands its publishes to a
+ * callback, and can publish to the agent at QoS 0. Along with it, an
+ * HTTP/1.1 blob server which serves the blobs set with hub_fake_set_blob()
+ * on GET, and takes any PUT, Content-Length or chunked. Callbacks run on
+ * the threads of the hub, and may call hub_fake_publish().
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct hub_fake;
+
+struct hub_fake_ops {
+    void (*publish)(void *user, const char *topic, const char *payload, size_t size);
+    void (*upload)(void *user, const char *path, size_t size);
+};
+
+int hub_fake_start(const struct hub_fake_ops *ops, void *user, struct hub_fake **hubp);
+void hub_fake_stop(struct hub_fake *hub);
+
+uint16_t hub_fake_mqtt_port(const struct hub_fake *hub);
+uint16_t hub_fake_http_port(const struct hub_fake *hub);
+bool hub_fake_connected(struct hub_fake *hub);
+
+int hub_fake_publish(struct hub_fake *hub, const char *topic, const void *payload, size_t size);
+/* The data is not copied */
+int hub_fake_set_blob(struct hub_fake *hub, const char *path, const void *data, size_t size);
+
+#endif /* __BENCH_HUB_FAKE_H__ */
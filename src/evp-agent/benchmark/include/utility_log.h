@@ -0,0 +1,31 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __BENCH_UTILITY_LOG_H__
+#define __BENCH_UTILITY_LOG_H__
+
+/*
+ * Stand-in for the ESF utility log, so that agent sources can be linked into
+ * the benchmarks without the rest of the ESF. Messages go to stderr.
+ */
+
+#include <stdio.h>
+
+/* The level is already part of the messages of log.h */
+#define BENCH_DLOG(module_id, fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+
+#define WRITE_DLOG_CRITICAL(module_id, fmt, ...) BENCH_DLOG(module_id, fmt, ##__VA_ARGS__)
+#define WRITE_DLOG_ERROR(module_id, fmt, ...) BENCH_DLOG(module_id, fmt, ##__VA_ARGS__)
+#define WRITE_DLOG_WARN(module_id, fmt, ...) BENCH_DLOG(module_id, fmt, ##__VA_ARGS__)
+#define WRITE_DLOG_INFO(module_id, fmt, ...) BENCH_DLOG(module_id, fmt, ##__VA_ARGS__)
+#define WRITE_DLOG_DEBUG(module_id, fmt, ...) \
+    do {                                      \
+    } while (0)
+#define WRITE_DLOG_TRACE(module_id, fmt, ...) \
+    do {                                      \
+    } while (0)
+
+#endif /* __BENCH_UTILITY_LOG_H__ */
@@ -0,0 +1,12 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __BENCH_UTILITY_LOG_MODULE_ID_H__
+#define __BENCH_UTILITY_LOG_MODULE_ID_H__
+
+#define MODULE_ID_SYSTEM 0
+
+#endif /* __BENCH_UTILITY_LOG_MODULE_ID_H__ */
@@ -0,0 +1,78 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Frame consumers for the senscord zero-copy benchmark.
+ *
+ * Compiled freestanding for wasm32. Both kernels read every cache line of
+ * "iterations" frames: one gets them copied into its linear memory, as the
+ * senscord WAMR bridge does, the other through senscord_zc_get_frame().
+ * They return a checksum, or a negative errno value on failure.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "evp_agent/senscord_zero_copy.h"
+
+#define EXPORT(name) __attribute__((export_name(#name)))
+#define IMPORT(name) __attribute__((import_module("env"), import_name(#name)))
+
+#define BENCH_STREAM 1
+#define BENCH_CHANNEL 0
+#define FRAME_MAX_SIZE (1024 * 1024)
+#define CACHE_LINE 64
+
+IMPORT(bench_copy_get_frame)
+int32_t bench_copy_get_frame(uint64_t stream, void *buf, uint32_t size);
+
+static uint8_t g_frame[FRAME_MAX_SIZE];
+
+static uint32_t consume(const uint8_t *data, uint32_t size)
+{
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < size; i += CACHE_LINE) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+EXPORT(bench_frames_copy)
+int32_t bench_frames_copy(int32_t iterations)
+{
+    uint32_t sum = 0;
+
+    for (int32_t it = 0; it < iterations; it++) {
+        int32_t size = bench_copy_get_frame(BENCH_STREAM, g_frame, sizeof(g_frame));
+
+        if (size < 0) {
+            return size;
+        }
+        sum += consume(g_frame, (uint32_t)size);
+    }
+
+    return (int32_t)(sum & 0x7fffffff);
+}
+
+EXPORT(bench_frames_zero_copy)
+int32_t bench_frames_zero_copy(int32_t iterations)
+{
+    struct senscord_zc_frame_info info;
+    uint32_t sum = 0;
+
+    for (int32_t it = 0; it < iterations; it++) {
+        int32_t ret = senscord_zc_get_frame(BENCH_STREAM, BENCH_CHANNEL, 1000, &info, sizeof(info));
+
+        if (ret < 0) {
+            return ret;
+        }
+        sum += consume((const uint8_t *)(uintptr_t)info.data, info.size);
+        senscord_zc_release_frame(info.handle);
+    }
+
+    return (int32_t)(sum & 0x7fffffff);
+}
@@ -0,0 +1,294 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * EVP module driven by the end to end benchmark.
+ *
+ * Compiled freestanding for wasm32, so the part of the EVP SDK it uses is
+ * declared here, with the layout the agent expects from wasm32 modules.
+ * Configurations are only recorded from the callback and acted upon from
+ * the main loop:
+ *
+ * - "echo": sends the configuration back as the "echo" telemetry,
+ * - "flood" N: sends N "flood" telemetries, as fast as the agent takes them,
+ * - "upload" "<url> <size>": PUTs size bytes to url, then sends the HTTP
+ *   status as the "upload" telemetry.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXPORT(name) __attribute__((export_name(#name)))
+#define IMPORT(name) __attribute__((import_module("env"), import_name(#name)))
+
+#define EVP_OK 0
+#define EVP_SHOULDEXIT 1
+#define EVP_BLOB_TYPE_HTTP 2
+#define EVP_BLOB_OP_PUT 1
+#define EVP_BLOB_CALLBACK_REASON_DONE 0
+#define EVP_BLOB_RESULT_SUCCESS 0
+#define EVP_BLOB_IO_RESULT_SUCCESS 0
+
+#define MODULE_SLOTS 256
+#define MODULE_VALUE_SIZE 64
+#define MODULE_URL_SIZE 256
+#define MODULE_PROCESS_MS 1000
+
+struct EVP_client;
+
+struct EVP_telemetry_entry {
+    const char *key;
+    const char *value;
+};
+
+struct EVP_BlobLocalStore {
+    const char *filename;
+    int (*io_cb)(void *buf, size_t buflen, void *user);
+    size_t blob_len;
+};
+
+struct EVP_BlobRequestHttp {
+    const char *url;
+};
+
+struct EVP_BlobResultHttp {
+    int result;
+    unsigned int http_status;
+    int error;
+};
+
+typedef void (*config_cb)(const char *topic, const void *config, size_t configlen, void *user);
+typedef void (*telemetry_cb)(int reason, void *user);
+typedef void (*blob_cb)(int reason, const void *result, void *user);
+
+IMPORT(EVP_initialize)
+struct EVP_client *EVP_initialize(void);
+IMPORT(EVP_processEvent)
+int EVP_processEvent(struct EVP_client *h, int timeout_ms);
+IMPORT(EVP_setConfigurationCallback)
+int EVP_setConfigurationCallback(struct EVP_client *h, config_cb cb, void *user);
+IMPORT(EVP_sendTelemetry)
+int EVP_sendTelemetry(struct EVP_client *h, const struct EVP_telemetry_entry *entries,
+                      size_t nentries, telemetry_cb cb, void *user);
+IMPORT(EVP_blobOperation)
+int EVP_blobOperation(struct EVP_client *h, int type, int op, const void *request,
+                      struct EVP_BlobLocalStore *store, blob_cb cb, void *user);
+
+/* A telemetry in flight */
+struct slot {
+    struct EVP_telemetry_entry entry;
+    char value[MODULE_VALUE_SIZE];
+    int used;
+};
+
+static struct EVP_client *g_h;
+static struct slot g_slots[MODULE_SLOTS];
+
+static char g_echo[MODULE_VALUE_SIZE];
+static int g_echo_pending;
+static uint32_t g_flood_left;
+static uint32_t g_flood_seq;
+
+static char g_upload_url[MODULE_URL_SIZE];
+static uint32_t g_upload_size;
+static int g_upload_pending;
+static int g_upload_busy;
+static int g_upload_done;
+static uint32_t g_upload_status;
+
+static size_t copy(char *dst, size_t size, const char *src, size_t len)
+{
+    size_t n = len < size - 1 ? len : size - 1;
+
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i];
+    }
+    dst[n] = '\0';
+    return n;
+}
+
+static int equals(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static uint32_t parse_u32(const char **p, const char *end)
+{
+    uint32_t v = 0;
+
+    while (*p < end && **p == ' ') {
+        (*p)++;
+    }
+    while (*p < end && **p >= '0' && **p <= '9') {
+        v = v * 10 + (uint32_t)(**p - '0');
+        (*p)++;
+    }
+    return v;
+}
+
+static void format_u32(char *buf, uint32_t v)
+{
+    char tmp[10];
+    size_t n = 0;
+
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) {
+        *buf++ = tmp[--n];
+    }
+    *buf = '\0';
+}
+
+static void on_config(const char *topic, const void *config, size_t configlen, void *user)
+{
+    const char *p = config;
+    const char *end = p + configlen;
+
+    if (equals(topic, "echo")) {
+        copy(g_echo, sizeof(g_echo), p, configlen);
+        g_echo_pending = 1;
+    }
+    else if (equals(topic, "flood")) {
+        g_flood_left += parse_u32(&p, end);
+    }
+    else if (equals(topic, "upload")) {
+        size_t n = 0;
+
+        while (n < configlen && p[n] != ' ') {
+            n++;
+        }
+        copy(g_upload_url, sizeof(g_upload_url), p, n);
+        p += n;
+        g_upload_size = parse_u32(&p, end);
+        g_upload_pending = 1;
+    }
+}
+
+static void on_telemetry(int reason, void *user)
+{
+    struct slot *slot = user;
+
+    slot->used = 0;
+}
+
+static int on_upload_read(void *buf, size_t buflen, void *user)
+{
+    uint8_t *p = buf;
+
+    for (size_t i = 0; i < buflen; i++) {
+        p[i] = (uint8_t)i;
+    }
+    return EVP_BLOB_IO_RESULT_SUCCESS;
+}
+
+static void on_upload(int reason, const void *result, void *user)
+{
+    const struct EVP_BlobResultHttp *http = result;
+
+    g_upload_status = 0;
+    if (reason == EVP_BLOB_CALLBACK_REASON_DONE && http->result == EVP_BLOB_RESULT_SUCCESS) {
+        g_upload_status = http->http_status;
+    }
+    g_upload_done = 1;
+}
+
+/* Waits for the agent to complete a telemetry if all the slots are in flight */
+static struct slot *slot_get(void)
+{
+    for (;;) {
+        for (size_t i = 0; i < MODULE_SLOTS; i++) {
+            if (!g_slots[i].used) {
+                g_slots[i].used = 1;
+                return &g_slots[i];
+            }
+        }
+        if (EVP_processEvent(g_h, MODULE_PROCESS_MS) == EVP_SHOULDEXIT) {
+            return NULL;
+        }
+    }
+}
+
+static int telemetry_send(const char *key, const char *value)
+{
+    struct slot *slot = slot_get();
+    size_t len = 0;
+
+    if (slot == NULL) {
+        return EVP_SHOULDEXIT;
+    }
+    while (value[len] != '\0') {
+        len++;
+    }
+    copy(slot->value, sizeof(slot->value), value, len);
+    slot->entry.key = key;
+    slot->entry.value = slot->value;
+    if (EVP_sendTelemetry(g_h, &slot->entry, 1, on_telemetry, slot) != EVP_OK) {
+        slot->used = 0;
+    }
+    return EVP_OK;
+}
+
+static void upload_start(void)
+{
+    static struct EVP_BlobRequestHttp request;
+    static struct EVP_BlobLocalStore store;
+
+    request.url = g_upload_url;
+    store.filename = NULL;
+    store.io_cb = on_upload_read;
+    store.blob_len = g_upload_size;
+    g_upload_pending = 0;
+    g_upload_busy = 1;
+    if (EVP_blobOperation(g_h, EVP_BLOB_TYPE_HTTP, EVP_BLOB_OP_PUT, &request, &store, on_upload,
+                          NULL) != EVP_OK) {
+        g_upload_status = 0;
+        g_upload_done = 1;
+    }
+}
+
+EXPORT(main)
+int module_main(void)
+{
+    char value[MODULE_VALUE_SIZE];
+
+    g_h = EVP_initialize();
+    EVP_setConfigurationCallback(g_h, on_config, NULL);
+
+    while (EVP_processEvent(g_h, MODULE_PROCESS_MS) != EVP_SHOULDEXIT) {
+        if (g_echo_pending) {
+            g_echo_pending = 0;
+            if (telemetry_send("echo", g_echo) == EVP_SHOULDEXIT) {
+                break;
+            }
+        }
+        while (g_flood_left > 0) {
+            g_flood_left--;
+            format_u32(value, g_flood_seq++);
+            if (telemetry_send("flood", value) == EVP_SHOULDEXIT) {
+                return 0;
+            }
+        }
+        if (g_upload_pending && !g_upload_busy) {
+            upload_start();
+        }
+        if (g_upload_done) {
+            g_upload_done = 0;
+            g_upload_busy = 0;
+            format_u32(value, g_upload_status);
+            if (telemetry_send("upload", value) == EVP_SHOULDEXIT) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
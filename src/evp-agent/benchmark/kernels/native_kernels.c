@@ -0,0 +1,86 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Native call loops for the native calling convention benchmark.
+ *
+ * Compiled freestanding for wasm32. Each kernel calls one host native
+ * "iterations" times: bench_add takes two scalars, bench_sum a buffer of
+ * the linear memory. The *_raw natives do the same work, registered with
+ * the raw calling convention.
+ */
+
+#include <stdint.h>
+
+#define EXPORT(name) __attribute__((export_name(#name)))
+#define IMPORT(name) __attribute__((import_module("env"), import_name(#name)))
+
+#define BENCH_BUF_SIZE 256
+
+IMPORT(bench_add)
+int32_t bench_add(int32_t a, int32_t b);
+IMPORT(bench_add_raw)
+int32_t bench_add_raw(int32_t a, int32_t b);
+IMPORT(bench_sum)
+int32_t bench_sum(const void *buf, uint32_t size);
+IMPORT(bench_sum_raw)
+int32_t bench_sum_raw(const void *buf, uint32_t size);
+
+static uint8_t g_buf[BENCH_BUF_SIZE] = {1};
+
+EXPORT(bench_calls_add)
+int32_t bench_calls_add(int32_t iterations)
+{
+    int32_t acc = 0;
+
+    for (int32_t i = 0; i < iterations; i++) {
+        acc = bench_add(acc, i);
+    }
+    return acc & 0x7fffffff;
+}
+
+EXPORT(bench_calls_add_raw)
+int32_t bench_calls_add_raw(int32_t iterations)
+{
+    int32_t acc = 0;
+
+    for (int32_t i = 0; i < iterations; i++) {
+        acc = bench_add_raw(acc, i);
+    }
+    return acc & 0x7fffffff;
+}
+
+EXPORT(bench_calls_sum)
+int32_t bench_calls_sum(int32_t iterations)
+{
+    int32_t acc = 0;
+
+    for (int32_t i = 0; i < iterations; i++) {
+        int32_t ret = bench_sum(g_buf, sizeof(g_buf));
+
+        if (ret < 0) {
+            return ret;
+        }
+        acc += ret;
+    }
+    return acc & 0x7fffffff;
+}
+
+EXPORT(bench_calls_sum_raw)
+int32_t bench_calls_sum_raw(int32_t iterations)
+{
+    int32_t acc = 0;
+
+    for (int32_t i = 0; i < iterations; i++) {
+        int32_t ret = bench_sum_raw(g_buf, sizeof(g_buf));
+
+        if (ret < 0) {
+            return ret;
+        }
+        acc += ret;
+    }
+    return acc & 0x7fffffff;
+}
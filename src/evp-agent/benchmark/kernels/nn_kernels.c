@@ -0,0 +1,146 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Inference loops for the wasi-nn bound tensor benchmark.
+ *
+ * Compiled freestanding for wasm32. Both kernels run "iterations" inferences
+ * of a VGA-sized input against the fake backend, which copies the first input
+ * byte to the first output byte: one through set_input(), compute() and
+ * get_output() of wasi_ephemeral_nn, the other through the bound tensors of
+ * the agent. They return 0, or a negative value on failure.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "evp_agent/wasi_nn_bound_tensors.h"
+
+#define EXPORT(name) __attribute__((export_name(#name)))
+#define NN_IMPORT(name) __attribute__((import_module("wasi_ephemeral_nn"), import_name(#name)))
+
+/* wasi-nn enums */
+#define NN_ENCODING_TFLITE 4
+#define NN_TARGET_CPU 0
+#define NN_TYPE_U8 3
+
+#define INPUT_H 480
+#define INPUT_W 640
+#define INPUT_C 3
+#define INPUT_SIZE (INPUT_H * INPUT_W * INPUT_C)
+/* 1001 class scores */
+#define OUTPUT_SIZE (1001 * 4)
+
+/* The memory layouts of wasi_ephemeral_nn */
+struct nn_builder {
+    const void *buf;
+    uint32_t size;
+};
+
+struct nn_tensor {
+    const uint32_t *dims;
+    uint32_t n_dims;
+    uint32_t type;
+    const void *data;
+    uint32_t size;
+};
+
+NN_IMPORT(load)
+int32_t nn_load(const struct nn_builder *builders, uint32_t n_builders, uint32_t encoding,
+                uint32_t target, uint32_t *graph);
+NN_IMPORT(init_execution_context)
+int32_t nn_init_execution_context(uint32_t graph, uint32_t *exec_ctx);
+NN_IMPORT(set_input)
+int32_t nn_set_input(uint32_t exec_ctx, uint32_t index, const struct nn_tensor *tensor);
+NN_IMPORT(compute)
+int32_t nn_compute(uint32_t exec_ctx);
+NN_IMPORT(get_output)
+int32_t nn_get_output(uint32_t exec_ctx, uint32_t index, void *buf, uint32_t size,
+                      uint32_t *written);
+
+static const uint8_t g_model[] = "fake model";
+static const uint32_t g_dims[] = {1, INPUT_H, INPUT_W, INPUT_C};
+static uint8_t g_input[INPUT_SIZE];
+static uint8_t g_output[OUTPUT_SIZE];
+
+/* Returns the execution context, or a negative value */
+EXPORT(bench_nn_setup)
+int32_t bench_nn_setup(void)
+{
+    struct nn_builder builder = {g_model, sizeof(g_model)};
+    uint32_t graph, exec_ctx;
+    int32_t ret;
+
+    ret = nn_load(&builder, 1, NN_ENCODING_TFLITE, NN_TARGET_CPU, &graph);
+    if (ret != 0) {
+        return -ret;
+    }
+    ret = nn_init_execution_context(graph, &exec_ctx);
+    if (ret != 0) {
+        return -ret;
+    }
+
+    ret = wasi_nn_bind_input(exec_ctx, 0, NN_TYPE_U8, g_dims, sizeof(g_dims), g_input,
+                             sizeof(g_input));
+    if (ret != 0) {
+        return ret;
+    }
+    ret = wasi_nn_bind_output(exec_ctx, 0, g_output, sizeof(g_output));
+    if (ret != 0) {
+        return ret;
+    }
+
+    return (int32_t)exec_ctx;
+}
+
+EXPORT(bench_nn_standard)
+int32_t bench_nn_standard(uint32_t exec_ctx, uint32_t iterations)
+{
+    struct nn_tensor input = {g_dims, sizeof(g_dims) / sizeof(g_dims[0]), NN_TYPE_U8, g_input,
+                              sizeof(g_input)};
+    uint32_t written;
+    int32_t ret;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        g_input[0] = (uint8_t)i;
+
+        ret = nn_set_input(exec_ctx, 0, &input);
+        if (ret == 0) {
+            ret = nn_compute(exec_ctx);
+        }
+        if (ret == 0) {
+            ret = nn_get_output(exec_ctx, 0, g_output, sizeof(g_output), &written);
+        }
+        if (ret != 0) {
+            return -ret;
+        }
+        if (g_output[0] != (uint8_t)i) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+EXPORT(bench_nn_bound)
+int32_t bench_nn_bound(uint32_t exec_ctx, uint32_t iterations)
+{
+    int32_t ret;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        g_input[0] = (uint8_t)i;
+
+        ret = wasi_nn_compute_bound(exec_ctx);
+        if (ret != 0) {
+            return ret < 0 ? ret : -ret;
+        }
+        if (g_output[0] != (uint8_t)i) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Representative wasm workloads for the WAMR engine benchmark.
+ *
+ * This file is compiled freestanding for wasm32 (no libc), so every helper
+ * it needs is implemented locally. Each exported kernel runs its workload
+ * "iterations" times and returns a checksum so that the compiler cannot
+ * discard the work.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EXPORT(name) __attribute__((export_name(#name)))
+#define IMPORT(name) __attribute__((import_module("env"), import_name(#name)))
+
+/* Post-processing of a MobileNet-SSD style output: anchors x classes logits */
+#define TENSOR_ANCHORS 1917
+#define TENSOR_CLASSES 21
+#define TENSOR_BOX_VALUES 4
+
+/* Typical size of a VGA JPEG produced by the sensor */
+#define JPEG_FRAME_SIZE (96 * 1024)
+
+#define JSON_BUFFER_SIZE 8192
+#define JSON_DETECTIONS 32
+
+#define NATIVE_CALLS_PER_ITERATION 1000
+
+IMPORT(senscord_bench_get_property)
+int32_t senscord_bench_get_property(uint64_t stream, const char *key, void *value, uint32_t size);
+
+static float g_scores[TENSOR_ANCHORS * TENSOR_CLASSES];
+static float g_boxes[TENSOR_ANCHORS * TENSOR_BOX_VALUES];
+static uint8_t g_frame_src[JPEG_FRAME_SIZE];
+static uint8_t g_frame_dst[JPEG_FRAME_SIZE];
+static char g_json[JSON_BUFFER_SIZE];
+
+struct detection {
+    int32_t class_id;
+    float score;
+    float box[TENSOR_BOX_VALUES];
+};
+
+static struct detection g_detections[JSON_DETECTIONS];
+
+static uint32_t xorshift(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void fill_inputs(void)
+{
+    static int filled;
+    uint32_t seed = 0x12345678;
+
+    if (filled) {
+        return;
+    }
+
+    for (size_t i = 0; i < TENSOR_ANCHORS * TENSOR_CLASSES; i++) {
+        g_scores[i] = (float)(int32_t)(xorshift(&seed) % 2000 - 1000) / 100.0f;
+    }
+    for (size_t i = 0; i < TENSOR_ANCHORS * TENSOR_BOX_VALUES; i++) {
+        g_boxes[i] = (float)(xorshift(&seed) % 1000) / 1000.0f;
+    }
+    for (size_t i = 0; i < JPEG_FRAME_SIZE; i++) {
+        g_frame_src[i] = (uint8_t)xorshift(&seed);
+    }
+
+    filled = 1;
+}
+
+/*
+ * Threshold the class logits of every anchor, keep the best class and
+ * decode the matching box. This is the hot loop of most detection
+ * post-processing modules.
+ */
+EXPORT(bench_tensor_postprocess)
+int32_t bench_tensor_postprocess(int32_t iterations)
+{
+    int32_t found = 0;
+
+    fill_inputs();
+
+    for (int32_t it = 0; it < iterations; it++) {
+        int32_t n = 0;
+
+        for (int32_t a = 0; a < TENSOR_ANCHORS; a++) {
+            const float *scores = &g_scores[a * TENSOR_CLASSES];
+            int32_t best = 0;
+
+            /* Class 0 is background */
+            for (int32_t c = 1; c < TENSOR_CLASSES; c++) {
+                if (scores[c] > scores[best]) {
+                    best = c;
+                }
+            }
+            if (best == 0 || scores[best] < 8.0f) {
+                continue;
+            }
+
+            if (n < JSON_DETECTIONS) {
+                const float *box = &g_boxes[a * TENSOR_BOX_VALUES];
+                struct detection *d = &g_detections[n];
+
+                d->class_id = best;
+                d->score = scores[best];
+                d->box[0] = box[0] - box[2] / 2.0f;
+                d->box[1] = box[1] - box[3] / 2.0f;
+                d->box[2] = box[0] + box[2] / 2.0f;
+                d->box[3] = box[1] + box[3] / 2.0f;
+            }
+            n++;
+        }
+        found += n;
+    }
+
+    return found;
+}
+
+/* Copy of a JPEG-sized frame, as done when handing a frame to a sink */
+EXPORT(bench_frame_memcpy)
+int32_t bench_frame_memcpy(int32_t iterations)
+{
+    uint32_t sum = 0;
+
+    fill_inputs();
+
+    for (int32_t it = 0; it < iterations; it++) {
+        const uint64_t *src = (const uint64_t *)g_frame_src;
+        uint64_t *dst = (uint64_t *)g_frame_dst;
+
+        for (size_t i = 0; i < JPEG_FRAME_SIZE / sizeof(uint64_t); i++) {
+            dst[i] = src[i];
+        }
+        sum += g_frame_dst[it % JPEG_FRAME_SIZE];
+    }
+
+    return (int32_t)sum;
+}
+
+static char *put_str(char *p, char *end, const char *s)
+{
+    while (*s != '\0' && p < end) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static char *put_int(char *p, char *end, int32_t v)
+{
+    char tmp[12];
+    size_t n = 0;
+    uint32_t u = v < 0 ? -(uint32_t)v : (uint32_t)v;
+
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+
+    if (v < 0 && p < end) {
+        *p++ = '-';
+    }
+    while (n > 0 && p < end) {
+        *p++ = tmp[--n];
+    }
+    return p;
+}
+
+/* Fixed point with three decimals, which is what the apps send */
+static char *put_fixed(char *p, char *end, float v)
+{
+    int32_t milli = (int32_t)(v * 1000.0f);
+    int32_t frac = milli % 1000;
+
+    if (milli < 0 && milli > -1000) {
+        p = put_str(p, end, "-");
+    }
+    p = put_int(p, end, milli / 1000);
+    p = put_str(p, end, ".");
+    if (frac < 0) {
+        frac = -frac;
+    }
+    if (frac < 100) {
+        p = put_str(p, end, "0");
+    }
+    if (frac < 10) {
+        p = put_str(p, end, "0");
+    }
+    return put_int(p, end, frac);
+}
+
+/* Serialise the detections as the JSON telemetry the apps publish */
+EXPORT(bench_json_build)
+int32_t bench_json_build(int32_t iterations)
+{
+    int32_t total = 0;
+
+    bench_tensor_postprocess(1);
+
+    for (int32_t it = 0; it < iterations; it++) {
+        char *p = g_json;
+        char *end = g_json + JSON_BUFFER_SIZE - 1;
+
+        p = put_str(p, end, "{\"frame\":");
+        p = put_int(p, end, it);
+        p = put_str(p, end, ",\"detections\":[");
+        for (int32_t i = 0; i < JSON_DETECTIONS; i++) {
+            const struct detection *d = &g_detections[i];
+
+            if (i != 0) {
+                p = put_str(p, end, ",");
+            }
+            p = put_str(p, end, "{\"class\":");
+            p = put_int(p, end, d->class_id);
+            p = put_str(p, end, ",\"score\":");
+            p = put_fixed(p, end, d->score);
+            p = put_str(p, end, ",\"box\":[");
+            for (int32_t b = 0; b < TENSOR_BOX_VALUES; b++) {
+                if (b != 0) {
+                    p = put_str(p, end, ",");
+                }
+                p = put_fixed(p, end, d->box[b]);
+            }
+            p = put_str(p, end, "]}");
+        }
+        p = put_str(p, end, "]}");
+        *p = '\0';
+        total += (int32_t)(p - g_json);
+    }
+
+    return total;
+}
+
+/* Many small calls into the host, mimicking the senscord property API */
+EXPORT(bench_native_calls)
+int32_t bench_native_calls(int32_t iterations)
+{
+    int32_t sum = 0;
+    uint32_t value[4];
+
+    for (int32_t it = 0; it < iterations; it++) {
+        for (int32_t i = 0; i < NATIVE_CALLS_PER_ITERATION; i++) {
+            sum += senscord_bench_get_property((uint64_t)i, "frame_rate_property", value,
+                                               sizeof(value));
+            sum += (int32_t)value[0];
+        }
+    }
+
+    return sum;
+}
@@ -0,0 +1,205 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Native calling convention benchmark.
+ *
+ * Measures the calls per second a wasm module gets out of a host native
+ * registered with wasm_runtime_register_natives(), where WAMR marshals the
+ * arguments from the signature string, and with
+ * wasm_runtime_register_natives_raw() and the helpers of
+ * evp_agent/native_raw.h, for a scalar native and for a native taking a
+ * buffer of the linear memory.
+ *
+ * usage: native_call_bench <native_kernels.wasm> [iterations]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "bench_util.h"
+#include "evp_agent/native_raw.h"
+
+#define BENCH_WASM_STACK_SIZE 32678
+#define BENCH_WASM_HEAP_SIZE (64 * 1024)
+#define BENCH_ERROR_BUF_SIZE 128
+
+#define BENCH_DEFAULT_ITERATIONS 10000000
+#define BENCH_WARMUP_ITERATIONS 10000
+
+static int32_t sum_edges(const uint8_t *buf, uint32_t size)
+{
+    return size == 0 ? 0 : buf[0] + buf[size - 1];
+}
+
+static int32_t bench_add(wasm_exec_env_t exec_env, int32_t a, int32_t b)
+{
+    return a + b;
+}
+
+static int32_t bench_sum(wasm_exec_env_t exec_env, const uint8_t *buf, uint32_t size)
+{
+    return sum_edges(buf, size);
+}
+
+static void bench_add_raw(wasm_exec_env_t exec_env, uint64_t *args)
+{
+    int32_t a = EVP_NATIVE_RAW_ARG(int32_t, args, 0);
+    int32_t b = EVP_NATIVE_RAW_ARG(int32_t, args, 1);
+
+    EVP_NATIVE_RAW_RETURN(int32_t, args, a + b);
+}
+
+static void bench_sum_raw(wasm_exec_env_t exec_env, uint64_t *args)
+{
+    uint32_t size = EVP_NATIVE_RAW_ARG(uint32_t, args, 1);
+    struct evp_native_raw_mem mem;
+    const uint8_t *buf;
+
+    if (!evp_native_raw_mem(exec_env, &mem) ||
+        (buf = evp_native_raw_ptr(&mem, EVP_NATIVE_RAW_ARG(uint32_t, args, 0), size)) == NULL) {
+        EVP_NATIVE_RAW_RETURN(int32_t, args, -EFAULT);
+        return;
+    }
+
+    EVP_NATIVE_RAW_RETURN(int32_t, args, sum_edges(buf, size));
+}
+
+static NativeSymbol g_bench_natives[] = {
+    {"bench_add", bench_add, "(ii)i", NULL},
+    {"bench_sum", bench_sum, "(*~)i", NULL},
+};
+
+static NativeSymbol g_bench_natives_raw[] = {
+    {"bench_add_raw", bench_add_raw, "(ii)i", NULL},
+    {"bench_sum_raw", bench_sum_raw, "(ii)i", NULL},
+};
+
+static int run_kernel(wasm_exec_env_t exec_env, wasm_module_inst_t inst, const char *style,
+                      const char *name, uint32_t iterations)
+{
+    wasm_function_inst_t func = wasm_runtime_lookup_function(inst, name);
+    uint32_t argv[1];
+
+    if (func == NULL) {
+        fprintf(stderr, "%s is not exported by the module\n", name);
+        return -1;
+    }
+
+    argv[0] = BENCH_WARMUP_ITERATIONS;
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+
+    argv[0] = iterations;
+    uint64_t t0 = now_ns();
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+    uint64_t elapsed = now_ns() - t0;
+
+    if ((int32_t)argv[0] < 0) {
+        fprintf(stderr, "%s failed: %s\n", name, strerror(-(int32_t)argv[0]));
+        return -1;
+    }
+
+    printf("style=%s kernel=%s calls=%" PRIu32 " ns_per_call=%.1f calls_per_sec=%.0f\n", style,
+           name, iterations, (double)elapsed / iterations,
+           elapsed > 0 ? iterations * 1e9 / elapsed : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char error_buf[BENCH_ERROR_BUF_SIZE];
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    RuntimeInitArgs init_args;
+    wasm_module_inst_t inst = NULL;
+    wasm_exec_env_t exec_env = NULL;
+    wasm_module_t module = NULL;
+    uint8_t *buf = NULL;
+    uint32_t size = 0;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <module> [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 2) {
+        iterations = (uint32_t)strtoul(argv[2], NULL, 0);
+    }
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.mem_alloc_type = Alloc_With_System_Allocator;
+
+    if (!wasm_runtime_full_init(&init_args)) {
+        fprintf(stderr, "wasm_runtime_full_init failed\n");
+        return EXIT_FAILURE;
+    }
+    if (!wasm_runtime_register_natives("env", g_bench_natives,
+                                       sizeof(g_bench_natives) / sizeof(g_bench_natives[0]))) {
+        fprintf(stderr, "wasm_runtime_register_natives failed\n");
+        goto out_destroy_runtime;
+    }
+    if (!wasm_runtime_register_natives_raw(
+            "env", g_bench_natives_raw,
+            sizeof(g_bench_natives_raw) / sizeof(g_bench_natives_raw[0]))) {
+        fprintf(stderr, "wasm_runtime_register_natives_raw failed\n");
+        goto out_destroy_runtime;
+    }
+
+    buf = read_module(argv[1], &size);
+    if (buf == NULL) {
+        goto out_destroy_runtime;
+    }
+
+    module = wasm_runtime_load(buf, size, error_buf, sizeof(error_buf));
+    if (module == NULL) {
+        fprintf(stderr, "wasm_runtime_load failed: %s\n", error_buf);
+        goto out_free_buf;
+    }
+
+    inst = wasm_runtime_instantiate(module, BENCH_WASM_STACK_SIZE, BENCH_WASM_HEAP_SIZE,
+                                    error_buf, sizeof(error_buf));
+    if (inst == NULL) {
+        fprintf(stderr, "wasm_runtime_instantiate failed: %s\n", error_buf);
+        goto out_unload;
+    }
+
+    exec_env = wasm_runtime_create_exec_env(inst, BENCH_WASM_STACK_SIZE);
+    if (exec_env == NULL) {
+        fprintf(stderr, "wasm_runtime_create_exec_env failed\n");
+        goto out_deinstantiate;
+    }
+
+    ret = EXIT_SUCCESS;
+    if (run_kernel(exec_env, inst, "signature", "bench_calls_add", iterations) != 0 ||
+        run_kernel(exec_env, inst, "raw", "bench_calls_add_raw", iterations) != 0 ||
+        run_kernel(exec_env, inst, "signature", "bench_calls_sum", iterations) != 0 ||
+        run_kernel(exec_env, inst, "raw", "bench_calls_sum_raw", iterations) != 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    wasm_runtime_destroy_exec_env(exec_env);
+out_deinstantiate:
+    wasm_runtime_deinstantiate(inst);
+out_unload:
+    wasm_runtime_unload(module);
+out_free_buf:
+    free(buf);
+out_destroy_runtime:
+    wasm_runtime_destroy();
+    return ret;
+}
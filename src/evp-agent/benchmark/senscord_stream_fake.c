@@ -0,0 +1,160 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for memfd_create */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench_util.h"
+#include "senscord_stream_fake.h"
+
+struct fake_buffer {
+    uint8_t *data;
+    bool in_use;
+};
+
+static struct {
+    struct senscord_stream_fake_config config;
+    struct fake_buffer *buffers;
+    unsigned int next;
+    uint64_t sequence;
+    pthread_mutex_t lock;
+} g_fake = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint8_t *buffer_alloc(size_t size, bool shared)
+{
+    uint8_t *data;
+    int fd;
+
+    if (!shared) {
+        data = malloc(size);
+        if (data != NULL) {
+            memset(data, 0x5a, size);
+        }
+        return data;
+    }
+
+    fd = memfd_create("senscord_stream_fake", MFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "memfd_create failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0) {
+        fprintf(stderr, "ftruncate failed: %s\n", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    memset(data, 0x5a, size);
+    return data;
+}
+
+static void buffer_free(uint8_t *data)
+{
+    if (g_fake.config.shared) {
+        munmap(data, g_fake.config.frame_size);
+    }
+    else {
+        free(data);
+    }
+}
+
+int senscord_stream_fake_open(const struct senscord_stream_fake_config *config)
+{
+    if (config->frame_size < sizeof(uint64_t) || config->buffers == 0) {
+        return -EINVAL;
+    }
+
+    g_fake.buffers = calloc(config->buffers, sizeof(*g_fake.buffers));
+    if (g_fake.buffers == NULL) {
+        return -ENOMEM;
+    }
+    g_fake.config = *config;
+
+    for (unsigned int i = 0; i < config->buffers; i++) {
+        g_fake.buffers[i].data = buffer_alloc(config->frame_size, config->shared);
+        if (g_fake.buffers[i].data == NULL) {
+            senscord_stream_fake_close();
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+void senscord_stream_fake_close(void)
+{
+    for (unsigned int i = 0; i < g_fake.config.buffers; i++) {
+        if (g_fake.buffers[i].data != NULL) {
+            buffer_free(g_fake.buffers[i].data);
+        }
+    }
+    free(g_fake.buffers);
+    g_fake.buffers = NULL;
+    g_fake.config.buffers = 0;
+}
+
+static int fake_get_frame(uint64_t stream, uint32_t channel_id, int32_t timeout_ms,
+                          struct evp_frame_share_frame *frame)
+{
+    struct fake_buffer *buffer = NULL;
+
+    pthread_mutex_lock(&g_fake.lock);
+    for (unsigned int i = 0; i < g_fake.config.buffers; i++) {
+        struct fake_buffer *b = &g_fake.buffers[(g_fake.next + i) % g_fake.config.buffers];
+
+        if (!b->in_use) {
+            buffer = b;
+            g_fake.next = (g_fake.next + i + 1) % g_fake.config.buffers;
+            break;
+        }
+    }
+    if (buffer == NULL) {
+        /* A real stream would wait for a buffer to be released */
+        pthread_mutex_unlock(&g_fake.lock);
+        return -ETIMEDOUT;
+    }
+
+    buffer->in_use = true;
+    frame->sequence = g_fake.sequence++;
+    pthread_mutex_unlock(&g_fake.lock);
+
+    /* The sensor writes the frame with DMA, so only stamp it */
+    memcpy(buffer->data, &frame->sequence, sizeof(frame->sequence));
+
+    frame->data = buffer->data;
+    frame->size = g_fake.config.frame_size;
+    frame->timestamp = now_ns();
+    frame->priv = (uintptr_t)buffer;
+    return 0;
+}
+
+static void fake_release_frame(uint64_t stream, struct evp_frame_share_frame *frame)
+{
+    struct fake_buffer *buffer = (struct fake_buffer *)(uintptr_t)frame->priv;
+
+    pthread_mutex_lock(&g_fake.lock);
+    buffer->in_use = false;
+    pthread_mutex_unlock(&g_fake.lock);
+}
+
+const struct evp_frame_share_source senscord_stream_fake = {
+    .get_frame = fake_get_frame,
+    .release_frame = fake_release_frame,
+};
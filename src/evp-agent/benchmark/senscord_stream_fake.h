@@ -0,0 +1,34 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __SENSCORD_STREAM_FAKE_H__
+#define __SENSCORD_STREAM_FAKE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "frame_share.h"
+
+/*
+ * Test double of a senscord stream, usable as a frame source without a
+ * camera. Frames are served round-robin from a ring of buffers allocated
+ * either like a DMA-capable senscord allocator (shared memory that can be
+ * mapped elsewhere) or like a heap allocator (private memory). Every frame
+ * carries its sequence number in its first bytes.
+ */
+
+struct senscord_stream_fake_config {
+    size_t frame_size;
+    unsigned int buffers;
+    bool shared;
+};
+
+int senscord_stream_fake_open(const struct senscord_stream_fake_config *config);
+void senscord_stream_fake_close(void);
+
+extern const struct evp_frame_share_source senscord_stream_fake;
+
+#endif /* __SENSCORD_STREAM_FAKE_H__ */
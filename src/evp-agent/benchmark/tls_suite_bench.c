@@ -0,0 +1,422 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * TLS cipher suite benchmark.
+ *
+ * Runs a client and a server of the product mbedtls build in one thread,
+ * over an in-memory transport, with a self-signed ECDSA P-256 certificate
+ * the client verifies, as the agent does. For each AEAD suite, it reports
+ * the time of a full handshake and the throughput of application data from
+ * the client to the server, then does the same with the suite preference
+ * of the agent (see tls_suites.h), which picks the suite.
+ *
+ * usage: tls_suite_bench [handshakes] [bulk MiB]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/ecp.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_ciphersuites.h>
+#include <mbedtls/x509_crt.h>
+#include <psa/crypto.h>
+
+#include "bench_util.h"
+#include "tls_suites.h"
+
+#define BENCH_DEFAULT_HANDSHAKES 100
+#define BENCH_DEFAULT_BULK_MIB 64
+#define BENCH_HOST "bench.local"
+#define BENCH_NOT_BEFORE "20240101000000"
+#define BENCH_NOT_AFTER "20991231235959"
+#define BENCH_CERT_SIZE 1024
+#define BENCH_RECORD_SIZE 16384
+/* Room for a whole flight of the handshake */
+#define BENCH_PIPE_SIZE (64 * 1024)
+#define BENCH_HANDSHAKE_STEPS 1000
+
+struct pipe {
+    unsigned char data[BENCH_PIPE_SIZE];
+    size_t start;
+    size_t end;
+};
+
+struct endpoint {
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    struct pipe *in;
+    struct pipe *out;
+};
+
+struct bench_suite {
+    int id;
+    bool tls13;
+};
+
+static const struct bench_suite g_suites[] = {
+    {MBEDTLS_TLS1_3_AES_128_GCM_SHA256, true},
+    {MBEDTLS_TLS1_3_AES_256_GCM_SHA384, true},
+    {MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256, true},
+    {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, false},
+    {MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384, false},
+    {MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256, false},
+};
+
+static mbedtls_entropy_context g_entropy;
+static mbedtls_ctr_drbg_context g_drbg;
+static mbedtls_pk_context g_key;
+static mbedtls_x509_crt g_cert;
+static struct pipe g_to_server;
+static struct pipe g_to_client;
+
+static int pipe_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    struct pipe *p = ctx;
+
+    if (p->end + len > sizeof(p->data) && p->start > 0) {
+        memmove(p->data, p->data + p->start, p->end - p->start);
+        p->end -= p->start;
+        p->start = 0;
+    }
+    if (len > sizeof(p->data) - p->end) {
+        len = sizeof(p->data) - p->end;
+    }
+    if (len == 0) {
+        return MBEDTLS_ERR_SSL_WANT_WRITE;
+    }
+
+    memcpy(p->data + p->end, buf, len);
+    p->end += len;
+    return (int)len;
+}
+
+static int pipe_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    struct pipe *p = ctx;
+
+    if (p->start == p->end) {
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    if (len > p->end - p->start) {
+        len = p->end - p->start;
+    }
+
+    memcpy(buf, p->data + p->start, len);
+    p->start += len;
+    return (int)len;
+}
+
+static bool would_block(int ret)
+{
+    return ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+static int make_certificate(void)
+{
+    static const unsigned char serial[] = {1};
+    unsigned char der[BENCH_CERT_SIZE];
+    mbedtls_x509write_cert crt;
+    int ret;
+
+    mbedtls_x509write_crt_init(&crt);
+
+    if ((ret = mbedtls_pk_setup(&g_key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY))) != 0 ||
+        (ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(g_key),
+                                   mbedtls_ctr_drbg_random, &g_drbg)) != 0) {
+        fprintf(stderr, "failed to generate the key: -0x%04x\n", (unsigned int)-ret);
+        goto end;
+    }
+
+    mbedtls_x509write_crt_set_version(&crt, MBEDTLS_X509_CRT_VERSION_3);
+    mbedtls_x509write_crt_set_md_alg(&crt, MBEDTLS_MD_SHA256);
+    mbedtls_x509write_crt_set_subject_key(&crt, &g_key);
+    mbedtls_x509write_crt_set_issuer_key(&crt, &g_key);
+    if ((ret = mbedtls_x509write_crt_set_subject_name(&crt, "CN=" BENCH_HOST)) ||
+        (ret = mbedtls_x509write_crt_set_issuer_name(&crt, "CN=" BENCH_HOST)) ||
+        (ret = mbedtls_x509write_crt_set_serial_raw(&crt, (unsigned char *)serial,
+                                                    sizeof(serial))) ||
+        (ret = mbedtls_x509write_crt_set_validity(&crt, BENCH_NOT_BEFORE, BENCH_NOT_AFTER)) ||
+        (ret = mbedtls_x509write_crt_set_basic_constraints(&crt, 1, -1))) {
+        fprintf(stderr, "failed to set up the certificate: -0x%04x\n", (unsigned int)-ret);
+        goto end;
+    }
+
+    /* The DER is written at the end of the buffer */
+    ret = mbedtls_x509write_crt_der(&crt, der, sizeof(der), mbedtls_ctr_drbg_random, &g_drbg);
+    if (ret < 0) {
+        fprintf(stderr, "failed to write the certificate: -0x%04x\n", (unsigned int)-ret);
+        goto end;
+    }
+    ret = mbedtls_x509_crt_parse_der(&g_cert, der + sizeof(der) - ret, ret);
+    if (ret != 0) {
+        fprintf(stderr, "failed to parse the certificate: -0x%04x\n", (unsigned int)-ret);
+    }
+
+end:
+    mbedtls_x509write_crt_free(&crt);
+    return ret;
+}
+
+static int endpoint_bio_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    return pipe_send(((struct endpoint *)ctx)->out, buf, len);
+}
+
+static int endpoint_bio_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    return pipe_recv(((struct endpoint *)ctx)->in, buf, len);
+}
+
+/* A zero terminated single suite list, or NULL for the preference of the agent */
+static int endpoint_setup(struct endpoint *ep, int endpoint, const int *suites, bool tls13,
+                          struct pipe *in, struct pipe *out)
+{
+    int ret;
+
+    ep->in = in;
+    ep->out = out;
+
+    ret = mbedtls_ssl_config_defaults(&ep->conf, endpoint, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        return ret;
+    }
+    mbedtls_ssl_conf_rng(&ep->conf, mbedtls_ctr_drbg_random, &g_drbg);
+
+    if (endpoint == MBEDTLS_SSL_IS_SERVER) {
+        ret = mbedtls_ssl_conf_own_cert(&ep->conf, &g_cert, &g_key);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    else {
+        mbedtls_ssl_conf_authmode(&ep->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&ep->conf, &g_cert, NULL);
+        if (suites != NULL) {
+            mbedtls_ssl_conf_ciphersuites(&ep->conf, suites);
+            mbedtls_ssl_conf_min_tls_version(&ep->conf, tls13 ? MBEDTLS_SSL_VERSION_TLS1_3
+                                                              : MBEDTLS_SSL_VERSION_TLS1_2);
+            mbedtls_ssl_conf_max_tls_version(&ep->conf, tls13 ? MBEDTLS_SSL_VERSION_TLS1_3
+                                                              : MBEDTLS_SSL_VERSION_TLS1_2);
+        }
+    }
+
+    ret = mbedtls_ssl_setup(&ep->ssl, &ep->conf);
+    if (ret != 0) {
+        return ret;
+    }
+    mbedtls_ssl_set_bio(&ep->ssl, ep, endpoint_bio_send, endpoint_bio_recv, NULL);
+    return 0;
+}
+
+static void endpoint_init(struct endpoint *ep)
+{
+    mbedtls_ssl_config_init(&ep->conf);
+    mbedtls_ssl_init(&ep->ssl);
+}
+
+static void endpoint_free(struct endpoint *ep)
+{
+    mbedtls_ssl_free(&ep->ssl);
+    mbedtls_ssl_config_free(&ep->conf);
+}
+
+static int handshake(struct endpoint *client, struct endpoint *server)
+{
+    bool client_done = false, server_done = false;
+    int ret;
+
+    memset(&g_to_server, 0, sizeof(g_to_server));
+    memset(&g_to_client, 0, sizeof(g_to_client));
+    if ((ret = mbedtls_ssl_session_reset(&client->ssl)) != 0 ||
+        (ret = mbedtls_ssl_session_reset(&server->ssl)) != 0 ||
+        (ret = mbedtls_ssl_set_hostname(&client->ssl, BENCH_HOST)) != 0) {
+        return ret;
+    }
+
+    for (int step = 0; step < BENCH_HANDSHAKE_STEPS; step++) {
+        if (!client_done) {
+            ret = mbedtls_ssl_handshake(&client->ssl);
+            if (ret == 0) {
+                client_done = true;
+            }
+            else if (!would_block(ret)) {
+                return ret;
+            }
+        }
+        if (!server_done) {
+            ret = mbedtls_ssl_handshake(&server->ssl);
+            if (ret == 0) {
+                server_done = true;
+            }
+            else if (!would_block(ret)) {
+                return ret;
+            }
+        }
+        if (client_done && server_done) {
+            return 0;
+        }
+    }
+
+    return MBEDTLS_ERR_SSL_TIMEOUT;
+}
+
+static int bulk(struct endpoint *client, struct endpoint *server, uint64_t size)
+{
+    static unsigned char payload[BENCH_RECORD_SIZE];
+    static unsigned char buf[BENCH_RECORD_SIZE];
+    uint64_t sent = 0, received = 0;
+    int ret;
+
+    while (received < size) {
+        if (sent < size) {
+            size_t len = size - sent < sizeof(payload) ? size - sent : sizeof(payload);
+
+            ret = mbedtls_ssl_write(&client->ssl, payload, len);
+            if (ret > 0) {
+                sent += ret;
+            }
+            else if (!would_block(ret)) {
+                return ret;
+            }
+        }
+
+        while ((ret = mbedtls_ssl_read(&server->ssl, buf, sizeof(buf))) > 0) {
+            received += ret;
+        }
+        if (ret == 0) {
+            return MBEDTLS_ERR_SSL_CONN_EOF;
+        }
+        if (!would_block(ret)) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+static int run_suite(const struct bench_suite *suite, unsigned int handshakes, uint64_t bulk_size)
+{
+    int suites[] = {suite != NULL ? suite->id : 0, 0};
+    struct endpoint client, server;
+    uint64_t t0, handshake_ns, bulk_ns;
+    const char *name;
+    int ret;
+
+    endpoint_init(&client);
+    endpoint_init(&server);
+    ret = endpoint_setup(&client, MBEDTLS_SSL_IS_CLIENT, suite != NULL ? suites : NULL,
+                         suite != NULL && suite->tls13, &g_to_client, &g_to_server);
+    if (ret == 0) {
+        ret = endpoint_setup(&server, MBEDTLS_SSL_IS_SERVER, NULL, false, &g_to_server,
+                             &g_to_client);
+    }
+    if (ret != 0) {
+        fprintf(stderr, "failed to set up the endpoints: -0x%04x\n", (unsigned int)-ret);
+        goto end;
+    }
+
+    t0 = now_ns();
+    for (unsigned int i = 0; i < handshakes; i++) {
+        ret = handshake(&client, &server);
+        if (ret != 0) {
+            fprintf(stderr, "handshake failed: -0x%04x\n", (unsigned int)-ret);
+            goto end;
+        }
+    }
+    handshake_ns = now_ns() - t0;
+
+    t0 = now_ns();
+    ret = bulk(&client, &server, bulk_size);
+    if (ret != 0) {
+        fprintf(stderr, "bulk transfer failed: -0x%04x\n", (unsigned int)-ret);
+        goto end;
+    }
+    bulk_ns = now_ns() - t0;
+
+    name = mbedtls_ssl_get_ciphersuite(&client.ssl);
+    printf("suite=%s%s version=%s handshakes=%u ms_per_handshake=%.2f bulk_mib=%" PRIu64
+           " mib_per_sec=%.1f\n",
+           suite != NULL ? "" : "agent-preference:", name != NULL ? name : "?",
+           mbedtls_ssl_get_version(&client.ssl), handshakes,
+           handshakes ? handshake_ns / 1e6 / handshakes : 0.0, bulk_size >> 20,
+           bulk_ns > 0 ? (bulk_size >> 20) * 1e9 / bulk_ns : 0.0);
+
+end:
+    endpoint_free(&client);
+    endpoint_free(&server);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int handshakes = BENCH_DEFAULT_HANDSHAKES;
+    uint64_t bulk_size = (uint64_t)BENCH_DEFAULT_BULK_MIB << 20;
+    int ret = EXIT_FAILURE;
+
+    if (argc > 1) {
+        handshakes = (unsigned int)strtoul(argv[1], NULL, 0);
+    }
+    if (argc > 2) {
+        bulk_size = (uint64_t)strtoul(argv[2], NULL, 0) << 20;
+    }
+
+    mbedtls_entropy_init(&g_entropy);
+    mbedtls_ctr_drbg_init(&g_drbg);
+    mbedtls_pk_init(&g_key);
+    mbedtls_x509_crt_init(&g_cert);
+
+    if (psa_crypto_init() != PSA_SUCCESS) {
+        fprintf(stderr, "psa_crypto_init failed\n");
+        goto end;
+    }
+    if (mbedtls_ctr_drbg_seed(&g_drbg, mbedtls_entropy_func, &g_entropy, NULL, 0) != 0) {
+        fprintf(stderr, "mbedtls_ctr_drbg_seed failed\n");
+        goto end;
+    }
+    if (make_certificate() != 0) {
+        goto end;
+    }
+    /* Logs the CPU features it found */
+    if (evp_agent_tls_suites_init() != 0) {
+        goto end;
+    }
+
+    ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < sizeof(g_suites) / sizeof(g_suites[0]); i++) {
+        if (mbedtls_ssl_ciphersuite_from_id(g_suites[i].id) == NULL) {
+            printf("suite=%s skipped=unsupported\n",
+                   mbedtls_ssl_get_ciphersuite_name(g_suites[i].id));
+            continue;
+        }
+        if (run_suite(&g_suites[i], handshakes, bulk_size) != 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+    if (run_suite(NULL, handshakes, bulk_size) != 0) {
+        ret = EXIT_FAILURE;
+    }
+
+    evp_agent_tls_suites_deinit();
+end:
+    mbedtls_x509_crt_free(&g_cert);
+    mbedtls_pk_free(&g_key);
+    mbedtls_ctr_drbg_free(&g_drbg);
+    mbedtls_entropy_free(&g_entropy);
+    mbedtls_psa_crypto_free();
+    return ret;
+}
@@ -0,0 +1,266 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * WAMR execution engine benchmark.
+ *
+ * The same runner is linked against one WAMR build per execution engine
+ * (see meson.build). It measures module load + instantiation time, kernel
+ * throughput and the resident set size of the process, and prints one
+ * "key=value" line per measurement so the results can be diffed between
+ * engines and flag sets.
+ *
+ * usage: wamr_engine_bench <engine> <module.wasm|module.aot> [iterations]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "bench_util.h"
+
+/* Same defaults as CONFIG_EVP_MODULE_IMPL_WASM_DEFAULT_{STACK,HEAP}SIZE */
+#define BENCH_WASM_STACK_SIZE 32678
+#define BENCH_WASM_HEAP_SIZE 32678
+
+#define BENCH_INSTANTIATE_REPEAT 20
+#define BENCH_DEFAULT_ITERATIONS 200
+#define BENCH_ERROR_BUF_SIZE 128
+
+#define JPEG_FRAME_SIZE (96 * 1024)
+#define NATIVE_CALLS_PER_ITERATION 1000
+
+struct bench_kernel {
+    const char *name;
+    /* Work units processed by one iteration, for the throughput figure */
+    uint64_t units;
+    const char *unit_name;
+    /* Relative cost, used to scale the iteration count per kernel */
+    uint32_t divisor;
+};
+
+static const struct bench_kernel g_kernels[] = {
+    {"bench_tensor_postprocess", 1, "tensors", 1},
+    {"bench_frame_memcpy", JPEG_FRAME_SIZE, "bytes", 1},
+    {"bench_json_build", 1, "documents", 1},
+    {"bench_native_calls", NATIVE_CALLS_PER_ITERATION, "calls", 4},
+};
+
+/* Stand-in for a senscord property getter: small copy into wasm memory */
+static int32_t senscord_bench_get_property(wasm_exec_env_t exec_env, uint64_t stream,
+                                           const char *key, void *value, uint32_t size)
+{
+    uint32_t property[4] = {30, 1, (uint32_t)stream, (uint32_t)strlen(key)};
+
+    if (size < sizeof(property)) {
+        return -1;
+    }
+    memcpy(value, property, sizeof(property));
+    return 0;
+}
+
+static NativeSymbol g_native_symbols[] = {
+    {"senscord_bench_get_property", senscord_bench_get_property, "(I$*~)i", NULL},
+};
+
+static long read_status_kb(const char *field)
+{
+    char line[128];
+    size_t len = strlen(field);
+    long value = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = strtol(line + len + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(fp);
+    return value;
+}
+
+/*
+ * Load and instantiate the module several times, keeping the last instance.
+ * The loader may patch the bytecode in place, so every round starts from a
+ * pristine copy of the file contents.
+ */
+static wasm_module_inst_t load_and_instantiate(const char *engine, const uint8_t *image,
+                                               uint32_t size, wasm_module_t *modulep,
+                                               uint8_t **bufp)
+{
+    char error_buf[BENCH_ERROR_BUF_SIZE];
+    uint64_t total_load_ns = 0, total_inst_ns = 0;
+    wasm_module_inst_t inst = NULL;
+    wasm_module_t module = NULL;
+    uint8_t *buf = NULL;
+
+    for (int i = 0; i < BENCH_INSTANTIATE_REPEAT; i++) {
+        if (inst != NULL) {
+            wasm_runtime_deinstantiate(inst);
+            wasm_runtime_unload(module);
+            free(buf);
+        }
+
+        buf = malloc(size);
+        if (buf == NULL) {
+            fprintf(stderr, "failed to allocate module buffer\n");
+            return NULL;
+        }
+        memcpy(buf, image, size);
+
+        uint64_t t0 = now_ns();
+        module = wasm_runtime_load(buf, size, error_buf, sizeof(error_buf));
+        uint64_t t1 = now_ns();
+        if (module == NULL) {
+            fprintf(stderr, "wasm_runtime_load failed: %s\n", error_buf);
+            free(buf);
+            return NULL;
+        }
+
+        inst = wasm_runtime_instantiate(module, BENCH_WASM_STACK_SIZE, BENCH_WASM_HEAP_SIZE,
+                                        error_buf, sizeof(error_buf));
+        uint64_t t2 = now_ns();
+        if (inst == NULL) {
+            fprintf(stderr, "wasm_runtime_instantiate failed: %s\n", error_buf);
+            wasm_runtime_unload(module);
+            free(buf);
+            return NULL;
+        }
+
+        total_load_ns += t1 - t0;
+        total_inst_ns += t2 - t1;
+    }
+
+    printf("engine=%s load_us=%.1f instantiate_us=%.1f\n", engine,
+           total_load_ns / 1000.0 / BENCH_INSTANTIATE_REPEAT,
+           total_inst_ns / 1000.0 / BENCH_INSTANTIATE_REPEAT);
+
+    *modulep = module;
+    *bufp = buf;
+    return inst;
+}
+
+static int run_kernel(const char *engine, wasm_exec_env_t exec_env, wasm_module_inst_t inst,
+                      const struct bench_kernel *kernel, uint32_t iterations)
+{
+    wasm_function_inst_t func = wasm_runtime_lookup_function(inst, kernel->name);
+    uint32_t argv[1];
+
+    if (func == NULL) {
+        fprintf(stderr, "%s is not exported by the module\n", kernel->name);
+        return -1;
+    }
+
+    iterations /= kernel->divisor;
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    /* Warm up: first touch of the data segments and lazy compilation */
+    argv[0] = 1;
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", kernel->name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+
+    argv[0] = iterations;
+    uint64_t t0 = now_ns();
+    if (!wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", kernel->name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+    uint64_t elapsed = now_ns() - t0;
+    double seconds = elapsed / 1e9;
+
+    printf("engine=%s kernel=%s iterations=%" PRIu32 " ns_per_iteration=%.0f %s_per_sec=%.0f "
+           "checksum=%" PRIu32 "\n",
+           engine, kernel->name, iterations, (double)elapsed / iterations, kernel->unit_name,
+           seconds > 0 ? (double)iterations * kernel->units / seconds : 0.0, argv[0]);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    RuntimeInitArgs init_args;
+    wasm_module_inst_t inst = NULL;
+    wasm_exec_env_t exec_env = NULL;
+    wasm_module_t module = NULL;
+    uint8_t *image = NULL, *buf = NULL;
+    uint32_t size = 0;
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <engine> <module> [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 3) {
+        iterations = (uint32_t)strtoul(argv[3], NULL, 0);
+    }
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.mem_alloc_type = Alloc_With_System_Allocator;
+    init_args.native_module_name = "env";
+    init_args.native_symbols = g_native_symbols;
+    init_args.n_native_symbols = sizeof(g_native_symbols) / sizeof(g_native_symbols[0]);
+
+    long rss_before = read_status_kb("VmRSS");
+
+    if (!wasm_runtime_full_init(&init_args)) {
+        fprintf(stderr, "wasm_runtime_full_init failed\n");
+        return EXIT_FAILURE;
+    }
+
+    image = read_module(argv[2], &size);
+    if (image == NULL) {
+        goto out_destroy_runtime;
+    }
+
+    inst = load_and_instantiate(argv[1], image, size, &module, &buf);
+    if (inst == NULL) {
+        goto out_free_image;
+    }
+
+    printf("engine=%s module_bytes=%" PRIu32 " rss_after_instantiate_kb=%ld\n", argv[1], size,
+           read_status_kb("VmRSS"));
+
+    exec_env = wasm_runtime_create_exec_env(inst, BENCH_WASM_STACK_SIZE);
+    if (exec_env == NULL) {
+        fprintf(stderr, "wasm_runtime_create_exec_env failed\n");
+        goto out_deinstantiate;
+    }
+
+    ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < sizeof(g_kernels) / sizeof(g_kernels[0]); i++) {
+        if (run_kernel(argv[1], exec_env, inst, &g_kernels[i], iterations) != 0) {
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    printf("engine=%s rss_before_kb=%ld rss_kb=%ld rss_peak_kb=%ld\n", argv[1], rss_before,
+           read_status_kb("VmRSS"), read_status_kb("VmHWM"));
+
+    wasm_runtime_destroy_exec_env(exec_env);
+out_deinstantiate:
+    wasm_runtime_deinstantiate(inst);
+    wasm_runtime_unload(module);
+    free(buf);
+out_free_image:
+    free(image);
+out_destroy_runtime:
+    wasm_runtime_destroy();
+    return ret;
+}
@@ -0,0 +1,118 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Stand-in for a wasi-nn backend.
+ *
+ * Keeps the input and output tensors in buffers of its own, as the TFLite
+ * interpreter does, and its inference only copies the first input byte to
+ * the first output byte, so that the benchmark measures the cost of getting
+ * tensors in and out of the backend.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wasi_nn_backend.h"
+
+/* 1001 class scores */
+#define FAKE_OUTPUT_SIZE (1001 * 4)
+
+struct fake_ctx {
+    uint8_t *input;
+    uint32_t input_size;
+    uint8_t output[FAKE_OUTPUT_SIZE];
+};
+
+__attribute__((visibility("default"))) wasi_nn_error init_backend(void **ctx)
+{
+    *ctx = calloc(1, sizeof(struct fake_ctx));
+    return *ctx != NULL ? success : runtime_error;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error deinit_backend(void *ctx)
+{
+    struct fake_ctx *fake = ctx;
+
+    if (fake != NULL) {
+        free(fake->input);
+        free(fake);
+    }
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error load(void *ctx, graph_builder_array *builder,
+                                                          graph_encoding encoding,
+                                                          execution_target target, graph *g)
+{
+    *g = 0;
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error load_by_name(void *ctx, const char *filename,
+                                                                  uint32_t filename_len, graph *g)
+{
+    *g = 0;
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error
+init_execution_context(void *ctx, graph g, graph_execution_context *exec_ctx)
+{
+    *exec_ctx = 0;
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error set_input(void *ctx,
+                                                               graph_execution_context exec_ctx,
+                                                               uint32_t index, tensor *input_tensor)
+{
+    struct fake_ctx *fake = ctx;
+
+    /* Allocated once, as the interpreter allocates its tensors */
+    if (fake->input_size != input_tensor->data.size) {
+        uint8_t *input = realloc(fake->input, input_tensor->data.size);
+
+        if (input == NULL) {
+            return runtime_error;
+        }
+        fake->input = input;
+        fake->input_size = input_tensor->data.size;
+    }
+
+    memcpy(fake->input, input_tensor->data.buf, input_tensor->data.size);
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error compute(void *ctx,
+                                                             graph_execution_context exec_ctx)
+{
+    struct fake_ctx *fake = ctx;
+
+    if (fake->input_size == 0) {
+        return runtime_error;
+    }
+    fake->output[0] = fake->input[0];
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error get_output(void *ctx,
+                                                                graph_execution_context exec_ctx,
+                                                                uint32_t index,
+                                                                tensor_data *output_tensor,
+                                                                uint32_t *output_tensor_size)
+{
+    struct fake_ctx *fake = ctx;
+
+    if (*output_tensor_size < FAKE_OUTPUT_SIZE) {
+        return too_large;
+    }
+
+    memcpy(output_tensor->buf, fake->output, FAKE_OUTPUT_SIZE);
+    *output_tensor_size = FAKE_OUTPUT_SIZE;
+    return success;
+}
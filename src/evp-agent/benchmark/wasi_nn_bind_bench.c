@@ -0,0 +1,167 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * wasi-nn bound tensor benchmark.
+ *
+ * Runs inferences of a wasm module through the wasi-nn library of the product
+ * WAMR build and the caching backend, on top of a fake backend whose
+ * inference is a no-op, so the time per inference is the overhead of getting
+ * tensors in and out: once with set_input(), compute() and get_output(), once
+ * with the bound tensors of the agent (wasi_nn_bind.c).
+ *
+ * WAMR must find the caching backend in LD_LIBRARY_PATH, and the caching
+ * backend the fake one in EVP_WASI_NN_BACKEND_DIR.
+ *
+ * usage: wasi_nn_bind_bench <nn_kernels.wasm> [iterations]
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "bench_util.h"
+#include "wasi_nn_bind.h"
+
+#define BENCH_WASM_STACK_SIZE 32678
+#define BENCH_WASM_HEAP_SIZE (1024 * 1024)
+#define BENCH_ERROR_BUF_SIZE 128
+#define BENCH_DEFAULT_ITERATIONS 2000
+
+static int call(wasm_exec_env_t exec_env, wasm_module_inst_t inst, const char *name,
+                uint32_t argc, uint32_t *argv)
+{
+    wasm_function_inst_t func = wasm_runtime_lookup_function(inst, name);
+
+    if (func == NULL) {
+        fprintf(stderr, "%s is not exported by the module\n", name);
+        return -1;
+    }
+    if (!wasm_runtime_call_wasm(exec_env, func, argc, argv)) {
+        fprintf(stderr, "%s trapped: %s\n", name, wasm_runtime_get_exception(inst));
+        return -1;
+    }
+    if ((int32_t)argv[0] < 0) {
+        fprintf(stderr, "%s failed: %" PRId32 "\n", name, (int32_t)argv[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int run_kernel(wasm_exec_env_t exec_env, wasm_module_inst_t inst, const char *name,
+                      uint32_t exec_ctx, uint32_t iterations, double *us_per_inference)
+{
+    uint32_t argv[2] = {exec_ctx, 16};
+
+    /* Warm up: first touch of the tensors, and of the backend buffers */
+    if (call(exec_env, inst, name, 2, argv) != 0) {
+        return -1;
+    }
+
+    argv[0] = exec_ctx;
+    argv[1] = iterations;
+    uint64_t t0 = now_ns();
+    if (call(exec_env, inst, name, 2, argv) != 0) {
+        return -1;
+    }
+    uint64_t elapsed = now_ns() - t0;
+
+    *us_per_inference = elapsed / 1000.0 / iterations;
+    printf("kernel=%s inferences=%" PRIu32 " us_per_inference=%.2f inferences_per_sec=%.0f\n",
+           name, iterations, *us_per_inference, elapsed > 0 ? iterations * 1e9 / elapsed : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char error_buf[BENCH_ERROR_BUF_SIZE];
+    uint32_t iterations = BENCH_DEFAULT_ITERATIONS;
+    double standard_us, bound_us;
+    RuntimeInitArgs init_args;
+    wasm_module_inst_t inst = NULL;
+    wasm_exec_env_t exec_env = NULL;
+    wasm_module_t module = NULL;
+    NativeSymbol *natives;
+    uint32_t n_natives;
+    uint32_t setup_argv[1] = {0};
+    uint8_t *buf = NULL;
+    uint32_t size = 0;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <module> [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc > 2) {
+        iterations = (uint32_t)strtoul(argv[2], NULL, 0);
+    }
+
+    natives = evp_agent_wasi_nn_bind_natives(&n_natives);
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.mem_alloc_type = Alloc_With_System_Allocator;
+    init_args.native_module_name = EVP_WASI_NN_BIND_MODULE_NAME;
+    init_args.native_symbols = natives;
+    init_args.n_native_symbols = n_natives;
+
+    if (!wasm_runtime_full_init(&init_args)) {
+        fprintf(stderr, "wasm_runtime_full_init failed\n");
+        return EXIT_FAILURE;
+    }
+
+    buf = read_module(argv[1], &size);
+    if (buf == NULL) {
+        goto out_destroy_runtime;
+    }
+
+    module = wasm_runtime_load(buf, size, error_buf, sizeof(error_buf));
+    if (module == NULL) {
+        fprintf(stderr, "wasm_runtime_load failed: %s\n", error_buf);
+        goto out_free_buf;
+    }
+
+    inst = wasm_runtime_instantiate(module, BENCH_WASM_STACK_SIZE, BENCH_WASM_HEAP_SIZE,
+                                    error_buf, sizeof(error_buf));
+    if (inst == NULL) {
+        fprintf(stderr, "wasm_runtime_instantiate failed: %s\n", error_buf);
+        goto out_unload;
+    }
+    /* As the instantiation wrapper of the agent does */
+    evp_agent_wasi_nn_bind_instance_created(inst);
+
+    exec_env = wasm_runtime_create_exec_env(inst, BENCH_WASM_STACK_SIZE);
+    if (exec_env == NULL) {
+        fprintf(stderr, "wasm_runtime_create_exec_env failed\n");
+        goto out_deinstantiate;
+    }
+
+    if (call(exec_env, inst, "bench_nn_setup", 0, setup_argv) == 0 &&
+        run_kernel(exec_env, inst, "bench_nn_standard", setup_argv[0], iterations,
+                   &standard_us) == 0 &&
+        run_kernel(exec_env, inst, "bench_nn_bound", setup_argv[0], iterations, &bound_us) == 0) {
+        printf("bound tensors save %.2f us per inference (%.1fx)\n", standard_us - bound_us,
+               bound_us > 0 ? standard_us / bound_us : 0.0);
+        ret = EXIT_SUCCESS;
+    }
+
+    wasm_runtime_destroy_exec_env(exec_env);
+out_deinstantiate:
+    evp_agent_wasi_nn_bind_instance_destroyed(inst);
+    wasm_runtime_deinstantiate(inst);
+out_unload:
+    wasm_runtime_unload(module);
+out_free_buf:
+    free(buf);
+out_destroy_runtime:
+    wasm_runtime_destroy();
+    return ret;
+}
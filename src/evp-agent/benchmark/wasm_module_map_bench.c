@@ -0,0 +1,222 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Memory of loaded wasm modules.
+ *
+ * Loads a module several times on the product WAMR build, as the agent loads
+ * a module for every deployment using it: each load reads the file into a
+ * heap buffer of its own first, as the agent does. In heap mode, WAMR loads
+ * from those buffers. In map mode, the module is put in a module cache
+ * (module_cache.h) and WAMR loads from its mappings (wasm_module_map.h), with
+ * the heap buffers kept allocated but paged out. The RSS of the process is
+ * then reported, split into anonymous and file-backed pages, along with the
+ * swap the paged out buffers went to.
+ *
+ * usage: wasm_module_map_bench <module> <heap|map> [copies]
+ */
+
+#define _GNU_SOURCE /* for asprintf */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mbedtls/sha256.h>
+#include <wasm_export.h>
+
+#include "bench_util.h"
+#include "module_cache.h"
+#include "wasm_module_map.h"
+#include "wasm_runtime_wrap.h"
+
+#define BENCH_ERROR_BUF_SIZE 128
+#define BENCH_DEFAULT_COPIES 8
+
+struct memory_sample {
+    unsigned long rss_kb;
+    unsigned long anon_kb;
+    unsigned long swap_kb;
+};
+
+struct module_copy {
+    uint8_t *buf;
+    struct evp_agent_wasm_module_map map;
+    wasm_module_t module;
+};
+
+static void memory_sample(struct memory_sample *s)
+{
+    char line[256];
+    FILE *fp;
+
+    memset(s, 0, sizeof(*s));
+    fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        sscanf(line, "Rss: %lu", &s->rss_kb);
+        sscanf(line, "Anonymous: %lu", &s->anon_kb);
+        sscanf(line, "Swap: %lu", &s->swap_kb);
+    }
+    fclose(fp);
+}
+
+static void module_digest(const uint8_t *buf, uint32_t size, char *digest)
+{
+    unsigned char hash[32];
+
+    mbedtls_sha256(buf, size, hash, 0);
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        snprintf(&digest[i * 2], 3, "%02x", hash[i]);
+    }
+}
+
+/* Puts a copy of the module in a cache under dir, as a deployment fetching it does */
+static int cache_module(const char *dir, const char *digest, const uint8_t *buf, uint32_t size)
+{
+    char *cache_dir = NULL, *path = NULL, *cached = NULL;
+    FILE *fp;
+    int ret = -1;
+
+    if (asprintf(&cache_dir, "%s/cache", dir) < 0 || asprintf(&path, "%s/fetched", dir) < 0) {
+        goto end;
+    }
+    setenv("EVP_MODULE_CACHE_DIR", cache_dir, 1);
+    if (evp_agent_module_cache_init() != 0) {
+        fprintf(stderr, "failed to set up the module cache in %s\n", cache_dir);
+        goto end;
+    }
+
+    fp = fopen(path, "wb");
+    if (fp == NULL || fwrite(buf, 1, size, fp) != size || fclose(fp) != 0) {
+        fprintf(stderr, "failed to write %s\n", path);
+        goto end;
+    }
+    evp_agent_module_cache_ref(digest);
+    if (evp_agent_module_cache_insert(digest, path, size, &cached) != 0) {
+        fprintf(stderr, "failed to cache the module\n");
+        goto end;
+    }
+    ret = evp_agent_wasm_module_map_init();
+
+end:
+    free(cached);
+    free(path);
+    free(cache_dir);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    char error_buf[BENCH_ERROR_BUF_SIZE];
+    char digest[EVP_WASM_DIGEST_LEN];
+    char dir[] = "/tmp/wasm_module_map_bench.XXXXXX", cmd[sizeof(dir) + 16];
+    unsigned int copies = BENCH_DEFAULT_COPIES;
+    struct memory_sample before, after;
+    struct module_copy *c = NULL;
+    RuntimeInitArgs init_args;
+    uint8_t *buf;
+    uint32_t size = 0;
+    bool map;
+    int ret = EXIT_FAILURE;
+
+    if (argc < 3 || (strcmp(argv[2], "heap") != 0 && strcmp(argv[2], "map") != 0)) {
+        fprintf(stderr, "usage: %s <module> <heap|map> [copies]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    map = strcmp(argv[2], "map") == 0;
+    if (argc > 3) {
+        copies = (unsigned int)strtoul(argv[3], NULL, 0);
+    }
+
+    buf = read_module(argv[1], &size);
+    if (buf == NULL) {
+        return EXIT_FAILURE;
+    }
+    module_digest(buf, size, digest);
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "failed to create %s: %s\n", dir, strerror(errno));
+        goto out_free_buf;
+    }
+    if (map && cache_module(dir, digest, buf, size) != 0) {
+        goto out_rmdir;
+    }
+
+    memset(&init_args, 0, sizeof(init_args));
+    init_args.mem_alloc_type = Alloc_With_System_Allocator;
+    if (!wasm_runtime_full_init(&init_args)) {
+        fprintf(stderr, "wasm_runtime_full_init failed\n");
+        goto out_cache_deinit;
+    }
+
+    c = calloc(copies, sizeof(*c));
+    if (c == NULL) {
+        fprintf(stderr, "failed to allocate %u copies\n", copies);
+        goto out_destroy_runtime;
+    }
+
+    memory_sample(&before);
+    for (unsigned int i = 0; i < copies; i++) {
+        uint32_t copy_size = 0;
+        uint8_t *image;
+
+        c[i].buf = read_module(argv[1], &copy_size);
+        if (c[i].buf == NULL) {
+            goto out_unload;
+        }
+        image = c[i].buf;
+        /* As the load wrapper of the agent does */
+        if (map && evp_agent_wasm_module_map(digest, c[i].buf, size, &c[i].map) == 0) {
+            image = c[i].map.addr;
+        }
+
+        c[i].module = wasm_runtime_load(image, size, error_buf, sizeof(error_buf));
+        if (c[i].module == NULL) {
+            fprintf(stderr, "wasm_runtime_load failed: %s\n", error_buf);
+            goto out_unload;
+        }
+    }
+    memory_sample(&after);
+
+    printf("mode=%s copies=%u module_kb=%" PRIu32 " rss_kb=%ld anon_kb=%ld file_kb=%ld "
+           "swap_kb=%ld\n",
+           argv[2], copies, size / 1024, (long)(after.rss_kb - before.rss_kb),
+           (long)(after.anon_kb - before.anon_kb),
+           (long)(after.rss_kb - after.anon_kb) - (long)(before.rss_kb - before.anon_kb),
+           (long)(after.swap_kb - before.swap_kb));
+    ret = EXIT_SUCCESS;
+
+out_unload:
+    for (unsigned int i = 0; i < copies; i++) {
+        if (c[i].module != NULL) {
+            wasm_runtime_unload(c[i].module);
+        }
+        evp_agent_wasm_module_unmap(&c[i].map);
+        free(c[i].buf);
+    }
+    free(c);
+out_destroy_runtime:
+    wasm_runtime_destroy();
+out_cache_deinit:
+    if (map) {
+        evp_agent_module_cache_deinit();
+    }
+out_rmdir:
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "failed to remove %s\n", dir);
+    }
+out_free_buf:
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,125 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#if !defined(__EVP_NATIVE_RAW_H__)
+#define __EVP_NATIVE_RAW_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wasm_export.h>
+
+/** @file
+ *
+ * Raw calling convention for host natives.
+ *
+ * Natives registered with EVP_wasm_runtime_register_natives_raw() are
+ * called as
+ *
+ *   void native(wasm_exec_env_t exec_env, uint64_t *args);
+ *
+ * with one 64-bit slot per wasm argument, and return their result in
+ * args[0]. This skips the per-call argument marshalling WAMR does for the
+ * other natives. The signature of a raw native is still checked against
+ * the import when the module is instantiated, but it should have no '*',
+ * '~' or '$' parameter: pointers come as app offsets, which the native
+ * checks against a view of the linear memory taken once per call.
+ *
+ * @code
+ * static void sum(wasm_exec_env_t exec_env, uint64_t *args)
+ * {
+ *     uint32_t len = EVP_NATIVE_RAW_ARG(uint32_t, args, 1);
+ *     struct evp_native_raw_mem mem;
+ *     const uint8_t *buf;
+ *
+ *     if (!evp_native_raw_mem(exec_env, &mem) ||
+ *         (buf = evp_native_raw_ptr(&mem, EVP_NATIVE_RAW_ARG(uint32_t, args, 0), len)) == NULL) {
+ *         EVP_NATIVE_RAW_RETURN(int32_t, args, -EFAULT);
+ *         return;
+ *     }
+ *     ...
+ * }
+ *
+ * static NativeSymbol natives[] = {
+ *     {"sum", sum, "(ii)i", NULL},
+ * };
+ * @endcode
+ */
+
+/** Argument n of a raw native, as a value of type */
+#define EVP_NATIVE_RAW_ARG(type, args, n) (*(type *)&(args)[n])
+
+/** Sets the result of a raw native */
+#define EVP_NATIVE_RAW_RETURN(type, args, value) (*(type *)&(args)[0] = (value))
+
+/** View of the linear memory of the calling instance */
+struct evp_native_raw_mem {
+    uint8_t *base;
+    uint64_t size;
+};
+
+/** @brief Takes a view of the linear memory of the calling instance
+ *
+ * The view holds while the linear memory stays in place. Shared memories
+ * and, on 64-bit targets with hardware bound checks, all memories are
+ * reserved at their maximum size and grow in place: other threads growing
+ * them meanwhile leave the view inside them. Otherwise, and on 32-bit
+ * targets in particular, memory.grow may move the linear memory, so a native
+ * that calls anything able to grow it (a call into wasm,
+ * wasm_runtime_module_malloc()) takes the view again afterwards, or checks
+ * the addresses it keeps with evp_native_raw_revalidate().
+ *
+ * @returns false if the instance has no linear memory.
+ */
+static inline bool evp_native_raw_mem(wasm_exec_env_t exec_env, struct evp_native_raw_mem *mem)
+{
+    wasm_memory_inst_t memory =
+        wasm_runtime_get_default_memory(wasm_runtime_get_module_inst(exec_env));
+
+    if (memory == NULL) {
+        return false;
+    }
+    mem->base = (uint8_t *)wasm_memory_get_base_address(memory);
+    mem->size = wasm_memory_get_cur_page_count(memory) * wasm_memory_get_bytes_per_page(memory);
+    return true;
+}
+
+/** @brief Native address of an app buffer
+ *
+ * @returns the address of [offset, offset + size) in the linear memory, or
+ * NULL if the buffer is not inside it.
+ */
+static inline void *evp_native_raw_ptr(const struct evp_native_raw_mem *mem, uint32_t offset,
+                                       uint64_t size)
+{
+    if (offset > mem->size || size > mem->size - offset) {
+        return NULL;
+    }
+    return mem->base + offset;
+}
+
+/** @brief Checks that a native address is still inside the linear memory
+ *
+ * For addresses resolved before a call that may have grown, and moved, the
+ * linear memory. As with WAMR's own checks, a failure sets an out of bounds
+ * exception on the instance.
+ *
+ * @returns false if [ptr, ptr + size) is not inside the linear memory.
+ */
+static inline bool evp_native_raw_revalidate(wasm_exec_env_t exec_env, void *ptr, uint64_t size)
+{
+    return wasm_runtime_validate_native_addr(wasm_runtime_get_module_inst(exec_env), ptr, size);
+}
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
+
+#endif /* !defined(__EVP_NATIVE_RAW_H__) */
@@ -0,0 +1,73 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#if !defined(__SENSCORD_ZERO_COPY_H__)
+#define __SENSCORD_ZERO_COPY_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/** @file
+ *
+ * Zero-copy access to senscord frames from wasm modules.
+ *
+ * These functions are imported from the "env" module. They are an
+ * alternative to senscord_stream_get_frame() and senscord_channel_get_raw_data()
+ * of the senscord WAMR bridge, which copy the channel data into the linear
+ * memory of the module. Here the frame buffer itself is mapped, read-only,
+ * into the linear memory whenever the senscord allocator allows it, and
+ * copied otherwise.
+ *
+ * A frame stays valid until it is released with senscord_zc_release_frame().
+ * Frames still held when the module instance is destroyed are released by
+ * the agent. Writing to the frame data traps.
+ */
+
+/** The frame data is mapped from the senscord buffer rather than copied */
+#define SENSCORD_ZC_FLAG_MAPPED (1u << 0)
+
+struct senscord_zc_frame_info {
+    /** Handle to pass to senscord_zc_release_frame() */
+    uint32_t handle;
+    /** Address of the channel raw data in the linear memory */
+    uint32_t data;
+    /** Size in bytes of the channel raw data */
+    uint32_t size;
+    /** SENSCORD_ZC_FLAG_* */
+    uint32_t flags;
+    /** Timestamp of the raw data, in nanoseconds */
+    uint64_t timestamp;
+    /** Sequence number of the frame */
+    uint64_t sequence;
+};
+
+/** @brief Get the next frame of a stream and expose one of its channels.
+ *
+ * @param stream      senscord stream handle, as returned by senscord_core_open_stream().
+ * @param channel_id  Channel whose raw data is exposed.
+ * @param timeout_ms  Time to wait for a frame, -1 to wait forever.
+ * @param info        Filled with the frame handle and data location.
+ * @param info_size   sizeof(struct senscord_zc_frame_info).
+ *
+ * @return 0 on success, or a negative errno value.
+ */
+int32_t senscord_zc_get_frame(uint64_t stream, uint32_t channel_id, int32_t timeout_ms,
+                              struct senscord_zc_frame_info *info, uint32_t info_size);
+
+/** @brief Release a frame obtained with senscord_zc_get_frame().
+ *
+ * @return 0 on success, or a negative errno value.
+ */
+int32_t senscord_zc_release_frame(uint32_t handle);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
+
+#endif /* __SENSCORD_ZERO_COPY_H__ */
@@ -0,0 +1,71 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#if !defined(__WASI_NN_BOUND_TENSORS_H__)
+#define __WASI_NN_BOUND_TENSORS_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/** @file
+ *
+ * Bound tensors for wasi-nn execution contexts.
+ *
+ * These functions are imported from the "env" module and extend the wasi-nn
+ * execution contexts created with init_execution_context(). Instead of a
+ * set_input() per input, compute() and a get_output() per output on every
+ * inference, the inputs and outputs are bound once to regions of the linear
+ * memory, and each inference is a single wasi_nn_compute_bound() call. It
+ * does no allocation and copies every tensor once, between its region and
+ * the backend.
+ *
+ * The regions must stay valid for as long as they are bound. Binding an
+ * index again replaces the previous binding.
+ */
+
+/** Maximum number of bound inputs, and of bound outputs, per execution context */
+#define WASI_NN_BOUND_MAX_TENSORS 8
+/** Maximum rank of a bound input */
+#define WASI_NN_BOUND_MAX_DIMS 8
+
+/** @brief Bind an input of an execution context to a region of linear memory.
+ *
+ * @param exec_ctx   Execution context from init_execution_context().
+ * @param index      Input index.
+ * @param type       wasi-nn tensor type of the input.
+ * @param dims       Dimensions of the input.
+ * @param dims_size  Size in bytes of dims.
+ * @param data       Region holding the input data at compute time.
+ * @param size       Size in bytes of the region.
+ *
+ * @return 0 on success, or a negative errno value: -ENOENT if exec_ctx is not
+ *         an execution context of the module.
+ */
+int32_t wasi_nn_bind_input(uint32_t exec_ctx, uint32_t index, uint32_t type,
+                           const uint32_t *dims, uint32_t dims_size, const void *data,
+                           uint32_t size);
+
+/** @brief Bind an output of an execution context to a region of linear memory.
+ *
+ * @return 0 on success, or a negative errno value.
+ */
+int32_t wasi_nn_bind_output(uint32_t exec_ctx, uint32_t index, void *data, uint32_t size);
+
+/** @brief Run an inference on the bound tensors.
+ *
+ * @return 0 on success, a negative errno value, or a positive wasi-nn error
+ *         returned by the backend.
+ */
+int32_t wasi_nn_compute_bound(uint32_t exec_ctx);
+
+#if defined(__cplusplus)
+} /* extern "C" */
+#endif
+
+#endif /* __WASI_NN_BOUND_TENSORS_H__ */
@@ -70,6 +70,14 @@ int EVP_undeployModules(void);
 bool EVP_wasm_runtime_register_natives(const char *module_name, NativeSymbol *native_symbols,
                                        uint32_t n_native_symbols);
 
+/** @brief wrapper for wasm_runtime_register_natives_raw
+ *
+ * For hot natives: they are called without argument marshalling, see
+ * evp_agent/native_raw.h.
+ */
+bool EVP_wasm_runtime_register_natives_raw(const char *module_name, NativeSymbol *native_symbols,
+                                           uint32_t n_native_symbols);
+
 #if defined(__cplusplus)
 } /* extern "C" */
 #endif
@@ -0,0 +1,976 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for O_DIRECT */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mbedtls/sha256.h>
+#include <webclient/webclient.h>
+
+#include "blob_download.h"
+#include "http_pool.h"
+#include "log.h"
+#include "metrics.h"
+
+#define BLOB_DOWNLOAD_DEFAULT_DIR "/var/lib/edge-device-core/blob-partial"
+#define BLOB_DOWNLOAD_RETRIES_DEFAULT 5
+#define BLOB_RESUME_MIN_BYTES_DEFAULT (1024 * 1024)
+#define BLOB_DOWNLOAD_PROGRESS_SEC_DEFAULT 10
+#define BLOB_PARTIAL_MAX_AGE_SEC_DEFAULT (7 * 24 * 3600)
+#define BLOB_PARTIAL_MAX_BYTES_DEFAULT (512 * 1024 * 1024)
+#define BLOB_DOWNLOAD_RETRY_DELAY_MS 500
+#define BLOB_DOWNLOAD_RETRY_DELAY_MAX_MS 8000
+/* Of the O_DIRECT writes: offsets, sizes and buffers */
+#define BLOB_DOWNLOAD_ALIGN 4096
+#define BLOB_DOWNLOAD_CHUNK (256 * 1024)
+#define BLOB_DOWNLOAD_HEADERS_MAX 32
+#define BLOB_DOWNLOAD_VALIDATOR_SIZE 128
+#define BLOB_DOWNLOAD_NAME_SIZE 128
+/* Of the metadata file: the validator, the total, the offset and the digest state */
+#define BLOB_DOWNLOAD_META_SIZE \
+    (BLOB_DOWNLOAD_VALIDATOR_SIZE + 64 + 2 * sizeof(mbedtls_sha256_context))
+
+static struct {
+    bool enabled;
+    char *dir;
+    unsigned int retries;
+    size_t resume_min_bytes;
+    uint64_t progress_us;
+    uint64_t downloads;
+    uint64_t failed;
+    uint64_t resumes;
+    uint64_t resumed_bytes;
+    uint64_t bytes;
+    uint64_t time_sum_us;
+    pthread_mutex_t lock;
+} g_blob_download = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+struct download {
+    struct webclient_context *ctx;
+    struct webclient_context c;
+    const char *headers[BLOB_DOWNLOAD_HEADERS_MAX];
+    unsigned int nheaders;
+    char range[64];
+    char if_range[BLOB_DOWNLOAD_VALIDATOR_SIZE + 16];
+    /* Scheme, host and path, for the logs */
+    char name[BLOB_DOWNLOAD_NAME_SIZE];
+    /* Of the first response: the ETag, or else the Last-Modified date */
+    char validator[BLOB_DOWNLOAD_VALIDATOR_SIZE];
+    char etag[BLOB_DOWNLOAD_VALIDATOR_SIZE];
+    char last_modified[BLOB_DOWNLOAD_VALIDATOR_SIZE];
+    size_t total;
+    size_t response_length;
+    size_t response_total;
+    /* Bytes handed to the sink of the agent */
+    size_t delivered;
+    /* Of a partial file from an earlier download, not replayed yet */
+    size_t replay;
+    /* Of a full response to a resume, already delivered */
+    size_t skip;
+    bool started;
+    bool passthrough;
+    bool headers_forwarded;
+    bool aborted;
+    /* The callbacks of the agent or the partial file failed, not the transfer */
+    bool local_error;
+    /* The partial file, written through an aligned buffer */
+    bool persist;
+    char *part_path;
+    char *meta_path;
+    /* Of the metadata file, locked while the download runs */
+    int meta_fd;
+    int fd;
+    uint8_t *buf;
+    size_t buf_len;
+    off_t buf_off;
+    uint64_t start_us;
+    uint64_t progress_us;
+    /* Of the bytes the agent took, hashed as they arrive */
+    mbedtls_sha256_context sha;
+    /* The digest state over the partial file was kept with it */
+    bool replay_hashed;
+};
+
+struct partial {
+    char key[NAME_MAX + 1];
+    off_t size;
+    time_t mtime;
+};
+
+bool evp_agent_blob_download_is(const struct webclient_context *ctx)
+{
+    return g_blob_download.enabled && ctx->sink_callback != NULL &&
+           (ctx->method == NULL || strcmp(ctx->method, "GET") == 0);
+}
+
+static void copy_value(char *dst, size_t size, const char *value)
+{
+    size_t len;
+
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    len = strcspn(value, "\r\n");
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
+        len--;
+    }
+    if (len >= size) {
+        len = 0;
+    }
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+static bool header_is(const char *line, const char *name, const char **value)
+{
+    size_t len = strlen(name);
+
+    if (strncasecmp(line, name, len) != 0 || line[len] != ':') {
+        return false;
+    }
+    *value = line + len + 1;
+    return true;
+}
+
+/*
+ * An error response the agent must not see: the blob changed under a partial
+ * file, or the transfer broke after the agent got some of it.
+ */
+static bool download_discarded(const struct download *d)
+{
+    unsigned int status = d->c.http_status;
+
+    if (status == 200 || status == 206) {
+        return false;
+    }
+    return d->delivered > 0 || (status == 416 && d->replay > 0);
+}
+
+/* An error of the agent itself, such as a full disk or a cancellation, is not retried */
+static int local_result(struct download *d, int ret)
+{
+    if (ret) {
+        d->local_error = true;
+    }
+    return ret;
+}
+
+static int download_header(const char *line, bool truncated, void *arg)
+{
+    struct download *d = arg;
+    struct webclient_context *ctx = d->ctx;
+    const char *value;
+    char length[32];
+    bool forward = !d->headers_forwarded && !download_discarded(d);
+
+    if (header_is(line, "ETag", &value)) {
+        copy_value(d->etag, sizeof(d->etag), value);
+    }
+    else if (header_is(line, "Last-Modified", &value)) {
+        copy_value(d->last_modified, sizeof(d->last_modified), value);
+    }
+    else if (header_is(line, "Content-Length", &value)) {
+        d->response_length = strtoull(value, NULL, 10);
+        /* The agent sees the whole blob coming, not the range */
+        if (forward && d->c.http_status == 206) {
+            snprintf(length, sizeof(length), "Content-Length: %zu", d->total);
+            if (d->total != 0 && ctx->header_callback != NULL) {
+                return local_result(d, ctx->header_callback(length, false,
+                                                            ctx->header_callback_arg));
+            }
+            return 0;
+        }
+    }
+    else if (header_is(line, "Content-Range", &value)) {
+        value = strchr(value, '/');
+        if (value != NULL && value[1] != '*') {
+            d->response_total = strtoull(value + 1, NULL, 10);
+            if (d->total == 0) {
+                d->total = d->response_total;
+            }
+        }
+        return 0;
+    }
+
+    if (forward && ctx->header_callback != NULL) {
+        return local_result(d, ctx->header_callback(line, truncated, ctx->header_callback_arg));
+    }
+    return 0;
+}
+
+static int forward(struct download *d, char **buffer, int offset, int datend, int *buflen)
+{
+    struct webclient_context *ctx = d->ctx;
+
+    return local_result(d,
+                        ctx->sink_callback(buffer, offset, datend, buflen, ctx->sink_callback_arg));
+}
+
+/*
+ * Records what the partial file holds: the validator and the size of the
+ * blob, then the bytes written so far and the digest state over them, so
+ * that a resume hashes on from there. The state is the context of the
+ * software SHA-256 of mbed TLS, plain data. It is written before the file is
+ * truncated, so that a crash in between leaves the new lines first.
+ */
+static void persist_meta(struct download *d, off_t offset)
+{
+    const unsigned char *state = (const unsigned char *)&d->sha;
+    char meta[BLOB_DOWNLOAD_META_SIZE];
+    int len;
+
+    len = snprintf(meta, sizeof(meta), "%s\n%zu\n%jd\n", d->validator, d->total,
+                   (intmax_t)offset);
+    for (size_t i = 0; i < sizeof(d->sha); i++) {
+        len += snprintf(&meta[len], 3, "%02x", state[i]);
+    }
+    meta[len++] = '\n';
+    if (pwrite(d->meta_fd, meta, len, 0) != len || ftruncate(d->meta_fd, len) != 0) {
+        EVP_AGENT_WARN("failed to write %s: %s", d->meta_path, strerror(errno));
+    }
+}
+
+static void persist_close(struct download *d, bool keep)
+{
+    int fd;
+
+    if (!d->persist) {
+        return;
+    }
+    d->persist = false;
+
+    /* The tail, which O_DIRECT cannot write */
+    if (keep && d->buf_len > 0) {
+        fd = open(d->part_path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || pwrite(fd, d->buf, d->buf_len, d->buf_off) != (ssize_t)d->buf_len ||
+            fdatasync(fd) != 0) {
+            EVP_AGENT_WARN("failed to write the tail of %s: %s", d->part_path, strerror(errno));
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (d->fd >= 0) {
+        if (keep) {
+            fdatasync(d->fd);
+        }
+        close(d->fd);
+        d->fd = -1;
+    }
+    if (keep) {
+        persist_meta(d, d->buf_off + d->buf_len);
+    }
+    else {
+        /* The metadata file stays, as the lock of the download */
+        unlink(d->part_path);
+        if (ftruncate(d->meta_fd, 0) != 0) {
+            EVP_AGENT_WARN("failed to truncate %s: %s", d->meta_path, strerror(errno));
+        }
+    }
+}
+
+static int persist_flush(struct download *d)
+{
+    if (pwrite(d->fd, d->buf, BLOB_DOWNLOAD_CHUNK, d->buf_off) != BLOB_DOWNLOAD_CHUNK) {
+        EVP_AGENT_WARN("failed to write %s: %s", d->part_path, strerror(errno));
+        persist_close(d, false);
+        return -1;
+    }
+    d->buf_off += BLOB_DOWNLOAD_CHUNK;
+    d->buf_len = 0;
+    persist_meta(d, d->buf_off);
+    return 0;
+}
+
+/*
+ * Hashes what the agent took and appends it to the partial file, a chunk at
+ * a time, so that the digest state written with a chunk covers the file.
+ */
+static void download_append(struct download *d, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len > 0) {
+        size_t n = len;
+
+        if (d->persist && n > BLOB_DOWNLOAD_CHUNK - d->buf_len) {
+            n = BLOB_DOWNLOAD_CHUNK - d->buf_len;
+        }
+        mbedtls_sha256_update(&d->sha, p, n);
+        if (d->persist) {
+            memcpy(d->buf + d->buf_len, p, n);
+            d->buf_len += n;
+            if (d->buf_len == BLOB_DOWNLOAD_CHUNK) {
+                persist_flush(d);
+            }
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+/* Opens the partial file, from offset, which must be aligned */
+static void persist_open(struct download *d, off_t offset, bool truncate)
+{
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+
+    if (d->meta_fd < 0) {
+        return;
+    }
+
+    d->fd = open(d->part_path, flags | O_DIRECT, 0600);
+    if (d->fd < 0 && errno == EINVAL) {
+        /* No O_DIRECT on this file system */
+        d->fd = open(d->part_path, flags, 0600);
+    }
+    if (d->fd < 0) {
+        EVP_AGENT_WARN("failed to open %s: %s", d->part_path, strerror(errno));
+        return;
+    }
+
+    if (truncate) {
+        persist_meta(d, 0);
+    }
+
+    d->buf_off = offset;
+    d->buf_len = 0;
+    d->persist = true;
+}
+
+/*
+ * Locks the metadata file, so that two downloads of the same URL do not
+ * write the same partial file. A lock on a file unlinked meanwhile does not
+ * count.
+ */
+static bool persist_lock(struct download *d)
+{
+    struct stat st, path_st;
+
+    d->meta_fd = open(d->meta_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (d->meta_fd < 0) {
+        EVP_AGENT_WARN("failed to open %s: %s", d->meta_path, strerror(errno));
+        return false;
+    }
+    if (flock(d->meta_fd, LOCK_EX | LOCK_NB) != 0 || fstat(d->meta_fd, &st) != 0 ||
+        stat(d->meta_path, &path_st) != 0 || st.st_ino != path_st.st_ino) {
+        EVP_AGENT_INFO("%s is being downloaded already, resuming in memory only", d->name);
+        close(d->meta_fd);
+        d->meta_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/* The digest state written by persist_meta(), in hex */
+static bool digest_state_load(struct download *d, const char *hex)
+{
+    mbedtls_sha256_context sha;
+    unsigned char *state = (unsigned char *)&sha;
+
+    if (strcspn(hex, "\n") != 2 * sizeof(sha)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(sha); i++) {
+        if (sscanf(&hex[i * 2], "%2hhx", &state[i]) != 1) {
+            return false;
+        }
+    }
+    d->sha = sha;
+    return true;
+}
+
+/*
+ * Loads the partial file of an earlier download, if it can be resumed, with
+ * the digest state over it when that covers the whole file.
+ */
+static void persist_load(struct download *d)
+{
+    char validator[BLOB_DOWNLOAD_VALIDATOR_SIZE];
+    char state[BLOB_DOWNLOAD_META_SIZE];
+    struct stat st;
+    intmax_t offset = -1;
+    size_t total;
+    FILE *fp;
+    int fd, n = 0;
+
+    fd = dup(d->meta_fd);
+    fp = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    if (fgets(validator, sizeof(validator), fp) == NULL ||
+        (n = fscanf(fp, "%zu %jd ", &total, &offset)) < 1 || stat(d->part_path, &st) != 0 ||
+        (size_t)st.st_size >= total) {
+        fclose(fp);
+        unlink(d->part_path);
+        return;
+    }
+    /* Otherwise the partial file is hashed as it is replayed */
+    d->replay_hashed = n == 2 && offset == (intmax_t)st.st_size &&
+                       fgets(state, sizeof(state), fp) != NULL && digest_state_load(d, state);
+    fclose(fp);
+
+    copy_value(d->validator, sizeof(d->validator), validator);
+    d->total = total;
+    d->replay = st.st_size;
+}
+
+/* Hands the partial file to the agent, then appends to it */
+static int persist_replay(struct download *d)
+{
+    size_t aligned = d->replay & ~(size_t)(BLOB_DOWNLOAD_ALIGN - 1);
+    char *buf = (char *)d->buf;
+    off_t off = 0;
+    int buflen, fd, ret = 0;
+
+    fd = open(d->part_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -errno;
+    }
+    while ((size_t)off < d->replay) {
+        size_t n = d->replay - off < BLOB_DOWNLOAD_CHUNK ? d->replay - off : BLOB_DOWNLOAD_CHUNK;
+        ssize_t r = pread(fd, d->buf, n, off);
+
+        if (r <= 0) {
+            ret = local_result(d, r < 0 ? -errno : -EIO);
+            break;
+        }
+        if (!d->replay_hashed) {
+            mbedtls_sha256_update(&d->sha, d->buf, r);
+        }
+        buflen = BLOB_DOWNLOAD_CHUNK;
+        ret = forward(d, &buf, 0, r, &buflen);
+        if (ret) {
+            break;
+        }
+        off += r;
+    }
+    if (ret == 0) {
+        /* The unaligned tail goes back to the buffer */
+        if (pread(fd, d->buf, d->replay - aligned, aligned) != (ssize_t)(d->replay - aligned)) {
+            ret = local_result(d, -EIO);
+        }
+    }
+    close(fd);
+    if (ret) {
+        return ret;
+    }
+
+    pthread_mutex_lock(&g_blob_download.lock);
+    g_blob_download.resumed_bytes += d->replay;
+    pthread_mutex_unlock(&g_blob_download.lock);
+    d->delivered = d->replay;
+    d->replay = 0;
+    persist_open(d, aligned, false);
+    d->buf_len = d->delivered - aligned;
+    return 0;
+}
+
+/* A weak ETag cannot go in If-Range */
+static const char *response_validator(const struct download *d)
+{
+    if (d->etag[0] != '\0' && strncmp(d->etag, "W/", 2) != 0) {
+        return d->etag;
+    }
+    return d->last_modified;
+}
+
+/* The first data of a response */
+static int download_start(struct download *d)
+{
+    unsigned int status = d->c.http_status;
+
+    if (status == 206) {
+        if (d->replay > 0) {
+            return persist_replay(d);
+        }
+        return 0;
+    }
+    if (status != 200) {
+        /* An error response, to the agent as is */
+        d->passthrough = true;
+        return 0;
+    }
+
+    if (d->delivered > 0) {
+        /* The range was not honoured: fine if the blob is the same */
+        if (d->validator[0] == '\0' || strcmp(d->validator, response_validator(d)) != 0) {
+            EVP_AGENT_ERR("%s changed during the download", d->name);
+            d->aborted = true;
+            return -ESTALE;
+        }
+        d->skip = d->delivered;
+        return 0;
+    }
+
+    /* From the first byte: a stale partial file goes */
+    persist_close(d, false);
+    mbedtls_sha256_starts(&d->sha, 0);
+    d->replay = 0;
+    d->total = d->response_length;
+    snprintf(d->validator, sizeof(d->validator), "%s", response_validator(d));
+    if (d->validator[0] != '\0' && d->total >= g_blob_download.resume_min_bytes) {
+        persist_open(d, 0, true);
+    }
+    return 0;
+}
+
+static int download_sink(char **buffer, int offset, int datend, int *buflen, void *arg)
+{
+    struct download *d = arg;
+    const char *data;
+    uint64_t now;
+    size_t len;
+    int ret;
+
+    if (download_discarded(d)) {
+        return 0;
+    }
+    if (!d->started) {
+        d->started = true;
+        ret = download_start(d);
+        if (ret) {
+            return ret;
+        }
+    }
+    if (d->passthrough) {
+        return forward(d, buffer, offset, datend, buflen);
+    }
+
+    len = datend - offset;
+    if (d->skip > 0) {
+        size_t n = d->skip < len ? d->skip : len;
+
+        d->skip -= n;
+        offset += n;
+        len -= n;
+        if (len == 0) {
+            return 0;
+        }
+    }
+
+    /* Only what the agent took counts: the next range starts after it */
+    data = *buffer + offset;
+    ret = forward(d, buffer, offset, datend, buflen);
+    if (ret) {
+        return ret;
+    }
+    download_append(d, data, len);
+    d->delivered += len;
+
+    now = evp_agent_now_us();
+    if (g_blob_download.progress_us != 0 && now - d->progress_us >= g_blob_download.progress_us) {
+        d->progress_us = now;
+        EVP_AGENT_INFO("downloading %s: %zu of %zu bytes, %" PRIu64 " KiB/s", d->name,
+                       d->delivered, d->total,
+                       (uint64_t)d->delivered * 1000000 / 1024 / (now - d->start_us + 1));
+    }
+
+    return 0;
+}
+
+/* The headers of the attempt: those of the agent, and a Range from what it has */
+static int download_headers(struct download *d)
+{
+    size_t from = d->delivered > 0 ? d->delivered : d->replay;
+
+    d->nheaders = 0;
+    for (unsigned int i = 0; i < d->ctx->nheaders; i++) {
+        if (d->nheaders == BLOB_DOWNLOAD_HEADERS_MAX - 2) {
+            return -E2BIG;
+        }
+        d->headers[d->nheaders++] = d->ctx->headers[i];
+    }
+    if (from > 0) {
+        snprintf(d->range, sizeof(d->range), "Range: bytes=%zu-", from);
+        d->headers[d->nheaders++] = d->range;
+        if (d->validator[0] != '\0') {
+            snprintf(d->if_range, sizeof(d->if_range), "If-Range: %s", d->validator);
+            d->headers[d->nheaders++] = d->if_range;
+        }
+    }
+    return 0;
+}
+
+static void download_name(struct download *d)
+{
+    const char *url = d->ctx->url;
+    unsigned char hash[32];
+    char key[65];
+
+    copy_value(d->name, sizeof(d->name), url);
+    d->name[strcspn(d->name, "?#")] = '\0';
+
+    if (g_blob_download.dir == NULL) {
+        return;
+    }
+    /*
+     * The scheme, host and path: the query of a presigned URL changes from a
+     * download to the next. Whether the blob is still the same is up to the
+     * validator of the partial file, sent in If-Range.
+     */
+    if (mbedtls_sha256((const unsigned char *)url, strcspn(url, "?#"), hash, 0) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        snprintf(&key[i * 2], 3, "%02x", hash[i]);
+    }
+    if (asprintf(&d->part_path, "%s/%s.part", g_blob_download.dir, key) < 0) {
+        d->part_path = NULL;
+        return;
+    }
+    if (asprintf(&d->meta_path, "%s/%s.meta", g_blob_download.dir, key) < 0) {
+        free(d->part_path);
+        d->part_path = NULL;
+        d->meta_path = NULL;
+        return;
+    }
+    if (posix_memalign((void **)&d->buf, BLOB_DOWNLOAD_ALIGN, BLOB_DOWNLOAD_CHUNK) != 0) {
+        d->buf = NULL;
+    }
+}
+
+static int download_attempt(struct download *d)
+{
+    int ret;
+
+    ret = download_headers(d);
+    if (ret) {
+        return ret;
+    }
+
+    d->c = *d->ctx;
+    d->c.headers = d->headers;
+    d->c.nheaders = d->nheaders;
+    d->c.sink_callback = download_sink;
+    d->c.sink_callback_arg = d;
+    d->c.header_callback = download_header;
+    d->c.header_callback_arg = d;
+    d->c.http_status = 0;
+    d->started = false;
+    d->passthrough = false;
+    d->local_error = false;
+    d->skip = 0;
+    d->etag[0] = d->last_modified[0] = '\0';
+    d->response_length = d->response_total = 0;
+
+    ret = evp_agent_http_pool_perform(&d->c);
+    if (d->c.http_status != 0 && !download_discarded(d)) {
+        d->headers_forwarded = true;
+    }
+    return ret;
+}
+
+int evp_agent_blob_download(struct webclient_context *ctx)
+{
+    struct download d = {.ctx = ctx, .meta_fd = -1, .fd = -1};
+    unsigned int delay_ms = BLOB_DOWNLOAD_RETRY_DELAY_MS;
+    unsigned char hash[32];
+    char digest[65];
+    uint64_t elapsed;
+    bool done = false, keep;
+    int ret;
+
+    mbedtls_sha256_init(&d.sha);
+    mbedtls_sha256_starts(&d.sha, 0);
+    download_name(&d);
+    if (d.part_path != NULL && d.buf != NULL && persist_lock(&d)) {
+        persist_load(&d);
+    }
+    d.start_us = d.progress_us = evp_agent_now_us();
+
+    for (unsigned int attempt = 0;; attempt++) {
+        size_t from = d.delivered > 0 ? d.delivered : d.replay;
+
+        if (from > 0) {
+            pthread_mutex_lock(&g_blob_download.lock);
+            g_blob_download.resumes++;
+            pthread_mutex_unlock(&g_blob_download.lock);
+            EVP_AGENT_INFO("resuming %s from byte %zu", d.name, from);
+        }
+
+        ret = download_attempt(&d);
+        if (d.c.http_status == 416 && d.replay > 0) {
+            /* The partial file does not match the blob any more */
+            persist_close(&d, false);
+            d.replay = 0;
+            d.total = 0;
+            d.validator[0] = '\0';
+            continue;
+        }
+        if (ret == 0 && d.passthrough) {
+            break;
+        }
+        if (ret != 0 && d.local_error) {
+            break;
+        }
+        if (ret == 0 && d.c.http_status != 200 && d.c.http_status != 206 &&
+            d.c.http_status / 100 != 5) {
+            /* Not going to change on a retry */
+            if (download_discarded(&d)) {
+                ret = -EIO;
+            }
+            break;
+        }
+        if (ret == 0 && (d.c.http_status == 200 || d.c.http_status == 206) &&
+            (d.total == 0 || d.delivered == d.total)) {
+            done = true;
+            break;
+        }
+        if (d.aborted || attempt == g_blob_download.retries) {
+            if (ret == 0) {
+                ret = -EIO;
+            }
+            break;
+        }
+        EVP_AGENT_WARN("download of %s broken after %zu bytes (%d, HTTP %u)", d.name, d.delivered,
+                       ret, d.c.http_status);
+        usleep(delay_ms * 1000);
+        if (delay_ms < BLOB_DOWNLOAD_RETRY_DELAY_MAX_MS) {
+            delay_ms *= 2;
+        }
+    }
+
+    ctx->http_status = done ? 200 : d.c.http_status;
+    elapsed = evp_agent_now_us() - d.start_us;
+    keep = !done && !d.aborted;
+    persist_close(&d, keep);
+    if (d.meta_fd >= 0) {
+        if (!keep) {
+            unlink(d.part_path);
+            unlink(d.meta_path);
+        }
+        close(d.meta_fd);
+    }
+
+    pthread_mutex_lock(&g_blob_download.lock);
+    if (done) {
+        g_blob_download.downloads++;
+        g_blob_download.bytes += d.delivered;
+        g_blob_download.time_sum_us += elapsed;
+    }
+    else if (!d.passthrough) {
+        g_blob_download.failed++;
+    }
+    pthread_mutex_unlock(&g_blob_download.lock);
+
+    if (done) {
+        mbedtls_sha256_finish(&d.sha, hash);
+        for (size_t i = 0; i < sizeof(hash); i++) {
+            snprintf(&digest[i * 2], 3, "%02x", hash[i]);
+        }
+        EVP_AGENT_INFO("downloaded %s: %zu bytes in %" PRIu64 " ms, %" PRIu64 " KiB/s, sha256 %s",
+                       d.name, d.delivered, elapsed / 1000,
+                       (uint64_t)d.delivered * 1000000 / 1024 / (elapsed + 1), digest);
+    }
+
+    mbedtls_sha256_free(&d.sha);
+    free(d.buf);
+    free(d.part_path);
+    free(d.meta_path);
+    return ret;
+}
+
+static void blob_download_report(void *user)
+{
+    pthread_mutex_lock(&g_blob_download.lock);
+    if (g_blob_download.downloads != 0 || g_blob_download.failed != 0) {
+        EVP_AGENT_INFO("blob download: downloads=%" PRIu64 " failed=%" PRIu64
+                       " resumes=%" PRIu64 " resumed_kib=%" PRIu64 " kib_per_sec=%" PRIu64,
+                       g_blob_download.downloads, g_blob_download.failed,
+                       g_blob_download.resumes, g_blob_download.resumed_bytes / 1024,
+                       g_blob_download.time_sum_us
+                           ? g_blob_download.bytes * 1000000 / 1024 / g_blob_download.time_sum_us
+                           : 0);
+    }
+    pthread_mutex_unlock(&g_blob_download.lock);
+}
+
+/* Removes a partial file and its metadata file, unless a download holds them */
+static bool partial_remove(const char *dir, const char *key)
+{
+    char *part_path, *meta_path;
+    bool removed = false;
+    int fd;
+
+    if (asprintf(&part_path, "%s/%s.part", dir, key) < 0) {
+        return false;
+    }
+    if (asprintf(&meta_path, "%s/%s.meta", dir, key) < 0) {
+        free(part_path);
+        return false;
+    }
+    fd = open(meta_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        unlink(part_path);
+        unlink(meta_path);
+        removed = true;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(part_path);
+    free(meta_path);
+    return removed;
+}
+
+static int partial_compare(const void *a, const void *b)
+{
+    const struct partial *pa = a, *pb = b;
+
+    return (pa->mtime > pb->mtime) - (pa->mtime < pb->mtime);
+}
+
+/*
+ * Removes the partial files of downloads given up on: those not written to
+ * for max_age_sec, then the oldest ones while they take more than
+ * max_bytes, 0 for no limit. A metadata file left without its partial file
+ * goes as well.
+ */
+static void partials_clean(const char *dir, uint64_t max_age_sec, uint64_t max_bytes)
+{
+    struct partial *partials = NULL, *p;
+    size_t n = 0, size = 0;
+    uint64_t bytes = 0, removed_bytes = 0;
+    unsigned int removed = 0;
+    time_t now = time(NULL);
+    struct dirent *de;
+    struct stat st;
+    DIR *dp;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        return;
+    }
+    while ((de = readdir(dp)) != NULL) {
+        const char *suffix = strrchr(de->d_name, '.');
+        char key[NAME_MAX + 1], part[NAME_MAX + sizeof(".part")];
+
+        if (suffix == NULL || (strcmp(suffix, ".part") != 0 && strcmp(suffix, ".meta") != 0) ||
+            fstatat(dirfd(dp), de->d_name, &st, 0) != 0) {
+            continue;
+        }
+        snprintf(key, sizeof(key), "%.*s", (int)(suffix - de->d_name), de->d_name);
+        if (strcmp(suffix, ".meta") == 0) {
+            snprintf(part, sizeof(part), "%s.part", key);
+            if (faccessat(dirfd(dp), part, F_OK, 0) != 0 && errno == ENOENT &&
+                partial_remove(dir, key)) {
+                removed++;
+            }
+            continue;
+        }
+        if (max_age_sec != 0 && now - st.st_mtime > (time_t)max_age_sec) {
+            if (partial_remove(dir, key)) {
+                removed++;
+                removed_bytes += st.st_size;
+            }
+            continue;
+        }
+        if (n == size) {
+            size = size ? size * 2 : 16;
+            p = realloc(partials, size * sizeof(*partials));
+            if (p == NULL) {
+                break;
+            }
+            partials = p;
+        }
+        snprintf(partials[n].key, sizeof(partials[n].key), "%s", key);
+        partials[n].size = st.st_size;
+        partials[n].mtime = st.st_mtime;
+        bytes += st.st_size;
+        n++;
+    }
+    closedir(dp);
+
+    qsort(partials, n, sizeof(*partials), partial_compare);
+    for (size_t i = 0; i < n && max_bytes != 0 && bytes > max_bytes; i++) {
+        if (partial_remove(dir, partials[i].key)) {
+            removed++;
+            removed_bytes += partials[i].size;
+            bytes -= partials[i].size;
+        }
+    }
+    free(partials);
+
+    if (removed != 0) {
+        EVP_AGENT_INFO("removed %u abandoned partial downloads from %s, %" PRIu64 " KiB", removed,
+                       dir, removed_bytes / 1024);
+    }
+}
+
+int evp_agent_blob_download_init(void)
+{
+    const char *dir = getenv("EVP_BLOB_DOWNLOAD_DIR");
+    const char *retries = getenv("EVP_BLOB_DOWNLOAD_RETRIES");
+    const char *min_bytes = getenv("EVP_BLOB_RESUME_MIN_BYTES");
+    const char *progress = getenv("EVP_BLOB_DOWNLOAD_PROGRESS_SEC");
+    const char *max_age = getenv("EVP_BLOB_PARTIAL_MAX_AGE_SEC");
+    const char *max_bytes = getenv("EVP_BLOB_PARTIAL_MAX_BYTES");
+    uint64_t max_age_sec = BLOB_PARTIAL_MAX_AGE_SEC_DEFAULT;
+    uint64_t max_partial_bytes = BLOB_PARTIAL_MAX_BYTES_DEFAULT;
+
+    g_blob_download.retries = BLOB_DOWNLOAD_RETRIES_DEFAULT;
+    if (retries != NULL) {
+        g_blob_download.retries = strtoul(retries, NULL, 10);
+    }
+    g_blob_download.resume_min_bytes = BLOB_RESUME_MIN_BYTES_DEFAULT;
+    if (min_bytes != NULL) {
+        g_blob_download.resume_min_bytes = strtoul(min_bytes, NULL, 10);
+    }
+    g_blob_download.progress_us = (uint64_t)BLOB_DOWNLOAD_PROGRESS_SEC_DEFAULT * 1000000;
+    if (progress != NULL) {
+        g_blob_download.progress_us = (uint64_t)strtoul(progress, NULL, 10) * 1000000;
+    }
+    if (max_age != NULL) {
+        max_age_sec = strtoull(max_age, NULL, 10);
+    }
+    if (max_bytes != NULL) {
+        max_partial_bytes = strtoull(max_bytes, NULL, 10);
+    }
+
+    if (dir == NULL) {
+        dir = BLOB_DOWNLOAD_DEFAULT_DIR;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        EVP_AGENT_WARN("failed to create %s, downloads resume in memory only: %s", dir,
+                       strerror(errno));
+    }
+    else {
+        g_blob_download.dir = strdup(dir);
+        if (g_blob_download.dir == NULL) {
+            return -ENOMEM;
+        }
+        partials_clean(dir, max_age_sec, max_partial_bytes);
+    }
+    g_blob_download.enabled = true;
+
+    return evp_agent_metrics_register("blob_download", NULL, blob_download_report, NULL);
+}
+
+void evp_agent_blob_download_deinit(void)
+{
+    g_blob_download.enabled = false;
+    free(g_blob_download.dir);
+    g_blob_download.dir = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_BLOB_DOWNLOAD_H__
+#define __EVP_BLOB_DOWNLOAD_H__
+
+#include <stdbool.h>
+
+/*
+ * Resumable downloads.
+ *
+ * The EVP agent library downloads modules and blobs with one HTTP GET,
+ * streamed to its sink callback, and starts over from the first byte when
+ * the transfer breaks. GETs of its HTTP client, wrapped at link time (see
+ * webclient_wrap.c), are instead:
+ *
+ * - resumed on a broken transfer or an HTTP 5xx, up to
+ *   EVP_BLOB_DOWNLOAD_RETRIES times (5 by default), with a Range request
+ *   from the last byte the agent took, guarded with If-Range by the ETag
+ *   or Last-Modified of the first response, so a blob changed meanwhile is
+ *   not spliced. An error of the agent itself, such as a full disk, ends
+ *   the download,
+ * - for blobs of at least EVP_BLOB_RESUME_MIN_BYTES (1 MiB by default) with
+ *   such a validator, persisted as they arrive to a partial file in
+ *   EVP_BLOB_DOWNLOAD_DIR (/var/lib/edge-device-core/blob-partial by
+ *   default), written in aligned chunks with O_DIRECT where the file system
+ *   supports it. The file is keyed by the scheme, host and path of the URL,
+ *   not its query, which changes with every presigned URL: the validator
+ *   kept with it, sent in If-Range, tells whether the blob is still the
+ *   same. The next download of the blob, after the retries ran out or the
+ *   agent restarted, replays it to the agent and only requests the rest. A
+ *   download of a blob another one is downloading meanwhile resumes in
+ *   memory only.
+ *
+ * Partial files not written to for EVP_BLOB_PARTIAL_MAX_AGE_SEC (7 days by
+ * default) are removed at start, then the oldest ones while they take more
+ * than EVP_BLOB_PARTIAL_MAX_BYTES (512 MiB by default, 0 for no limit).
+ *
+ * The SHA-256 of the blob is computed as it arrives, its state kept with
+ * the partial file, so that a resume does not hash the file again. It is
+ * logged with the size and the throughput once the download is done.
+ * Progress is logged every EVP_BLOB_DOWNLOAD_PROGRESS_SEC (10 by default).
+ * Resumes and the bytes they saved are reported in the metrics.
+ */
+
+struct webclient_context;
+
+int evp_agent_blob_download_init(void);
+void evp_agent_blob_download_deinit(void);
+
+/* The request is a download to resume on failure */
+bool evp_agent_blob_download_is(const struct webclient_context *ctx);
+/* webclient_perform() with the resumes */
+int evp_agent_blob_download(struct webclient_context *ctx);
+
+#endif /* __EVP_BLOB_DOWNLOAD_H__ */
@@ -0,0 +1,584 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for asprintf */
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mbedtls/base64.h>
+#include <webclient/webclient.h>
+
+#include "blob_upload.h"
+#include "http_pool.h"
+#include "log.h"
+#include "metrics.h"
+
+#define BLOB_UPLOAD_BLOCK_BYTES_DEFAULT (1024 * 1024)
+#define BLOB_UPLOAD_CONNECTIONS_DEFAULT 4
+#define BLOB_UPLOAD_RETRIES_DEFAULT 3
+#define BLOB_UPLOAD_CONNECTIONS_MAX 16
+#define BLOB_UPLOAD_RETRY_DELAY_MS 200
+/* The delay doubles with each retry, up to 32 times the first one */
+#define BLOB_UPLOAD_RETRY_SHIFT_MAX 5
+/* Limit of the blocks of a block blob */
+#define BLOB_UPLOAD_BLOCKS_MAX 50000
+/* Block IDs must all have the same length: base64 of 6 digits, 8 characters */
+#define BLOB_UPLOAD_BLOCK_ID_FMT "%06u"
+#define BLOB_UPLOAD_BLOCK_ID_SIZE 9
+#define BLOB_UPLOAD_HEADERS_MAX 32
+#define BLOB_TYPE_HEADER "x-ms-blob-type:"
+#define BLOCK_LIST_HEAD "<?xml version=\"1.0\" encoding=\"utf-8\"?><BlockList>"
+#define BLOCK_LIST_ENTRY "<Latest>%s</Latest>"
+#define BLOCK_LIST_TAIL "</BlockList>"
+
+static struct {
+    size_t block_bytes;
+    unsigned int connections;
+    unsigned int retries;
+    uint64_t uploads;
+    uint64_t failed;
+    uint64_t blocks;
+    uint64_t retried;
+    uint64_t bytes;
+    uint64_t time_sum_us;
+    uint64_t block_max_us;
+    pthread_mutex_t lock;
+} g_blob_upload = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/*
+ * Of the last request of the thread, which the EVP agent library performs on
+ * the thread of the blob work that then publishes its result
+ */
+static __thread struct {
+    struct evp_agent_blob_upload_stats stats;
+    bool pending;
+} t_last;
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_FILLING,
+    SLOT_READY,
+    SLOT_SENDING,
+};
+
+/* A block buffer */
+struct slot {
+    uint8_t *data;
+    size_t size;
+    unsigned int index;
+    enum slot_state state;
+};
+
+struct upload {
+    struct webclient_context *ctx;
+    const char *headers[BLOB_UPLOAD_HEADERS_MAX];
+    unsigned int nheaders;
+    char (*ids)[BLOB_UPLOAD_BLOCK_ID_SIZE];
+    uint64_t *block_us;
+    struct slot *slots;
+    unsigned int n_slots;
+    unsigned int n_blocks;
+    /* All the blocks were read */
+    bool read;
+    bool failed;
+    /* Of the failure: an HTTP status, or else an error */
+    unsigned int http_status;
+    int error;
+    unsigned int retries;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct block_body {
+    const uint8_t *data;
+    size_t size;
+    size_t off;
+};
+
+bool evp_agent_blob_upload_is(const struct webclient_context *ctx)
+{
+    if (g_blob_upload.block_bytes == 0 || ctx->method == NULL || strcmp(ctx->method, "PUT") != 0 ||
+        ctx->body_callback == NULL || ctx->bodylen <= g_blob_upload.block_bytes) {
+        return false;
+    }
+    for (unsigned int i = 0; i < ctx->nheaders; i++) {
+        const char *header = ctx->headers[i];
+
+        if (strncasecmp(header, BLOB_TYPE_HEADER, strlen(BLOB_TYPE_HEADER)) == 0) {
+            return strcasestr(header, "BlockBlob") != NULL;
+        }
+    }
+    return false;
+}
+
+static int block_body(void *buffer, size_t *sizep, const void **datap, size_t reqsize, void *arg)
+{
+    struct block_body *body = arg;
+    size_t n = body->size - body->off;
+
+    if (n > reqsize) {
+        n = reqsize;
+    }
+    *datap = body->data + body->off;
+    *sizep = n;
+    body->off += n;
+    return 0;
+}
+
+static int discard_sink(char **buffer, int offset, int datend, int *buflen, void *arg)
+{
+    return 0;
+}
+
+/* A PUT with the request of the upload, the response goes to buf or to the upload if NULL */
+static int request(struct upload *u, const char *url, const void *data, size_t size, char *buf,
+                   unsigned int *status)
+{
+    struct webclient_context c = *u->ctx;
+    struct block_body body = {.data = data, .size = size};
+    int ret;
+
+    c.url = url;
+    c.headers = u->headers;
+    c.nheaders = u->nheaders;
+    c.bodylen = size;
+    c.body_callback = block_body;
+    c.body_callback_arg = &body;
+    c.header_callback = NULL;
+    c.http_status = 0;
+    if (buf != NULL) {
+        c.buffer = buf;
+        c.sink_callback = discard_sink;
+        c.sink_callback_arg = NULL;
+    }
+
+    ret = evp_agent_http_pool_perform(&c);
+    *status = c.http_status;
+    return ret;
+}
+
+static int block_put(struct upload *u, struct slot *slot, char *buf, unsigned int *status,
+                     unsigned int *retries)
+{
+    const char *sep = strchr(u->ctx->url, '?') != NULL ? "&" : "?";
+    char *url;
+    int ret;
+
+    if (asprintf(&url, "%s%scomp=block&blockid=%s", u->ctx->url, sep, u->ids[slot->index]) < 0) {
+        return -ENOMEM;
+    }
+
+    for (unsigned int attempt = 0;; attempt++) {
+        ret = request(u, url, slot->data, slot->size, buf, status);
+        if (ret == 0 && *status / 100 == 2) {
+            break;
+        }
+        /* Only a broken connection or a server error may go away on its own */
+        if (attempt == g_blob_upload.retries || (ret == 0 && *status / 100 != 5)) {
+            if (ret == 0) {
+                ret = -EIO;
+            }
+            break;
+        }
+        EVP_AGENT_WARN("block %u failed (%d, HTTP %u), retrying", slot->index, ret, *status);
+        (*retries)++;
+        usleep((useconds_t)BLOB_UPLOAD_RETRY_DELAY_MS * 1000
+               << (attempt < BLOB_UPLOAD_RETRY_SHIFT_MAX ? attempt : BLOB_UPLOAD_RETRY_SHIFT_MAX));
+    }
+
+    free(url);
+    return ret;
+}
+
+static struct slot *slot_find(struct upload *u, enum slot_state state)
+{
+    for (unsigned int i = 0; i < u->n_slots; i++) {
+        if (u->slots[i].state == state) {
+            return &u->slots[i];
+        }
+    }
+    return NULL;
+}
+
+static void upload_fail(struct upload *u, int error, unsigned int http_status)
+{
+    if (!u->failed) {
+        u->failed = true;
+        u->error = error;
+        u->http_status = http_status;
+    }
+    pthread_cond_broadcast(&u->cond);
+}
+
+static void *upload_thread(void *arg)
+{
+    struct upload *u = arg;
+    char *buf = malloc(u->ctx->buflen);
+    unsigned int status, retries;
+    struct slot *slot;
+    uint64_t start;
+    int ret;
+
+    pthread_mutex_lock(&u->lock);
+    if (buf == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for the block response");
+        upload_fail(u, -ENOMEM, 0);
+    }
+    while (!u->failed) {
+        slot = slot_find(u, SLOT_READY);
+        if (slot == NULL) {
+            if (u->read) {
+                break;
+            }
+            pthread_cond_wait(&u->cond, &u->lock);
+            continue;
+        }
+        slot->state = SLOT_SENDING;
+        pthread_mutex_unlock(&u->lock);
+
+        start = evp_agent_now_us();
+        retries = 0;
+        ret = block_put(u, slot, buf, &status, &retries);
+
+        pthread_mutex_lock(&u->lock);
+        u->block_us[slot->index] = evp_agent_now_us() - start;
+        u->retries += retries;
+        if (ret) {
+            upload_fail(u, ret, status);
+        }
+        slot->state = SLOT_FREE;
+        pthread_cond_broadcast(&u->cond);
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    free(buf);
+    return NULL;
+}
+
+/* Reads a block from the body callback of the upload */
+static int block_read(struct upload *u, struct slot *slot)
+{
+    struct webclient_context *ctx = u->ctx;
+    size_t off = 0;
+    int ret;
+
+    while (off < slot->size) {
+        const void *data = slot->data + off;
+        size_t n = slot->size - off;
+
+        ret = ctx->body_callback(slot->data + off, &n, &data, slot->size - off,
+                                 ctx->body_callback_arg);
+        if (ret) {
+            return ret;
+        }
+        if (n == 0 || n > slot->size - off) {
+            return -EIO;
+        }
+        if (data != slot->data + off) {
+            memcpy(slot->data + off, data, n);
+        }
+        off += n;
+    }
+
+    return 0;
+}
+
+static void upload_read(struct upload *u, size_t block)
+{
+    struct slot *slot;
+    int ret;
+
+    for (unsigned int i = 0; i < u->n_blocks; i++) {
+        pthread_mutex_lock(&u->lock);
+        while (!u->failed && (slot = slot_find(u, SLOT_FREE)) == NULL) {
+            pthread_cond_wait(&u->cond, &u->lock);
+        }
+        if (u->failed) {
+            pthread_mutex_unlock(&u->lock);
+            break;
+        }
+        slot->state = SLOT_FILLING;
+        pthread_mutex_unlock(&u->lock);
+
+        slot->index = i;
+        slot->size = i + 1 < u->n_blocks ? block : u->ctx->bodylen - (size_t)i * block;
+        ret = block_read(u, slot);
+
+        pthread_mutex_lock(&u->lock);
+        if (ret) {
+            EVP_AGENT_ERR("failed to read block %u of the upload: %d", i, ret);
+            slot->state = SLOT_FREE;
+            upload_fail(u, ret, 0);
+        }
+        else {
+            slot->state = SLOT_READY;
+            pthread_cond_broadcast(&u->cond);
+        }
+        pthread_mutex_unlock(&u->lock);
+    }
+
+    pthread_mutex_lock(&u->lock);
+    u->read = true;
+    pthread_cond_broadcast(&u->cond);
+    pthread_mutex_unlock(&u->lock);
+}
+
+static int upload_commit(struct upload *u, unsigned int *status)
+{
+    size_t size = strlen(BLOCK_LIST_HEAD) + strlen(BLOCK_LIST_TAIL) +
+                  (size_t)u->n_blocks * (strlen(BLOCK_LIST_ENTRY) + BLOB_UPLOAD_BLOCK_ID_SIZE) + 1;
+    const char *sep = strchr(u->ctx->url, '?') != NULL ? "&" : "?";
+    char *list = malloc(size);
+    char *url = NULL;
+    size_t len;
+    int ret;
+
+    if (list == NULL || asprintf(&url, "%s%scomp=blocklist", u->ctx->url, sep) < 0) {
+        free(list);
+        return -ENOMEM;
+    }
+
+    len = snprintf(list, size, BLOCK_LIST_HEAD);
+    for (unsigned int i = 0; i < u->n_blocks; i++) {
+        len += snprintf(list + len, size - len, BLOCK_LIST_ENTRY, u->ids[i]);
+    }
+    len += snprintf(list + len, size - len, BLOCK_LIST_TAIL);
+
+    ret = request(u, url, list, len, NULL, status);
+    free(url);
+    free(list);
+    return ret;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void upload_account(struct upload *u, unsigned int connections, uint64_t elapsed_us,
+                           bool ok)
+{
+    struct evp_agent_blob_upload_stats *last = &t_last.stats;
+
+    qsort(u->block_us, u->n_blocks, sizeof(*u->block_us), compare_u64);
+
+    last->bytes = u->ctx->bodylen;
+    last->blocks = u->n_blocks;
+    last->connections = connections;
+    last->retries = u->retries;
+    last->elapsed_us = elapsed_us;
+    last->block_p50_us = u->block_us[(u->n_blocks - 1) / 2];
+    last->block_max_us = u->block_us[u->n_blocks - 1];
+    t_last.pending = true;
+
+    pthread_mutex_lock(&g_blob_upload.lock);
+    g_blob_upload.uploads++;
+    g_blob_upload.retried += u->retries;
+    if (ok) {
+        g_blob_upload.blocks += u->n_blocks;
+        g_blob_upload.bytes += u->ctx->bodylen;
+        g_blob_upload.time_sum_us += elapsed_us;
+        if (last->block_max_us > g_blob_upload.block_max_us) {
+            g_blob_upload.block_max_us = last->block_max_us;
+        }
+    }
+    else {
+        g_blob_upload.failed++;
+    }
+    pthread_mutex_unlock(&g_blob_upload.lock);
+}
+
+static int upload_prepare(struct upload *u, size_t block)
+{
+    unsigned char digits[BLOB_UPLOAD_BLOCK_ID_SIZE];
+    size_t len;
+
+    for (unsigned int i = 0; i < u->ctx->nheaders; i++) {
+        const char *header = u->ctx->headers[i];
+
+        /* Block requests are not blob creations */
+        if (strncasecmp(header, BLOB_TYPE_HEADER, strlen(BLOB_TYPE_HEADER)) == 0) {
+            continue;
+        }
+        if (u->nheaders == BLOB_UPLOAD_HEADERS_MAX) {
+            return -E2BIG;
+        }
+        u->headers[u->nheaders++] = header;
+    }
+
+    u->ids = calloc(u->n_blocks, sizeof(*u->ids));
+    u->block_us = calloc(u->n_blocks, sizeof(*u->block_us));
+    u->slots = calloc(u->n_slots, sizeof(*u->slots));
+    if (u->ids == NULL || u->block_us == NULL || u->slots == NULL) {
+        return -ENOMEM;
+    }
+    for (unsigned int i = 0; i < u->n_slots; i++) {
+        u->slots[i].data = malloc(block);
+        if (u->slots[i].data == NULL) {
+            return -ENOMEM;
+        }
+    }
+    for (unsigned int i = 0; i < u->n_blocks; i++) {
+        snprintf((char *)digits, sizeof(digits), BLOB_UPLOAD_BLOCK_ID_FMT, i);
+        if (mbedtls_base64_encode((unsigned char *)u->ids[i], sizeof(u->ids[i]), &len, digits,
+                                  strlen((char *)digits)) != 0) {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static void upload_free(struct upload *u)
+{
+    if (u->slots != NULL) {
+        for (unsigned int i = 0; i < u->n_slots; i++) {
+            free(u->slots[i].data);
+        }
+    }
+    free(u->slots);
+    free(u->block_us);
+    free(u->ids);
+    pthread_cond_destroy(&u->cond);
+    pthread_mutex_destroy(&u->lock);
+}
+
+int evp_agent_blob_upload(struct webclient_context *ctx)
+{
+    pthread_t threads[BLOB_UPLOAD_CONNECTIONS_MAX];
+    struct upload u = {.ctx = ctx};
+    size_t block = g_blob_upload.block_bytes;
+    unsigned int connections, started = 0, status = 0;
+    uint64_t start = evp_agent_now_us();
+    int ret;
+
+    if (ctx->bodylen / block >= BLOB_UPLOAD_BLOCKS_MAX) {
+        block = ctx->bodylen / BLOB_UPLOAD_BLOCKS_MAX + 1;
+    }
+    u.n_blocks = (ctx->bodylen + block - 1) / block;
+    connections = g_blob_upload.connections;
+    if (connections > u.n_blocks) {
+        connections = u.n_blocks;
+    }
+    /* One block is read while the others are sent */
+    u.n_slots = connections + 1;
+    pthread_mutex_init(&u.lock, NULL);
+    pthread_cond_init(&u.cond, NULL);
+
+    ret = upload_prepare(&u, block);
+    if (ret) {
+        EVP_AGENT_ERR("failed to prepare the block upload: %d", ret);
+        goto out;
+    }
+
+    for (; started < connections; started++) {
+        ret = pthread_create(&threads[started], NULL, upload_thread, &u);
+        if (ret) {
+            EVP_AGENT_ERR("failed to create a block upload thread: %s", strerror(ret));
+            pthread_mutex_lock(&u.lock);
+            upload_fail(&u, -ret, 0);
+            pthread_mutex_unlock(&u.lock);
+            break;
+        }
+    }
+    if (started != 0) {
+        upload_read(&u, block);
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (u.failed) {
+        /* As the single request would have: an HTTP error is a completed request */
+        ret = u.http_status != 0 ? 0 : u.error;
+        status = u.http_status;
+    }
+    else {
+        ret = upload_commit(&u, &status);
+    }
+    ctx->http_status = status;
+    upload_account(&u, connections, evp_agent_now_us() - start, ret == 0 && status / 100 == 2);
+
+out:
+    upload_free(&u);
+    return ret;
+}
+
+bool evp_agent_blob_upload_take_stats(struct evp_agent_blob_upload_stats *stats)
+{
+    bool pending = t_last.pending;
+
+    if (pending && stats != NULL) {
+        *stats = t_last.stats;
+    }
+    t_last.pending = false;
+    return pending;
+}
+
+static void blob_upload_report(void *user)
+{
+    pthread_mutex_lock(&g_blob_upload.lock);
+    if (g_blob_upload.uploads != 0) {
+        uint64_t done = g_blob_upload.uploads - g_blob_upload.failed;
+
+        EVP_AGENT_INFO("blob upload: uploads=%" PRIu64 " failed=%" PRIu64 " blocks=%" PRIu64
+                       " retried=%" PRIu64 " kib_per_sec=%" PRIu64 " upload_avg_ms=%" PRIu64
+                       " block_max_ms=%" PRIu64,
+                       g_blob_upload.uploads, g_blob_upload.failed, g_blob_upload.blocks,
+                       g_blob_upload.retried,
+                       g_blob_upload.time_sum_us
+                           ? g_blob_upload.bytes * 1000000 / 1024 / g_blob_upload.time_sum_us
+                           : 0,
+                       done ? g_blob_upload.time_sum_us / done / 1000 : 0,
+                       g_blob_upload.block_max_us / 1000);
+    }
+    pthread_mutex_unlock(&g_blob_upload.lock);
+}
+
+int evp_agent_blob_upload_init(void)
+{
+    const char *bytes = getenv("EVP_BLOB_BLOCK_BYTES");
+    const char *connections = getenv("EVP_BLOB_UPLOAD_CONNECTIONS");
+    const char *retries = getenv("EVP_BLOB_BLOCK_RETRIES");
+
+    g_blob_upload.block_bytes = BLOB_UPLOAD_BLOCK_BYTES_DEFAULT;
+    if (bytes != NULL) {
+        g_blob_upload.block_bytes = strtoul(bytes, NULL, 10);
+    }
+    g_blob_upload.connections = BLOB_UPLOAD_CONNECTIONS_DEFAULT;
+    if (connections != NULL) {
+        g_blob_upload.connections = strtoul(connections, NULL, 10);
+    }
+    if (g_blob_upload.connections == 0) {
+        g_blob_upload.connections = 1;
+    }
+    if (g_blob_upload.connections > BLOB_UPLOAD_CONNECTIONS_MAX) {
+        g_blob_upload.connections = BLOB_UPLOAD_CONNECTIONS_MAX;
+    }
+    g_blob_upload.retries = BLOB_UPLOAD_RETRIES_DEFAULT;
+    if (retries != NULL) {
+        g_blob_upload.retries = strtoul(retries, NULL, 10);
+    }
+
+    return evp_agent_metrics_register("blob_upload", NULL, blob_upload_report, NULL);
+}
+
+void evp_agent_blob_upload_deinit(void)
+{
+    /* Uploads in progress finish with the current settings */
+    g_blob_upload.block_bytes = 0;
+}
@@ -0,0 +1,65 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_BLOB_UPLOAD_H__
+#define __EVP_BLOB_UPLOAD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Parallel block uploads.
+ *
+ * The EVP agent library sends a blob upload as one HTTP PUT, streamed from
+ * the module through the body callback of its HTTP client, whose entry
+ * point is wrapped at link time (see evp_agent_link_args). An upload to
+ * block blob storage (the Azure blob type, and the EVP one, whose URLs
+ * come from the hub storage tokens) larger than one block is instead:
+ *
+ * - read into blocks of EVP_BLOB_BLOCK_BYTES (1 MiB by default, 0
+ *   disables this), at most one more than there are connections, so the
+ *   memory used is bounded,
+ * - sent as Put Block requests over EVP_BLOB_UPLOAD_CONNECTIONS concurrent
+ *   connections (4 by default), each block retried up to
+ *   EVP_BLOB_BLOCK_RETRIES times (3 by default) on a connection error or an
+ *   HTTP 5xx, with a backoff,
+ * - committed with a Put Block List request.
+ *
+ * Uploads of the plain HTTP blob type are left as they are, since there is
+ * no way to commit blocks on an arbitrary server.
+ *
+ * The block times of an upload go with the blob result notification of its
+ * request (see notifications.c), and the totals are reported in the metrics.
+ */
+
+struct webclient_context;
+
+struct evp_agent_blob_upload_stats {
+    size_t bytes;
+    unsigned int blocks;
+    unsigned int connections;
+    unsigned int retries;
+    uint64_t elapsed_us;
+    uint64_t block_p50_us;
+    uint64_t block_max_us;
+};
+
+int evp_agent_blob_upload_init(void);
+void evp_agent_blob_upload_deinit(void);
+
+/* The request is a block blob upload to split */
+bool evp_agent_blob_upload_is(const struct webclient_context *ctx);
+/* webclient_perform() of such a request */
+int evp_agent_blob_upload(struct webclient_context *ctx);
+
+/*
+ * Takes the stats of the request the calling thread performed last, false
+ * if it was not a block upload. NULL only drops them.
+ */
+bool evp_agent_blob_upload_take_stats(struct evp_agent_blob_upload_stats *stats);
+
+#endif /* __EVP_BLOB_UPLOAD_H__ */
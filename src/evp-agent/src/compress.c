@@ -0,0 +1,332 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+#if defined(EDC_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+#include "log.h"
+#include "metrics.h"
+
+#define COMPRESS_MIN_BYTES_DEFAULT 256
+#define COMPRESS_BLOB_MAX_BYTES_DEFAULT (8 * 1024 * 1024)
+#define COMPRESS_ZSTD_LEVEL 3
+#define COMPRESS_DICT_MAX_BYTES (1024 * 1024)
+
+enum compress_method {
+    COMPRESS_NONE,
+    COMPRESS_DEFLATE,
+    COMPRESS_ZSTD,
+};
+
+struct compress_stats {
+    uint64_t payloads;
+    uint64_t compressed;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t cpu_us;
+};
+
+static const struct {
+    const char *env;
+    const char *name;
+    /* The exact topic of the class */
+    const char *topic;
+} g_classes[EVP_AGENT_COMPRESS_CLASSES] = {
+    [EVP_AGENT_COMPRESS_TELEMETRY] = {"EVP_COMPRESS_TELEMETRY", "telemetry",
+                                      "v1/devices/me/telemetry"},
+    [EVP_AGENT_COMPRESS_STATE] = {"EVP_COMPRESS_STATE", "state", "v1/devices/me/attributes"},
+    [EVP_AGENT_COMPRESS_BLOB] = {"EVP_COMPRESS_BLOB", "blob", NULL},
+};
+
+static const char *const g_encodings[] = {
+    [COMPRESS_NONE] = NULL,
+    [COMPRESS_DEFLATE] = "deflate",
+    [COMPRESS_ZSTD] = "zstd",
+};
+
+/* Images and archives, which would not shrink */
+static const struct {
+    const char *magic;
+    size_t len;
+} g_compressed_magics[] = {
+    {"\xff\xd8\xff", 3},              /* JPEG */
+    {"\x89PNG", 4},                   /* PNG */
+    {"GIF8", 4},                      /* GIF */
+    {"RIFF", 4},                      /* WebP */
+    {"\x1f\x8b", 2},                  /* gzip */
+    {"PK\x03\x04", 4},                /* zip */
+    {"\x28\xb5\x2f\xfd", 4},          /* zstd */
+    {"\xfd" "7zXZ", 5},               /* xz */
+};
+
+static struct {
+    enum compress_method methods[EVP_AGENT_COMPRESS_CLASSES];
+    size_t min_bytes;
+    size_t blob_max_bytes;
+    struct compress_stats stats[EVP_AGENT_COMPRESS_CLASSES];
+#if defined(EDC_HAVE_ZSTD)
+    ZSTD_CCtx *cctx;
+    ZSTD_CDict *cdict;
+#endif
+    pthread_mutex_t lock;
+} g_compress = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+enum evp_agent_compress_class evp_agent_compress_topic_class(const char *topic)
+{
+    for (int i = 0; i < EVP_AGENT_COMPRESS_CLASSES; i++) {
+        if (g_classes[i].topic != NULL && strcmp(topic, g_classes[i].topic) == 0) {
+            return i;
+        }
+    }
+    return EVP_AGENT_COMPRESS_CLASSES;
+}
+
+bool evp_agent_compress_wants(enum evp_agent_compress_class cls, size_t size)
+{
+    if (cls >= EVP_AGENT_COMPRESS_CLASSES || g_compress.methods[cls] == COMPRESS_NONE ||
+        size < g_compress.min_bytes) {
+        return false;
+    }
+    return cls != EVP_AGENT_COMPRESS_BLOB || size <= g_compress.blob_max_bytes;
+}
+
+static bool already_compressed(const void *data, size_t size)
+{
+    for (size_t i = 0; i < sizeof(g_compressed_magics) / sizeof(g_compressed_magics[0]); i++) {
+        if (size >= g_compressed_magics[i].len &&
+            memcmp(data, g_compressed_magics[i].magic, g_compressed_magics[i].len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool deflate_payload(const void *data, size_t size, void **out, size_t *out_size)
+{
+    uLongf len = compressBound(size);
+
+    *out = malloc(len);
+    if (*out == NULL) {
+        return false;
+    }
+    if (compress2(*out, &len, data, size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        free(*out);
+        return false;
+    }
+    *out_size = len;
+    return true;
+}
+
+#if defined(EDC_HAVE_ZSTD)
+static bool zstd_payload(const void *data, size_t size, void **out, size_t *out_size)
+{
+    size_t len = ZSTD_compressBound(size);
+
+    *out = malloc(len);
+    if (*out == NULL) {
+        return false;
+    }
+    /* One context for all, the payloads are small */
+    pthread_mutex_lock(&g_compress.lock);
+    if (g_compress.cdict != NULL) {
+        len = ZSTD_compress_usingCDict(g_compress.cctx, *out, len, data, size, g_compress.cdict);
+    }
+    else {
+        len = ZSTD_compressCCtx(g_compress.cctx, *out, len, data, size, COMPRESS_ZSTD_LEVEL);
+    }
+    pthread_mutex_unlock(&g_compress.lock);
+    if (ZSTD_isError(len)) {
+        free(*out);
+        return false;
+    }
+    *out_size = len;
+    return true;
+}
+#endif
+
+bool evp_agent_compress(enum evp_agent_compress_class cls, const void *data, size_t size,
+                        void **out, size_t *out_size, const char **encoding)
+{
+    enum compress_method method;
+    uint64_t cpu;
+    bool ok = false;
+
+    if (!evp_agent_compress_wants(cls, size)) {
+        return false;
+    }
+    if (cls == EVP_AGENT_COMPRESS_BLOB && already_compressed(data, size)) {
+        return false;
+    }
+
+    method = g_compress.methods[cls];
+    cpu = evp_agent_thread_cpu_us();
+#if defined(EDC_HAVE_ZSTD)
+    if (method == COMPRESS_ZSTD) {
+        ok = zstd_payload(data, size, out, out_size);
+    }
+#endif
+    if (method == COMPRESS_DEFLATE) {
+        ok = deflate_payload(data, size, out, out_size);
+    }
+    if (ok && *out_size > size - size / 16) {
+        /* Not worth the decompression at the other end */
+        free(*out);
+        ok = false;
+    }
+    cpu = evp_agent_thread_cpu_us() - cpu;
+
+    pthread_mutex_lock(&g_compress.lock);
+    g_compress.stats[cls].payloads++;
+    g_compress.stats[cls].cpu_us += cpu;
+    if (ok) {
+        g_compress.stats[cls].compressed++;
+        g_compress.stats[cls].bytes_in += size;
+        g_compress.stats[cls].bytes_out += *out_size;
+    }
+    pthread_mutex_unlock(&g_compress.lock);
+
+    if (ok && encoding != NULL) {
+        *encoding = g_encodings[method];
+    }
+    return ok;
+}
+
+static void compress_report(void *user)
+{
+    pthread_mutex_lock(&g_compress.lock);
+    for (int i = 0; i < EVP_AGENT_COMPRESS_CLASSES; i++) {
+        struct compress_stats *s = &g_compress.stats[i];
+
+        if (s->payloads == 0) {
+            continue;
+        }
+        EVP_AGENT_INFO("compress %s: payloads=%" PRIu64 " compressed=%" PRIu64
+                       " kib_in=%" PRIu64 " kib_out=%" PRIu64 " ratio_pct=%" PRIu64
+                       " cpu_ms=%" PRIu64 " cpu_us_per_mib=%" PRIu64,
+                       g_classes[i].name, s->payloads, s->compressed, s->bytes_in / 1024,
+                       s->bytes_out / 1024, s->bytes_in ? s->bytes_out * 100 / s->bytes_in : 0,
+                       s->cpu_us / 1000,
+                       s->bytes_in ? s->cpu_us * 1024 * 1024 / s->bytes_in : 0);
+    }
+    pthread_mutex_unlock(&g_compress.lock);
+}
+
+static size_t env_size(const char *name, size_t def)
+{
+    const char *value = getenv(name);
+
+    return value != NULL ? strtoul(value, NULL, 10) : def;
+}
+
+#if defined(EDC_HAVE_ZSTD)
+static int zstd_init(void)
+{
+    const char *path = getenv("EVP_COMPRESS_ZSTD_DICT");
+    void *dict = NULL;
+    size_t size;
+    FILE *fp;
+
+    g_compress.cctx = ZSTD_createCCtx();
+    if (g_compress.cctx == NULL) {
+        return -ENOMEM;
+    }
+    if (path == NULL) {
+        return 0;
+    }
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        EVP_AGENT_WARN("failed to open the zstd dictionary %s: %s", path, strerror(errno));
+        return 0;
+    }
+    dict = malloc(COMPRESS_DICT_MAX_BYTES);
+    if (dict != NULL) {
+        size = fread(dict, 1, COMPRESS_DICT_MAX_BYTES, fp);
+        g_compress.cdict = ZSTD_createCDict(dict, size, COMPRESS_ZSTD_LEVEL);
+        if (g_compress.cdict == NULL) {
+            EVP_AGENT_WARN("failed to load the zstd dictionary %s", path);
+        }
+        else {
+            EVP_AGENT_INFO("zstd dictionary %u loaded", ZSTD_getDictID_fromDict(dict, size));
+        }
+    }
+    fclose(fp);
+    free(dict);
+    return 0;
+}
+#endif
+
+int evp_agent_compress_init(void)
+{
+    bool zstd = false;
+
+    for (int i = 0; i < EVP_AGENT_COMPRESS_CLASSES; i++) {
+        const char *value = getenv(g_classes[i].env);
+
+        g_compress.methods[i] = COMPRESS_NONE;
+        if (value == NULL || strcmp(value, "none") == 0) {
+            continue;
+        }
+        if (strcmp(value, "deflate") == 0) {
+            g_compress.methods[i] = COMPRESS_DEFLATE;
+        }
+        else if (strcmp(value, "zstd") == 0) {
+#if defined(EDC_HAVE_ZSTD)
+            g_compress.methods[i] = COMPRESS_ZSTD;
+            zstd = true;
+#else
+            EVP_AGENT_WARN("%s: built without zstd, using deflate", g_classes[i].env);
+            g_compress.methods[i] = COMPRESS_DEFLATE;
+#endif
+        }
+        else {
+            EVP_AGENT_WARN("%s: unknown compression %s", g_classes[i].env, value);
+        }
+    }
+    g_compress.min_bytes = env_size("EVP_COMPRESS_MIN_BYTES", COMPRESS_MIN_BYTES_DEFAULT);
+    g_compress.blob_max_bytes =
+        env_size("EVP_COMPRESS_BLOB_MAX_BYTES", COMPRESS_BLOB_MAX_BYTES_DEFAULT);
+
+#if defined(EDC_HAVE_ZSTD)
+    if (zstd) {
+        int ret = zstd_init();
+
+        if (ret) {
+            return ret;
+        }
+    }
+#else
+    (void)zstd;
+#endif
+
+    return evp_agent_metrics_register("compress", NULL, compress_report, NULL);
+}
+
+void evp_agent_compress_deinit(void)
+{
+    for (int i = 0; i < EVP_AGENT_COMPRESS_CLASSES; i++) {
+        g_compress.methods[i] = COMPRESS_NONE;
+    }
+#if defined(EDC_HAVE_ZSTD)
+    ZSTD_freeCDict(g_compress.cdict);
+    g_compress.cdict = NULL;
+    ZSTD_freeCCtx(g_compress.cctx);
+    g_compress.cctx = NULL;
+#endif
+}
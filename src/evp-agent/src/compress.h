@@ -0,0 +1,59 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_COMPRESS_H__
+#define __EVP_COMPRESS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Payload compression.
+ *
+ * The EVP agent library sends telemetry, device state and blob uploads as
+ * they are, mostly repetitive JSON. Each class of payload can instead be
+ * compressed, as set with EVP_COMPRESS_TELEMETRY, EVP_COMPRESS_STATE and
+ * EVP_COMPRESS_BLOB, to what the hub side was set up to accept:
+ *
+ * - none, the default,
+ * - deflate, a zlib stream, whose first byte is 0x78,
+ * - zstd, a zstd frame, with the trained dictionary in
+ *   EVP_COMPRESS_ZSTD_DICT if set, whose ID the frame carries so the hub
+ *   picks the same one. Builds without libzstd use deflate instead.
+ *
+ * MQTT 3.1.1 has no content type, so a compressed MQTT payload is told from
+ * a JSON one by its first byte. Blob uploads carry a Content-Encoding
+ * header. Payloads smaller than EVP_COMPRESS_MIN_BYTES (256 by default),
+ * blobs larger than EVP_COMPRESS_BLOB_MAX_BYTES (8 MiB by default), images
+ * and other already compressed blobs, and payloads that do not shrink by at
+ * least a sixteenth are sent as they are.
+ *
+ * Compression ratios and the CPU time they cost are reported per class in
+ * the metrics.
+ */
+
+enum evp_agent_compress_class {
+    EVP_AGENT_COMPRESS_TELEMETRY,
+    EVP_AGENT_COMPRESS_STATE,
+    EVP_AGENT_COMPRESS_BLOB,
+    EVP_AGENT_COMPRESS_CLASSES,
+};
+
+int evp_agent_compress_init(void);
+void evp_agent_compress_deinit(void);
+
+/* The class of the payloads of an MQTT topic, EVP_AGENT_COMPRESS_CLASSES if none */
+enum evp_agent_compress_class evp_agent_compress_topic_class(const char *topic);
+/* A payload of the class and size may be compressed */
+bool evp_agent_compress_wants(enum evp_agent_compress_class cls, size_t size);
+/*
+ * Compresses a payload into *out, to be freed, with its Content-Encoding.
+ * False if it is to be sent as is.
+ */
+bool evp_agent_compress(enum evp_agent_compress_class cls, const void *data, size_t size,
+                        void **out, size_t *out_size, const char **encoding);
+
+#endif /* __EVP_COMPRESS_H__ */
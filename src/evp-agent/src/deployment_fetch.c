@@ -0,0 +1,819 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for memmem */
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mbedtls/sha256.h>
+#include <parson.h>
+#include <webclient/webclient.h>
+
+#include "deployment_fetch.h"
+#include "esf.h"
+#include "http_pool.h"
+#include "log.h"
+#include "metrics.h"
+#include "module_cache.h"
+#include "wasm_runtime_wrap.h"
+
+#define DEPLOY_FETCH_WORKERS_DEFAULT 3
+#define DEPLOY_FETCH_WORKERS_MAX 16
+#define DEPLOY_FETCH_DEFAULT_DIR "/var/lib/edge-device-core/module-fetch"
+#define DEPLOY_FETCH_BUFFER_SIZE (16 * 1024)
+#define DEPLOY_FETCH_TIMEOUT_SEC 60
+#define DEPLOY_FETCH_ID_SIZE 128
+#define DEPLOY_FETCH_TIMELINE_SIZE 256
+/* Shared attributes, and the responses to their requests */
+#define ATTRIBUTES_TOPIC "v1/devices/me/attributes"
+
+enum fetch_stage {
+    FETCH_QUEUED,
+    FETCH_DOWNLOADING,
+    FETCH_VERIFYING,
+    FETCH_READY,
+    FETCH_INSTANTIATING,
+    FETCH_RUNNING,
+    FETCH_FAILED,
+    FETCH_STAGES,
+};
+
+static const char *const g_stage_names[FETCH_STAGES] = {
+    [FETCH_QUEUED] = "queued",
+    [FETCH_DOWNLOADING] = "downloading",
+    [FETCH_VERIFYING] = "verifying",
+    [FETCH_READY] = "verified",
+    [FETCH_INSTANTIATING] = "instantiating",
+    [FETCH_RUNNING] = "running",
+    [FETCH_FAILED] = "failed",
+};
+
+/* A module of the deployment */
+struct fetch {
+    TAILQ_ENTRY(fetch) q;
+    char *module_id;
+    char *url;
+    /* Of the manifest, empty if it has none to verify against */
+    char hash[EVP_WASM_DIGEST_LEN];
+    char *path;
+    enum fetch_stage stage;
+    /* Handed to the agent, and its file removed unless cached */
+    bool served;
+    /* Its file is the one of the module cache */
+    bool cached;
+    /* Out of the deployment, freed by the last thread using it */
+    bool dropped;
+    unsigned int refs;
+    size_t size;
+    uint64_t stamps[FETCH_STAGES];
+};
+
+TAILQ_HEAD(fetch_head, fetch);
+
+struct fetch_job {
+    struct fetch *f;
+    struct webclient_context c;
+    mbedtls_sha256_context sha;
+    int fd;
+    size_t size;
+};
+
+static struct {
+    unsigned int workers;
+    pthread_t threads[DEPLOY_FETCH_WORKERS_MAX];
+    unsigned int started;
+    char *dir;
+    char deployment_id[DEPLOY_FETCH_ID_SIZE];
+    struct fetch_head fetches;
+    /* The fetches of a deployment are under way, since batch_start_us */
+    bool batch;
+    uint64_t batch_start_us;
+    bool stopping;
+    unsigned int seq;
+    uint64_t deployments;
+    uint64_t fetched;
+    uint64_t failed;
+    uint64_t bytes;
+    /* Of the batches: their time, and the one of their fetches in a row */
+    uint64_t wall_us;
+    uint64_t serial_us;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} g_deployment_fetch = {.fetches = TAILQ_HEAD_INITIALIZER(g_deployment_fetch.fetches),
+                        .lock = PTHREAD_MUTEX_INITIALIZER,
+                        .cond = PTHREAD_COND_INITIALIZER};
+
+static void fetch_set_stage(struct fetch *f, enum fetch_stage stage)
+{
+    f->stage = stage;
+    f->stamps[stage] = evp_agent_now_us();
+    pthread_cond_broadcast(&g_deployment_fetch.cond);
+}
+
+static void fetch_free(struct fetch *f)
+{
+    if (!f->served && !f->cached && f->path != NULL) {
+        unlink(f->path);
+    }
+    if (f->hash[0] != '\0') {
+        evp_agent_module_cache_unref(f->hash);
+    }
+    free(f->path);
+    free(f->url);
+    free(f->module_id);
+    free(f);
+}
+
+static void fetch_put(struct fetch *f)
+{
+    if (--f->refs == 0 && f->dropped) {
+        fetch_free(f);
+    }
+}
+
+static void fetch_drop(struct fetch *f)
+{
+    TAILQ_REMOVE(&g_deployment_fetch.fetches, f, q);
+    f->dropped = true;
+    pthread_cond_broadcast(&g_deployment_fetch.cond);
+    if (f->refs == 0) {
+        fetch_free(f);
+    }
+}
+
+static struct fetch *fetch_lookup(const char *url)
+{
+    struct fetch *f;
+
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        if (strcmp(f->url, url) == 0) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static bool hash_valid(const char *hash)
+{
+    if (hash == NULL || strlen(hash) != EVP_WASM_DIGEST_LEN - 1) {
+        return false;
+    }
+    return strspn(hash, "0123456789abcdef") == EVP_WASM_DIGEST_LEN - 1;
+}
+
+static void fetch_add(const char *module_id, const char *url, const char *hash)
+{
+    struct fetch *f = calloc(1, sizeof(*f));
+    char *cached = NULL;
+    int ret;
+
+    if (f == NULL) {
+        return;
+    }
+    f->module_id = strdup(module_id);
+    f->url = strdup(url);
+    if (hash_valid(hash)) {
+        ret = asprintf(&f->path, "%s/%s", g_deployment_fetch.dir, hash);
+    }
+    else {
+        ret = asprintf(&f->path, "%s/module-%u", g_deployment_fetch.dir,
+                       g_deployment_fetch.seq++);
+    }
+    if (ret < 0) {
+        f->path = NULL;
+    }
+    if (f->module_id == NULL || f->url == NULL || f->path == NULL) {
+        fetch_free(f);
+        return;
+    }
+    fetch_set_stage(f, FETCH_QUEUED);
+    TAILQ_INSERT_TAIL(&g_deployment_fetch.fetches, f, q);
+
+    if (!hash_valid(hash)) {
+        return;
+    }
+    snprintf(f->hash, sizeof(f->hash), "%s", hash);
+    evp_agent_module_cache_ref(hash);
+    /* Verified when it went in, nothing to download */
+    cached = evp_agent_module_cache_lookup(hash, &f->size);
+    if (cached != NULL) {
+        free(f->path);
+        f->path = cached;
+        f->cached = true;
+        fetch_set_stage(f, FETCH_READY);
+    }
+}
+
+/* A module the new deployment keeps, to serve again */
+static void fetch_reset(struct fetch *f)
+{
+    char *cached;
+
+    if (f->stage == FETCH_QUEUED || f->stage == FETCH_DOWNLOADING ||
+        f->stage == FETCH_VERIFYING) {
+        return;
+    }
+    memset(f->stamps, 0, sizeof(f->stamps));
+    f->served = false;
+    fetch_set_stage(f, FETCH_QUEUED);
+    if (!f->cached) {
+        return;
+    }
+    cached = evp_agent_module_cache_lookup(f->hash, &f->size);
+    if (cached != NULL) {
+        free(f->path);
+        f->path = cached;
+        fetch_set_stage(f, FETCH_READY);
+    }
+}
+
+static unsigned int fetch_queued(void)
+{
+    unsigned int n = 0;
+    struct fetch *f;
+
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        n += f->stage == FETCH_QUEUED;
+    }
+    return n;
+}
+
+/* The deployment of a shared attributes message, NULL if it has none */
+static JSON_Value *manifest_parse(const char *topic, size_t topic_len, const void *msg,
+                                  size_t size)
+{
+    static const char key[] = "\"deployment\"";
+    JSON_Value *value, *deployment = NULL;
+    JSON_Object *root, *shared;
+    const char *str;
+    char *text;
+
+    if (topic_len < strlen(ATTRIBUTES_TOPIC) ||
+        memcmp(topic, ATTRIBUTES_TOPIC, strlen(ATTRIBUTES_TOPIC)) != 0 ||
+        memmem(msg, size, key, strlen(key)) == NULL) {
+        return NULL;
+    }
+    text = strndup(msg, size);
+    if (text == NULL) {
+        return NULL;
+    }
+    value = json_parse_string(text);
+    free(text);
+
+    root = json_value_get_object(value);
+    shared = json_object_get_object(root, "shared");
+    if (shared != NULL) {
+        root = shared;
+    }
+    /* A JSON string with EVP2, an object with EVP1 */
+    str = json_object_get_string(root, "deployment");
+    if (str != NULL) {
+        deployment = json_parse_string(str);
+    }
+    else if (json_object_get_object(root, "deployment") != NULL) {
+        deployment = json_value_deep_copy(json_object_get_value(root, "deployment"));
+    }
+    json_value_free(value);
+    return deployment;
+}
+
+static bool manifest_has(const JSON_Object *modules, const struct fetch *f)
+{
+    for (size_t i = 0; i < json_object_get_count(modules); i++) {
+        const JSON_Object *module = json_value_get_object(json_object_get_value_at(modules, i));
+        const char *url = json_object_get_string(module, "downloadUrl");
+        const char *hash = json_object_get_string(module, "hash");
+
+        if (url != NULL && strcmp(url, f->url) == 0 &&
+            strcmp(hash_valid(hash) ? hash : "", f->hash) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void evp_agent_deployment_fetch_received(const char *topic, size_t topic_len, const void *msg,
+                                         size_t size)
+{
+    JSON_Value *value;
+    JSON_Object *deployment, *modules;
+    struct fetch *f, *tmp;
+    const char *id;
+
+    if (g_deployment_fetch.workers == 0) {
+        return;
+    }
+    value = manifest_parse(topic, topic_len, msg, size);
+    if (value == NULL) {
+        return;
+    }
+    deployment = json_value_get_object(value);
+    id = json_object_get_string(deployment, "deploymentId");
+    modules = json_object_get_object(deployment, "modules");
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    if (id == NULL || strcmp(id, g_deployment_fetch.deployment_id) == 0) {
+        pthread_mutex_unlock(&g_deployment_fetch.lock);
+        json_value_free(value);
+        return;
+    }
+    snprintf(g_deployment_fetch.deployment_id, sizeof(g_deployment_fetch.deployment_id), "%s",
+             id);
+    g_deployment_fetch.deployments++;
+
+    /* The modules the new deployment keeps go on where they are */
+    TAILQ_FOREACH_SAFE(f, &g_deployment_fetch.fetches, q, tmp)
+    {
+        if (!manifest_has(modules, f)) {
+            fetch_drop(f);
+        }
+        else {
+            fetch_reset(f);
+        }
+    }
+    for (size_t i = 0; i < json_object_get_count(modules); i++) {
+        const JSON_Object *module = json_value_get_object(json_object_get_value_at(modules, i));
+        const char *url = json_object_get_string(module, "downloadUrl");
+
+        if (url != NULL && fetch_lookup(url) == NULL) {
+            fetch_add(json_object_get_name(modules, i), url,
+                      json_object_get_string(module, "hash"));
+        }
+    }
+    if (!g_deployment_fetch.batch && fetch_queued() != 0) {
+        g_deployment_fetch.batch = true;
+        g_deployment_fetch.batch_start_us = evp_agent_now_us();
+    }
+    /* For the workers */
+    pthread_cond_broadcast(&g_deployment_fetch.cond);
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    json_value_free(value);
+}
+
+static int fetch_sink(char **buffer, int offset, int datend, int *buflen, void *arg)
+{
+    struct fetch_job *job = arg;
+    const char *data = *buffer + offset;
+    size_t len = datend - offset;
+    bool cancelled;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    cancelled = g_deployment_fetch.stopping || job->f->dropped;
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+    if (cancelled) {
+        return -ECANCELED;
+    }
+
+    mbedtls_sha256_update(&job->sha, (const unsigned char *)data, len);
+    job->size += len;
+    while (len > 0) {
+        ssize_t n = write(job->fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+bool evp_agent_deployment_fetch_is(const struct webclient_context *ctx)
+{
+    bool is;
+
+    /* The fetches themselves come back through the wrap of webclient_perform() */
+    if (g_deployment_fetch.workers == 0 || ctx->url == NULL || ctx->sink_callback == NULL ||
+        ctx->sink_callback == fetch_sink ||
+        (ctx->method != NULL && strcmp(ctx->method, "GET") != 0)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    is = fetch_lookup(ctx->url) != NULL;
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    return is;
+}
+
+/*
+ * The transport of a fetch, false to leave the module to the agent: HTTPS
+ * runs on the pooled connections, through the proxy of the agent if any,
+ * and plain HTTP only goes direct
+ */
+static bool fetch_transport(struct webclient_context *c)
+{
+    const char *host, *port, *username, *password;
+    bool proxy = evp_agent_esf_get_proxy(&host, &port, &username, &password);
+
+    if (strncmp(c->url, "https://", 8) == 0) {
+        c->tls_ops = evp_agent_http_pool_tls_ops();
+        c->proxy = proxy ? host : NULL;
+        return c->tls_ops != NULL;
+    }
+    return strncmp(c->url, "http://", 7) == 0 && !proxy;
+}
+
+/* Downloads a module with a request of its own */
+static void fetch_download(struct fetch *f)
+{
+    struct fetch_job job = {.f = f, .fd = -1};
+    unsigned char hash[32];
+    char digest[EVP_WASM_DIGEST_LEN];
+    char *cached = NULL;
+    bool ok;
+    int ret;
+
+    job.c.method = "GET";
+    job.c.url = f->url;
+    job.c.timeout_sec = DEPLOY_FETCH_TIMEOUT_SEC;
+    if (!fetch_transport(&job.c)) {
+        EVP_AGENT_DBG("module %s is left to the agent", f->module_id);
+        pthread_mutex_lock(&g_deployment_fetch.lock);
+        fetch_set_stage(f, FETCH_FAILED);
+        pthread_mutex_unlock(&g_deployment_fetch.lock);
+        return;
+    }
+    job.c.buflen = DEPLOY_FETCH_BUFFER_SIZE;
+    job.c.buffer = malloc(job.c.buflen);
+    job.c.sink_callback = fetch_sink;
+    job.c.sink_callback_arg = &job;
+    mbedtls_sha256_init(&job.sha);
+    mbedtls_sha256_starts(&job.sha, 0);
+
+    if (job.c.buffer == NULL) {
+        ret = -ENOMEM;
+    }
+    else {
+        job.fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        /* Through the wrap, for the resumes */
+        ret = job.fd < 0 ? -errno : webclient_perform(&job.c);
+    }
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    fetch_set_stage(f, FETCH_VERIFYING);
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    /* Hashed as it streamed in, only the digest is left to compare */
+    mbedtls_sha256_finish(&job.sha, hash);
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        snprintf(&digest[i * 2], 3, "%02x", hash[i]);
+    }
+    if (job.fd >= 0 && close(job.fd) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    ok = ret == 0 && job.c.http_status == 200;
+    if (!ok) {
+        EVP_AGENT_WARN("failed to fetch module %s: %d (HTTP %u)", f->module_id, ret,
+                       job.c.http_status);
+    }
+    else if (f->hash[0] != '\0' && strcmp(digest, f->hash) != 0) {
+        EVP_AGENT_WARN("module %s does not match its hash: sha256 %s", f->module_id, digest);
+        ok = false;
+    }
+    if (!ok) {
+        unlink(f->path);
+    }
+    else if (f->hash[0] != '\0' &&
+             evp_agent_module_cache_insert(f->hash, f->path, job.size, &cached) != 0) {
+        cached = NULL;
+    }
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    if (cached != NULL) {
+        free(f->path);
+        f->path = cached;
+        f->cached = true;
+    }
+    f->size = job.size;
+    fetch_set_stage(f, ok ? FETCH_READY : FETCH_FAILED);
+    if (ok) {
+        g_deployment_fetch.fetched++;
+        g_deployment_fetch.bytes += job.size;
+    }
+    else {
+        g_deployment_fetch.failed++;
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    mbedtls_sha256_free(&job.sha);
+    free(job.c.buffer);
+}
+
+/* The fetches of a batch, one after the other */
+static uint64_t batch_serial_us(uint64_t start)
+{
+    uint64_t sum = 0;
+    struct fetch *f;
+
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        uint64_t end = f->stamps[FETCH_FAILED] ? f->stamps[FETCH_FAILED] : f->stamps[FETCH_READY];
+
+        if (f->stamps[FETCH_DOWNLOADING] >= start && end > f->stamps[FETCH_DOWNLOADING]) {
+            sum += end - f->stamps[FETCH_DOWNLOADING];
+        }
+    }
+    return sum;
+}
+
+/* Accounts for the batch once none of its fetches is left, with the lock held */
+static void batch_check(void)
+{
+    uint64_t wall, serial;
+    struct fetch *f;
+
+    if (!g_deployment_fetch.batch) {
+        return;
+    }
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        if (f->stage == FETCH_QUEUED || f->stage == FETCH_DOWNLOADING ||
+            f->stage == FETCH_VERIFYING) {
+            return;
+        }
+    }
+    g_deployment_fetch.batch = false;
+    wall = evp_agent_now_us() - g_deployment_fetch.batch_start_us;
+    serial = batch_serial_us(g_deployment_fetch.batch_start_us);
+    g_deployment_fetch.wall_us += wall;
+    g_deployment_fetch.serial_us += serial;
+    EVP_AGENT_INFO("deployment %s: modules fetched by %u threads in %" PRIu64 " ms, %" PRIu64
+                   " ms one after the other",
+                   g_deployment_fetch.deployment_id, g_deployment_fetch.started, wall / 1000,
+                   serial / 1000);
+}
+
+static struct fetch *fetch_claim(void)
+{
+    struct fetch *f;
+
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        if (f->stage == FETCH_QUEUED) {
+            f->refs++;
+            fetch_set_stage(f, FETCH_DOWNLOADING);
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/* Fetches the modules of the deployments as their manifests come in */
+static void *fetch_thread(void *arg)
+{
+    struct fetch *f;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    while (!g_deployment_fetch.stopping) {
+        f = fetch_claim();
+        if (f == NULL) {
+            pthread_cond_wait(&g_deployment_fetch.cond, &g_deployment_fetch.lock);
+            continue;
+        }
+        pthread_mutex_unlock(&g_deployment_fetch.lock);
+        fetch_download(f);
+        pthread_mutex_lock(&g_deployment_fetch.lock);
+        fetch_put(f);
+        batch_check();
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+    return NULL;
+}
+
+/* Hands the file of a module to the agent as the response to its request */
+static int fetch_replay(struct fetch *f, struct webclient_context *ctx)
+{
+    char length[32];
+    char *buf = ctx->buffer;
+    int buflen = ctx->buflen;
+    int fd, ret = 0;
+
+    fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        EVP_AGENT_WARN("failed to open the fetched module %s: %s", f->module_id,
+                       strerror(errno));
+        return -ENOENT;
+    }
+    /* The agent writes its own copy */
+    if (!f->cached) {
+        unlink(f->path);
+    }
+
+    ctx->http_status = 200;
+    if (ctx->header_callback != NULL) {
+        snprintf(length, sizeof(length), "Content-Length: %zu", f->size);
+        ret = ctx->header_callback(length, false, ctx->header_callback_arg);
+    }
+    while (ret == 0) {
+        ssize_t n = read(fd, buf, buflen);
+
+        if (n <= 0) {
+            ret = n < 0 ? -errno : 0;
+            break;
+        }
+        ret = ctx->sink_callback(&buf, 0, n, &buflen, ctx->sink_callback_arg);
+    }
+    close(fd);
+    return ret;
+}
+
+int evp_agent_deployment_fetch_serve(struct webclient_context *ctx)
+{
+    struct fetch *f;
+    bool ready;
+    int ret;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    f = fetch_lookup(ctx->url);
+    if (f == NULL) {
+        pthread_mutex_unlock(&g_deployment_fetch.lock);
+        return -ENOENT;
+    }
+    f->refs++;
+
+    /* Not claimed by a worker yet: the agent would wait for it anyway */
+    if (f->stage == FETCH_QUEUED) {
+        fetch_set_stage(f, FETCH_DOWNLOADING);
+        pthread_mutex_unlock(&g_deployment_fetch.lock);
+        fetch_download(f);
+        pthread_mutex_lock(&g_deployment_fetch.lock);
+        batch_check();
+    }
+    while (f->stage == FETCH_DOWNLOADING || f->stage == FETCH_VERIFYING) {
+        pthread_cond_wait(&g_deployment_fetch.cond, &g_deployment_fetch.lock);
+    }
+    /* A cached file stays, whatever the agent made of it */
+    ready = !f->dropped && (f->cached ? f->stage >= FETCH_READY
+                                      : f->stage == FETCH_READY && !f->served);
+    f->served |= ready;
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    ret = ready ? fetch_replay(f, ctx) : -ENOENT;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    fetch_put(f);
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    return ret;
+}
+
+static void fetch_timeline(const struct fetch *f)
+{
+    char timeline[DEPLOY_FETCH_TIMELINE_SIZE];
+    size_t len = 0;
+
+    for (int i = FETCH_QUEUED + 1; i < FETCH_STAGES && len < sizeof(timeline); i++) {
+        if (f->stamps[i] != 0) {
+            len += snprintf(timeline + len, sizeof(timeline) - len, " %s=%" PRIu64,
+                            g_stage_names[i], (f->stamps[i] - f->stamps[FETCH_QUEUED]) / 1000);
+        }
+    }
+    EVP_AGENT_INFO("deployment %s module %s: bytes=%zu ms since queued:%s",
+                   g_deployment_fetch.deployment_id, f->module_id, f->size, timeline);
+}
+
+void evp_agent_deployment_fetch_loading(const char *digest)
+{
+    struct fetch *f;
+
+    if (digest[0] == '\0') {
+        return;
+    }
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        if (f->served && f->stage == FETCH_READY && strcmp(f->hash, digest) == 0) {
+            fetch_set_stage(f, FETCH_INSTANTIATING);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+}
+
+void evp_agent_deployment_fetch_instantiated(const char *digest, bool ok)
+{
+    struct fetch *f;
+
+    if (digest[0] == '\0') {
+        return;
+    }
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    TAILQ_FOREACH(f, &g_deployment_fetch.fetches, q)
+    {
+        if (f->stage == FETCH_INSTANTIATING && strcmp(f->hash, digest) == 0) {
+            fetch_set_stage(f, ok ? FETCH_RUNNING : FETCH_FAILED);
+            fetch_timeline(f);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+}
+
+static void deployment_fetch_report(void *user)
+{
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    if (g_deployment_fetch.fetched != 0 || g_deployment_fetch.failed != 0) {
+        EVP_AGENT_INFO("deployment fetch: deployments=%" PRIu64 " fetched=%" PRIu64
+                       " failed=%" PRIu64 " kib=%" PRIu64 " wall_ms=%" PRIu64
+                       " serial_ms=%" PRIu64 " saved_ms=%" PRIu64,
+                       g_deployment_fetch.deployments, g_deployment_fetch.fetched,
+                       g_deployment_fetch.failed, g_deployment_fetch.bytes / 1024,
+                       g_deployment_fetch.wall_us / 1000, g_deployment_fetch.serial_us / 1000,
+                       g_deployment_fetch.serial_us > g_deployment_fetch.wall_us
+                           ? (g_deployment_fetch.serial_us - g_deployment_fetch.wall_us) / 1000
+                           : 0);
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+}
+
+int evp_agent_deployment_fetch_init(void)
+{
+    const char *workers = getenv("EVP_DEPLOY_FETCH_WORKERS");
+    const char *dir = getenv("EVP_DEPLOY_FETCH_DIR");
+    int ret;
+
+    g_deployment_fetch.stopping = false;
+    g_deployment_fetch.workers = DEPLOY_FETCH_WORKERS_DEFAULT;
+    if (workers != NULL) {
+        g_deployment_fetch.workers = strtoul(workers, NULL, 10);
+    }
+    if (g_deployment_fetch.workers > DEPLOY_FETCH_WORKERS_MAX) {
+        g_deployment_fetch.workers = DEPLOY_FETCH_WORKERS_MAX;
+    }
+
+    if (dir == NULL) {
+        dir = DEPLOY_FETCH_DEFAULT_DIR;
+    }
+    if (g_deployment_fetch.workers != 0 && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        EVP_AGENT_WARN("failed to create %s, modules are downloaded one at a time: %s", dir,
+                       strerror(errno));
+        g_deployment_fetch.workers = 0;
+    }
+    g_deployment_fetch.dir = strdup(dir);
+    if (g_deployment_fetch.dir == NULL) {
+        return -ENOMEM;
+    }
+
+    /* Short of threads, the agent still fetches each module as it asks for it */
+    g_deployment_fetch.started = 0;
+    while (g_deployment_fetch.started < g_deployment_fetch.workers) {
+        ret = pthread_create(&g_deployment_fetch.threads[g_deployment_fetch.started], NULL,
+                             fetch_thread, NULL);
+        if (ret) {
+            EVP_AGENT_WARN("failed to create a module fetch thread: %s", strerror(ret));
+            break;
+        }
+        g_deployment_fetch.started++;
+    }
+
+    return evp_agent_metrics_register("deployment_fetch", NULL, deployment_fetch_report, NULL);
+}
+
+void evp_agent_deployment_fetch_deinit(void)
+{
+    struct fetch *f, *tmp;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    g_deployment_fetch.stopping = true;
+    g_deployment_fetch.workers = 0;
+    pthread_cond_broadcast(&g_deployment_fetch.cond);
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    for (unsigned int i = 0; i < g_deployment_fetch.started; i++) {
+        pthread_join(g_deployment_fetch.threads[i], NULL);
+    }
+    g_deployment_fetch.started = 0;
+
+    pthread_mutex_lock(&g_deployment_fetch.lock);
+    g_deployment_fetch.batch = false;
+    g_deployment_fetch.deployment_id[0] = '\0';
+    TAILQ_FOREACH_SAFE(f, &g_deployment_fetch.fetches, q, tmp)
+    {
+        fetch_drop(f);
+    }
+    pthread_mutex_unlock(&g_deployment_fetch.lock);
+
+    free(g_deployment_fetch.dir);
+    g_deployment_fetch.dir = NULL;
+}
@@ -0,0 +1,61 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_DEPLOYMENT_FETCH_H__
+#define __EVP_DEPLOYMENT_FETCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Concurrent module downloads.
+ *
+ * The EVP agent library reconciles a deployment by downloading its modules
+ * one after the other, so a deployment of several modules takes the sum of
+ * their download times. The deployment manifests it receives over MQTT are
+ * read here too (see mqtt_buffers.h), and as soon as one comes:
+ *
+ * - its modules are fetched by EVP_DEPLOY_FETCH_WORKERS threads (3 by
+ *   default, 0 disables this) started with the agent, into
+ *   EVP_DEPLOY_FETCH_DIR (/var/lib/edge-device-core/module-fetch by
+ *   default), each with a request of its own: HTTPS ones on the pooled
+ *   connections of http_pool.h, which own their TLS setup, so a module is
+ *   left to the agent when the pool is off,
+ * - each is verified against the hash of the manifest as it streams in,
+ *   and kept in the module cache of module_cache.h, which answers the
+ *   modules it already has without any download,
+ * - the request of the agent for a module, through its HTTP client (wrapped
+ *   at link time, see webclient_wrap.c), is answered from its file as soon
+ *   as it is verified, so the agent goes on to load and instantiate it while
+ *   the others are still downloading. A module no worker took yet is
+ *   fetched by the thread of the request, and one that failed is requested
+ *   again as usual.
+ *
+ * The timeline of each module (queued, downloading, verifying,
+ * instantiating, running, in milliseconds since the manifest came) is logged
+ * once it runs, and the download time the concurrency saved is reported in
+ * the metrics.
+ */
+
+struct webclient_context;
+
+int evp_agent_deployment_fetch_init(void);
+void evp_agent_deployment_fetch_deinit(void);
+
+/* An MQTT message the agent received, which may carry a deployment manifest */
+void evp_agent_deployment_fetch_received(const char *topic, size_t topic_len, const void *msg,
+                                         size_t size);
+
+/* The request is a download of a module of the current deployment */
+bool evp_agent_deployment_fetch_is(const struct webclient_context *ctx);
+/* webclient_perform() of such a request, -ENOENT if it is to be requested as usual */
+int evp_agent_deployment_fetch_serve(struct webclient_context *ctx);
+
+/* A module is loaded, and was instantiated, from a binary of the given SHA-256 */
+void evp_agent_deployment_fetch_loading(const char *digest);
+void evp_agent_deployment_fetch_instantiated(const char *digest, bool ok);
+
+#endif /* __EVP_DEPLOYMENT_FETCH_H__ */
@@ -169,6 +169,20 @@ end:
     return ret;
 }
 
+bool evp_agent_esf_get_proxy(const char **host, const char **port, const char **username,
+                             const char **password)
+{
+    if (g_proxy_cache.host == NULL) {
+        return false;
+    }
+
+    *host = g_proxy_cache.host;
+    *port = g_proxy_cache.port;
+    *username = g_proxy_cache.username;
+    *password = g_proxy_cache.password;
+    return true;
+}
+
 static int get_cert_key_path(enum config_key key, char **cert_key_path)
 {
     int ret = -ENOENT;
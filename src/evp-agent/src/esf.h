@@ -13,6 +13,8 @@ struct config;
 bool evp_agent_esf_is_tls_enabled(void);
 void evp_agent_esf_deinit_proxy_cache(void);
 int evp_agent_esf_init_proxy_cache(void);
+bool evp_agent_esf_get_proxy(const char **host, const char **port, const char **username,
+                             const char **password);
 struct config *evp_agent_esf_read_config(enum config_key key);
 
 #endif /* __EVP_ESF_H__ */
\ No newline at end of file
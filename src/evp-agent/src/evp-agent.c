@@ -27,10 +27,31 @@ extern void wasm_add_native_lib(const char *);
 #include "utility_log_module_id.h"
 
 /* Local Headers */
+#include "blob_download.h"
+#include "blob_upload.h"
+#include "compress.h"
+#include "deployment_fetch.h"
 #include "esf.h"
+#include "frame_share.h"
+#include "http_pool.h"
+#include "http_upload.h"
 #include "log.h"
+#include "metrics.h"
+#include "module_cache.h"
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
 #include "notifications.h"
+#include "reconnect.h"
 #include "sdk_backdoor.h"
+#include "telemetry_batch.h"
+#include "tls_session.h"
+#include "tls_suites.h"
+#include "wasi_nn_bind.h"
+#include "wasi_threads_pool.h"
+#include "wasm_module_map.h"
+#include "wasm_pool.h"
+#include "wasm_profile.h"
+#include "wasm_reclaim.h"
 
 // Define CONFIG_EXTERNAL_POWER_MANAGER_SW_WDT_ID_1 if it is not defined yet for Raspberry Pi
 #ifndef CONFIG_EXTERNAL_POWER_MANAGER_SW_WDT_ID_1
@@ -80,6 +101,8 @@ struct native_symbol_entry {
     const char *module_name;
     NativeSymbol *native_symbols;
     uint32_t n_native_symbols;
+    /* Registered with wasm_runtime_register_natives_raw() */
+    bool raw;
 };
 
 TAILQ_HEAD(native_symbol_entry_head, native_symbol_entry);
@@ -152,7 +175,7 @@ int EVP_undeployModules()
 }
 
 static int evp_agent_wasm_native_symbol_add(const char *module_name, NativeSymbol *native_symbols,
-                                            uint32_t n_native_symbols)
+                                            uint32_t n_native_symbols, bool raw)
 {
     if (module_name == NULL) {
         EVP_AGENT_ERR("module_name is NULL");
@@ -176,6 +199,7 @@ static int evp_agent_wasm_native_symbol_add(const char *module_name, NativeSymbo
     entry->module_name = module_name;
     entry->native_symbols = native_symbols;
     entry->n_native_symbols = n_native_symbols;
+    entry->raw = raw;
 
     pthread_mutex_lock(&g_wasm_native_symbols.lock);
     TAILQ_INSERT_TAIL(&g_wasm_native_symbols.queue, entry, q);
@@ -194,7 +218,24 @@ bool EVP_wasm_runtime_register_natives(const char *module_name, NativeSymbol *na
         return false;
     }
 
-    ret = evp_agent_wasm_native_symbol_add(module_name, native_symbols, n_native_symbols);
+    ret = evp_agent_wasm_native_symbol_add(module_name, native_symbols, n_native_symbols, false);
+    if (ret)
+        return false;
+
+    return true;
+}
+
+bool EVP_wasm_runtime_register_natives_raw(const char *module_name, NativeSymbol *native_symbols,
+                                           uint32_t n_native_symbols)
+{
+    int ret;
+
+    if (g_evp_agent.started) {
+        EVP_AGENT_ERR("EVP Agent has already started");
+        return false;
+    }
+
+    ret = evp_agent_wasm_native_symbol_add(module_name, native_symbols, n_native_symbols, true);
     if (ret)
         return false;
 
@@ -209,8 +250,17 @@ static int evp_agent_flush_wasm_native_symbols()
     TAILQ_FOREACH_SAFE(entry, &g_wasm_native_symbols.queue, q, tmp)
     {
         if (!ret) {
-            if (!wasm_runtime_register_natives(entry->module_name, entry->native_symbols,
-                                               entry->n_native_symbols)) {
+            bool registered;
+
+            if (entry->raw) {
+                registered = wasm_runtime_register_natives_raw(
+                    entry->module_name, entry->native_symbols, entry->n_native_symbols);
+            }
+            else {
+                registered = wasm_runtime_register_natives(
+                    entry->module_name, entry->native_symbols, entry->n_native_symbols);
+            }
+            if (!registered) {
                 EVP_AGENT_ERR("Failed to register native symbols");
                 ret = -1;
             }
@@ -268,9 +318,89 @@ static void *evp_agent_thread(void *data)
     if (ret)
         goto out_deinit_proxy_cache;
 
+    ret = evp_agent_wasm_profile_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_frame_share_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_wasi_nn_bind_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_wasm_pool_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_wasm_module_map_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_wasm_reclaim_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_wasi_threads_pool_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_compress_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_mqtt_buffers_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_mqtt_store_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_telemetry_batch_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_blob_upload_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_blob_download_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_module_cache_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_http_pool_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_deployment_fetch_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_http_upload_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_tls_suites_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_tls_session_init();
+    if (ret)
+        goto out_deinit_metrics;
+
+    ret = evp_agent_reconnect_init();
+    if (ret)
+        goto out_deinit_metrics;
+
     ret = evp_agent_start(ctxt);
     if (ret)
-        goto out_deinit_proxy_cache;
+        goto out_deinit_metrics;
 
     ret = evp_agent_flush_wasm_native_symbols();
     if (ret)
@@ -292,11 +422,15 @@ static void *evp_agent_thread(void *data)
             EVP_AGENT_ERR("EsfPwrMgrSwWdtKeepalive failed: %d", wdt_err);
         }
         ret = evp_agent_loop(ctxt);
+        evp_agent_reconnect_poll(ctxt);
+        evp_agent_metrics_poll();
         if (g_evp_agent.signalled) {
             break;
         }
     }
 
+    evp_agent_telemetry_batch_flush();
+
     wdt_err = EsfPwrMgrSwWdtStop(EVP_SW_WDT_ID);
     if (wdt_err != kEsfPwrMgrOk) {
         EVP_AGENT_ERR("EsfPwrMgrSwWdtStop failed: %d", wdt_err);
@@ -306,6 +440,28 @@ out_disconnect_evp_agent:
     evp_agent_disconnect(ctxt);
 out_stop_evp_agent:
     evp_agent_stop(ctxt);
+    evp_agent_metrics_report();
+out_deinit_metrics:
+    evp_agent_reconnect_deinit();
+    evp_agent_wasm_pool_deinit();
+    evp_agent_wasm_reclaim_deinit();
+    evp_agent_wasi_threads_pool_deinit();
+    evp_agent_deployment_fetch_deinit();
+    evp_agent_http_pool_deinit();
+    evp_agent_tls_session_deinit();
+    evp_agent_tls_suites_deinit();
+    evp_agent_http_upload_deinit();
+    evp_agent_module_cache_deinit();
+    evp_agent_blob_download_deinit();
+    evp_agent_blob_upload_deinit();
+    evp_agent_telemetry_batch_deinit();
+    evp_agent_mqtt_store_deinit();
+    evp_agent_mqtt_buffers_deinit();
+    evp_agent_compress_deinit();
+    evp_agent_metrics_deinit();
+    evp_agent_wasi_nn_bind_deinit();
+    evp_agent_frame_share_deinit();
+    evp_agent_wasm_profile_deinit();
 out_deinit_proxy_cache:
     evp_agent_esf_deinit_proxy_cache();
 out_free_evp_agent:
@@ -334,8 +490,22 @@ static void evp_add_wasm_native_library(const char *fname)
 
 int evp_agent_startup()
 {
+    NativeSymbol *natives;
+    uint32_t n_natives;
     int ret;
 
+    evp_agent_frame_share_set_source(&evp_frame_share_senscord);
+    natives = evp_agent_frame_share_natives(&n_natives);
+    ret = evp_agent_wasm_native_symbol_add(EVP_FRAME_SHARE_MODULE_NAME, natives, n_natives, false);
+    if (ret)
+        return ret;
+
+    natives = evp_agent_wasi_nn_bind_natives(&n_natives);
+    ret = evp_agent_wasm_native_symbol_add(EVP_WASI_NN_BIND_MODULE_NAME, natives, n_natives,
+                                           false);
+    if (ret)
+        return ret;
+
     ret = pthread_create(&g_evp_agent.thread, NULL, evp_agent_thread, NULL);
     if (ret)
         return ret;
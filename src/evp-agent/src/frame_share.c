@@ -0,0 +1,520 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for mremap */
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <wasm_export.h>
+
+#include "evp_agent/senscord_zero_copy.h"
+#include "frame_share.h"
+#include "log.h"
+#include "metrics.h"
+
+#define FRAME_SHARE_MAX_WINDOWS_DEFAULT 4
+
+/*
+ * On 64-bit targets WAMR reserves the address range of the whole linear
+ * memory up front (hardware bound checks), so the memory never moves and
+ * pages inside it can be replaced. On 32-bit targets memory.grow may move
+ * the linear memory, turning any alias into a stale private copy, so frames
+ * are always copied there.
+ */
+#if UINTPTR_MAX > 0xffffffffu
+#define FRAME_SHARE_CAN_ALIAS 1
+#else
+#define FRAME_SHARE_CAN_ALIAS 0
+#endif
+
+struct frame_window {
+    TAILQ_ENTRY(frame_window) q;
+    wasm_module_inst_t inst;
+    /* Block allocated in the module heap, and the page-aligned window in it */
+    uint64_t block;
+    uint8_t *window;
+    size_t len;
+    /* Source pages mapped at the window, NULL when the window holds a copy */
+    const void *alias;
+    size_t alias_len;
+    /* Non-zero while the module holds a frame */
+    uint32_t handle;
+    uint64_t stream;
+    struct evp_frame_share_frame frame;
+    uint64_t last_used;
+};
+
+TAILQ_HEAD(frame_window_head, frame_window);
+
+/* A stream handle issued to a module instance */
+struct frame_stream {
+    TAILQ_ENTRY(frame_stream) q;
+    wasm_module_inst_t inst;
+    uint64_t stream;
+};
+
+TAILQ_HEAD(frame_stream_head, frame_stream);
+
+static struct {
+    const struct evp_frame_share_source *source;
+    struct frame_window_head windows;
+    struct frame_stream_head streams;
+    unsigned int max_windows;
+    uint32_t next_handle;
+    uint64_t tick;
+    struct evp_frame_share_stats stats;
+    pthread_mutex_t lock;
+} g_frame_share = {.windows = TAILQ_HEAD_INITIALIZER(g_frame_share.windows),
+                   .streams = TAILQ_HEAD_INITIALIZER(g_frame_share.streams),
+                   .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static size_t round_up(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+static unsigned int max_windows(void)
+{
+    if (g_frame_share.max_windows == 0) {
+        unsigned int max = FRAME_SHARE_MAX_WINDOWS_DEFAULT;
+        const char *env = getenv("EVP_SENSCORD_ZC_MAX_WINDOWS");
+
+        if (env != NULL && strtoul(env, NULL, 10) > 0) {
+            max = strtoul(env, NULL, 10);
+        }
+        g_frame_share.max_windows = max;
+    }
+
+    return g_frame_share.max_windows;
+}
+
+/* Put private anonymous memory back under an aliased window */
+static int window_unalias(struct frame_window *w)
+{
+    if (w->alias == NULL) {
+        return 0;
+    }
+
+    if (mmap(w->window, w->len, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0) == MAP_FAILED) {
+        EVP_AGENT_ERR("mmap failed: %s", strerror(errno));
+        return -errno;
+    }
+
+    w->alias = NULL;
+    w->alias_len = 0;
+    return 0;
+}
+
+static int window_alias(struct frame_window *w, const void *pages, size_t len)
+{
+#if FRAME_SHARE_CAN_ALIAS
+    /* An old_size of 0 duplicates a shared mapping instead of moving it */
+    if (mremap((void *)pages, 0, len, MREMAP_MAYMOVE | MREMAP_FIXED, w->window) == MAP_FAILED) {
+        return -errno;
+    }
+
+    w->alias = pages;
+    w->alias_len = len;
+
+    if (mprotect(w->window, len, PROT_READ) != 0) {
+        int ret = -errno;
+
+        window_unalias(w);
+        return ret;
+    }
+#if defined(MADV_POPULATE_READ)
+    /* Fault the page tables in at once rather than page by page */
+    madvise(w->window, len, MADV_POPULATE_READ);
+#endif
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+static struct frame_window *window_create(wasm_module_inst_t inst, size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct frame_window *w = calloc(1, sizeof(*w));
+    void *native = NULL;
+
+    if (w == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for frame_window");
+        return NULL;
+    }
+
+    w->block = wasm_runtime_module_malloc(inst, len + page, &native);
+    if (w->block == 0) {
+        /* Report the failure to the caller rather than trapping the module */
+        wasm_runtime_clear_exception(inst);
+        free(w);
+        return NULL;
+    }
+
+    w->inst = inst;
+    w->window = (uint8_t *)round_up((uintptr_t)native, page);
+    w->len = len;
+    TAILQ_INSERT_TAIL(&g_frame_share.windows, w, q);
+    return w;
+}
+
+/*
+ * The module heap is only freed while the instance is alive: once it is being
+ * destroyed, its linear memory goes away as a whole.
+ */
+static void window_destroy(struct frame_window *w, bool free_block)
+{
+    TAILQ_REMOVE(&g_frame_share.windows, w, q);
+
+    /* A window still aliased cannot be given back to the module heap */
+    if (window_unalias(w) == 0 && free_block) {
+        wasm_runtime_module_free(w->inst, w->block);
+    }
+    free(w);
+}
+
+/*
+ * The frame of a window goes back to its source, which may reuse the buffer
+ * for another frame: the module must not see its pages any more.
+ */
+static void window_release(struct frame_window *w)
+{
+    w->handle = 0;
+    if (w->alias != NULL && window_unalias(w) != 0 &&
+        mprotect(w->window, w->alias_len, PROT_NONE) != 0) {
+        EVP_AGENT_ERR("failed to unmap a released frame: %s", strerror(errno));
+    }
+}
+
+/*
+ * Pick the window for a frame of the given size, in order of preference: the
+ * least recently used idle window it fits in, a new window, and finally a new
+ * window replacing the least recently used idle one.
+ */
+static int window_get(wasm_module_inst_t inst, size_t len, struct frame_window **wp)
+{
+    struct frame_window *w, *lru = NULL, *lru_fit = NULL;
+    unsigned int count = 0;
+
+    TAILQ_FOREACH(w, &g_frame_share.windows, q)
+    {
+        if (w->inst != inst) {
+            continue;
+        }
+        count++;
+        if (w->handle != 0) {
+            continue;
+        }
+        if (lru == NULL || w->last_used < lru->last_used) {
+            lru = w;
+        }
+        if (w->len >= len && (lru_fit == NULL || w->last_used < lru_fit->last_used)) {
+            lru_fit = w;
+        }
+    }
+
+    if (lru_fit != NULL) {
+        *wp = lru_fit;
+        return 0;
+    }
+    if (count < max_windows()) {
+        *wp = window_create(inst, len);
+        return *wp != NULL ? 0 : -ENOMEM;
+    }
+    if (lru == NULL) {
+        /* Every window holds a frame */
+        return -EBUSY;
+    }
+
+    window_destroy(lru, true);
+    *wp = window_create(inst, len);
+    return *wp != NULL ? 0 : -ENOMEM;
+}
+
+static uint32_t next_handle(void)
+{
+    if (++g_frame_share.next_handle == 0) {
+        g_frame_share.next_handle = 1;
+    }
+
+    return g_frame_share.next_handle;
+}
+
+static bool stream_issued(wasm_module_inst_t inst, uint64_t stream)
+{
+    struct frame_stream *s;
+
+    TAILQ_FOREACH(s, &g_frame_share.streams, q)
+    {
+        if (s->inst == inst && s->stream == stream) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int32_t native_get_frame(wasm_exec_env_t exec_env, uint64_t stream, uint32_t channel_id,
+                                int32_t timeout_ms, void *info_buf, uint32_t info_size)
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+    const struct evp_frame_share_source *source = g_frame_share.source;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    struct senscord_zc_frame_info info = {0};
+    struct evp_frame_share_frame frame;
+    struct frame_window *w;
+    int ret;
+
+    if (info_size < sizeof(info)) {
+        return -EINVAL;
+    }
+    if (source == NULL) {
+        return -ENOTSUP;
+    }
+
+    /* The handle is a native pointer the source dereferences */
+    pthread_mutex_lock(&g_frame_share.lock);
+    if (!stream_issued(inst, stream)) {
+        pthread_mutex_unlock(&g_frame_share.lock);
+        return -EBADF;
+    }
+    pthread_mutex_unlock(&g_frame_share.lock);
+
+    ret = source->get_frame(stream, channel_id, timeout_ms, &frame);
+    if (ret) {
+        return ret;
+    }
+
+    const void *pages = (const void *)((uintptr_t)frame.data & ~(uintptr_t)(page - 1));
+    size_t offset = (uintptr_t)frame.data - (uintptr_t)pages;
+    size_t len = round_up(offset + frame.size, page);
+
+    if (len == 0) {
+        len = page;
+    }
+
+    pthread_mutex_lock(&g_frame_share.lock);
+
+    ret = window_get(inst, len, &w);
+    if (ret) {
+        goto err_unlock;
+    }
+
+    /* Left aliased only if unmapping it failed at its last release */
+    ret = window_unalias(w);
+    if (ret) {
+        window_destroy(w, false);
+        goto err_unlock;
+    }
+
+    if (window_alias(w, pages, len) == 0) {
+        g_frame_share.stats.remaps++;
+    }
+    else {
+        memcpy(w->window + offset, frame.data, frame.size);
+        g_frame_share.stats.bytes_copied += frame.size;
+    }
+
+    w->handle = next_handle();
+    w->stream = stream;
+    w->frame = frame;
+    w->last_used = ++g_frame_share.tick;
+
+    g_frame_share.stats.frames++;
+    if (w->alias != NULL) {
+        g_frame_share.stats.mapped++;
+        info.flags |= SENSCORD_ZC_FLAG_MAPPED;
+    }
+    else {
+        g_frame_share.stats.copied++;
+    }
+
+    info.handle = w->handle;
+    info.data = (uint32_t)wasm_runtime_addr_native_to_app(inst, w->window + offset);
+    info.size = (uint32_t)frame.size;
+    info.timestamp = frame.timestamp;
+    info.sequence = frame.sequence;
+
+    pthread_mutex_unlock(&g_frame_share.lock);
+
+    memcpy(info_buf, &info, sizeof(info));
+    return 0;
+
+err_unlock:
+    pthread_mutex_unlock(&g_frame_share.lock);
+    source->release_frame(stream, &frame);
+    return ret;
+}
+
+static int32_t native_release_frame(wasm_exec_env_t exec_env, uint32_t handle)
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+    struct evp_frame_share_frame frame;
+    struct frame_window *w;
+    uint64_t stream;
+
+    if (handle == 0) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&g_frame_share.lock);
+    TAILQ_FOREACH(w, &g_frame_share.windows, q)
+    {
+        if (w->inst == inst && w->handle == handle) {
+            break;
+        }
+    }
+    if (w == NULL) {
+        pthread_mutex_unlock(&g_frame_share.lock);
+        return -ENOENT;
+    }
+    stream = w->stream;
+    frame = w->frame;
+    window_release(w);
+    pthread_mutex_unlock(&g_frame_share.lock);
+
+    g_frame_share.source->release_frame(stream, &frame);
+    return 0;
+}
+
+static NativeSymbol g_frame_share_natives[] = {
+    {"senscord_zc_get_frame", native_get_frame, "(Iii*~)i", NULL},
+    {"senscord_zc_release_frame", native_release_frame, "(i)i", NULL},
+};
+
+void evp_agent_frame_share_set_source(const struct evp_frame_share_source *source)
+{
+    pthread_mutex_lock(&g_frame_share.lock);
+    g_frame_share.source = source;
+    pthread_mutex_unlock(&g_frame_share.lock);
+}
+
+NativeSymbol *evp_agent_frame_share_natives(uint32_t *n_native_symbols)
+{
+    *n_native_symbols = sizeof(g_frame_share_natives) / sizeof(g_frame_share_natives[0]);
+    return g_frame_share_natives;
+}
+
+void evp_agent_frame_share_stats(struct evp_frame_share_stats *stats)
+{
+    pthread_mutex_lock(&g_frame_share.lock);
+    *stats = g_frame_share.stats;
+    pthread_mutex_unlock(&g_frame_share.lock);
+}
+
+void evp_agent_frame_share_stream_opened(wasm_module_inst_t inst, uint64_t stream)
+{
+    struct frame_stream *s = calloc(1, sizeof(*s));
+
+    if (s == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for frame_stream");
+        return;
+    }
+    s->inst = inst;
+    s->stream = stream;
+
+    pthread_mutex_lock(&g_frame_share.lock);
+    TAILQ_INSERT_TAIL(&g_frame_share.streams, s, q);
+    pthread_mutex_unlock(&g_frame_share.lock);
+}
+
+void evp_agent_frame_share_stream_closed(wasm_module_inst_t inst, uint64_t stream)
+{
+    struct frame_stream *s;
+
+    pthread_mutex_lock(&g_frame_share.lock);
+    TAILQ_FOREACH(s, &g_frame_share.streams, q)
+    {
+        if (s->inst == inst && s->stream == stream) {
+            TAILQ_REMOVE(&g_frame_share.streams, s, q);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_frame_share.lock);
+
+    free(s);
+}
+
+static void streams_forget(wasm_module_inst_t inst)
+{
+    struct frame_stream *s, *tmp;
+
+    TAILQ_FOREACH_SAFE(s, &g_frame_share.streams, q, tmp)
+    {
+        if (inst == NULL || s->inst == inst) {
+            TAILQ_REMOVE(&g_frame_share.streams, s, q);
+            free(s);
+        }
+    }
+}
+
+void evp_agent_frame_share_instance_destroyed(wasm_module_inst_t inst)
+{
+    struct frame_window *w, *tmp;
+
+    pthread_mutex_lock(&g_frame_share.lock);
+    streams_forget(inst);
+    TAILQ_FOREACH_SAFE(w, &g_frame_share.windows, q, tmp)
+    {
+        if (w->inst != inst) {
+            continue;
+        }
+        if (w->handle != 0) {
+            g_frame_share.source->release_frame(w->stream, &w->frame);
+        }
+        window_destroy(w, false);
+    }
+    pthread_mutex_unlock(&g_frame_share.lock);
+}
+
+static void frame_share_report(void *user)
+{
+    struct evp_frame_share_stats stats;
+
+    evp_agent_frame_share_stats(&stats);
+    if (stats.frames == 0) {
+        return;
+    }
+
+    EVP_AGENT_INFO("senscord zero-copy: frames=%" PRIu64 " mapped=%" PRIu64 " copied=%" PRIu64
+                   " bytes_copied=%" PRIu64 " remaps=%" PRIu64,
+                   stats.frames, stats.mapped, stats.copied, stats.bytes_copied, stats.remaps);
+}
+
+int evp_agent_frame_share_init(void)
+{
+    return evp_agent_metrics_register("frame_share", NULL, frame_share_report, NULL);
+}
+
+/*
+ * The instances are gone by now: their held frames go back to the source,
+ * and their windows are dropped with the linear memory they were in.
+ */
+void evp_agent_frame_share_deinit(void)
+{
+    struct frame_window *w, *tmp;
+
+    pthread_mutex_lock(&g_frame_share.lock);
+    TAILQ_FOREACH_SAFE(w, &g_frame_share.windows, q, tmp)
+    {
+        if (w->handle != 0) {
+            g_frame_share.source->release_frame(w->stream, &w->frame);
+        }
+        window_destroy(w, false);
+    }
+    streams_forget(NULL);
+    g_frame_share.source = NULL;
+    pthread_mutex_unlock(&g_frame_share.lock);
+}
@@ -0,0 +1,79 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_FRAME_SHARE_H__
+#define __EVP_FRAME_SHARE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wasm_export.h>
+
+/*
+ * Zero-copy sharing of sensor frames with wasm modules.
+ *
+ * Implements the natives of evp_agent/senscord_zero_copy.h. Frames come from
+ * a frame source, which is senscord on the device and a test double in the
+ * benchmarks. Each frame exposed to a module gets a page-aligned window in
+ * the module heap, and the frame pages are aliased into that window with
+ * mremap() when the source buffer is a shared mapping. Buffers the kernel
+ * cannot alias (private or heap memory) are copied into the window instead.
+ *
+ * Once a frame is released, private memory is put back under its window, so
+ * the module cannot read a buffer the source has reused. At most
+ * EVP_SENSCORD_ZC_MAX_WINDOWS windows (4 by default) are kept per module
+ * instance.
+ *
+ * Stream handles come from the module, so only those the senscord WAMR bridge
+ * opened for the calling instance are accepted: its natives that open and
+ * close streams are wrapped when the agent registers them (see
+ * wasm_runtime_wrap.h).
+ */
+
+#define EVP_FRAME_SHARE_MODULE_NAME "env"
+
+struct evp_frame_share_frame {
+    const void *data;
+    size_t size;
+    uint64_t timestamp;
+    uint64_t sequence;
+    /* Owned by the frame source */
+    uint64_t priv;
+};
+
+struct evp_frame_share_source {
+    int (*get_frame)(uint64_t stream, uint32_t channel_id, int32_t timeout_ms,
+                     struct evp_frame_share_frame *frame);
+    void (*release_frame)(uint64_t stream, struct evp_frame_share_frame *frame);
+};
+
+struct evp_frame_share_stats {
+    uint64_t frames;
+    uint64_t mapped;
+    uint64_t copied;
+    uint64_t bytes_copied;
+    uint64_t remaps;
+};
+
+extern const struct evp_frame_share_source evp_frame_share_senscord;
+
+void evp_agent_frame_share_set_source(const struct evp_frame_share_source *source);
+NativeSymbol *evp_agent_frame_share_natives(uint32_t *n_native_symbols);
+void evp_agent_frame_share_stats(struct evp_frame_share_stats *stats);
+
+/* A stream was opened for, or closed by, a module instance */
+void evp_agent_frame_share_stream_opened(wasm_module_inst_t inst, uint64_t stream);
+void evp_agent_frame_share_stream_closed(wasm_module_inst_t inst, uint64_t stream);
+
+/* Natives being registered, with those of the senscord bridge opening streams wrapped */
+NativeSymbol *evp_agent_frame_share_senscord_natives(NativeSymbol *native_symbols,
+                                                     uint32_t n_native_symbols);
+
+int evp_agent_frame_share_init(void);
+void evp_agent_frame_share_deinit(void);
+void evp_agent_frame_share_instance_destroyed(wasm_module_inst_t inst);
+
+#endif /* __EVP_FRAME_SHARE_H__ */
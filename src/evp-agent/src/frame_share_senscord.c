@@ -0,0 +1,181 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <senscord/c_api/senscord_c_api.h>
+
+#include "frame_share.h"
+#include "log.h"
+
+/*
+ * Frame source backed by the senscord C API. Stream handles are the ones the
+ * senscord WAMR bridge hands to wasm modules, which are the native handles:
+ * the natives of the bridge opening and closing them are wrapped to record
+ * which instance each one was issued to.
+ */
+
+static int senscord_error(const char *what)
+{
+    struct senscord_status_t status = senscord_get_last_error();
+
+    if (status.cause == SENSCORD_ERROR_TIMEOUT) {
+        return -ETIMEDOUT;
+    }
+
+    EVP_AGENT_ERR("%s failed: cause=%d %s", what, status.cause,
+                  status.message != NULL ? status.message : "");
+    return -EIO;
+}
+
+static int senscord_get_frame(uint64_t stream, uint32_t channel_id, int32_t timeout_ms,
+                              struct evp_frame_share_frame *frame)
+{
+    struct senscord_raw_data_t raw_data;
+    senscord_channel_t channel;
+    senscord_frame_t sframe;
+    uint64_t sequence = 0;
+    int ret;
+
+    if (senscord_stream_get_frame(stream, &sframe, timeout_ms) != 0) {
+        return senscord_error("senscord_stream_get_frame");
+    }
+
+    if (senscord_frame_get_channel_from_channel_id(sframe, channel_id, &channel) != 0) {
+        ret = senscord_error("senscord_frame_get_channel_from_channel_id");
+        goto err_release_frame;
+    }
+
+    if (senscord_channel_get_raw_data(channel, &raw_data) != 0) {
+        ret = senscord_error("senscord_channel_get_raw_data");
+        goto err_release_frame;
+    }
+
+    /* Only used as information for the module */
+    senscord_frame_get_sequence_number(sframe, &sequence);
+
+    frame->data = raw_data.address;
+    frame->size = raw_data.size;
+    frame->timestamp = raw_data.timestamp;
+    frame->sequence = sequence;
+    frame->priv = sframe;
+    return 0;
+
+err_release_frame:
+    senscord_stream_release_frame(stream, sframe);
+    return ret;
+}
+
+static void senscord_release_frame(uint64_t stream, struct evp_frame_share_frame *frame)
+{
+    if (senscord_stream_release_frame(stream, (senscord_frame_t)frame->priv) != 0) {
+        senscord_error("senscord_stream_release_frame");
+    }
+}
+
+const struct evp_frame_share_source evp_frame_share_senscord = {
+    .get_frame = senscord_get_frame,
+    .release_frame = senscord_release_frame,
+};
+
+/* Natives of the senscord WAMR bridge, with the signatures they are wrapped for */
+typedef int32_t (*open_stream_t)(wasm_exec_env_t exec_env, uint64_t core, const char *key,
+                                 uint64_t *stream);
+typedef int32_t (*open_stream_with_setting_t)(wasm_exec_env_t exec_env, uint64_t core,
+                                              const char *key, void *setting, uint64_t *stream);
+typedef int32_t (*close_stream_t)(wasm_exec_env_t exec_env, uint64_t core, uint64_t stream);
+
+static struct {
+    open_stream_t open_stream;
+    open_stream_with_setting_t open_stream_with_setting;
+    close_stream_t close_stream;
+} g_bridge;
+
+static int32_t bridge_open_stream(wasm_exec_env_t exec_env, uint64_t core, const char *key,
+                                  uint64_t *stream)
+{
+    int32_t ret = g_bridge.open_stream(exec_env, core, key, stream);
+
+    if (ret == 0) {
+        evp_agent_frame_share_stream_opened(wasm_runtime_get_module_inst(exec_env), *stream);
+    }
+    return ret;
+}
+
+static int32_t bridge_open_stream_with_setting(wasm_exec_env_t exec_env, uint64_t core,
+                                               const char *key, void *setting, uint64_t *stream)
+{
+    int32_t ret = g_bridge.open_stream_with_setting(exec_env, core, key, setting, stream);
+
+    if (ret == 0) {
+        evp_agent_frame_share_stream_opened(wasm_runtime_get_module_inst(exec_env), *stream);
+    }
+    return ret;
+}
+
+static int32_t bridge_close_stream(wasm_exec_env_t exec_env, uint64_t core, uint64_t stream)
+{
+    int32_t ret = g_bridge.close_stream(exec_env, core, stream);
+
+    if (ret == 0) {
+        evp_agent_frame_share_stream_closed(wasm_runtime_get_module_inst(exec_env), stream);
+    }
+    return ret;
+}
+
+static const struct {
+    const char *name;
+    const char *signature;
+    void **real;
+    void *wrapper;
+} g_bridge_natives[] = {
+    {"senscord_core_open_stream", "(I$*)i", (void **)&g_bridge.open_stream, bridge_open_stream},
+    {"senscord_core_open_stream_with_setting", "(I$**)i",
+     (void **)&g_bridge.open_stream_with_setting, bridge_open_stream_with_setting},
+    {"senscord_core_close_stream", "(II)i", (void **)&g_bridge.close_stream,
+     bridge_close_stream},
+};
+
+/*
+ * A native registered with another signature is left alone, so that the
+ * streams it opens are not accepted for zero-copy frames. WAMR keeps the
+ * array it is given, so the copy is never freed.
+ */
+NativeSymbol *evp_agent_frame_share_senscord_natives(NativeSymbol *native_symbols,
+                                                     uint32_t n_native_symbols)
+{
+    NativeSymbol *copy = NULL;
+
+    for (uint32_t i = 0; i < n_native_symbols; i++) {
+        for (size_t j = 0; j < sizeof(g_bridge_natives) / sizeof(g_bridge_natives[0]); j++) {
+            if (strcmp(native_symbols[i].symbol, g_bridge_natives[j].name) != 0) {
+                continue;
+            }
+            if (native_symbols[i].signature == NULL ||
+                strcmp(native_symbols[i].signature, g_bridge_natives[j].signature) != 0) {
+                EVP_AGENT_WARN("%s has signature %s: its streams have no zero-copy frames",
+                               native_symbols[i].symbol,
+                               native_symbols[i].signature ? native_symbols[i].signature : "");
+                continue;
+            }
+            if (copy == NULL) {
+                copy = malloc(n_native_symbols * sizeof(*copy));
+                if (copy == NULL) {
+                    EVP_AGENT_ERR("failed to allocate memory for the senscord natives");
+                    return native_symbols;
+                }
+                memcpy(copy, native_symbols, n_native_symbols * sizeof(*copy));
+            }
+            *g_bridge_natives[j].real = native_symbols[i].func_ptr;
+            copy[i].func_ptr = g_bridge_natives[j].wrapper;
+        }
+    }
+
+    return copy != NULL ? copy : native_symbols;
+}
@@ -0,0 +1,253 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for strcasestr */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_message.h"
+
+static bool header_is(const char *line, const char *name)
+{
+    size_t len = strlen(name);
+
+    return strncasecmp(line, name, len) == 0 && line[len] == ':';
+}
+
+int evp_agent_http_request_head(char *buf, size_t size, const char *method, const char *target,
+                                const char *host, size_t host_len, const char *const *headers,
+                                unsigned int nheaders, ssize_t length, bool close)
+{
+    size_t len;
+    int n;
+
+    n = snprintf(buf, size, "%s %s HTTP/1.1\r\nHost: %.*s\r\n", method, target, (int)host_len,
+                 host);
+    if (n < 0 || n >= size) {
+        return -E2BIG;
+    }
+    len = n;
+    if (length >= 0) {
+        n = snprintf(buf + len, size - len, "Content-Length: %zd\r\n", length);
+        if (n < 0 || n >= size - len) {
+            return -E2BIG;
+        }
+        len += n;
+    }
+    if (close) {
+        n = snprintf(buf + len, size - len, "Connection: close\r\n");
+        if (n < 0 || n >= size - len) {
+            return -E2BIG;
+        }
+        len += n;
+    }
+
+    for (unsigned int i = 0; i < nheaders; i++) {
+        if (header_is(headers[i], "Host") || header_is(headers[i], "Content-Length") ||
+            header_is(headers[i], "Connection")) {
+            continue;
+        }
+        n = snprintf(buf + len, size - len, "%s\r\n", headers[i]);
+        if (n < 0 || n >= size - len) {
+            return -E2BIG;
+        }
+        len += n;
+    }
+    if (len + 2 >= size) {
+        return -E2BIG;
+    }
+    memcpy(buf + len, "\r\n", 3);
+    return len + 2;
+}
+
+void evp_agent_http_response_reset(struct evp_agent_http_response *r)
+{
+    r->state = EVP_AGENT_HTTP_HEAD;
+    r->status = 0;
+    r->keep_alive = true;
+    r->chunked = false;
+    r->chunk_ext = false;
+    r->has_length = false;
+    r->remaining = 0;
+    r->line_len = 0;
+    r->truncated = false;
+}
+
+static int response_head_line(struct evp_agent_http_response *r)
+{
+    const char *line = r->line;
+    unsigned int minor;
+
+    if (r->line_len > 0 && line[r->line_len - 1] == '\r') {
+        r->line_len--;
+    }
+    r->line[r->line_len] = '\0';
+
+    if (r->status == 0) {
+        if (sscanf(line, "HTTP/1.%u %u", &minor, &r->status) != 2 || r->status == 0) {
+            r->status = 0;
+            r->keep_alive = false;
+            return -EPROTO;
+        }
+        if (minor == 0) {
+            /* HTTP/1.0 closes by default */
+            r->keep_alive = false;
+        }
+        return 0;
+    }
+
+    if (r->line_len > 0) {
+        if (header_is(line, "Content-Length")) {
+            r->remaining = strtoull(line + 15, NULL, 10);
+            r->has_length = true;
+        }
+        else if (header_is(line, "Transfer-Encoding")) {
+            r->chunked = strcasestr(line + 18, "chunked") != NULL;
+        }
+        else if (header_is(line, "Connection") && strcasestr(line + 11, "close") != NULL) {
+            r->keep_alive = false;
+        }
+        /* Those of an interim response are not the caller's */
+        if (r->header_callback != NULL && (r->status >= 200 || r->status == 101)) {
+            return r->header_callback(line, r->truncated, r->arg);
+        }
+        return 0;
+    }
+
+    /* The end of the head */
+    if (r->status == 101) {
+        r->keep_alive = false;
+        r->state = EVP_AGENT_HTTP_EOF;
+    }
+    else if (r->status < 200) {
+        /* An interim response, such as 100 Continue: the final one follows */
+        r->status = 0;
+        r->has_length = r->chunked = false;
+    }
+    else if (r->head || r->status == 204 || r->status == 304) {
+        r->state = EVP_AGENT_HTTP_DONE;
+    }
+    else if (r->chunked) {
+        r->state = EVP_AGENT_HTTP_CHUNK_SIZE;
+        r->remaining = 0;
+    }
+    else if (r->has_length) {
+        r->state = r->remaining == 0 ? EVP_AGENT_HTTP_DONE : EVP_AGENT_HTTP_LENGTH;
+    }
+    else {
+        r->keep_alive = false;
+        r->state = EVP_AGENT_HTTP_EOF;
+    }
+    return 0;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static int response_body(struct evp_agent_http_response *r, const char *data, size_t len)
+{
+    if (r->body_callback == NULL || len == 0) {
+        return 0;
+    }
+    return r->body_callback(data, len, r->arg);
+}
+
+ssize_t evp_agent_http_response_parse(struct evp_agent_http_response *r, const char *data,
+                                      size_t len)
+{
+    size_t i = 0, n;
+    int ret = 0, v;
+
+    while (i < len && ret == 0 && r->state != EVP_AGENT_HTTP_DONE) {
+        char c = data[i];
+
+        switch (r->state) {
+            case EVP_AGENT_HTTP_HEAD:
+                i++;
+                if (c == '\n') {
+                    ret = response_head_line(r);
+                    r->line_len = 0;
+                    r->truncated = false;
+                }
+                else if (r->line_len < sizeof(r->line) - 1) {
+                    r->line[r->line_len++] = c;
+                }
+                else {
+                    r->truncated = true;
+                }
+                break;
+            case EVP_AGENT_HTTP_LENGTH:
+            case EVP_AGENT_HTTP_CHUNK_DATA:
+                n = len - i < r->remaining ? len - i : r->remaining;
+                ret = response_body(r, data + i, n);
+                i += n;
+                r->remaining -= n;
+                if (r->remaining == 0) {
+                    r->state = r->state == EVP_AGENT_HTTP_LENGTH ? EVP_AGENT_HTTP_DONE
+                                                                 : EVP_AGENT_HTTP_CHUNK_END;
+                }
+                break;
+            case EVP_AGENT_HTTP_CHUNK_SIZE:
+                i++;
+                v = hex_value(c);
+                if (c == '\n') {
+                    r->state = r->remaining > 0 ? EVP_AGENT_HTTP_CHUNK_DATA
+                                                : EVP_AGENT_HTTP_TRAILER;
+                    r->line_len = 0;
+                }
+                else if (!r->chunk_ext && v >= 0 && r->remaining <= UINT64_MAX >> 4) {
+                    r->remaining = r->remaining << 4 | v;
+                }
+                else if (c != '\r') {
+                    r->chunk_ext = true;
+                }
+                break;
+            case EVP_AGENT_HTTP_CHUNK_END:
+                i++;
+                if (c == '\n') {
+                    r->state = EVP_AGENT_HTTP_CHUNK_SIZE;
+                    r->chunk_ext = false;
+                }
+                break;
+            case EVP_AGENT_HTTP_TRAILER:
+                i++;
+                if (c == '\n') {
+                    if (r->line_len == 0) {
+                        r->state = EVP_AGENT_HTTP_DONE;
+                    }
+                    r->line_len = 0;
+                }
+                else if (c != '\r') {
+                    r->line_len++;
+                }
+                break;
+            case EVP_AGENT_HTTP_EOF:
+                ret = response_body(r, data + i, len - i);
+                i = len;
+                break;
+            default:
+                i = len;
+                break;
+        }
+    }
+    return ret ? ret : (ssize_t)i;
+}
@@ -0,0 +1,83 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_HTTP_MESSAGE_H__
+#define __EVP_HTTP_MESSAGE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * HTTP/1.1 messages, for the connections served from here (see http_pool.h
+ * and http_upload.h).
+ *
+ * A request head is built from the headers of the caller, less those the
+ * builder sets itself (Host, Content-Length and Connection), so none goes
+ * twice.
+ *
+ * A response is fed as it arrives. The parser finds the status and the
+ * end of the response, from its Content-Length or its chunked encoding,
+ * skips interim 1xx responses (such as 100 Continue), and tells whether the
+ * server leaves the connection open. The header lines of the final response
+ * and its body, without the chunked encoding, go to optional callbacks.
+ */
+
+#define EVP_AGENT_HTTP_LINE_SIZE 256
+
+enum evp_agent_http_framing {
+    EVP_AGENT_HTTP_HEAD,
+    EVP_AGENT_HTTP_LENGTH,
+    EVP_AGENT_HTTP_CHUNK_SIZE,
+    EVP_AGENT_HTTP_CHUNK_DATA,
+    EVP_AGENT_HTTP_CHUNK_END,
+    EVP_AGENT_HTTP_TRAILER,
+    EVP_AGENT_HTTP_DONE,
+    /* Up to the server closing the connection */
+    EVP_AGENT_HTTP_EOF,
+};
+
+struct evp_agent_http_response {
+    /* Of a HEAD or CONNECT request, whose response has no body */
+    bool head;
+    int (*header_callback)(const char *line, bool truncated, void *arg);
+    int (*body_callback)(const char *data, size_t len, void *arg);
+    void *arg;
+
+    enum evp_agent_http_framing state;
+    /* Of the final response, 0 until its status line, or if it is not HTTP */
+    unsigned int status;
+    bool keep_alive;
+    bool chunked;
+    bool chunk_ext;
+    bool has_length;
+    uint64_t remaining;
+    char line[EVP_AGENT_HTTP_LINE_SIZE];
+    size_t line_len;
+    bool truncated;
+};
+
+/*
+ * Writes the head of a request for target to buf, with a Host of host_len
+ * bytes, a Content-Length unless length is negative, and Connection: close
+ * if close: its length, or -E2BIG if it does not fit
+ */
+int evp_agent_http_request_head(char *buf, size_t size, const char *method, const char *target,
+                                const char *host, size_t host_len, const char *const *headers,
+                                unsigned int nheaders, ssize_t length, bool close);
+
+/* Before each response, with the request fields and the callbacks set */
+void evp_agent_http_response_reset(struct evp_agent_http_response *r);
+
+/*
+ * Parses the next data of the response: the number of bytes of it that are
+ * of the response, or the error a callback returned
+ */
+ssize_t evp_agent_http_response_parse(struct evp_agent_http_response *r, const char *data,
+                                      size_t len);
+
+#endif /* __EVP_HTTP_MESSAGE_H__ */
@@ -0,0 +1,687 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for memmem */
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <evp/agent_config.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#include <webclient/webclient.h>
+
+#include "esf.h"
+#include "http_message.h"
+#include "http_pool.h"
+#include "log.h"
+#include "metrics.h"
+
+#define HTTP_POOL_MAX_DEFAULT 8
+#define HTTP_POOL_IDLE_SEC_DEFAULT 30
+#define HTTP_POOL_KEY_SIZE 256
+
+int __real_webclient_perform(struct webclient_context *ctx);
+
+/* A TLS connection of the pool, set up with the configuration of the pool */
+struct http_conn {
+    struct http_conn *next;
+    char key[HTTP_POOL_KEY_SIZE];
+    mbedtls_net_context net;
+    mbedtls_ssl_context ssl;
+    /* The time it took to connect */
+    uint64_t setup_us;
+    uint64_t idle_since_us;
+};
+
+struct http_request {
+    const char *proxy_host;
+    const char *proxy_port;
+    const char *proxy_username;
+    const char *proxy_password;
+    /* A pooled connection failed before its response: connect anew */
+    bool fresh;
+    bool reused;
+    size_t received;
+    bool request_sent;
+    bool reusable;
+    struct evp_agent_http_response response;
+};
+
+static struct {
+    bool enabled;
+    unsigned int max;
+    uint64_t idle_us;
+    /* Most recently used first */
+    struct http_conn *idle;
+    unsigned int nidle;
+    uint64_t connects;
+    uint64_t reuses;
+    uint64_t stale;
+    uint64_t setup_us;
+    uint64_t avoided_us;
+    /*
+     * The TLS configuration of the pooled connections, which outlive the
+     * requests and the TLS contexts they come with. It is set up at the
+     * first HTTPS request, once the root CA can be read.
+     */
+    bool tls_ready;
+    bool tls_failed;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    pthread_mutex_t lock;
+} g_http_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void conn_close(struct http_conn *conn)
+{
+    if (mbedtls_ssl_is_handshake_over(&conn->ssl)) {
+        mbedtls_ssl_close_notify(&conn->ssl);
+    }
+    mbedtls_ssl_free(&conn->ssl);
+    mbedtls_net_free(&conn->net);
+    free(conn);
+}
+
+static void conn_close_list(struct http_conn *conn)
+{
+    while (conn != NULL) {
+        struct http_conn *next = conn->next;
+
+        conn_close(conn);
+        conn = next;
+    }
+}
+
+/* Unlinks the connections idle for too long, with the lock held */
+static struct http_conn *pool_expire(uint64_t now)
+{
+    struct http_conn **pp = &g_http_pool.idle, *expired = NULL;
+
+    while (*pp != NULL) {
+        struct http_conn *conn = *pp;
+
+        if (now - conn->idle_since_us >= g_http_pool.idle_us) {
+            *pp = conn->next;
+            conn->next = expired;
+            expired = conn;
+            g_http_pool.nidle--;
+        }
+        else {
+            pp = &conn->next;
+        }
+    }
+    return expired;
+}
+
+/* Neither closed by the server nor sending anything out of turn */
+static bool conn_alive(struct http_conn *conn)
+{
+    struct pollfd pfd = {.fd = conn->net.fd, .events = POLLIN};
+
+    return mbedtls_ssl_get_bytes_avail(&conn->ssl) == 0 && poll(&pfd, 1, 0) == 0;
+}
+
+static struct http_conn *pool_take(const char *key)
+{
+    struct http_conn **pp, *conn, *expired;
+
+    for (;;) {
+        pthread_mutex_lock(&g_http_pool.lock);
+        expired = pool_expire(evp_agent_now_us());
+        conn = NULL;
+        for (pp = &g_http_pool.idle; *pp != NULL; pp = &(*pp)->next) {
+            if (strcmp((*pp)->key, key) == 0) {
+                conn = *pp;
+                *pp = conn->next;
+                g_http_pool.nidle--;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&g_http_pool.lock);
+        conn_close_list(expired);
+
+        if (conn == NULL || conn_alive(conn)) {
+            return conn;
+        }
+        pthread_mutex_lock(&g_http_pool.lock);
+        g_http_pool.stale++;
+        pthread_mutex_unlock(&g_http_pool.lock);
+        conn_close(conn);
+    }
+}
+
+static void pool_put(struct http_conn *conn)
+{
+    struct http_conn **pp, *evicted = NULL;
+
+    conn->idle_since_us = evp_agent_now_us();
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    if (!g_http_pool.enabled || g_http_pool.max == 0) {
+        evicted = conn;
+        evicted->next = NULL;
+    }
+    else {
+        if (g_http_pool.nidle == g_http_pool.max) {
+            /* The least recently used goes */
+            for (pp = &g_http_pool.idle; (*pp)->next != NULL; pp = &(*pp)->next) {
+            }
+            evicted = *pp;
+            *pp = NULL;
+            g_http_pool.nidle--;
+        }
+        conn->next = g_http_pool.idle;
+        g_http_pool.idle = conn;
+        g_http_pool.nidle++;
+    }
+    pthread_mutex_unlock(&g_http_pool.lock);
+
+    conn_close_list(evicted);
+}
+
+static void conn_timeout(struct http_conn *conn, unsigned int timeout)
+{
+    struct timeval tv = {.tv_sec = timeout};
+
+    setsockopt(conn->net.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(conn->net.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static ssize_t conn_send(struct http_conn *conn, const void *buf, size_t len)
+{
+    int ret;
+
+    do {
+        ret = mbedtls_ssl_write(&conn->ssl, buf, len);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+    return ret < 0 ? -EIO : ret;
+}
+
+static ssize_t conn_recv(struct http_conn *conn, void *buf, size_t len)
+{
+    int ret;
+
+    do {
+        ret = mbedtls_ssl_read(&conn->ssl, buf, len);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+    return ret < 0 ? -EIO : ret;
+}
+
+static ssize_t send_all(struct http_conn *conn, const char *buf, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t n = conn_send(conn, buf + sent, len - sent);
+
+        if (n <= 0) {
+            return n < 0 ? n : -EIO;
+        }
+        sent += n;
+    }
+    return len;
+}
+
+static int tcp_connect(const char *host, const char *port, unsigned int timeout)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res, *ai;
+    struct timeval tv = {.tv_sec = timeout};
+    int fd = -1, ret;
+
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        EVP_AGENT_WARN("failed to resolve %s: %s", host, gai_strerror(ret));
+        return -EHOSTUNREACH;
+    }
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (timeout != 0) {
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd >= 0 ? fd : -ECONNREFUSED;
+}
+
+/* Asks the proxy on fd for a tunnel to hostname */
+static int tunnel_connect(struct http_request *r, int fd, const char *hostname, const char *port)
+{
+    struct evp_agent_http_response response = {.head = true};
+    unsigned char credentials[256], auth[384];
+    char authority[HTTP_POOL_KEY_SIZE], header[416], request[768];
+    const char *headers[1] = {header};
+    size_t auth_len = 0;
+    char c;
+    int n;
+
+    if (r->proxy_username != NULL) {
+        n = snprintf((char *)credentials, sizeof(credentials), "%s:%s", r->proxy_username,
+                     r->proxy_password != NULL ? r->proxy_password : "");
+        if (n < 0 || n >= sizeof(credentials) ||
+            mbedtls_base64_encode(auth, sizeof(auth), &auth_len, credentials, n) != 0) {
+            return -E2BIG;
+        }
+        snprintf(header, sizeof(header), "Proxy-Authorization: Basic %s", (const char *)auth);
+    }
+    n = snprintf(authority, sizeof(authority), "%s:%s", hostname, port);
+    if (n < 0 || n >= sizeof(authority)) {
+        return -E2BIG;
+    }
+    n = evp_agent_http_request_head(request, sizeof(request), "CONNECT", authority, authority, n,
+                                    headers, auth_len ? 1 : 0, -1, false);
+    if (n < 0) {
+        return n;
+    }
+    if (send(fd, request, n, MSG_NOSIGNAL) != n) {
+        return -errno;
+    }
+
+    /* Byte by byte, so as not to read into the TLS handshake */
+    evp_agent_http_response_reset(&response);
+    while (response.state == EVP_AGENT_HTTP_HEAD) {
+        if (recv(fd, &c, 1, 0) != 1) {
+            return -ECONNRESET;
+        }
+        if (evp_agent_http_response_parse(&response, &c, 1) < 0) {
+            break;
+        }
+    }
+    if (response.status / 100 != 2) {
+        EVP_AGENT_WARN("the proxy refused the tunnel to %s:%s (HTTP %u)", hostname, port,
+                       response.status);
+        return -ECONNREFUSED;
+    }
+    return 0;
+}
+
+/* The TCP connection, through the proxy if any, and the TLS session over it */
+static int conn_open(struct http_request *r, struct http_conn *conn, const char *hostname,
+                     const char *port, unsigned int timeout)
+{
+    int ret;
+
+    if (r->proxy_host != NULL) {
+        conn->net.fd = tcp_connect(r->proxy_host, r->proxy_port, timeout);
+        if (conn->net.fd < 0) {
+            return conn->net.fd;
+        }
+        ret = tunnel_connect(r, conn->net.fd, hostname, port);
+    }
+    else {
+        conn->net.fd = tcp_connect(hostname, port, timeout);
+        if (conn->net.fd < 0) {
+            return conn->net.fd;
+        }
+        ret = 0;
+    }
+    if (ret) {
+        return ret;
+    }
+
+    ret = mbedtls_ssl_setup(&conn->ssl, &g_http_pool.conf);
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&conn->ssl, hostname);
+    }
+    if (ret == 0) {
+        mbedtls_ssl_set_bio(&conn->ssl, &conn->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+        do {
+            ret = mbedtls_ssl_handshake(&conn->ssl);
+        } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+    }
+    if (ret) {
+        EVP_AGENT_WARN("TLS handshake with %s:%s failed: -0x%04x", hostname, port, -ret);
+        return -EPROTO;
+    }
+    return 0;
+}
+
+static int pool_connect(void *arg, const char *hostname, const char *port, unsigned int timeout,
+                        struct webclient_tls_connection **connp)
+{
+    struct http_request *r = arg;
+    struct http_conn *conn = NULL;
+    char key[HTTP_POOL_KEY_SIZE];
+    uint64_t start;
+    int n, ret;
+
+    if (r->proxy_host != NULL) {
+        n = snprintf(key, sizeof(key), "%s:%s via %s:%s", hostname, port, r->proxy_host,
+                     r->proxy_port);
+    }
+    else {
+        n = snprintf(key, sizeof(key), "%s:%s", hostname, port);
+    }
+    if (n < 0 || n >= sizeof(key)) {
+        return -E2BIG;
+    }
+
+    r->received = 0;
+    r->request_sent = false;
+    r->reusable = true;
+    evp_agent_http_response_reset(&r->response);
+    r->reused = false;
+    if (!r->fresh) {
+        conn = pool_take(key);
+    }
+    if (conn != NULL) {
+        r->reused = true;
+        conn_timeout(conn, timeout);
+        pthread_mutex_lock(&g_http_pool.lock);
+        g_http_pool.reuses++;
+        g_http_pool.avoided_us += conn->setup_us;
+        pthread_mutex_unlock(&g_http_pool.lock);
+        *connp = (struct webclient_tls_connection *)conn;
+        return 0;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(conn->key, key, n + 1);
+    mbedtls_net_init(&conn->net);
+    mbedtls_ssl_init(&conn->ssl);
+
+    start = evp_agent_now_us();
+    ret = conn_open(r, conn, hostname, port, timeout);
+    if (ret) {
+        conn_close(conn);
+        return ret;
+    }
+    conn->setup_us = evp_agent_now_us() - start;
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    g_http_pool.connects++;
+    g_http_pool.setup_us += conn->setup_us;
+    pthread_mutex_unlock(&g_http_pool.lock);
+
+    *connp = (struct webclient_tls_connection *)conn;
+    return 0;
+}
+
+static ssize_t pool_send(void *arg, struct webclient_tls_connection *tls_conn, const void *buf,
+                         size_t len)
+{
+    static const char close_line[] = "\r\nConnection: close\r\n";
+    struct http_request *r = arg;
+    struct http_conn *conn = (struct http_conn *)tls_conn;
+    const char *data = buf, *line;
+    ssize_t ret;
+    size_t head;
+
+    if (r->request_sent) {
+        return conn_send(conn, buf, len);
+    }
+
+    line = memmem(data, len, "\r\n\r\n", 4);
+    head = line != NULL ? line - data + 4 : len;
+    r->request_sent = line != NULL;
+
+    /* The server would close the connection after the response */
+    line = memmem(data, head, close_line, sizeof(close_line) - 1);
+    if (line == NULL) {
+        return conn_send(conn, buf, len);
+    }
+    ret = send_all(conn, data, line - data + 2);
+    if (ret < 0) {
+        return ret;
+    }
+    line += sizeof(close_line) - 1;
+    ret = send_all(conn, line, len - (line - data));
+    return ret < 0 ? ret : (ssize_t)len;
+}
+
+static ssize_t pool_recv(void *arg, struct webclient_tls_connection *tls_conn, void *buf,
+                         size_t len)
+{
+    struct http_request *r = arg;
+    struct http_conn *conn = (struct http_conn *)tls_conn;
+    ssize_t ret, n;
+
+    if (r->response.state == EVP_AGENT_HTTP_DONE) {
+        /* To the client, as if the server closed it */
+        return 0;
+    }
+
+    ret = conn_recv(conn, buf, len);
+    if (ret <= 0) {
+        r->reusable = false;
+        return ret;
+    }
+    r->received += ret;
+
+    n = evp_agent_http_response_parse(&r->response, buf, ret);
+    if (n < 0) {
+        /* Not a response to frame: up to the client, on this connection only */
+        r->response.state = EVP_AGENT_HTTP_EOF;
+        n = ret;
+    }
+    if (n < ret) {
+        /* Past the end of the response */
+        r->reusable = false;
+    }
+    return n;
+}
+
+static int pool_close(void *arg, struct webclient_tls_connection *tls_conn)
+{
+    struct http_request *r = arg;
+    struct http_conn *conn = (struct http_conn *)tls_conn;
+
+    if (r->response.state == EVP_AGENT_HTTP_DONE && r->response.keep_alive && r->reusable) {
+        pool_put(conn);
+    }
+    else {
+        conn_close(conn);
+    }
+    return 0;
+}
+
+static const struct webclient_tls_ops g_http_pool_ops = {
+    .connect = pool_connect,
+    .send = pool_send,
+    .recv = pool_recv,
+    .close = pool_close,
+};
+
+/* The TLS configuration of the pool, with the root CA of the HTTPS requests */
+static bool pool_tls_setup(void)
+{
+    struct config *ca;
+    bool ready;
+    int ret;
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    if (!g_http_pool.enabled || g_http_pool.tls_ready || g_http_pool.tls_failed) {
+        ready = g_http_pool.tls_ready;
+        pthread_mutex_unlock(&g_http_pool.lock);
+        return ready;
+    }
+
+    ca = evp_agent_esf_read_config(EVP_CONFIG_HTTPS_CA_CERT);
+    if (ca == NULL) {
+        ret = -1;
+    }
+    else {
+        ret = mbedtls_ctr_drbg_seed(&g_http_pool.drbg, mbedtls_entropy_func,
+                                    &g_http_pool.entropy, NULL, 0);
+        if (ret == 0) {
+            ret = mbedtls_x509_crt_parse(&g_http_pool.ca, ca->value, ca->size);
+        }
+        if (ret == 0) {
+            ret = mbedtls_ssl_config_defaults(&g_http_pool.conf, MBEDTLS_SSL_IS_CLIENT,
+                                              MBEDTLS_SSL_TRANSPORT_STREAM,
+                                              MBEDTLS_SSL_PRESET_DEFAULT);
+        }
+        ca->free(ca->value);
+        ca->free(ca);
+    }
+    if (ret == 0) {
+        mbedtls_ssl_conf_authmode(&g_http_pool.conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&g_http_pool.conf, &g_http_pool.ca, NULL);
+        mbedtls_ssl_conf_rng(&g_http_pool.conf, mbedtls_ctr_drbg_random, &g_http_pool.drbg);
+        g_http_pool.tls_ready = true;
+    }
+    else {
+        EVP_AGENT_WARN("no TLS setup for the pool (-0x%04x), HTTPS connections are not pooled",
+                       -ret);
+        g_http_pool.tls_failed = true;
+    }
+    ready = g_http_pool.tls_ready;
+    pthread_mutex_unlock(&g_http_pool.lock);
+
+    return ready;
+}
+
+const struct webclient_tls_ops *evp_agent_http_pool_tls_ops(void)
+{
+    return g_http_pool.enabled && pool_tls_setup() ? &g_http_pool_ops : NULL;
+}
+
+int evp_agent_http_pool_perform(struct webclient_context *ctx)
+{
+    struct http_request r = {0};
+    struct webclient_context c;
+    /* A request of the agent itself, which has no TLS context to fall back on */
+    bool own = ctx->tls_ops == &g_http_pool_ops;
+    int ret;
+
+    if (!g_http_pool.enabled || ctx->tls_ops == NULL || !pool_tls_setup()) {
+        return own ? -ENOTSUP : __real_webclient_perform(ctx);
+    }
+    if (ctx->proxy != NULL && !evp_agent_esf_get_proxy(&r.proxy_host, &r.proxy_port,
+                                                       &r.proxy_username, &r.proxy_password)) {
+        return own ? -ENOTSUP : __real_webclient_perform(ctx);
+    }
+
+    r.response.head = ctx->method != NULL && strcmp(ctx->method, "HEAD") == 0;
+
+    c = *ctx;
+    c.proxy = NULL;
+    c.tls_ops = &g_http_pool_ops;
+    c.tls_ctx = &r;
+
+    ret = __real_webclient_perform(&c);
+    if (ret != 0 && r.reused && r.received == 0 && ctx->bodylen == 0) {
+        /* The server closed it as it was taken: nothing was lost */
+        r.fresh = true;
+        c.http_status = 0;
+        ret = __real_webclient_perform(&c);
+    }
+    ctx->http_status = c.http_status;
+    return ret;
+}
+
+static void http_pool_sample(void *user)
+{
+    struct http_conn *expired;
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    expired = pool_expire(evp_agent_now_us());
+    pthread_mutex_unlock(&g_http_pool.lock);
+
+    conn_close_list(expired);
+}
+
+static void http_pool_report(void *user)
+{
+    uint64_t requests;
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    requests = g_http_pool.connects + g_http_pool.reuses;
+    if (requests != 0) {
+        EVP_AGENT_INFO("http pool: connects=%" PRIu64 " reuses=%" PRIu64 " reuse_pct=%" PRIu64
+                       " stale=%" PRIu64 " idle=%u setup_avg_ms=%" PRIu64
+                       " setup_avoided_ms=%" PRIu64,
+                       g_http_pool.connects, g_http_pool.reuses,
+                       g_http_pool.reuses * 100 / requests, g_http_pool.stale, g_http_pool.nidle,
+                       g_http_pool.connects ? g_http_pool.setup_us / g_http_pool.connects / 1000
+                                            : 0,
+                       g_http_pool.avoided_us / 1000);
+    }
+    pthread_mutex_unlock(&g_http_pool.lock);
+}
+
+int evp_agent_http_pool_init(void)
+{
+    const char *max = getenv("EVP_HTTP_POOL_MAX");
+    const char *idle = getenv("EVP_HTTP_POOL_IDLE_SEC");
+
+    g_http_pool.max = HTTP_POOL_MAX_DEFAULT;
+    if (max != NULL) {
+        g_http_pool.max = strtoul(max, NULL, 10);
+    }
+    g_http_pool.idle_us = (uint64_t)HTTP_POOL_IDLE_SEC_DEFAULT * 1000000;
+    if (idle != NULL) {
+        g_http_pool.idle_us = (uint64_t)strtoul(idle, NULL, 10) * 1000000;
+    }
+    if (g_http_pool.max == 0) {
+        return 0;
+    }
+    mbedtls_ssl_config_init(&g_http_pool.conf);
+    mbedtls_x509_crt_init(&g_http_pool.ca);
+    mbedtls_entropy_init(&g_http_pool.entropy);
+    mbedtls_ctr_drbg_init(&g_http_pool.drbg);
+    g_http_pool.enabled = true;
+
+    return evp_agent_metrics_register("http_pool", http_pool_sample, http_pool_report, NULL);
+}
+
+void evp_agent_http_pool_deinit(void)
+{
+    struct http_conn *idle;
+
+    pthread_mutex_lock(&g_http_pool.lock);
+    if (!g_http_pool.enabled) {
+        pthread_mutex_unlock(&g_http_pool.lock);
+        return;
+    }
+    g_http_pool.enabled = false;
+    idle = g_http_pool.idle;
+    g_http_pool.idle = NULL;
+    g_http_pool.nidle = 0;
+    pthread_mutex_unlock(&g_http_pool.lock);
+
+    conn_close_list(idle);
+
+    /* The agent made its last request */
+    mbedtls_ssl_config_free(&g_http_pool.conf);
+    mbedtls_x509_crt_free(&g_http_pool.ca);
+    mbedtls_ctr_drbg_free(&g_http_pool.drbg);
+    mbedtls_entropy_free(&g_http_pool.entropy);
+    g_http_pool.tls_ready = g_http_pool.tls_failed = false;
+}
@@ -0,0 +1,53 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_HTTP_POOL_H__
+#define __EVP_HTTP_POOL_H__
+
+/*
+ * Keep-alive HTTPS connections.
+ *
+ * The HTTP client of the EVP agent library opens a TCP connection and a TLS
+ * session for each blob request, and closes both once the response is read.
+ * An HTTPS request (see webclient_wrap.c for the link time wrap) instead
+ * runs over connections of the pool, set up here with a TLS configuration
+ * of the pool that outlives the requests: the root CA of HTTPS requests,
+ * and the cipher suites and session resumption of tls_suites.h and
+ * tls_session.h. Without a root CA, requests are left as they are.
+ *
+ * - a connection whose response was read to its end, as framed by its
+ *   Content-Length or chunked encoding, and that the server left open, goes
+ *   to a pool keyed by host, port and proxy instead of being closed. The
+ *   Connection: close of the request is dropped so the server keeps it open,
+ * - the next request to the same endpoint takes it, once checked not to have
+ *   been closed by the server meanwhile,
+ * - connections idle for EVP_HTTP_POOL_IDLE_SEC (30 by default) are closed,
+ *   and at most EVP_HTTP_POOL_MAX (8 by default, 0 disables the pool) are
+ *   kept,
+ * - with the HTTP proxy of the network manager, the CONNECT tunnel is opened
+ *   here, so it is pooled along with the TLS session over it.
+ *
+ * Plain HTTP requests, which the client serves on its own sockets, are left
+ * as they are. The share of requests served on a pooled connection and the
+ * connection setup time this saved are reported in the metrics.
+ */
+
+struct webclient_context;
+struct webclient_tls_ops;
+
+int evp_agent_http_pool_init(void);
+void evp_agent_http_pool_deinit(void);
+
+/* webclient_perform() on a pooled connection where it can */
+int evp_agent_http_pool_perform(struct webclient_context *ctx);
+/*
+ * The TLS operations of an HTTPS request the agent makes on its own, which
+ * only runs on pooled connections: NULL if the pool is off or has no TLS
+ * setup
+ */
+const struct webclient_tls_ops *evp_agent_http_pool_tls_ops(void);
+
+#endif /* __EVP_HTTP_POOL_H__ */
@@ -0,0 +1,503 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for MSG_MORE */
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* After time.h, for struct timespec */
+#include <linux/errqueue.h>
+#include <webclient/webclient.h>
+
+#include "http_message.h"
+#include "http_upload.h"
+#include "log.h"
+#include "metrics.h"
+
+#define HTTP_UPLOAD_ZEROCOPY_MIN_BYTES_DEFAULT (64 * 1024)
+#define HTTP_UPLOAD_CHUNK (256 * 1024)
+#define HTTP_UPLOAD_HEAD_MAX 4096
+#define HTTP_UPLOAD_HOST_SIZE 256
+#define HTTP_UPLOAD_PORT_SIZE 8
+#define HTTP_UPLOAD_TIMEOUT_MS_DEFAULT 60000
+/* Zero-copy sends whose completion is not read yet, each holding some socket memory */
+#define HTTP_UPLOAD_ZEROCOPY_PENDING_MAX 32
+
+/* Not in every libc yet */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+static struct {
+    bool enabled;
+    size_t zerocopy_min;
+    uint64_t uploads;
+    uint64_t failed;
+    uint64_t bytes;
+    uint64_t direct_bytes;
+    uint64_t zerocopy_bytes;
+    /* Zero-copy sends the kernel had to copy after all */
+    uint64_t zerocopy_copied;
+    uint64_t time_sum_us;
+    pthread_mutex_t lock;
+} g_http_upload = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+struct upload {
+    struct webclient_context *ctx;
+    int fd;
+    int timeout_ms;
+    bool zerocopy;
+    /* Of the sends with MSG_ZEROCOPY */
+    uint32_t zerocopy_sent;
+    uint32_t zerocopy_done;
+    bool zerocopy_copied;
+    size_t direct_bytes;
+    size_t zerocopy_bytes;
+    struct evp_agent_http_response response;
+    /* The request head, then the response as it is read */
+    char head[HTTP_UPLOAD_HEAD_MAX];
+    size_t head_len;
+};
+
+bool evp_agent_http_upload_is(const struct webclient_context *ctx)
+{
+    return g_http_upload.enabled && ctx->method != NULL &&
+           (strcmp(ctx->method, "PUT") == 0 || strcmp(ctx->method, "POST") == 0) &&
+           ctx->body_callback != NULL && ctx->proxy == NULL && ctx->url != NULL &&
+           strncasecmp(ctx->url, "http://", 7) == 0;
+}
+
+/* Splits http://host[:port]/path into its parts */
+static int url_parse(const char *url, char *host, char *port, const char **authority,
+                     size_t *authority_len, const char **path)
+{
+    const char *p = url + 7, *end;
+    size_t len;
+
+    *authority = p;
+    *authority_len = strcspn(p, "/?#");
+    *path = p + *authority_len;
+
+    if (*p == '[') {
+        end = memchr(p, ']', *authority_len);
+        if (end == NULL) {
+            return -EINVAL;
+        }
+        p++;
+        len = end - p;
+        end++;
+    }
+    else {
+        end = memchr(p, ':', *authority_len);
+        if (end == NULL) {
+            end = *path;
+        }
+        len = end - p;
+    }
+    if (len == 0 || len >= HTTP_UPLOAD_HOST_SIZE) {
+        return -EINVAL;
+    }
+    memcpy(host, p, len);
+    host[len] = '\0';
+
+    if (end < *path && *end == ':') {
+        len = *path - end - 1;
+        if (len == 0 || len >= HTTP_UPLOAD_PORT_SIZE) {
+            return -EINVAL;
+        }
+        memcpy(port, end + 1, len);
+        port[len] = '\0';
+    }
+    else {
+        strcpy(port, "80");
+    }
+    return 0;
+}
+
+static int upload_connect(struct upload *u, const char *host, const char *port)
+{
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct timeval tv = {.tv_sec = u->timeout_ms / 1000};
+    struct addrinfo *res, *ai;
+    int one = 1, ret;
+
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        EVP_AGENT_WARN("failed to resolve %s: %s", host, gai_strerror(ret));
+        return -EHOSTUNREACH;
+    }
+    ret = -ECONNREFUSED;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        u->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (u->fd < 0) {
+            ret = -errno;
+            continue;
+        }
+        setsockopt(u->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(u->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        if (connect(u->fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            ret = 0;
+            break;
+        }
+        ret = -errno;
+        close(u->fd);
+        u->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (ret) {
+        return ret;
+    }
+
+    if (g_http_upload.zerocopy_min != 0 &&
+        setsockopt(u->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+        u->zerocopy = true;
+    }
+    return 0;
+}
+
+static int upload_head(struct upload *u, const char *authority, size_t authority_len,
+                       const char *path)
+{
+    struct webclient_context *ctx = u->ctx;
+    char target[HTTP_UPLOAD_HEAD_MAX];
+    int n;
+
+    n = snprintf(target, sizeof(target), "%s%s", *path == '/' ? "" : "/", path);
+    if (n < 0 || n >= sizeof(target)) {
+        return -E2BIG;
+    }
+    n = evp_agent_http_request_head(u->head, sizeof(u->head), ctx->method, target, authority,
+                                    authority_len, ctx->headers, ctx->nheaders,
+                                    (ssize_t)ctx->bodylen, true);
+    if (n < 0) {
+        return n;
+    }
+    u->head_len = n;
+    return 0;
+}
+
+static int send_iov(struct upload *u, struct iovec *iov, int iovcnt, int flags)
+{
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(u->fd, &msg, flags | MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                /* Over the locked memory limit: copy this one */
+                flags &= ~MSG_ZEROCOPY;
+                continue;
+            }
+            return -errno;
+        }
+        if (flags & MSG_ZEROCOPY) {
+            u->zerocopy_sent++;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Reads the completions of the zero-copy sends, until at most pending are left */
+static int zerocopy_wait(struct upload *u, uint32_t pending)
+{
+    char control[128];
+    struct pollfd pfd = {.fd = u->fd};
+
+    while (u->zerocopy_sent - u->zerocopy_done > pending) {
+        struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+        struct cmsghdr *cm;
+
+        if (recvmsg(u->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -errno;
+            }
+            /* The notification comes as an error on the socket */
+            if (poll(&pfd, 1, u->timeout_ms) == 0) {
+                return -ETIMEDOUT;
+            }
+            continue;
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *err;
+
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            err = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
+                continue;
+            }
+            /* Completed sends, from ee_info to ee_data */
+            u->zerocopy_done = err->ee_data + 1;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                u->zerocopy_copied = true;
+            }
+        }
+    }
+    return 0;
+}
+
+static int upload_body(struct upload *u)
+{
+    struct webclient_context *ctx = u->ctx;
+    size_t left = ctx->bodylen;
+    struct iovec iov[2];
+    bool head = true;
+    char *buf;
+    int ret = 0;
+
+    if (left == 0) {
+        iov[0] = (struct iovec){.iov_base = u->head, .iov_len = u->head_len};
+        return send_iov(u, iov, 1, 0);
+    }
+
+    buf = malloc(HTTP_UPLOAD_CHUNK);
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    while (left > 0) {
+        const void *data = buf;
+        size_t size = left < HTTP_UPLOAD_CHUNK ? left : HTTP_UPLOAD_CHUNK;
+        int flags, n = 0;
+
+        ret = ctx->body_callback(buf, &size, &data, left, ctx->body_callback_arg);
+        if (ret) {
+            break;
+        }
+        if (size == 0 || size > left) {
+            ret = -EIO;
+            break;
+        }
+        left -= size;
+        flags = left > 0 ? MSG_MORE : 0;
+
+        if (data != buf && u->zerocopy && size >= g_http_upload.zerocopy_min) {
+            /* The pages stay the callback's, as they are, until the upload ends */
+            if (head) {
+                iov[0] = (struct iovec){.iov_base = u->head, .iov_len = u->head_len};
+                ret = send_iov(u, iov, 1, MSG_MORE);
+                if (ret) {
+                    break;
+                }
+            }
+            iov[0] = (struct iovec){.iov_base = (void *)data, .iov_len = size};
+            ret = send_iov(u, iov, 1, flags | MSG_ZEROCOPY);
+            if (ret == 0) {
+                ret = zerocopy_wait(u, HTTP_UPLOAD_ZEROCOPY_PENDING_MAX);
+            }
+            u->zerocopy_bytes += size;
+        }
+        else {
+            if (head) {
+                iov[n++] = (struct iovec){.iov_base = u->head, .iov_len = u->head_len};
+            }
+            iov[n++] = (struct iovec){.iov_base = (void *)data, .iov_len = size};
+            ret = send_iov(u, iov, n, flags);
+        }
+        if (ret) {
+            break;
+        }
+        if (data != buf) {
+            u->direct_bytes += size;
+        }
+        head = false;
+    }
+
+    free(buf);
+    return ret;
+}
+
+static int response_header(const char *line, bool truncated, void *arg)
+{
+    struct upload *u = arg;
+    struct webclient_context *ctx = u->ctx;
+
+    if (ctx->header_callback == NULL) {
+        return 0;
+    }
+    return ctx->header_callback(line, truncated, ctx->header_callback_arg);
+}
+
+/* Hands the body to the sink, without the chunked encoding */
+static int response_sink(const char *data, size_t len, void *arg)
+{
+    struct upload *u = arg;
+    struct webclient_context *ctx = u->ctx;
+    int ret;
+
+    if (ctx->sink_callback == NULL || ctx->buffer == NULL || ctx->buflen <= 0) {
+        return 0;
+    }
+    while (len > 0) {
+        size_t n = len < (size_t)ctx->buflen ? len : (size_t)ctx->buflen;
+
+        memcpy(ctx->buffer, data, n);
+        ret = ctx->sink_callback(&ctx->buffer, 0, n, &ctx->buflen, ctx->sink_callback_arg);
+        if (ret) {
+            return ret;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int upload_response(struct upload *u)
+{
+    struct evp_agent_http_response *r = &u->response;
+    ssize_t n;
+
+    r->header_callback = response_header;
+    r->body_callback = response_sink;
+    r->arg = u;
+    evp_agent_http_response_reset(r);
+
+    while (r->state != EVP_AGENT_HTTP_DONE) {
+        n = recv(u->fd, u->head, sizeof(u->head), 0);
+        if (n < 0) {
+            return -errno;
+        }
+        if (n == 0) {
+            return r->state == EVP_AGENT_HTTP_EOF ? 0 : -ECONNRESET;
+        }
+        n = evp_agent_http_response_parse(r, u->head, n);
+        if (n < 0) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+int evp_agent_http_upload(struct webclient_context *ctx)
+{
+    struct upload *u;
+    char host[HTTP_UPLOAD_HOST_SIZE], port[HTTP_UPLOAD_PORT_SIZE];
+    const char *authority, *path;
+    size_t authority_len;
+    uint64_t start = evp_agent_now_us();
+    int ret;
+
+    /* The request and the response head are kept in it */
+    u = calloc(1, sizeof(*u));
+    if (u == NULL) {
+        return -ENOMEM;
+    }
+    u->ctx = ctx;
+    u->fd = -1;
+    u->timeout_ms = ctx->timeout_sec != 0 ? ctx->timeout_sec * 1000
+                                          : HTTP_UPLOAD_TIMEOUT_MS_DEFAULT;
+    ctx->http_status = 0;
+
+    ret = url_parse(ctx->url, host, port, &authority, &authority_len, &path);
+    if (ret == 0) {
+        ret = upload_head(u, authority, authority_len, path);
+    }
+    if (ret == 0) {
+        ret = upload_connect(u, host, port);
+    }
+    if (ret == 0) {
+        ret = upload_body(u);
+    }
+    if (ret == 0) {
+        ret = upload_response(u);
+        ctx->http_status = u->response.status;
+    }
+    if (ret == 0) {
+        /* Acknowledged by now: this only counts the copies */
+        ret = zerocopy_wait(u, 0);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    if (ret) {
+        EVP_AGENT_WARN("upload to %s:%s failed: %d", host, port, ret);
+    }
+
+    pthread_mutex_lock(&g_http_upload.lock);
+    if (ret == 0) {
+        g_http_upload.uploads++;
+        g_http_upload.bytes += ctx->bodylen;
+        g_http_upload.direct_bytes += u->direct_bytes;
+        g_http_upload.zerocopy_bytes += u->zerocopy_bytes;
+        g_http_upload.zerocopy_copied += u->zerocopy_copied;
+        g_http_upload.time_sum_us += evp_agent_now_us() - start;
+    }
+    else {
+        g_http_upload.failed++;
+    }
+    pthread_mutex_unlock(&g_http_upload.lock);
+
+    free(u);
+    return ret;
+}
+
+static void http_upload_report(void *user)
+{
+    pthread_mutex_lock(&g_http_upload.lock);
+    if (g_http_upload.uploads != 0 || g_http_upload.failed != 0) {
+        EVP_AGENT_INFO("http upload: uploads=%" PRIu64 " failed=%" PRIu64 " kib=%" PRIu64
+                       " direct_kib=%" PRIu64 " zerocopy_kib=%" PRIu64
+                       " zerocopy_copied=%" PRIu64 " kib_per_sec=%" PRIu64,
+                       g_http_upload.uploads, g_http_upload.failed, g_http_upload.bytes / 1024,
+                       g_http_upload.direct_bytes / 1024, g_http_upload.zerocopy_bytes / 1024,
+                       g_http_upload.zerocopy_copied,
+                       g_http_upload.time_sum_us
+                           ? g_http_upload.bytes * 1000000 / 1024 / g_http_upload.time_sum_us
+                           : 0);
+    }
+    pthread_mutex_unlock(&g_http_upload.lock);
+}
+
+int evp_agent_http_upload_init(void)
+{
+    const char *min = getenv("EVP_HTTP_ZEROCOPY_MIN_BYTES");
+
+    g_http_upload.zerocopy_min = HTTP_UPLOAD_ZEROCOPY_MIN_BYTES_DEFAULT;
+    if (min != NULL) {
+        g_http_upload.zerocopy_min = strtoul(min, NULL, 10);
+    }
+    g_http_upload.enabled = true;
+
+    return evp_agent_metrics_register("http_upload", NULL, http_upload_report, NULL);
+}
+
+void evp_agent_http_upload_deinit(void)
+{
+    g_http_upload.enabled = false;
+}
@@ -0,0 +1,46 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_HTTP_UPLOAD_H__
+#define __EVP_HTTP_UPLOAD_H__
+
+#include <stdbool.h>
+
+/*
+ * Plain HTTP uploads without the client buffer.
+ *
+ * With TLS disabled (the local console, or an insecure setup), the HTTP
+ * client of the EVP agent library writes an upload body to the socket in
+ * pieces no larger than its own small buffer, one send per piece. Plain
+ * HTTP PUT and POST requests without a proxy, wrapped at link time (see
+ * webclient_wrap.c), are instead sent from here:
+ *
+ * - the request head goes out in the same writev() as the first piece,
+ * - a piece the body callback hands over in its own memory (in-memory blobs,
+ *   which stay as they are until the upload ends) is sent from there; from
+ *   EVP_HTTP_ZEROCOPY_MIN_BYTES (64 KiB by default, 0 disables it) with
+ *   MSG_ZEROCOPY, waiting for the kernel only once 32 such sends are not
+ *   completed yet, and at the end,
+ * - a piece the callback copies in (file blobs) goes through a 256 KiB
+ *   buffer, so the file is read and sent in larger steps.
+ *
+ * The request head is built and the response parsed as for the pooled
+ * connections (see http_message.h), and the response is handed to the
+ * header and sink callbacks as the client does. Totals and the share sent
+ * without a copy are reported in the metrics.
+ */
+
+struct webclient_context;
+
+int evp_agent_http_upload_init(void);
+void evp_agent_http_upload_deinit(void);
+
+/* The request is a plain HTTP upload to send from here */
+bool evp_agent_http_upload_is(const struct webclient_context *ctx);
+/* webclient_perform() of such a request */
+int evp_agent_http_upload(struct webclient_context *ctx);
+
+#endif /* __EVP_HTTP_UPLOAD_H__ */
@@ -0,0 +1,156 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#define METRICS_SAMPLE_INTERVAL_MS 1000
+#define METRICS_REPORT_INTERVAL_SEC_DEFAULT 300
+
+struct metrics_source {
+    TAILQ_ENTRY(metrics_source) q;
+    const char *name;
+    evp_agent_metrics_cb sample;
+    evp_agent_metrics_cb report;
+    void *user;
+};
+
+TAILQ_HEAD(metrics_source_head, metrics_source);
+
+static struct {
+    struct metrics_source_head queue;
+    pthread_mutex_t lock;
+    uint64_t last_sample_ms;
+    uint64_t last_report_ms;
+    uint64_t report_interval_ms;
+} g_metrics = {.queue = TAILQ_HEAD_INITIALIZER(g_metrics.queue),
+               .lock = PTHREAD_MUTEX_INITIALIZER};
+
+uint64_t evp_agent_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint64_t evp_agent_thread_cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t now_ms(void)
+{
+    return evp_agent_now_us() / 1000;
+}
+
+static uint64_t report_interval_ms(void)
+{
+    if (g_metrics.report_interval_ms == 0) {
+        uint64_t sec = METRICS_REPORT_INTERVAL_SEC_DEFAULT;
+        const char *env = getenv("EVP_AGENT_METRICS_REPORT_SEC");
+
+        if (env != NULL && strtoul(env, NULL, 10) > 0) {
+            sec = strtoul(env, NULL, 10);
+        }
+        g_metrics.report_interval_ms = sec * 1000;
+    }
+
+    return g_metrics.report_interval_ms;
+}
+
+int evp_agent_metrics_register(const char *name, evp_agent_metrics_cb sample,
+                               evp_agent_metrics_cb report, void *user)
+{
+    if (name == NULL || (sample == NULL && report == NULL)) {
+        EVP_AGENT_ERR("invalid metrics source");
+        return -EINVAL;
+    }
+
+    struct metrics_source *source = malloc(sizeof(*source));
+    if (source == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for metrics source %s", name);
+        return -ENOMEM;
+    }
+
+    source->name = name;
+    source->sample = sample;
+    source->report = report;
+    source->user = user;
+
+    pthread_mutex_lock(&g_metrics.lock);
+    TAILQ_INSERT_TAIL(&g_metrics.queue, source, q);
+    pthread_mutex_unlock(&g_metrics.lock);
+
+    return 0;
+}
+
+static void metrics_run(bool report)
+{
+    struct metrics_source *source;
+
+    pthread_mutex_lock(&g_metrics.lock);
+    TAILQ_FOREACH(source, &g_metrics.queue, q)
+    {
+        if (source->sample != NULL) {
+            source->sample(source->user);
+        }
+        if (report && source->report != NULL) {
+            source->report(source->user);
+        }
+    }
+    pthread_mutex_unlock(&g_metrics.lock);
+}
+
+void evp_agent_metrics_poll(void)
+{
+    uint64_t now = now_ms();
+
+    if (now - g_metrics.last_sample_ms < METRICS_SAMPLE_INTERVAL_MS) {
+        return;
+    }
+    g_metrics.last_sample_ms = now;
+    if (g_metrics.last_report_ms == 0) {
+        g_metrics.last_report_ms = now;
+    }
+
+    bool report = now - g_metrics.last_report_ms >= report_interval_ms();
+    if (report) {
+        g_metrics.last_report_ms = now;
+    }
+
+    metrics_run(report);
+}
+
+void evp_agent_metrics_report(void)
+{
+    g_metrics.last_report_ms = now_ms();
+    metrics_run(true);
+}
+
+void evp_agent_metrics_deinit(void)
+{
+    struct metrics_source *source, *tmp;
+
+    pthread_mutex_lock(&g_metrics.lock);
+    TAILQ_FOREACH_SAFE(source, &g_metrics.queue, q, tmp)
+    {
+        TAILQ_REMOVE(&g_metrics.queue, source, q);
+        free(source);
+    }
+    pthread_mutex_unlock(&g_metrics.lock);
+}
@@ -0,0 +1,34 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_METRICS_H__
+#define __EVP_METRICS_H__
+
+#include <stdint.h>
+
+/*
+ * Periodic sampling and reporting of agent-side metrics.
+ *
+ * Sources register a sample callback, called about once per second to update
+ * high-water marks and counters, and a report callback, called every report
+ * interval (EVP_AGENT_METRICS_REPORT_SEC, 300 s by default) to log them.
+ * Both callbacks run on the EVP Agent thread.
+ */
+
+typedef void (*evp_agent_metrics_cb)(void *user);
+
+int evp_agent_metrics_register(const char *name, evp_agent_metrics_cb sample,
+                               evp_agent_metrics_cb report, void *user);
+void evp_agent_metrics_poll(void);
+void evp_agent_metrics_report(void);
+void evp_agent_metrics_deinit(void);
+
+/* CLOCK_MONOTONIC, in microseconds */
+uint64_t evp_agent_now_us(void);
+/* The CPU time of the calling thread, in microseconds */
+uint64_t evp_agent_thread_cpu_us(void);
+
+#endif /* __EVP_METRICS_H__ */
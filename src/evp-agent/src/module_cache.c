@@ -0,0 +1,508 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for asprintf */
+#include <dirent.h>
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <parson.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "module_cache.h"
+#include "wasm_runtime_wrap.h"
+
+#define MODULE_CACHE_DEFAULT_DIR "/var/lib/edge-device-core/module-cache"
+#define MODULE_CACHE_MAX_BYTES_DEFAULT (256 * 1024 * 1024)
+#define MODULE_CACHE_INDEX "index.json"
+#define MODULE_CACHE_INDEX_TMP "index.json.tmp"
+
+struct cache_entry {
+    TAILQ_ENTRY(cache_entry) q;
+    char digest[EVP_WASM_DIGEST_LEN];
+    /* In the cache, or only referenced */
+    bool present;
+    size_t size;
+    /* Seconds since the epoch, kept across restarts */
+    uint64_t last_used;
+    /* By the current deployment, which keeps it from eviction */
+    unsigned int refs;
+};
+
+TAILQ_HEAD(cache_entry_head, cache_entry);
+
+static struct {
+    char *dir;
+    size_t max_bytes;
+    size_t bytes;
+    struct cache_entry_head entries;
+    /* The last uses changed since the index was written */
+    bool dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t saved_bytes;
+    pthread_mutex_t lock;
+} g_module_cache = {.entries = TAILQ_HEAD_INITIALIZER(g_module_cache.entries),
+                    .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* A SHA-256 in lowercase hex, and nothing a path could be made of */
+static bool digest_valid(const char *digest)
+{
+    return strlen(digest) == EVP_WASM_DIGEST_LEN - 1 &&
+           strspn(digest, "0123456789abcdef") == EVP_WASM_DIGEST_LEN - 1;
+}
+
+static struct cache_entry *entry_lookup(const char *digest)
+{
+    struct cache_entry *e;
+
+    TAILQ_FOREACH(e, &g_module_cache.entries, q)
+    {
+        if (strcmp(e->digest, digest) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static struct cache_entry *entry_get(const char *digest)
+{
+    struct cache_entry *e = entry_lookup(digest);
+
+    if (e != NULL) {
+        return e;
+    }
+    if (!digest_valid(digest)) {
+        EVP_AGENT_WARN("not a module digest: %.80s", digest);
+        return NULL;
+    }
+    e = calloc(1, sizeof(*e));
+    if (e == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for a module cache entry");
+        return NULL;
+    }
+    snprintf(e->digest, sizeof(e->digest), "%s", digest);
+    TAILQ_INSERT_TAIL(&g_module_cache.entries, e, q);
+    return e;
+}
+
+static void entry_put(struct cache_entry *e)
+{
+    if (!e->present && e->refs == 0) {
+        TAILQ_REMOVE(&g_module_cache.entries, e, q);
+        free(e);
+    }
+}
+
+static char *entry_path(const char *name)
+{
+    char *path;
+
+    if (asprintf(&path, "%s/%s", g_module_cache.dir, name) < 0) {
+        return NULL;
+    }
+    return path;
+}
+
+static void entry_remove(struct cache_entry *e)
+{
+    char *path = entry_path(e->digest);
+
+    if (path != NULL) {
+        unlink(path);
+        free(path);
+    }
+    g_module_cache.bytes -= e->size;
+    e->present = false;
+    e->size = 0;
+    entry_put(e);
+}
+
+/* Written aside and renamed, so a power cut leaves either index whole */
+static void index_save(void)
+{
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *root = json_value_get_object(value);
+    struct cache_entry *e;
+    char *path, *tmp;
+
+    if (root == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for the module cache index");
+        json_value_free(value);
+        return;
+    }
+    TAILQ_FOREACH(e, &g_module_cache.entries, q)
+    {
+        JSON_Value *obj;
+
+        if (!e->present) {
+            continue;
+        }
+        obj = json_value_init_object();
+        json_object_set_number(json_value_get_object(obj), "size", e->size);
+        json_object_set_number(json_value_get_object(obj), "lastUsed", e->last_used);
+        json_object_set_value(root, e->digest, obj);
+    }
+
+    path = entry_path(MODULE_CACHE_INDEX);
+    tmp = entry_path(MODULE_CACHE_INDEX_TMP);
+    if (path == NULL || tmp == NULL || json_serialize_to_file(value, tmp) != JSONSuccess ||
+        rename(tmp, path) != 0) {
+        EVP_AGENT_WARN("failed to write the module cache index");
+    }
+    else {
+        g_module_cache.dirty = false;
+    }
+    free(tmp);
+    free(path);
+    json_value_free(value);
+}
+
+/*
+ * Copies a file from another file system next to dst, then renames it, so a
+ * power cut never leaves dst short
+ */
+static int file_copy(const char *src, const char *dst)
+{
+    char buf[16 * 1024], *tmp;
+    int in, out, ret = 0;
+    ssize_t n;
+
+    if (asprintf(&tmp, "%s.tmp", dst) < 0) {
+        return -ENOMEM;
+    }
+    in = open(src, O_RDONLY | O_CLOEXEC);
+    out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (in < 0 || out < 0) {
+        ret = -errno;
+    }
+    while (ret == 0 && (n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            ret = errno == EINTR ? 0 : -errno;
+            continue;
+        }
+        for (ssize_t done = 0, w; ret == 0 && done < n; done += w) {
+            w = write(out, buf + done, n - done);
+            if (w < 0) {
+                ret = errno == EINTR ? 0 : -errno;
+                w = 0;
+            }
+        }
+    }
+    if (ret == 0 && fsync(out) != 0) {
+        ret = -errno;
+    }
+    if (out >= 0 && close(out) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    if (ret == 0 && rename(tmp, dst) != 0) {
+        ret = -errno;
+    }
+    if (ret == 0) {
+        unlink(src);
+    }
+    else {
+        unlink(tmp);
+    }
+    free(tmp);
+    return ret;
+}
+
+/* Makes room for size bytes, least recently used first, sparing the referenced */
+static void evict(size_t size)
+{
+    while (g_module_cache.bytes + size > g_module_cache.max_bytes) {
+        struct cache_entry *e, *lru = NULL;
+
+        TAILQ_FOREACH(e, &g_module_cache.entries, q)
+        {
+            if (e->present && e->refs == 0 && (lru == NULL || e->last_used < lru->last_used)) {
+                lru = e;
+            }
+        }
+        if (lru == NULL) {
+            break;
+        }
+        EVP_AGENT_INFO("evicting module %.12s from the cache: %zu bytes", lru->digest, lru->size);
+        g_module_cache.evictions++;
+        entry_remove(lru);
+    }
+}
+
+void evp_agent_module_cache_ref(const char *digest)
+{
+    struct cache_entry *e;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir != NULL) {
+        e = entry_get(digest);
+        if (e != NULL) {
+            e->refs++;
+        }
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+}
+
+void evp_agent_module_cache_unref(const char *digest)
+{
+    struct cache_entry *e;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    e = entry_lookup(digest);
+    if (e != NULL && e->refs > 0) {
+        e->refs--;
+        entry_put(e);
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+}
+
+char *evp_agent_module_cache_lookup(const char *digest, size_t *size)
+{
+    struct cache_entry *e;
+    char *path = NULL;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir == NULL) {
+        pthread_mutex_unlock(&g_module_cache.lock);
+        return NULL;
+    }
+    e = entry_lookup(digest);
+    if (e != NULL && e->present) {
+        path = entry_path(digest);
+    }
+    if (path != NULL) {
+        e->last_used = time(NULL);
+        g_module_cache.dirty = true;
+        g_module_cache.hits++;
+        g_module_cache.saved_bytes += e->size;
+        *size = e->size;
+    }
+    else {
+        g_module_cache.misses++;
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+
+    return path;
+}
+
+char *evp_agent_module_cache_path(const char *digest, size_t *size)
+{
+    struct cache_entry *e;
+    char *path = NULL;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir != NULL) {
+        e = entry_lookup(digest);
+        if (e != NULL && e->present) {
+            path = entry_path(digest);
+            *size = e->size;
+        }
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+
+    return path;
+}
+
+int evp_agent_module_cache_insert(const char *digest, const char *path, size_t size,
+                                  char **cached)
+{
+    struct cache_entry *e = NULL;
+    char *dst = NULL;
+    int ret = 0;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir == NULL) {
+        ret = -ENOTSUP;
+        goto out;
+    }
+    if (!digest_valid(digest)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    e = entry_get(digest);
+    dst = entry_path(digest);
+    if (e == NULL || dst == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    if (e->present) {
+        g_module_cache.bytes -= e->size;
+        e->present = false;
+    }
+    evict(size);
+    if (g_module_cache.bytes + size > g_module_cache.max_bytes && e->refs == 0) {
+        ret = -ENOSPC;
+        goto out;
+    }
+    /* The fetch directory may be on another file system */
+    ret = rename(path, dst) != 0 ? -errno : 0;
+    if (ret == -EXDEV) {
+        ret = file_copy(path, dst);
+    }
+    if (ret) {
+        EVP_AGENT_WARN("failed to move module %.12s into the cache: %s", digest, strerror(-ret));
+        goto out;
+    }
+    e->present = true;
+    e->size = size;
+    e->last_used = time(NULL);
+    g_module_cache.bytes += size;
+    g_module_cache.inserts++;
+    index_save();
+    *cached = dst;
+    dst = NULL;
+
+out:
+    if (ret && e != NULL) {
+        entry_put(e);
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+    free(dst);
+    return ret;
+}
+
+static void index_load(void)
+{
+    char *path = entry_path(MODULE_CACHE_INDEX);
+    JSON_Value *value = path != NULL ? json_parse_file(path) : NULL;
+    JSON_Object *root = json_value_get_object(value);
+    struct dirent *dent;
+    struct stat st;
+    DIR *dir;
+
+    for (size_t i = 0; i < json_object_get_count(root); i++) {
+        const char *digest = json_object_get_name(root, i);
+        JSON_Object *obj = json_value_get_object(json_object_get_value_at(root, i));
+        char *file;
+        struct cache_entry *e;
+
+        /* Never a path of its own */
+        if (obj == NULL || digest == NULL || !digest_valid(digest)) {
+            continue;
+        }
+        file = entry_path(digest);
+        /* A file cut short, or replaced, is dropped below */
+        if (file == NULL || stat(file, &st) != 0 ||
+            (size_t)st.st_size != (size_t)json_object_get_number(obj, "size")) {
+            free(file);
+            continue;
+        }
+        free(file);
+        e = entry_get(digest);
+        if (e == NULL) {
+            break;
+        }
+        e->present = true;
+        e->size = st.st_size;
+        e->last_used = (uint64_t)json_object_get_number(obj, "lastUsed");
+        g_module_cache.bytes += e->size;
+    }
+    json_value_free(value);
+    free(path);
+
+    /* Files the index does not list: unverified, or left by a power cut */
+    dir = opendir(g_module_cache.dir);
+    while (dir != NULL && (dent = readdir(dir)) != NULL) {
+        struct cache_entry *e = entry_lookup(dent->d_name);
+
+        if (dent->d_name[0] == '.' || strcmp(dent->d_name, MODULE_CACHE_INDEX) == 0 ||
+            (e != NULL && e->present)) {
+            continue;
+        }
+        unlinkat(dirfd(dir), dent->d_name, 0);
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+}
+
+static void module_cache_report(void *user)
+{
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir != NULL) {
+        if (g_module_cache.dirty) {
+            index_save();
+        }
+        EVP_AGENT_INFO("module cache: kib=%zu max_kib=%zu hits=%" PRIu64 " misses=%" PRIu64
+                       " inserts=%" PRIu64 " evictions=%" PRIu64 " saved_kib=%" PRIu64,
+                       g_module_cache.bytes / 1024, g_module_cache.max_bytes / 1024,
+                       g_module_cache.hits, g_module_cache.misses, g_module_cache.inserts,
+                       g_module_cache.evictions, g_module_cache.saved_bytes / 1024);
+    }
+    pthread_mutex_unlock(&g_module_cache.lock);
+}
+
+int evp_agent_module_cache_init(void)
+{
+    const char *dir = getenv("EVP_MODULE_CACHE_DIR");
+    const char *max_bytes = getenv("EVP_MODULE_CACHE_MAX_BYTES");
+
+    g_module_cache.max_bytes = MODULE_CACHE_MAX_BYTES_DEFAULT;
+    if (max_bytes != NULL) {
+        g_module_cache.max_bytes = strtoull(max_bytes, NULL, 10);
+    }
+    if (dir == NULL) {
+        dir = MODULE_CACHE_DEFAULT_DIR;
+    }
+
+    if (g_module_cache.max_bytes != 0) {
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            EVP_AGENT_WARN("failed to create %s, modules are not cached: %s", dir,
+                           strerror(errno));
+        }
+        else {
+            g_module_cache.dir = strdup(dir);
+            if (g_module_cache.dir == NULL) {
+                return -ENOMEM;
+            }
+            pthread_mutex_lock(&g_module_cache.lock);
+            index_load();
+            evict(0);
+            index_save();
+            pthread_mutex_unlock(&g_module_cache.lock);
+            EVP_AGENT_INFO("module cache %s: %zu KiB of %zu KiB", dir,
+                           g_module_cache.bytes / 1024, g_module_cache.max_bytes / 1024);
+        }
+    }
+
+    return evp_agent_metrics_register("module_cache", NULL, module_cache_report, NULL);
+}
+
+void evp_agent_module_cache_deinit(void)
+{
+    struct cache_entry *e, *tmp;
+
+    pthread_mutex_lock(&g_module_cache.lock);
+    if (g_module_cache.dir != NULL && g_module_cache.dirty) {
+        index_save();
+    }
+    TAILQ_FOREACH_SAFE(e, &g_module_cache.entries, q, tmp)
+    {
+        TAILQ_REMOVE(&g_module_cache.entries, e, q);
+        free(e);
+    }
+    g_module_cache.bytes = 0;
+    free(g_module_cache.dir);
+    g_module_cache.dir = NULL;
+    pthread_mutex_unlock(&g_module_cache.lock);
+}
@@ -0,0 +1,52 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_MODULE_CACHE_H__
+#define __EVP_MODULE_CACHE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Content-addressed module cache.
+ *
+ * The modules fetched for a deployment (see deployment_fetch.h) are kept in
+ * EVP_MODULE_CACHE_DIR (/var/lib/edge-device-core/module-cache by default)
+ * under their SHA-256, once verified against it, and listed in its
+ * index.json with their size and their last use: only verified modules go
+ * in, and an entry whose file is missing or of another size is dropped at
+ * startup. The size is all that is checked again: no record of the
+ * verification is kept. A module of a later deployment with the same hash,
+ * a rollback or the same module under a new deployment ID, is then answered
+ * from there without a download, across restarts too. The agent library
+ * still verifies its digest as it reads it.
+ *
+ * Each module is referenced by the deployments that use it, and those the
+ * current deployment references are kept. The others are evicted, least
+ * recently used first, to keep the cache within EVP_MODULE_CACHE_MAX_BYTES
+ * (256 MiB by default, 0 disables the cache). Hits, misses and the bytes
+ * they saved are reported in the metrics.
+ */
+
+int evp_agent_module_cache_init(void);
+void evp_agent_module_cache_deinit(void);
+
+/* A deployment references, or stopped referencing, the module of a hash */
+void evp_agent_module_cache_ref(const char *digest);
+void evp_agent_module_cache_unref(const char *digest);
+
+/* The path of the cached module of a hash, to be freed, NULL if not cached */
+char *evp_agent_module_cache_lookup(const char *digest, size_t *size);
+/* Same, for reading a module already fetched: not counted as a hit or a miss */
+char *evp_agent_module_cache_path(const char *digest, size_t *size);
+/*
+ * Moves the file of a module verified against its hash into the cache, and
+ * gives its path there, to be freed
+ */
+int evp_agent_module_cache_insert(const char *digest, const char *path, size_t size,
+                                  char **cached);
+
+#endif /* __EVP_MODULE_CACHE_H__ */
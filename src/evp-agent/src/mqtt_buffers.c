@@ -0,0 +1,562 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mqtt.h>
+
+#include "compress.h"
+#include "deployment_fetch.h"
+#include "log.h"
+#include "metrics.h"
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
+#include "telemetry_batch.h"
+
+#define MQTT_RECV_BUFFER_MAX_DEFAULT (1024 * 1024)
+#define MQTT_SEND_BACKLOG_MAX_DEFAULT (256 * 1024)
+/* Send buffer occupancy above which the connection is congested */
+#define MQTT_CONGESTED_PCT 75
+
+enum MQTTErrors __real_mqtt_init(struct mqtt_client *client, mqtt_pal_socket_handle sockfd,
+                                 uint8_t *sendbuf, size_t sendbufsz, uint8_t *recvbuf,
+                                 size_t recvbufsz,
+                                 void (*publish_response_callback)(
+                                     void **state, struct mqtt_response_publish *publish));
+void __real_mqtt_reinit(struct mqtt_client *client, mqtt_pal_socket_handle socketfd,
+                        uint8_t *sendbuf, size_t sendbufsz, uint8_t *recvbuf, size_t recvbufsz);
+enum MQTTErrors __real_mqtt_sync(struct mqtt_client *client);
+enum MQTTErrors __real_mqtt_publish(struct mqtt_client *client, const char *topic_name,
+                                    const void *application_message,
+                                    size_t application_message_size, uint8_t publish_flags);
+
+struct mqtt_deferred {
+    TAILQ_ENTRY(mqtt_deferred) q;
+    char *topic;
+    size_t size;
+    uint8_t flags;
+    uint8_t data[];
+};
+
+TAILQ_HEAD(mqtt_deferred_head, mqtt_deferred);
+
+struct mqtt_buffers_client {
+    TAILQ_ENTRY(mqtt_buffers_client) q;
+    struct mqtt_client *client;
+    /*
+     * Orders the sends of the client and guards the rest of the entry.
+     * Taken before the mutex of the MQTT-C client, which is never held
+     * when taking it, and before the global lock.
+     */
+    pthread_mutex_t lock;
+    /* Grown receive buffer, owned here */
+    uint8_t *recvbuf;
+    size_t recv_size;
+    struct mqtt_deferred_head backlog;
+    size_t backlog_bytes;
+    /* Of the agent, the messages it receives go through publish_received() first */
+    void (*publish_response_callback)(void **state, struct mqtt_response_publish *publish);
+};
+
+TAILQ_HEAD(mqtt_buffers_client_head, mqtt_buffers_client);
+
+static struct {
+    /* Entries live until deinit, once the MQTT clients are stopped */
+    struct mqtt_buffers_client_head clients;
+    size_t recv_max;
+    size_t backlog_max;
+    bool congested;
+    size_t recv_size;
+    size_t send_size;
+    /* High-water marks, in bytes */
+    size_t recv_hwm;
+    size_t send_hwm;
+    size_t backlog_hwm;
+    uint64_t grown;
+    uint64_t deferred;
+    uint64_t rejected;
+    /* Guards the list and the statistics, taken last */
+    pthread_mutex_t lock;
+} g_mqtt_buffers = {.clients = TAILQ_HEAD_INITIALIZER(g_mqtt_buffers.clients),
+                    .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* The client running mqtt_sync() on this thread, which calls publish_received() */
+static __thread struct mqtt_buffers_client *t_sync;
+
+static size_t env_size(const char *name, size_t def)
+{
+    const char *value = getenv(name);
+
+    if (value == NULL) {
+        return def;
+    }
+    return strtoul(value, NULL, 0);
+}
+
+static struct mqtt_buffers_client *client_lookup(const struct mqtt_client *client)
+{
+    struct mqtt_buffers_client *c;
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    TAILQ_FOREACH(c, &g_mqtt_buffers.clients, q)
+    {
+        if (c->client == client) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+
+    return c;
+}
+
+static struct mqtt_buffers_client *client_get(struct mqtt_client *client)
+{
+    struct mqtt_buffers_client *c = client_lookup(client);
+
+    if (c != NULL) {
+        return c;
+    }
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for mqtt_buffers_client");
+        return NULL;
+    }
+    c->client = client;
+    pthread_mutex_init(&c->lock, NULL);
+    TAILQ_INIT(&c->backlog);
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    TAILQ_INSERT_TAIL(&g_mqtt_buffers.clients, c, q);
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+
+    return c;
+}
+
+/* Bytes a publish takes in the send buffer */
+static size_t publish_size(const char *topic, size_t size, uint8_t flags)
+{
+    size_t remaining = 2 + strlen(topic) + size + ((flags & MQTT_PUBLISH_QOS_MASK) ? 2 : 0);
+    size_t len = 2;
+
+    for (size_t r = remaining; r >= 128; r >>= 7) {
+        len++;
+    }
+
+    return len + remaining;
+}
+
+static size_t send_buffer_size(const struct mqtt_client *client)
+{
+    return (uint8_t *)client->mq.mem_end - (uint8_t *)client->mq.mem_start;
+}
+
+/*
+ * Free room in the send buffer, once the acknowledged messages are
+ * dropped. Also samples the occupancy. Called with the client lock held.
+ */
+static size_t send_room(struct mqtt_client *client)
+{
+    size_t room, size;
+
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    mqtt_mq_clean(&client->mq);
+    room = client->mq.curr_sz;
+    size = send_buffer_size(client);
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    if (size - room > g_mqtt_buffers.send_hwm) {
+        g_mqtt_buffers.send_hwm = size - room;
+    }
+    g_mqtt_buffers.send_size = size;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+    return room;
+}
+
+/* Called with the client lock held */
+static void update_congested(struct mqtt_buffers_client *c)
+{
+    size_t size = send_buffer_size(c->client);
+    size_t room = send_room(c->client);
+    bool congested =
+        !TAILQ_EMPTY(&c->backlog) || (size - room) * 100 > size * MQTT_CONGESTED_PCT;
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    g_mqtt_buffers.congested = congested;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+}
+
+/* Called with the client lock held */
+static bool recv_grow(struct mqtt_buffers_client *c)
+{
+    struct mqtt_client *client = c->client;
+    bool grown = false;
+    size_t size, used;
+    uint8_t *buf;
+
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    size = client->recv_buffer.mem_size;
+    if (client->error != MQTT_ERROR_RECV_BUFFER_TOO_SMALL || size >= g_mqtt_buffers.recv_max) {
+        MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+        return false;
+    }
+
+    used = client->recv_buffer.curr - client->recv_buffer.mem_start;
+    size = size * 2 < g_mqtt_buffers.recv_max ? size * 2 : g_mqtt_buffers.recv_max;
+    buf = malloc(size);
+    if (buf != NULL) {
+        /* Keep the partial packet */
+        memcpy(buf, client->recv_buffer.mem_start, used);
+        free(c->recvbuf);
+        c->recvbuf = buf;
+        c->recv_size = size;
+        client->recv_buffer.mem_start = buf;
+        client->recv_buffer.mem_size = size;
+        client->recv_buffer.curr = buf + used;
+        client->recv_buffer.curr_sz = size - used;
+        client->error = MQTT_OK;
+        grown = true;
+    }
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+
+    if (!grown) {
+        EVP_AGENT_ERR("failed to grow the MQTT receive buffer to %zu bytes", size);
+        return false;
+    }
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    if (used > g_mqtt_buffers.recv_hwm) {
+        g_mqtt_buffers.recv_hwm = used;
+    }
+    g_mqtt_buffers.recv_size = size;
+    g_mqtt_buffers.grown++;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+    EVP_AGENT_INFO("MQTT receive buffer grown to %zu bytes", size);
+
+    return true;
+}
+
+/* Sends the deferred publishes that fit, called with the client lock held */
+static void backlog_drain(struct mqtt_buffers_client *c)
+{
+    struct mqtt_deferred *d;
+
+    while ((d = TAILQ_FIRST(&c->backlog)) != NULL) {
+        if (send_room(c->client) < publish_size(d->topic, d->size, d->flags) ||
+            __real_mqtt_publish(c->client, d->topic, d->data, d->size, d->flags) != MQTT_OK) {
+            break;
+        }
+        TAILQ_REMOVE(&c->backlog, d, q);
+        c->backlog_bytes -= d->size;
+        free(d);
+    }
+}
+
+/* Called with the client lock held */
+static enum MQTTErrors backlog_add(struct mqtt_buffers_client *c, const char *topic,
+                                   const void *msg, size_t size, uint8_t flags)
+{
+    size_t topic_len = strlen(topic) + 1;
+    struct mqtt_deferred *d = NULL;
+
+    if (c->backlog_bytes + size <= g_mqtt_buffers.backlog_max) {
+        d = malloc(sizeof(*d) + size + topic_len);
+        if (d == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for mqtt_deferred");
+        }
+    }
+    if (d == NULL) {
+        pthread_mutex_lock(&g_mqtt_buffers.lock);
+        g_mqtt_buffers.rejected++;
+        pthread_mutex_unlock(&g_mqtt_buffers.lock);
+        return MQTT_ERROR_SEND_BUFFER_IS_FULL;
+    }
+    d->topic = (char *)d->data + size;
+    d->size = size;
+    d->flags = flags;
+    memcpy(d->data, msg, size);
+    memcpy(d->topic, topic, topic_len);
+
+    TAILQ_INSERT_TAIL(&c->backlog, d, q);
+    c->backlog_bytes += size;
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    if (c->backlog_bytes > g_mqtt_buffers.backlog_hwm) {
+        g_mqtt_buffers.backlog_hwm = c->backlog_bytes;
+    }
+    g_mqtt_buffers.deferred++;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+
+    return MQTT_OK;
+}
+
+/* Called by mqtt_sync(), with the mutex of the MQTT-C client held */
+static void publish_received(void **state, struct mqtt_response_publish *publish)
+{
+    evp_agent_deployment_fetch_received(publish->topic_name, publish->topic_name_size,
+                                        publish->application_message,
+                                        publish->application_message_size);
+    t_sync->publish_response_callback(state, publish);
+}
+
+enum MQTTErrors __wrap_mqtt_init(struct mqtt_client *client, mqtt_pal_socket_handle sockfd,
+                                 uint8_t *sendbuf, size_t sendbufsz, uint8_t *recvbuf,
+                                 size_t recvbufsz,
+                                 void (*publish_response_callback)(
+                                     void **state, struct mqtt_response_publish *publish))
+{
+    struct mqtt_buffers_client *c = client_get(client);
+
+    if (c == NULL) {
+        return __real_mqtt_init(client, sockfd, sendbuf, sendbufsz, recvbuf, recvbufsz,
+                                publish_response_callback);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (c->recv_size > recvbufsz) {
+        recvbuf = c->recvbuf;
+        recvbufsz = c->recv_size;
+    }
+    c->publish_response_callback = publish_response_callback;
+    pthread_mutex_unlock(&c->lock);
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    g_mqtt_buffers.recv_size = recvbufsz;
+    g_mqtt_buffers.send_size = sendbufsz;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+
+    return __real_mqtt_init(client, sockfd, sendbuf, sendbufsz, recvbuf, recvbufsz,
+                            publish_received);
+}
+
+void __wrap_mqtt_reinit(struct mqtt_client *client, mqtt_pal_socket_handle socketfd,
+                        uint8_t *sendbuf, size_t sendbufsz, uint8_t *recvbuf, size_t recvbufsz)
+{
+    struct mqtt_buffers_client *c = client_lookup(client);
+
+    /* Called on reconnects, keep the grown receive buffer */
+    if (c != NULL) {
+        pthread_mutex_lock(&c->lock);
+        if (c->recv_size > recvbufsz) {
+            recvbuf = c->recvbuf;
+            recvbufsz = c->recv_size;
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    __real_mqtt_reinit(client, socketfd, sendbuf, sendbufsz, recvbuf, recvbufsz);
+    /* The queue is dropped with the messages not sent or acknowledged yet */
+    evp_agent_mqtt_store_rewind();
+}
+
+enum MQTTErrors __wrap_mqtt_sync(struct mqtt_client *client)
+{
+    struct mqtt_buffers_client *c;
+    enum MQTTErrors ret;
+    bool grown;
+
+    evp_agent_telemetry_batch_poll(client);
+
+    c = client_lookup(client);
+    if (c != NULL) {
+        pthread_mutex_lock(&c->lock);
+        if (client->error == MQTT_OK) {
+            backlog_drain(c);
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    t_sync = c;
+    for (;;) {
+        ret = __real_mqtt_sync(client);
+        if (ret != MQTT_ERROR_RECV_BUFFER_TOO_SMALL || c == NULL) {
+            break;
+        }
+
+        pthread_mutex_lock(&c->lock);
+        grown = recv_grow(c);
+        pthread_mutex_unlock(&c->lock);
+        if (!grown) {
+            break;
+        }
+    }
+    t_sync = NULL;
+
+    if (c != NULL) {
+        pthread_mutex_lock(&c->lock);
+        update_congested(c);
+        pthread_mutex_unlock(&c->lock);
+    }
+
+    evp_agent_mqtt_store_replay(client);
+
+    return ret;
+}
+
+enum MQTTErrors evp_agent_mqtt_send(struct mqtt_client *client, const char *topic_name,
+                                    const void *application_message,
+                                    size_t application_message_size, uint8_t publish_flags)
+{
+    size_t size = publish_size(topic_name, application_message_size, publish_flags);
+    struct mqtt_buffers_client *c = client_lookup(client);
+    enum MQTTErrors ret;
+
+    if (c == NULL) {
+        return __real_mqtt_publish(client, topic_name, application_message,
+                                   application_message_size, publish_flags);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    /*
+     * Defer only what can be sent later: not on a failed connection, and not
+     * a message larger than the whole send buffer
+     */
+    if (g_mqtt_buffers.backlog_max == 0 || client->error != MQTT_OK ||
+        size > send_buffer_size(client) - sizeof(struct mqtt_queued_message) ||
+        (TAILQ_EMPTY(&c->backlog) && send_room(client) >= size)) {
+        ret = __real_mqtt_publish(client, topic_name, application_message,
+                                  application_message_size, publish_flags);
+    }
+    else {
+        ret = backlog_add(c, topic_name, application_message, application_message_size,
+                          publish_flags);
+    }
+    update_congested(c);
+    pthread_mutex_unlock(&c->lock);
+
+    return ret;
+}
+
+enum MQTTErrors evp_agent_mqtt_publish(struct mqtt_client *client, const char *topic_name,
+                                       const void *application_message,
+                                       size_t application_message_size, uint8_t publish_flags)
+{
+    void *compressed = NULL;
+    size_t size;
+    enum MQTTErrors ret;
+
+    /* Stored and sent compressed, so a replay needs no second pass */
+    if (evp_agent_compress(evp_agent_compress_topic_class(topic_name), application_message,
+                           application_message_size, &compressed, &size, NULL)) {
+        application_message = compressed;
+        application_message_size = size;
+    }
+
+    if (evp_agent_mqtt_store_add(client, topic_name, application_message,
+                                 application_message_size, publish_flags)) {
+        free(compressed);
+        return MQTT_OK;
+    }
+
+    ret = evp_agent_mqtt_send(client, topic_name, application_message, application_message_size,
+                              publish_flags);
+    if (ret != MQTT_OK && evp_agent_mqtt_store_spill(topic_name, application_message,
+                                                     application_message_size, publish_flags)) {
+        ret = MQTT_OK;
+    }
+
+    free(compressed);
+    return ret;
+}
+
+enum MQTTErrors __wrap_mqtt_publish(struct mqtt_client *client, const char *topic_name,
+                                    const void *application_message,
+                                    size_t application_message_size, uint8_t publish_flags)
+{
+    if (evp_agent_telemetry_batch_add(client, topic_name, application_message,
+                                      application_message_size, publish_flags)) {
+        return MQTT_OK;
+    }
+
+    return evp_agent_mqtt_publish(client, topic_name, application_message,
+                                  application_message_size, publish_flags);
+}
+
+bool evp_agent_mqtt_sent(struct mqtt_client *client)
+{
+    struct mqtt_buffers_client *c = client_lookup(client);
+    bool sent = true;
+
+    if (c != NULL) {
+        pthread_mutex_lock(&c->lock);
+        sent = TAILQ_EMPTY(&c->backlog);
+        pthread_mutex_unlock(&c->lock);
+    }
+    if (!sent) {
+        return false;
+    }
+
+    MQTT_PAL_MUTEX_LOCK(&client->mutex);
+    sent = client->error == MQTT_OK;
+    for (ssize_t i = 0; sent && i < mqtt_mq_length(&client->mq); i++) {
+        sent = mqtt_mq_get(&client->mq, i)->state == MQTT_QUEUED_COMPLETE;
+    }
+    MQTT_PAL_MUTEX_UNLOCK(&client->mutex);
+
+    return sent;
+}
+
+bool evp_agent_mqtt_congested(void)
+{
+    bool congested;
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    congested = g_mqtt_buffers.congested;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+
+    return congested;
+}
+
+static void mqtt_buffers_report(void *user)
+{
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    EVP_AGENT_INFO("mqtt buffers: recv_size=%zu recv_hwm=%zu grown=%" PRIu64
+                   " send_size=%zu send_hwm=%zu backlog_hwm=%zu deferred=%" PRIu64
+                   " rejected=%" PRIu64,
+                   g_mqtt_buffers.recv_size, g_mqtt_buffers.recv_hwm, g_mqtt_buffers.grown,
+                   g_mqtt_buffers.send_size, g_mqtt_buffers.send_hwm, g_mqtt_buffers.backlog_hwm,
+                   g_mqtt_buffers.deferred, g_mqtt_buffers.rejected);
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+}
+
+int evp_agent_mqtt_buffers_init(void)
+{
+    g_mqtt_buffers.recv_max = env_size("EVP_MQTT_RECV_BUFFER_MAX", MQTT_RECV_BUFFER_MAX_DEFAULT);
+    g_mqtt_buffers.backlog_max =
+        env_size("EVP_MQTT_SEND_BACKLOG_MAX", MQTT_SEND_BACKLOG_MAX_DEFAULT);
+
+    return evp_agent_metrics_register("mqtt_buffers", NULL, mqtt_buffers_report, NULL);
+}
+
+void evp_agent_mqtt_buffers_deinit(void)
+{
+    struct mqtt_buffers_client *c, *tmp;
+    struct mqtt_deferred *d, *dtmp;
+
+    pthread_mutex_lock(&g_mqtt_buffers.lock);
+    TAILQ_FOREACH_SAFE(c, &g_mqtt_buffers.clients, q, tmp)
+    {
+        TAILQ_FOREACH_SAFE(d, &c->backlog, q, dtmp)
+        {
+            free(d);
+        }
+        TAILQ_REMOVE(&g_mqtt_buffers.clients, c, q);
+        /* The agent is stopped, nothing receives into it any more */
+        free(c->recvbuf);
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+    }
+    g_mqtt_buffers.congested = false;
+    pthread_mutex_unlock(&g_mqtt_buffers.lock);
+}
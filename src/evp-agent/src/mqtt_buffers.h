@@ -0,0 +1,64 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_MQTT_BUFFERS_H__
+#define __EVP_MQTT_BUFFERS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mqtt.h>
+
+/*
+ * Adaptive MQTT buffers.
+ *
+ * The MQTT client of the EVP agent library (MQTT-C) runs on the fixed send
+ * and receive buffers the agent gives it, and fails the connection when a
+ * message does not fit. Its entry points are wrapped at link time (see
+ * evp_agent_link_args):
+ *
+ * - The receive buffer grows, doubling, when an incoming packet does not
+ *   fit, up to EVP_MQTT_RECV_BUFFER_MAX bytes (1 MiB by default), and the
+ *   grown buffer is kept across reconnects.
+ * - A publish that does not fit in the send buffer is deferred instead of
+ *   failing, into a backlog of up to EVP_MQTT_SEND_BACKLOG_MAX bytes
+ *   (256 KiB by default, 0 disables it), sent in order as the acks free the
+ *   send buffer. Later publishes queue behind it.
+ *
+ * evp_agent_mqtt_congested() tells producers that can wait to hold back.
+ * Buffer high-water marks are reported in the metrics.
+ *
+ * Telemetry publishes go through the batching of telemetry_batch.h first,
+ * telemetry and state ones through the compression of compress.h, then
+ * through the store of mqtt_store.h while the connection is down. The
+ * messages the agent receives are shown to deployment_fetch.h first.
+ */
+
+int evp_agent_mqtt_buffers_init(void);
+void evp_agent_mqtt_buffers_deinit(void);
+
+/* The send buffer is nearly full or publishes are waiting in the backlog */
+bool evp_agent_mqtt_congested(void);
+/*
+ * Everything the agent published on the client was sent, and acknowledged
+ * for QoS 1: nothing waits in the backlog or the queue of the client
+ */
+bool evp_agent_mqtt_sent(struct mqtt_client *client);
+
+/*
+ * mqtt_publish() through the compression, the store and the backlog, without
+ * the telemetry batching
+ */
+enum MQTTErrors evp_agent_mqtt_publish(struct mqtt_client *client, const char *topic_name,
+                                       const void *application_message,
+                                       size_t application_message_size, uint8_t publish_flags);
+/* mqtt_publish() through the backlog only */
+enum MQTTErrors evp_agent_mqtt_send(struct mqtt_client *client, const char *topic_name,
+                                    const void *application_message,
+                                    size_t application_message_size, uint8_t publish_flags);
+
+#endif /* __EVP_MQTT_BUFFERS_H__ */
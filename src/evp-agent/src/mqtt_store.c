@@ -0,0 +1,690 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mqtt.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
+
+#define MQTT_STORE_DEFAULT_DIR "/var/lib/edge-device-core/mqtt-store"
+#define MQTT_STORE_MAX_BYTES_DEFAULT 0
+#define MQTT_STORE_SEGMENT_BYTES_DEFAULT (256 * 1024)
+#define MQTT_STORE_RETENTION_SEC_DEFAULT (7 * 24 * 3600)
+#define MQTT_STORE_REPLAY_RATE_DEFAULT (16 * 1024)
+#define MQTT_STORE_SEGMENT_MAGIC 0x47455345 /* "ESEG" */
+#define MQTT_STORE_RECORD_MAGIC 0x43455245  /* "EREC" */
+/* Records stamped before 2020 were stored before the clock was set */
+#define MQTT_STORE_VALID_TIME 1577836800
+#define RECORD_LEN(size) ((sizeof(struct mqtt_store_record) + (size) + 7) & ~(size_t)7)
+
+static const char *const g_stored_topics[] = {
+    "v1/devices/me/telemetry",
+    "v1/devices/me/attributes",
+};
+
+struct mqtt_store_segment_header {
+    uint32_t magic;
+    /* Where the replay resumes: the records before it were delivered */
+    uint32_t read_off;
+    uint64_t seq;
+};
+
+struct mqtt_store_record {
+    uint32_t magic;
+    /* Of the rest of the record, from size on */
+    uint32_t crc;
+    /* Of the NUL terminated topic and the message that follow */
+    uint32_t size;
+    uint16_t topic_len;
+    uint8_t flags;
+    uint8_t reserved;
+    int64_t time;
+    uint8_t data[];
+};
+
+struct mqtt_store_segment {
+    TAILQ_ENTRY(mqtt_store_segment) q;
+    uint64_t seq;
+    uint8_t *addr;
+    size_t size;
+    size_t write_off;
+    /*
+     * Where the next record to hand to the MQTT client is. The ones from
+     * read_off to it are in flight until the client has sent (QoS 0) or had
+     * acknowledged (QoS 1) them.
+     */
+    size_t send_off;
+    /* Recovered segments are not appended to */
+    bool sealed;
+    /* Not handed to the MQTT client yet */
+    unsigned int records;
+};
+
+TAILQ_HEAD(mqtt_store_segment_head, mqtt_store_segment);
+
+static struct {
+    struct mqtt_store_segment_head segments;
+    bool enabled;
+    const char *dir;
+    size_t max_bytes;
+    size_t segment_bytes;
+    int64_t retention;
+    size_t rate;
+    uint64_t next_seq;
+    unsigned int n_segments;
+    /* Not handed to the MQTT client yet */
+    unsigned int records;
+    /* Not delivered yet */
+    size_t bytes;
+    /* Replay token bucket, in bytes */
+    size_t tokens;
+    uint64_t refill_us;
+    uint32_t crc_table[256];
+    uint64_t stored;
+    uint64_t spilled;
+    uint64_t replayed;
+    uint64_t expired;
+    uint64_t dropped;
+    uint64_t rejected;
+    pthread_mutex_t lock;
+} g_mqtt_store = {.segments = TAILQ_HEAD_INITIALIZER(g_mqtt_store.segments),
+                  .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static size_t env_size(const char *name, size_t def)
+{
+    const char *value = getenv(name);
+
+    if (value == NULL) {
+        return def;
+    }
+    return strtoul(value, NULL, 0);
+}
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_mqtt_store.crc_table[i] = c;
+    }
+}
+
+static uint32_t record_crc(const struct mqtt_store_record *rec)
+{
+    const uint8_t *p = (const uint8_t *)&rec->size;
+    size_t len = sizeof(*rec) - offsetof(struct mqtt_store_record, size) + rec->size;
+    uint32_t crc = 0xffffffff;
+
+    while (len--) {
+        crc = g_mqtt_store.crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static bool topic_is_stored(const char *topic)
+{
+    for (size_t i = 0; i < sizeof(g_stored_topics) / sizeof(*g_stored_topics); i++) {
+        if (strcmp(topic, g_stored_topics[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct mqtt_store_segment_header *segment_header(const struct mqtt_store_segment *seg)
+{
+    return (struct mqtt_store_segment_header *)seg->addr;
+}
+
+static struct mqtt_store_record *segment_record(const struct mqtt_store_segment *seg, size_t off)
+{
+    return (struct mqtt_store_record *)(seg->addr + off);
+}
+
+static void segment_path(char *path, size_t len, uint64_t seq)
+{
+    snprintf(path, len, "%s/%016" PRIx64 ".seg", g_mqtt_store.dir, seq);
+}
+
+/* A record is valid if it is complete and intact */
+static bool record_valid(const struct mqtt_store_segment *seg, size_t off)
+{
+    const struct mqtt_store_record *rec = segment_record(seg, off);
+
+    if (off + sizeof(*rec) > seg->size || rec->magic != MQTT_STORE_RECORD_MAGIC ||
+        rec->size > seg->size - off - sizeof(*rec) || rec->topic_len >= rec->size ||
+        rec->data[rec->topic_len] != '\0') {
+        return false;
+    }
+
+    return rec->crc == record_crc(rec);
+}
+
+/* Finds the end of the records and counts the ones not replayed yet */
+static void segment_scan(struct mqtt_store_segment *seg)
+{
+    struct mqtt_store_segment_header *hdr = segment_header(seg);
+    size_t off = sizeof(*hdr);
+
+    seg->records = 0;
+    while (record_valid(seg, off)) {
+        if (off >= hdr->read_off) {
+            seg->records++;
+        }
+        off += RECORD_LEN(segment_record(seg, off)->size);
+    }
+    seg->write_off = off;
+
+    if (hdr->read_off < sizeof(*hdr) || hdr->read_off > off) {
+        EVP_AGENT_WARN("MQTT store segment %016" PRIx64 " has a bad read offset, replaying it all",
+                       seg->seq);
+        hdr->read_off = sizeof(*hdr);
+        seg->records = 0;
+        for (off = sizeof(*hdr); off < seg->write_off;
+             off += RECORD_LEN(segment_record(seg, off)->size)) {
+            seg->records++;
+        }
+    }
+    seg->send_off = hdr->read_off;
+}
+
+static struct mqtt_store_segment *segment_map(uint64_t seq, bool create)
+{
+    struct mqtt_store_segment *seg;
+    char path[PATH_MAX];
+    struct stat st;
+    void *addr;
+    int fd;
+
+    segment_path(path, sizeof(path), seq);
+    fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0600);
+    if (fd < 0) {
+        EVP_AGENT_ERR("failed to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (create && ftruncate(fd, g_mqtt_store.segment_bytes) != 0) {
+        EVP_AGENT_ERR("failed to size %s: %s", path, strerror(errno));
+        goto err_unlink;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct mqtt_store_segment_header)) {
+        EVP_AGENT_WARN("ignoring the truncated MQTT store segment %s", path);
+        goto err_unlink;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        EVP_AGENT_ERR("failed to map %s: %s", path, strerror(errno));
+        goto err_close;
+    }
+    close(fd);
+
+    seg = calloc(1, sizeof(*seg));
+    if (seg == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for mqtt_store_segment");
+        munmap(addr, st.st_size);
+        return NULL;
+    }
+    seg->seq = seq;
+    seg->addr = addr;
+    seg->size = st.st_size;
+
+    if (create) {
+        struct mqtt_store_segment_header *hdr = segment_header(seg);
+
+        hdr->seq = seq;
+        hdr->read_off = sizeof(*hdr);
+        hdr->magic = MQTT_STORE_SEGMENT_MAGIC;
+        seg->write_off = sizeof(*hdr);
+        seg->send_off = sizeof(*hdr);
+    }
+    else if (segment_header(seg)->magic != MQTT_STORE_SEGMENT_MAGIC ||
+             segment_header(seg)->seq != seq) {
+        EVP_AGENT_WARN("ignoring the invalid MQTT store segment %s", path);
+        munmap(addr, st.st_size);
+        free(seg);
+        unlink(path);
+        return NULL;
+    }
+    else {
+        segment_scan(seg);
+        seg->sealed = true;
+    }
+
+    return seg;
+
+err_unlink:
+    unlink(path);
+err_close:
+    close(fd);
+    return NULL;
+}
+
+/* Unmaps a segment, and deletes it if it is done with. Called with the lock held */
+static void segment_free(struct mqtt_store_segment *seg, bool remove)
+{
+    char path[PATH_MAX];
+
+    if (remove) {
+        segment_path(path, sizeof(path), seg->seq);
+        unlink(path);
+    }
+    munmap(seg->addr, seg->size);
+    free(seg);
+}
+
+/* Called with the lock held */
+static void segment_remove(struct mqtt_store_segment *seg)
+{
+    TAILQ_REMOVE(&g_mqtt_store.segments, seg, q);
+    g_mqtt_store.n_segments--;
+    g_mqtt_store.records -= seg->records;
+    g_mqtt_store.bytes -= seg->write_off - segment_header(seg)->read_off;
+    segment_free(seg, true);
+}
+
+/* Called with the lock held */
+static void segment_insert(struct mqtt_store_segment *seg)
+{
+    struct mqtt_store_segment *s;
+
+    TAILQ_FOREACH(s, &g_mqtt_store.segments, q)
+    {
+        if (s->seq > seg->seq) {
+            TAILQ_INSERT_BEFORE(s, seg, q);
+            break;
+        }
+    }
+    if (s == NULL) {
+        TAILQ_INSERT_TAIL(&g_mqtt_store.segments, seg, q);
+    }
+    g_mqtt_store.n_segments++;
+    g_mqtt_store.records += seg->records;
+    g_mqtt_store.bytes += seg->write_off - segment_header(seg)->read_off;
+    if (seg->seq >= g_mqtt_store.next_seq) {
+        g_mqtt_store.next_seq = seg->seq + 1;
+    }
+}
+
+/* A segment with room for len more bytes, called with the lock held */
+static struct mqtt_store_segment *segment_for(size_t len)
+{
+    struct mqtt_store_segment *seg = TAILQ_LAST(&g_mqtt_store.segments, mqtt_store_segment_head);
+
+    if (seg != NULL && !seg->sealed && seg->write_off + len <= seg->size) {
+        return seg;
+    }
+    if (seg != NULL) {
+        seg->sealed = true;
+    }
+
+    /* Make room for a new segment */
+    while (g_mqtt_store.n_segments != 0 &&
+           (g_mqtt_store.n_segments + 1) * g_mqtt_store.segment_bytes > g_mqtt_store.max_bytes) {
+        seg = TAILQ_FIRST(&g_mqtt_store.segments);
+        g_mqtt_store.dropped += seg->records;
+        EVP_AGENT_WARN("MQTT store full, dropping %u stored publishes", seg->records);
+        segment_remove(seg);
+    }
+
+    seg = segment_map(g_mqtt_store.next_seq, true);
+    if (seg == NULL) {
+        return NULL;
+    }
+    segment_insert(seg);
+    return seg;
+}
+
+/* Called with the lock held */
+static bool store_put(const char *topic, const void *msg, size_t size, uint8_t flags)
+{
+    size_t topic_len = strlen(topic);
+    size_t len = RECORD_LEN(topic_len + 1 + size);
+    struct mqtt_store_segment *seg;
+    struct mqtt_store_record *rec;
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start;
+
+    if (topic_len > UINT16_MAX ||
+        len > g_mqtt_store.segment_bytes - sizeof(struct mqtt_store_segment_header)) {
+        g_mqtt_store.rejected++;
+        return false;
+    }
+
+    seg = segment_for(len);
+    if (seg == NULL) {
+        g_mqtt_store.rejected++;
+        return false;
+    }
+
+    rec = segment_record(seg, seg->write_off);
+    rec->size = topic_len + 1 + size;
+    rec->topic_len = topic_len;
+    rec->flags = flags;
+    rec->reserved = 0;
+    rec->time = time(NULL);
+    memcpy(rec->data, topic, topic_len + 1);
+    memcpy(rec->data + topic_len + 1, msg, size);
+    rec->crc = record_crc(rec);
+    /* Written last: a record is only seen once complete */
+    __atomic_store_n(&rec->magic, MQTT_STORE_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+    /* Start the writeback, the CRC catches records torn by a power loss */
+    start = (uintptr_t)rec & ~(uintptr_t)(page - 1);
+    msync((void *)start, (uintptr_t)rec + len - start, MS_ASYNC);
+
+    seg->write_off += len;
+    seg->records++;
+    g_mqtt_store.records++;
+    g_mqtt_store.bytes += len;
+    return true;
+}
+
+bool evp_agent_mqtt_store_add(struct mqtt_client *client, const char *topic, const void *msg,
+                              size_t size, uint8_t flags)
+{
+    bool stored = false;
+
+    if (!g_mqtt_store.enabled || !topic_is_stored(topic)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    /* Once publishes are stored, later ones queue behind them */
+    if (client->error != MQTT_OK || g_mqtt_store.records != 0) {
+        stored = store_put(topic, msg, size, flags);
+        if (stored) {
+            g_mqtt_store.stored++;
+        }
+    }
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+
+    return stored;
+}
+
+bool evp_agent_mqtt_store_spill(const char *topic, const void *msg, size_t size, uint8_t flags)
+{
+    bool stored;
+
+    if (!g_mqtt_store.enabled || !topic_is_stored(topic)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    stored = store_put(topic, msg, size, flags);
+    if (stored) {
+        g_mqtt_store.spilled++;
+    }
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+
+    return stored;
+}
+
+/* Called with the lock held */
+static void replay_refill(void)
+{
+    uint64_t now = evp_agent_now_us();
+    uint64_t add;
+
+    if (g_mqtt_store.rate == 0) {
+        g_mqtt_store.tokens = SIZE_MAX;
+        return;
+    }
+
+    /* Up to one second worth of bytes */
+    add = (now - g_mqtt_store.refill_us) * g_mqtt_store.rate / 1000000;
+    g_mqtt_store.tokens = g_mqtt_store.tokens + add < g_mqtt_store.rate
+                              ? g_mqtt_store.tokens + add
+                              : g_mqtt_store.rate;
+    if (add != 0) {
+        g_mqtt_store.refill_us = now;
+    }
+}
+
+static bool record_expired(const struct mqtt_store_record *rec, int64_t now)
+{
+    return g_mqtt_store.retention != 0 && rec->time >= MQTT_STORE_VALID_TIME &&
+           now >= MQTT_STORE_VALID_TIME && now - rec->time > g_mqtt_store.retention;
+}
+
+/* The records handed to the MQTT client are delivered, called with the lock held */
+static void replay_commit(void)
+{
+    struct mqtt_store_segment *seg, *tmp;
+    struct mqtt_store_segment_header *hdr;
+
+    TAILQ_FOREACH_SAFE(seg, &g_mqtt_store.segments, q, tmp)
+    {
+        hdr = segment_header(seg);
+        g_mqtt_store.bytes -= seg->send_off - hdr->read_off;
+        hdr->read_off = seg->send_off;
+        if (hdr->read_off != seg->write_off) {
+            break;
+        }
+        /* Keep the one being appended to */
+        if (!seg->sealed && seg == TAILQ_LAST(&g_mqtt_store.segments, mqtt_store_segment_head)) {
+            break;
+        }
+        segment_remove(seg);
+    }
+}
+
+void evp_agent_mqtt_store_replay(struct mqtt_client *client)
+{
+    struct mqtt_store_segment *seg;
+    struct mqtt_store_record *rec;
+    int64_t now = time(NULL);
+    size_t len;
+
+    if (!g_mqtt_store.enabled || client->error != MQTT_OK) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    /*
+     * Once nothing the agent queued is waiting to be sent or acknowledged,
+     * the records handed out so far are delivered. Until then, they are
+     * handed out again after a reconnect, see evp_agent_mqtt_store_rewind().
+     */
+    if (evp_agent_mqtt_sent(client)) {
+        replay_commit();
+    }
+
+    replay_refill();
+    TAILQ_FOREACH(seg, &g_mqtt_store.segments, q)
+    {
+        for (; seg->send_off != seg->write_off; seg->send_off += len) {
+            rec = segment_record(seg, seg->send_off);
+            len = RECORD_LEN(rec->size);
+            if (record_expired(rec, now)) {
+                g_mqtt_store.expired++;
+            }
+            else {
+                /* A record larger than the bucket goes once the bucket is full */
+                if ((g_mqtt_store.tokens < len && g_mqtt_store.tokens < g_mqtt_store.rate) ||
+                    evp_agent_mqtt_congested()) {
+                    goto out;
+                }
+                if (evp_agent_mqtt_send(client, (const char *)rec->data,
+                                        rec->data + rec->topic_len + 1,
+                                        rec->size - rec->topic_len - 1, rec->flags) != MQTT_OK) {
+                    goto out;
+                }
+                g_mqtt_store.tokens -= g_mqtt_store.tokens < len ? g_mqtt_store.tokens : len;
+                g_mqtt_store.replayed++;
+            }
+            seg->records--;
+            g_mqtt_store.records--;
+        }
+    }
+out:
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+}
+
+void evp_agent_mqtt_store_rewind(void)
+{
+    struct mqtt_store_segment *seg;
+    size_t off;
+
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    TAILQ_FOREACH(seg, &g_mqtt_store.segments, q)
+    {
+        off = segment_header(seg)->read_off;
+        for (; off != seg->send_off; off += RECORD_LEN(segment_record(seg, off)->size)) {
+            seg->records++;
+            g_mqtt_store.records++;
+        }
+        seg->send_off = segment_header(seg)->read_off;
+    }
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+}
+
+static void mqtt_store_report(void *user)
+{
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    EVP_AGENT_INFO("mqtt store: segments=%u pending=%u pending_bytes=%zu stored=%" PRIu64
+                   " spilled=%" PRIu64 " replayed=%" PRIu64 " expired=%" PRIu64
+                   " dropped=%" PRIu64 " rejected=%" PRIu64,
+                   g_mqtt_store.n_segments, g_mqtt_store.records, g_mqtt_store.bytes,
+                   g_mqtt_store.stored, g_mqtt_store.spilled, g_mqtt_store.replayed,
+                   g_mqtt_store.expired, g_mqtt_store.dropped, g_mqtt_store.rejected);
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+}
+
+/* Maps the segments left by a previous run */
+static void store_recover(void)
+{
+    struct mqtt_store_segment *seg;
+    struct dirent *de;
+    uint64_t seq;
+    DIR *d;
+    int n;
+
+    d = opendir(g_mqtt_store.dir);
+    if (d == NULL) {
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        if (strlen(de->d_name) != 20 || sscanf(de->d_name, "%16" SCNx64 ".seg%n", &seq, &n) != 1 ||
+            n != 20) {
+            continue;
+        }
+        seg = segment_map(seq, false);
+        if (seg == NULL) {
+            continue;
+        }
+        if (seg->records == 0) {
+            segment_free(seg, true);
+            continue;
+        }
+        segment_insert(seg);
+    }
+    closedir(d);
+
+    /* The limit may have been lowered */
+    while (g_mqtt_store.n_segments * g_mqtt_store.segment_bytes > g_mqtt_store.max_bytes &&
+           g_mqtt_store.n_segments > 1) {
+        seg = TAILQ_FIRST(&g_mqtt_store.segments);
+        g_mqtt_store.dropped += seg->records;
+        segment_remove(seg);
+    }
+
+    if (g_mqtt_store.records != 0) {
+        EVP_AGENT_INFO("MQTT store: %u publishes to replay", g_mqtt_store.records);
+    }
+}
+
+int evp_agent_mqtt_store_init(void)
+{
+    const char *dir = getenv("EVP_MQTT_STORE_DIR");
+    long page = sysconf(_SC_PAGESIZE);
+
+    g_mqtt_store.max_bytes = env_size("EVP_MQTT_STORE_MAX_BYTES", MQTT_STORE_MAX_BYTES_DEFAULT);
+    if (g_mqtt_store.max_bytes == 0) {
+        return 0;
+    }
+    g_mqtt_store.segment_bytes =
+        env_size("EVP_MQTT_STORE_SEGMENT_BYTES", MQTT_STORE_SEGMENT_BYTES_DEFAULT);
+    g_mqtt_store.segment_bytes = (g_mqtt_store.segment_bytes + page - 1) & ~(size_t)(page - 1);
+    if (g_mqtt_store.segment_bytes > UINT32_MAX) {
+        g_mqtt_store.segment_bytes = MQTT_STORE_SEGMENT_BYTES_DEFAULT;
+    }
+    /* Otherwise no segment fits, and each store would drop the previous one */
+    if (g_mqtt_store.max_bytes < (size_t)page) {
+        EVP_AGENT_WARN("EVP_MQTT_STORE_MAX_BYTES is less than a page, not storing MQTT publishes");
+        return 0;
+    }
+    if (g_mqtt_store.segment_bytes > g_mqtt_store.max_bytes) {
+        g_mqtt_store.segment_bytes = g_mqtt_store.max_bytes & ~(size_t)(page - 1);
+        EVP_AGENT_WARN("EVP_MQTT_STORE_MAX_BYTES is less than a segment, using %zu byte segments",
+                       g_mqtt_store.segment_bytes);
+    }
+    g_mqtt_store.retention =
+        env_size("EVP_MQTT_STORE_RETENTION_SEC", MQTT_STORE_RETENTION_SEC_DEFAULT);
+    g_mqtt_store.rate = env_size("EVP_MQTT_STORE_REPLAY_RATE", MQTT_STORE_REPLAY_RATE_DEFAULT);
+    if (dir == NULL) {
+        dir = MQTT_STORE_DEFAULT_DIR;
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        EVP_AGENT_WARN("failed to create %s, not storing MQTT publishes: %s", dir,
+                       strerror(errno));
+        return 0;
+    }
+
+    crc_init();
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    g_mqtt_store.dir = dir;
+    store_recover();
+    g_mqtt_store.refill_us = evp_agent_now_us();
+    g_mqtt_store.enabled = true;
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+
+    return evp_agent_metrics_register("mqtt_store", NULL, mqtt_store_report, NULL);
+}
+
+void evp_agent_mqtt_store_deinit(void)
+{
+    struct mqtt_store_segment *seg, *tmp;
+
+    pthread_mutex_lock(&g_mqtt_store.lock);
+    g_mqtt_store.enabled = false;
+    /* Pending records stay on disk for the next run */
+    TAILQ_FOREACH_SAFE(seg, &g_mqtt_store.segments, q, tmp)
+    {
+        TAILQ_REMOVE(&g_mqtt_store.segments, seg, q);
+        msync(seg->addr, seg->size, MS_SYNC);
+        segment_free(seg, segment_header(seg)->read_off == seg->write_off);
+    }
+    g_mqtt_store.n_segments = 0;
+    g_mqtt_store.records = 0;
+    g_mqtt_store.bytes = 0;
+    pthread_mutex_unlock(&g_mqtt_store.lock);
+}
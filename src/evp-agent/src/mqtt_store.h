@@ -0,0 +1,58 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_MQTT_STORE_H__
+#define __EVP_MQTT_STORE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Store-and-forward of telemetry and state.
+ *
+ * While the MQTT connection is down, the publishes of telemetry and state
+ * (attributes) go to an append-only queue of memory-mapped segment files in
+ * EVP_MQTT_STORE_DIR (/var/lib/edge-device-core/mqtt-store by default)
+ * instead of failing, and so do the ones the send buffer and its backlog
+ * cannot take. Once the connection is back, they are replayed in order from
+ * the MQTT sync loop, at up to EVP_MQTT_STORE_REPLAY_RATE bytes per second
+ * (16384 by default, 0 for no limit) and only while the connection is not
+ * congested. Publishes made while stored ones are pending queue behind them.
+ *
+ * - The queue takes up to EVP_MQTT_STORE_MAX_BYTES (0 by default, which
+ *   disables it, 8 MiB is a good start) in segments of
+ *   EVP_MQTT_STORE_SEGMENT_BYTES (256 KiB by default, and no more than the
+ *   whole queue). The oldest segment is dropped to make room.
+ * - Records older than EVP_MQTT_STORE_RETENTION_SEC (7 days by default, 0
+ *   keeps them) are dropped at replay. Records stored before the clock was
+ *   set are not aged.
+ * - Every record carries a CRC. After a crash or a power loss the queue is
+ *   recovered up to the first torn record, and replay resumes where it
+ *   stopped.
+ * - A record leaves the queue once it is delivered: once nothing the agent
+ *   queued to the MQTT client is waiting to be sent (QoS 0) or acknowledged
+ *   (QoS 1) any more. A reconnect drops the queue of the client, so the
+ *   records handed to it since are replayed again.
+ */
+
+struct mqtt_client;
+
+int evp_agent_mqtt_store_init(void);
+void evp_agent_mqtt_store_deinit(void);
+
+/* Stores a publish while offline or behind stored ones, false if it is sent as usual */
+bool evp_agent_mqtt_store_add(struct mqtt_client *client, const char *topic, const void *msg,
+                              size_t size, uint8_t flags);
+/* Stores a publish the MQTT client could not take */
+bool evp_agent_mqtt_store_spill(const char *topic, const void *msg, size_t size, uint8_t flags);
+
+/* Replays stored publishes, as the rate limit and the connection allow */
+void evp_agent_mqtt_store_replay(struct mqtt_client *client);
+/* Hands the records not delivered yet again, once the MQTT client dropped its queue */
+void evp_agent_mqtt_store_rewind(void);
+
+#endif /* __EVP_MQTT_STORE_H__ */
@@ -6,6 +6,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -19,6 +20,7 @@
 
 #include "system_manager.h"
 #include "led_manager.h"
+#include "blob_upload.h"
 #include "esf.h"
 #include "notifications.h"
 #include "log.h"
@@ -243,8 +245,18 @@ static int elog_handler_blob_other_error(int error)
 static int elog_handler_blob_result(const void *event, void *user_data)
 {
     const struct evp_agent_notification_blob_result *notif = event;
+    struct evp_agent_blob_upload_stats stats;
 
     if (notif) {
+        if (evp_agent_blob_upload_take_stats(&stats)) {
+            EVP_AGENT_INFO("blob result %d (HTTP %u) of a block upload: bytes=%zu blocks=%u"
+                           " connections=%u retries=%u elapsed_ms=%" PRIu64
+                           " block_p50_ms=%" PRIu64 " block_max_ms=%" PRIu64,
+                           notif->result, notif->http_status, stats.bytes, stats.blocks,
+                           stats.connections, stats.retries, stats.elapsed_us / 1000,
+                           stats.block_p50_us / 1000, stats.block_max_us / 1000);
+        }
+
         switch (notif->result) {
             case EVP_BLOB_RESULT_SUCCESS:
                 elog_handler_blob_success();
@@ -0,0 +1,251 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include <NetworkManager.h>
+#include <evp/agent.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "reconnect.h"
+
+#define RECONNECT_JITTER_MS_DEFAULT 3000
+
+static struct {
+    bool enabled;
+    pthread_t thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    uint64_t jitter_ms;
+    /* Set from the NetworkManager thread */
+    bool online;
+    uint64_t online_us;
+    unsigned int changes;
+    /* The rest is used from the agent loop, which may miss a short outage */
+    bool applied_online;
+    unsigned int applied_changes;
+    /* The agent was disconnected here */
+    bool suspended;
+    uint64_t connect_at_us;
+    /* Link-up time of a reconnect being measured */
+    uint64_t link_up_us;
+    uint64_t suspends;
+    uint64_t resumes;
+    uint64_t measured;
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+    pthread_mutex_t lock;
+} g_reconnect = {.online = true, .applied_online = true, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t jitter_us(void)
+{
+    uint64_t r;
+
+    if (g_reconnect.jitter_ms == 0) {
+        return 0;
+    }
+    if (getrandom(&r, sizeof(r), GRND_NONBLOCK) != sizeof(r)) {
+        r = evp_agent_now_us();
+    }
+
+    return r % (g_reconnect.jitter_ms * 1000 + 1);
+}
+
+static void nm_state_changed(GObject *object, GParamSpec *pspec, gpointer user_data)
+{
+    NMState state = nm_client_get_state(NM_CLIENT(object));
+    /* SITE: a default route, without a successful connectivity check */
+    bool online = state >= NM_STATE_CONNECTED_SITE;
+
+    pthread_mutex_lock(&g_reconnect.lock);
+    if (online != g_reconnect.online) {
+        g_reconnect.online = online;
+        g_reconnect.online_us = evp_agent_now_us();
+        g_reconnect.changes++;
+        EVP_AGENT_INFO("network %s (NetworkManager state %d)", online ? "up" : "down", state);
+    }
+    pthread_mutex_unlock(&g_reconnect.lock);
+}
+
+static gboolean loop_quit(gpointer user_data)
+{
+    g_main_loop_quit(g_reconnect.loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void *reconnect_thread(void *arg)
+{
+    GError *error = NULL;
+    NMClient *client;
+
+    g_main_context_push_thread_default(g_reconnect.context);
+
+    client = nm_client_new(NULL, &error);
+    if (client == NULL) {
+        EVP_AGENT_WARN("libnm unavailable, leaving reconnects to the agent: %s", error->message);
+        g_error_free(error);
+        goto out;
+    }
+    if (!nm_client_get_nm_running(client)) {
+        EVP_AGENT_WARN("NetworkManager not running, leaving reconnects to the agent");
+        goto out_unref;
+    }
+
+    g_signal_connect(client, "notify::" NM_CLIENT_STATE, G_CALLBACK(nm_state_changed), NULL);
+    nm_state_changed(G_OBJECT(client), NULL, NULL);
+    g_main_loop_run(g_reconnect.loop);
+
+out_unref:
+    g_object_unref(client);
+out:
+    g_main_context_pop_thread_default(g_reconnect.context);
+    return NULL;
+}
+
+/* Retrying on its own backoff */
+static bool agent_retrying(enum evp_agent_status status)
+{
+    return status == EVP_AGENT_STATUS_READY || status == EVP_AGENT_STATUS_CONNECTING;
+}
+
+/*
+ * Waiting to retry, or stopped: a restart loses nothing. A restart while
+ * connecting would abort a handshake that may well succeed.
+ */
+static bool agent_idle(enum evp_agent_status status)
+{
+    return status == EVP_AGENT_STATUS_READY || status == EVP_AGENT_STATUS_DISCONNECTED;
+}
+
+void evp_agent_reconnect_poll(struct evp_agent_context *ctxt)
+{
+    enum evp_agent_status status;
+    uint64_t now, latency;
+    int ret;
+
+    if (!g_reconnect.enabled) {
+        return;
+    }
+
+    status = evp_agent_get_status(ctxt);
+    now = evp_agent_now_us();
+
+    pthread_mutex_lock(&g_reconnect.lock);
+    if (g_reconnect.changes != g_reconnect.applied_changes) {
+        g_reconnect.applied_changes = g_reconnect.changes;
+        g_reconnect.applied_online = g_reconnect.online;
+        g_reconnect.connect_at_us = 0;
+        g_reconnect.link_up_us = 0;
+        if (g_reconnect.online && (g_reconnect.suspended || agent_idle(status))) {
+            g_reconnect.connect_at_us = now + jitter_us();
+            g_reconnect.link_up_us = g_reconnect.online_us;
+        }
+    }
+
+    if (!g_reconnect.applied_online && !g_reconnect.suspended && agent_retrying(status)) {
+        EVP_AGENT_INFO("network down, suspending the reconnects of the agent");
+        evp_agent_disconnect(ctxt);
+        g_reconnect.suspended = true;
+        g_reconnect.suspends++;
+    }
+
+    if (g_reconnect.connect_at_us != 0 && now >= g_reconnect.connect_at_us) {
+        g_reconnect.connect_at_us = 0;
+        /* Also restarts an agent sleeping out its backoff, but not one connecting meanwhile */
+        if (g_reconnect.suspended || agent_idle(status)) {
+            if (!g_reconnect.suspended) {
+                evp_agent_disconnect(ctxt);
+            }
+            ret = evp_agent_connect(ctxt);
+            if (ret) {
+                EVP_AGENT_ERR("evp_agent_connect failed: %d", ret);
+            }
+            g_reconnect.suspended = false;
+            g_reconnect.resumes++;
+        }
+    }
+
+    if (g_reconnect.link_up_us != 0 && status == EVP_AGENT_STATUS_CONNECTED) {
+        latency = now - g_reconnect.link_up_us;
+        g_reconnect.link_up_us = 0;
+        g_reconnect.measured++;
+        g_reconnect.latency_sum_us += latency;
+        if (latency > g_reconnect.latency_max_us) {
+            g_reconnect.latency_max_us = latency;
+        }
+        EVP_AGENT_INFO("connected %" PRIu64 " ms after the network came back", latency / 1000);
+    }
+    pthread_mutex_unlock(&g_reconnect.lock);
+}
+
+static void reconnect_report(void *user)
+{
+    pthread_mutex_lock(&g_reconnect.lock);
+    EVP_AGENT_INFO("reconnect: online=%d suspends=%" PRIu64 " resumes=%" PRIu64
+                   " link_up_to_connected_avg_ms=%" PRIu64 " link_up_to_connected_max_ms=%" PRIu64,
+                   g_reconnect.online, g_reconnect.suspends, g_reconnect.resumes,
+                   g_reconnect.measured ? g_reconnect.latency_sum_us / g_reconnect.measured / 1000
+                                        : 0,
+                   g_reconnect.latency_max_us / 1000);
+    pthread_mutex_unlock(&g_reconnect.lock);
+}
+
+int evp_agent_reconnect_init(void)
+{
+    const char *enabled = getenv("EVP_RECONNECT_NM");
+    const char *jitter = getenv("EVP_RECONNECT_JITTER_MS");
+    int ret;
+
+    if (enabled != NULL && strcmp(enabled, "0") == 0) {
+        return 0;
+    }
+    g_reconnect.jitter_ms = RECONNECT_JITTER_MS_DEFAULT;
+    if (jitter != NULL) {
+        g_reconnect.jitter_ms = strtoul(jitter, NULL, 10);
+    }
+
+    g_reconnect.context = g_main_context_new();
+    g_reconnect.loop = g_main_loop_new(g_reconnect.context, FALSE);
+    ret = pthread_create(&g_reconnect.thread, NULL, reconnect_thread, NULL);
+    if (ret) {
+        EVP_AGENT_ERR("failed to create the reconnect thread: %s", strerror(ret));
+        g_main_loop_unref(g_reconnect.loop);
+        g_main_context_unref(g_reconnect.context);
+        return -ret;
+    }
+    g_reconnect.enabled = true;
+
+    return evp_agent_metrics_register("reconnect", NULL, reconnect_report, NULL);
+}
+
+void evp_agent_reconnect_deinit(void)
+{
+    GSource *source;
+
+    if (!g_reconnect.enabled) {
+        return;
+    }
+    g_reconnect.enabled = false;
+
+    /* Queued on the context: also stops a loop not running yet */
+    source = g_idle_source_new();
+    g_source_set_callback(source, loop_quit, NULL, NULL);
+    g_source_attach(source, g_reconnect.context);
+    g_source_unref(source);
+
+    pthread_join(g_reconnect.thread, NULL);
+    g_main_loop_unref(g_reconnect.loop);
+    g_main_context_unref(g_reconnect.context);
+}
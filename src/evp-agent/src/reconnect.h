@@ -0,0 +1,38 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_RECONNECT_H__
+#define __EVP_RECONNECT_H__
+
+struct evp_agent_context;
+
+/*
+ * Network-aware reconnects.
+ *
+ * The EVP agent library retries its MQTT connection on its own backoff,
+ * whether the device has a network or not. A thread here follows the
+ * NetworkManager state through libnm, and from the agent loop:
+ *
+ * - while NetworkManager reports no IP connectivity and the agent is not
+ *   connected, the agent is disconnected, so it stops retrying,
+ * - once connectivity is back, the agent is connected again, after a
+ *   random delay of up to EVP_RECONNECT_JITTER_MS (3000 by default) so a
+ *   fleet coming back from the same outage does not reconnect all at
+ *   once. This also cuts short a backoff the agent may be in, but leaves
+ *   a connection attempt in progress to finish.
+ *
+ * The time from the link coming back to the agent being connected is
+ * reported in the metrics. Set EVP_RECONNECT_NM=0, or run without
+ * NetworkManager, to leave reconnects to the agent.
+ */
+
+int evp_agent_reconnect_init(void);
+void evp_agent_reconnect_deinit(void);
+
+/* Applies the network state to the agent, called from the agent loop */
+void evp_agent_reconnect_poll(struct evp_agent_context *ctxt);
+
+#endif /* __EVP_RECONNECT_H__ */
@@ -0,0 +1,333 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for asprintf and memmem */
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mqtt.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
+#include "telemetry_batch.h"
+
+#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
+#define TELEMETRY_BATCH_BYTES_DEFAULT 0
+#define TELEMETRY_BATCH_LINGER_MS_DEFAULT 1000
+/* A congested connection makes the batch wait up to this many lingers */
+#define TELEMETRY_BATCH_CONGESTED_LINGERS 4
+#define TELEMETRY_URGENT_KEYS_MAX 16
+
+static struct {
+    /* "[entry,entry" without the closing bracket */
+    char *buf;
+    size_t len;
+    size_t budget;
+    uint64_t linger_us;
+    unsigned int entries;
+    uint8_t flags;
+    struct mqtt_client *client;
+    /* When the oldest entry came, and the sum of the arrival times */
+    uint64_t first_us;
+    uint64_t sum_us;
+    /* The prefixes, after the opening quote of a key */
+    char *urgent_keys[TELEMETRY_URGENT_KEYS_MAX];
+    unsigned int n_urgent_keys;
+    uint64_t publishes;
+    uint64_t batched;
+    uint64_t urgent;
+    uint64_t failed;
+    uint64_t latency_sum_us;
+    uint64_t latency_max_us;
+    pthread_mutex_t lock;
+} g_telemetry_batch = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/*
+ * The entries name their telemetry topic, "<module instance>/<topic>", in
+ * their keys: look for the quoted prefixes in the payload rather than
+ * parsing it. A value looking like one only makes the batch go early.
+ */
+static bool entry_is_urgent(const void *msg, size_t size)
+{
+    for (unsigned int i = 0; i < g_telemetry_batch.n_urgent_keys; i++) {
+        const char *key = g_telemetry_batch.urgent_keys[i];
+
+        if (memmem(msg, size, key, strlen(key)) != NULL) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void trim(const char **str, size_t *len)
+{
+    while (*len > 0 && isspace((unsigned char)**str)) {
+        (*str)++;
+        (*len)--;
+    }
+    while (*len > 0 && isspace((unsigned char)(*str)[*len - 1])) {
+        (*len)--;
+    }
+}
+
+/*
+ * The telemetry objects of a payload, without the enclosing brackets of an
+ * array. Returns false for anything else, or for an empty array.
+ */
+static bool payload_entries(const char *msg, size_t size, const char **entries, size_t *len)
+{
+    trim(&msg, &size);
+    if (size < 2) {
+        return false;
+    }
+
+    if (msg[0] == '{' && msg[size - 1] == '}') {
+        *entries = msg;
+        *len = size;
+        return true;
+    }
+    if (msg[0] == '[' && msg[size - 1] == ']') {
+        *entries = msg + 1;
+        *len = size - 2;
+        trim(entries, len);
+        return *len != 0;
+    }
+
+    return false;
+}
+
+/* Called with the lock held */
+static int batch_flush(uint64_t now)
+{
+    enum MQTTErrors ret;
+    uint64_t latency;
+
+    if (g_telemetry_batch.entries == 0) {
+        return 0;
+    }
+
+    /* buf has room for the closing bracket */
+    g_telemetry_batch.buf[g_telemetry_batch.len] = ']';
+    ret = evp_agent_mqtt_publish(g_telemetry_batch.client, TELEMETRY_TOPIC, g_telemetry_batch.buf,
+                                 g_telemetry_batch.len + 1, g_telemetry_batch.flags);
+    if (ret != MQTT_OK) {
+        /* Kept for the next flush */
+        g_telemetry_batch.failed++;
+        return -EAGAIN;
+    }
+
+    latency = now - g_telemetry_batch.first_us;
+    if (latency > g_telemetry_batch.latency_max_us) {
+        g_telemetry_batch.latency_max_us = latency;
+    }
+    g_telemetry_batch.latency_sum_us +=
+        g_telemetry_batch.entries * now - g_telemetry_batch.sum_us;
+    g_telemetry_batch.batched += g_telemetry_batch.entries;
+    g_telemetry_batch.publishes++;
+
+    g_telemetry_batch.entries = 0;
+    g_telemetry_batch.len = 0;
+    g_telemetry_batch.sum_us = 0;
+    return 0;
+}
+
+/* A batch is one publish, of one client and with one QoS. Called with the lock held */
+static bool batch_fits(struct mqtt_client *client, uint8_t flags, size_t len)
+{
+    if (g_telemetry_batch.entries != 0 &&
+        (client != g_telemetry_batch.client || flags != g_telemetry_batch.flags)) {
+        return false;
+    }
+
+    /* The separator, the entry and the closing bracket */
+    return g_telemetry_batch.len + 1 + len + 1 <= g_telemetry_batch.budget;
+}
+
+bool evp_agent_telemetry_batch_add(struct mqtt_client *client, const char *topic,
+                                   const void *msg, size_t size, uint8_t flags)
+{
+    uint64_t now = evp_agent_now_us();
+    const char *entries;
+    bool urgent;
+    size_t len;
+
+    if (g_telemetry_batch.budget == 0 || strcmp(topic, TELEMETRY_TOPIC) != 0 ||
+        !payload_entries(msg, size, &entries, &len)) {
+        return false;
+    }
+    urgent = entry_is_urgent(msg, size);
+
+    pthread_mutex_lock(&g_telemetry_batch.lock);
+
+    if (!batch_fits(client, flags, len)) {
+        batch_flush(now);
+    }
+    /* Too large for a batch, or the batch could not be sent: as before */
+    if (!batch_fits(client, flags, len)) {
+        pthread_mutex_unlock(&g_telemetry_batch.lock);
+        return false;
+    }
+
+    g_telemetry_batch.buf[g_telemetry_batch.len++] = g_telemetry_batch.entries ? ',' : '[';
+    memcpy(g_telemetry_batch.buf + g_telemetry_batch.len, entries, len);
+    g_telemetry_batch.len += len;
+    if (g_telemetry_batch.entries++ == 0) {
+        g_telemetry_batch.client = client;
+        g_telemetry_batch.flags = flags;
+        g_telemetry_batch.first_us = now;
+    }
+    g_telemetry_batch.sum_us += now;
+
+    if (urgent) {
+        g_telemetry_batch.urgent++;
+        batch_flush(now);
+    }
+    else if (g_telemetry_batch.len + 2 >= g_telemetry_batch.budget) {
+        batch_flush(now);
+    }
+
+    pthread_mutex_unlock(&g_telemetry_batch.lock);
+    return true;
+}
+
+void evp_agent_telemetry_batch_flush(void)
+{
+    pthread_mutex_lock(&g_telemetry_batch.lock);
+    batch_flush(evp_agent_now_us());
+    pthread_mutex_unlock(&g_telemetry_batch.lock);
+}
+
+void evp_agent_telemetry_batch_poll(struct mqtt_client *client)
+{
+    uint64_t now = evp_agent_now_us();
+    uint64_t linger;
+
+    pthread_mutex_lock(&g_telemetry_batch.lock);
+    if (g_telemetry_batch.entries != 0 && g_telemetry_batch.client == client) {
+        linger = g_telemetry_batch.linger_us;
+        if (evp_agent_mqtt_congested()) {
+            linger *= TELEMETRY_BATCH_CONGESTED_LINGERS;
+        }
+        if (now - g_telemetry_batch.first_us >= linger) {
+            batch_flush(now);
+        }
+    }
+    pthread_mutex_unlock(&g_telemetry_batch.lock);
+}
+
+static void telemetry_batch_report(void *user)
+{
+    pthread_mutex_lock(&g_telemetry_batch.lock);
+    if (g_telemetry_batch.publishes != 0) {
+        EVP_AGENT_INFO("telemetry batch: publishes=%" PRIu64 " entries=%" PRIu64
+                       " entries_per_publish=%" PRIu64 " urgent=%" PRIu64 " failed=%" PRIu64
+                       " latency_avg_ms=%" PRIu64 " latency_max_ms=%" PRIu64,
+                       g_telemetry_batch.publishes, g_telemetry_batch.batched,
+                       g_telemetry_batch.batched / g_telemetry_batch.publishes,
+                       g_telemetry_batch.urgent, g_telemetry_batch.failed,
+                       g_telemetry_batch.latency_sum_us / g_telemetry_batch.batched / 1000,
+                       g_telemetry_batch.latency_max_us / 1000);
+    }
+    pthread_mutex_unlock(&g_telemetry_batch.lock);
+}
+
+static int parse_urgent_keys(const char *keys)
+{
+    char *copy = strdup(keys);
+    char *saveptr;
+
+    if (copy == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for EVP_TELEMETRY_URGENT_KEYS");
+        return -ENOMEM;
+    }
+
+    for (char *key = strtok_r(copy, ",", &saveptr); key != NULL;
+         key = strtok_r(NULL, ",", &saveptr)) {
+        if (g_telemetry_batch.n_urgent_keys == TELEMETRY_URGENT_KEYS_MAX) {
+            EVP_AGENT_WARN("too many urgent telemetry keys, ignoring %s", key);
+            continue;
+        }
+        if (asprintf(&g_telemetry_batch.urgent_keys[g_telemetry_batch.n_urgent_keys], "\"%s",
+                     key) < 0) {
+            EVP_AGENT_ERR("failed to allocate memory for EVP_TELEMETRY_URGENT_KEYS");
+            free(copy);
+            return -ENOMEM;
+        }
+        g_telemetry_batch.n_urgent_keys++;
+    }
+
+    free(copy);
+    return 0;
+}
+
+int evp_agent_telemetry_batch_init(void)
+{
+    const char *bytes = getenv("EVP_TELEMETRY_BATCH_BYTES");
+    const char *linger = getenv("EVP_TELEMETRY_BATCH_LINGER_MS");
+    const char *keys = getenv("EVP_TELEMETRY_URGENT_KEYS");
+    int ret;
+
+    g_telemetry_batch.budget = TELEMETRY_BATCH_BYTES_DEFAULT;
+    if (bytes != NULL) {
+        g_telemetry_batch.budget = strtoul(bytes, NULL, 10);
+    }
+    g_telemetry_batch.linger_us = (uint64_t)TELEMETRY_BATCH_LINGER_MS_DEFAULT * 1000;
+    if (linger != NULL) {
+        g_telemetry_batch.linger_us = (uint64_t)strtoul(linger, NULL, 10) * 1000;
+    }
+    if (keys != NULL) {
+        ret = parse_urgent_keys(keys);
+        if (ret) {
+            evp_agent_telemetry_batch_deinit();
+            return ret;
+        }
+    }
+
+    if (g_telemetry_batch.budget != 0) {
+        g_telemetry_batch.buf = malloc(g_telemetry_batch.budget);
+        if (g_telemetry_batch.buf == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for the telemetry batch");
+            evp_agent_telemetry_batch_deinit();
+            return -ENOMEM;
+        }
+    }
+
+    return evp_agent_metrics_register("telemetry_batch", NULL, telemetry_batch_report, NULL);
+}
+
+void evp_agent_telemetry_batch_deinit(void)
+{
+    pthread_mutex_lock(&g_telemetry_batch.lock);
+    /* The MQTT client is gone, keep what evp_agent_telemetry_batch_flush() could not send */
+    if (g_telemetry_batch.entries != 0) {
+        g_telemetry_batch.buf[g_telemetry_batch.len] = ']';
+        if (!evp_agent_mqtt_store_spill(TELEMETRY_TOPIC, g_telemetry_batch.buf,
+                                        g_telemetry_batch.len + 1, g_telemetry_batch.flags)) {
+            EVP_AGENT_WARN("dropping %u unsent telemetry entries", g_telemetry_batch.entries);
+        }
+    }
+    for (unsigned int i = 0; i < g_telemetry_batch.n_urgent_keys; i++) {
+        free(g_telemetry_batch.urgent_keys[i]);
+    }
+    g_telemetry_batch.n_urgent_keys = 0;
+    free(g_telemetry_batch.buf);
+    g_telemetry_batch.buf = NULL;
+    g_telemetry_batch.budget = 0;
+    g_telemetry_batch.entries = 0;
+    g_telemetry_batch.len = 0;
+    pthread_mutex_unlock(&g_telemetry_batch.lock);
+}
@@ -0,0 +1,52 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_TELEMETRY_BATCH_H__
+#define __EVP_TELEMETRY_BATCH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Telemetry batching.
+ *
+ * The EVP agent library publishes each telemetry of the modules as its own
+ * MQTT message. The publishes to the telemetry topic are collected here
+ * instead, from the MQTT publish wrapper (see mqtt_buffers.h), and sent as
+ * one JSON array of the telemetry objects, which the hub accepts as well:
+ *
+ * - once the batch reaches EVP_TELEMETRY_BATCH_BYTES bytes (0 by default,
+ *   which disables batching: a hub expecting one object per message has to
+ *   accept arrays before it is set, 4096 is a good start),
+ * - or once its oldest entry is EVP_TELEMETRY_BATCH_LINGER_MS old (1000 by
+ *   default), up to 4 times longer while the connection is congested,
+ * - or right away for an entry with a key starting with one of the comma
+ *   separated EVP_TELEMETRY_URGENT_KEYS prefixes, such as
+ *   "<module instance>/alert", found without parsing the payload,
+ * - or when the agent stops, see evp_agent_telemetry_batch_flush(). What
+ *   still could not be sent goes to the store of mqtt_store.h.
+ *
+ * The entries per publish and the time entries wait in the batch are
+ * reported in the metrics.
+ */
+
+struct mqtt_client;
+
+int evp_agent_telemetry_batch_init(void);
+void evp_agent_telemetry_batch_deinit(void);
+
+/* Takes a publish into the batch, returns false if it is not for batching */
+bool evp_agent_telemetry_batch_add(struct mqtt_client *client, const char *topic,
+                                   const void *msg, size_t size, uint8_t flags);
+
+/* Sends the batch now, before the MQTT client disconnects */
+void evp_agent_telemetry_batch_flush(void);
+
+/* Sends the batch if it lingered long enough */
+void evp_agent_telemetry_batch_poll(struct mqtt_client *client);
+
+#endif /* __EVP_TELEMETRY_BATCH_H__ */
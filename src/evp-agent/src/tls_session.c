@@ -0,0 +1,528 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+#include <psa/crypto.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "tls_session.h"
+
+#define TLS_SESSION_CACHE_SIZE_DEFAULT 8
+#define TLS_HOST_MAX 256
+
+void __real_mbedtls_ssl_config_free(mbedtls_ssl_config *conf);
+int __real_mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf);
+void __real_mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t *f_send,
+                                mbedtls_ssl_recv_t *f_recv,
+                                mbedtls_ssl_recv_timeout_t *f_recv_timeout);
+int __real_mbedtls_ssl_session_reset(mbedtls_ssl_context *ssl);
+int __real_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+int __real_mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len);
+void __real_mbedtls_ssl_free(mbedtls_ssl_context *ssl);
+int __real_mbedtls_x509_crt_verify_with_profile(
+    mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca, mbedtls_x509_crl *ca_crl,
+    const mbedtls_x509_crt_profile *profile, const char *cn, uint32_t *flags,
+    int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *), void *p_vrfy);
+int __real_mbedtls_x509_crt_verify_restartable(
+    mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca, mbedtls_x509_crl *ca_crl,
+    const mbedtls_x509_crt_profile *profile, const char *cn, uint32_t *flags,
+    int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *), void *p_vrfy,
+    mbedtls_x509_crt_restart_ctx *rs_ctx);
+
+struct tls_conn {
+    TAILQ_ENTRY(tls_conn) q;
+    mbedtls_ssl_context *ssl;
+    const mbedtls_ssl_config *conf;
+    /* Of the peer, 0 until known */
+    uint16_t port;
+    uint64_t start_us;
+    /* A cached session was offered */
+    bool offered;
+    /* The peer certificate chain was verified: a full handshake */
+    bool verified;
+};
+
+struct tls_session_entry {
+    TAILQ_ENTRY(tls_session_entry) q;
+    char host[TLS_HOST_MAX];
+    uint16_t port;
+    /* Sessions only resume with the configuration they were negotiated with */
+    const mbedtls_ssl_config *conf;
+    mbedtls_ssl_session session;
+};
+
+TAILQ_HEAD(tls_conn_head, tls_conn);
+TAILQ_HEAD(tls_session_entry_head, tls_session_entry);
+
+struct handshake_stats {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+};
+
+static struct {
+    struct tls_conn_head conns;
+    /* Most recently used first */
+    struct tls_session_entry_head sessions;
+    unsigned int n_sessions;
+    unsigned int size;
+    struct handshake_stats full;
+    struct handshake_stats resumed;
+    uint64_t offered;
+    uint64_t failed;
+    uint64_t tls13;
+    pthread_mutex_t lock;
+} g_tls_session = {.conns = TAILQ_HEAD_INITIALIZER(g_tls_session.conns),
+                   .sessions = TAILQ_HEAD_INITIALIZER(g_tls_session.sessions),
+                   .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* The connection handshaking on this thread */
+static __thread struct tls_conn *t_conn;
+
+/* Called with the lock held */
+static struct tls_conn *conn_lookup(const mbedtls_ssl_context *ssl)
+{
+    struct tls_conn *conn;
+
+    TAILQ_FOREACH(conn, &g_tls_session.conns, q)
+    {
+        if (conn->ssl == ssl) {
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the lock held */
+static struct tls_session_entry *session_lookup(const struct tls_conn *conn)
+{
+    const char *host = mbedtls_ssl_get_hostname(conn->ssl);
+    struct tls_session_entry *entry;
+
+    if (host == NULL || conn->port == 0) {
+        return NULL;
+    }
+
+    TAILQ_FOREACH(entry, &g_tls_session.sessions, q)
+    {
+        if (entry->port == conn->port && entry->conf == conn->conf &&
+            strcmp(entry->host, host) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the lock held */
+static void session_drop(struct tls_session_entry *entry)
+{
+    TAILQ_REMOVE(&g_tls_session.sessions, entry, q);
+    g_tls_session.n_sessions--;
+    mbedtls_ssl_session_free(&entry->session);
+    free(entry);
+}
+
+/* Stores the session of a connection, called with the lock held */
+static void session_save(struct tls_conn *conn)
+{
+    const char *host = mbedtls_ssl_get_hostname(conn->ssl);
+    struct tls_session_entry *entry;
+    int ret;
+
+    /* Without the port, the session could be offered to another server */
+    if (g_tls_session.size == 0 || host == NULL || strlen(host) >= TLS_HOST_MAX ||
+        conn->port == 0) {
+        return;
+    }
+
+    entry = session_lookup(conn);
+    if (entry != NULL) {
+        TAILQ_REMOVE(&g_tls_session.sessions, entry, q);
+        mbedtls_ssl_session_free(&entry->session);
+    }
+    else if (g_tls_session.n_sessions >= g_tls_session.size) {
+        entry = TAILQ_LAST(&g_tls_session.sessions, tls_session_entry_head);
+        TAILQ_REMOVE(&g_tls_session.sessions, entry, q);
+        mbedtls_ssl_session_free(&entry->session);
+    }
+    else {
+        entry = malloc(sizeof(*entry));
+        if (entry == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for tls_session_entry");
+            return;
+        }
+        g_tls_session.n_sessions++;
+    }
+
+    snprintf(entry->host, sizeof(entry->host), "%s", host);
+    entry->port = conn->port;
+    entry->conf = conn->conf;
+    mbedtls_ssl_session_init(&entry->session);
+    ret = mbedtls_ssl_get_session(conn->ssl, &entry->session);
+    if (ret != 0) {
+        EVP_AGENT_DBG("no TLS session to keep for %s:%u: -0x%04x", host, (unsigned int)conn->port,
+                      (unsigned int)-ret);
+        mbedtls_ssl_session_free(&entry->session);
+        free(entry);
+        g_tls_session.n_sessions--;
+        return;
+    }
+
+    TAILQ_INSERT_HEAD(&g_tls_session.sessions, entry, q);
+}
+
+/* Offers the cached session of the server, called with the lock held */
+static void session_offer(struct tls_conn *conn)
+{
+    struct tls_session_entry *entry = session_lookup(conn);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    if (mbedtls_ssl_set_session(conn->ssl, &entry->session) != 0) {
+        /* Expired ticket, or a version the configuration no longer allows */
+        session_drop(entry);
+        return;
+    }
+    TAILQ_REMOVE(&g_tls_session.sessions, entry, q);
+    TAILQ_INSERT_HEAD(&g_tls_session.sessions, entry, q);
+    conn->offered = true;
+    g_tls_session.offered++;
+}
+
+static void handshake_stats_add(struct handshake_stats *stats, uint64_t elapsed_us)
+{
+    stats->count++;
+    stats->sum_us += elapsed_us;
+    if (elapsed_us > stats->max_us) {
+        stats->max_us = elapsed_us;
+    }
+}
+
+/* Called with the lock held */
+static void handshake_done(struct tls_conn *conn)
+{
+    uint64_t elapsed = evp_agent_now_us() - conn->start_us;
+    bool tls13 = mbedtls_ssl_get_version_number(conn->ssl) == MBEDTLS_SSL_VERSION_TLS1_3;
+
+    /*
+     * Resumed handshakes skip the certificate exchange. With certificate
+     * verification disabled, a full handshake also looks resumed.
+     */
+    if (conn->offered && !conn->verified) {
+        handshake_stats_add(&g_tls_session.resumed, elapsed);
+    }
+    else {
+        handshake_stats_add(&g_tls_session.full, elapsed);
+    }
+    g_tls_session.tls13 += tls13;
+
+    /* TLS 1.3 sessions come later, with the tickets of the server */
+    if (!tls13) {
+        session_save(conn);
+    }
+}
+
+/* The port of the peer of a socket bio, 0 for other bios */
+static uint16_t bio_peer_port(void *p_bio, mbedtls_ssl_send_t *f_send)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    const mbedtls_net_context *net = p_bio;
+
+    if (f_send != mbedtls_net_send || net == NULL ||
+        getpeername(net->fd, (struct sockaddr *)&addr, &len) != 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        return ntohs(((const struct sockaddr_in *)&addr)->sin_port);
+    }
+    if (addr.ss_family == AF_INET6) {
+        return ntohs(((const struct sockaddr_in6 *)&addr)->sin6_port);
+    }
+
+    return 0;
+}
+
+void evp_agent_tls_session_conf(mbedtls_ssl_config *conf)
+{
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+    /* Otherwise the tickets are discarded, see __wrap_mbedtls_ssl_read() */
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(
+        conf, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#else
+    (void)conf;
+#endif
+}
+
+void __wrap_mbedtls_ssl_config_free(mbedtls_ssl_config *conf)
+{
+    struct tls_session_entry *entry, *tmp;
+
+    /* Another configuration may be allocated at the same address */
+    pthread_mutex_lock(&g_tls_session.lock);
+    TAILQ_FOREACH_SAFE(entry, &g_tls_session.sessions, q, tmp)
+    {
+        if (entry->conf == conf) {
+            session_drop(entry);
+        }
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    __real_mbedtls_ssl_config_free(conf);
+}
+
+int __wrap_mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf)
+{
+    struct tls_conn *conn;
+    int ret;
+
+    ret = __real_mbedtls_ssl_setup(ssl, conf);
+    if (ret != 0 || mbedtls_ssl_conf_get_endpoint(conf) != MBEDTLS_SSL_IS_CLIENT) {
+        return ret;
+    }
+
+    conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for tls_conn");
+        return ret;
+    }
+    conn->ssl = ssl;
+    conn->conf = conf;
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    TAILQ_INSERT_TAIL(&g_tls_session.conns, conn, q);
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    return ret;
+}
+
+void __wrap_mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t *f_send,
+                                mbedtls_ssl_recv_t *f_recv,
+                                mbedtls_ssl_recv_timeout_t *f_recv_timeout)
+{
+    uint16_t port = bio_peer_port(p_bio, f_send);
+    struct tls_conn *conn;
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    conn = conn_lookup(ssl);
+    if (conn != NULL) {
+        conn->port = port;
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    __real_mbedtls_ssl_set_bio(ssl, p_bio, f_send, f_recv, f_recv_timeout);
+}
+
+int __wrap_mbedtls_ssl_session_reset(mbedtls_ssl_context *ssl)
+{
+    struct tls_conn *conn;
+
+    /* Contexts reused for a reconnect handshake again */
+    pthread_mutex_lock(&g_tls_session.lock);
+    conn = conn_lookup(ssl);
+    if (conn != NULL) {
+        conn->start_us = 0;
+        conn->offered = false;
+        conn->verified = false;
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    return __real_mbedtls_ssl_session_reset(ssl);
+}
+
+/* Also called by mbedtls_ssl_read() and mbedtls_ssl_write() */
+int __wrap_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl)
+{
+    struct tls_conn *conn;
+    int ret;
+
+    if (mbedtls_ssl_is_handshake_over(ssl)) {
+        return __real_mbedtls_ssl_handshake(ssl);
+    }
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    conn = conn_lookup(ssl);
+    if (conn != NULL && conn->start_us == 0) {
+        conn->start_us = evp_agent_now_us();
+        session_offer(conn);
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    t_conn = conn;
+    ret = __real_mbedtls_ssl_handshake(ssl);
+    t_conn = NULL;
+
+    if (conn == NULL || ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+        ret == MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS || ret == MBEDTLS_ERR_SSL_CRYPTO_IN_PROGRESS) {
+        return ret;
+    }
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    if (ret == 0) {
+        handshake_done(conn);
+    }
+    else {
+        struct tls_session_entry *entry = session_lookup(conn);
+
+        g_tls_session.failed++;
+        /* Do not offer a session that may be the cause again */
+        if (conn->offered && entry != NULL) {
+            session_drop(entry);
+        }
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    return ret;
+}
+
+int __wrap_mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len)
+{
+    int ret;
+
+    /*
+     * The TLS layer of the agent does not expect the new session ticket
+     * signal, which it could take for an error: keep the ticket and read
+     * again.
+     */
+    do {
+        ret = __real_mbedtls_ssl_read(ssl, buf, len);
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            struct tls_conn *conn;
+
+            pthread_mutex_lock(&g_tls_session.lock);
+            conn = conn_lookup(ssl);
+            if (conn != NULL) {
+                session_save(conn);
+            }
+            pthread_mutex_unlock(&g_tls_session.lock);
+        }
+    } while (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET);
+
+    return ret;
+}
+
+void __wrap_mbedtls_ssl_free(mbedtls_ssl_context *ssl)
+{
+    struct tls_conn *conn;
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    conn = conn_lookup(ssl);
+    if (conn != NULL) {
+        TAILQ_REMOVE(&g_tls_session.conns, conn, q);
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+
+    free(conn);
+    __real_mbedtls_ssl_free(ssl);
+}
+
+static void peer_verified(void)
+{
+    if (t_conn == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&g_tls_session.lock);
+    t_conn->verified = true;
+    pthread_mutex_unlock(&g_tls_session.lock);
+}
+
+/* Certificate verification of TLS 1.3 handshakes */
+int __wrap_mbedtls_x509_crt_verify_with_profile(
+    mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca, mbedtls_x509_crl *ca_crl,
+    const mbedtls_x509_crt_profile *profile, const char *cn, uint32_t *flags,
+    int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *), void *p_vrfy)
+{
+    peer_verified();
+    return __real_mbedtls_x509_crt_verify_with_profile(crt, trust_ca, ca_crl, profile, cn, flags,
+                                                       f_vrfy, p_vrfy);
+}
+
+/* Certificate verification of TLS 1.2 handshakes */
+int __wrap_mbedtls_x509_crt_verify_restartable(
+    mbedtls_x509_crt *crt, mbedtls_x509_crt *trust_ca, mbedtls_x509_crl *ca_crl,
+    const mbedtls_x509_crt_profile *profile, const char *cn, uint32_t *flags,
+    int (*f_vrfy)(void *, mbedtls_x509_crt *, int, uint32_t *), void *p_vrfy,
+    mbedtls_x509_crt_restart_ctx *rs_ctx)
+{
+    peer_verified();
+    return __real_mbedtls_x509_crt_verify_restartable(crt, trust_ca, ca_crl, profile, cn, flags,
+                                                      f_vrfy, p_vrfy, rs_ctx);
+}
+
+static void tls_session_report(void *user)
+{
+    uint64_t full, resumed;
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    full = g_tls_session.full.count;
+    resumed = g_tls_session.resumed.count;
+    if (full + resumed != 0) {
+        EVP_AGENT_INFO("tls handshakes: full=%" PRIu64 " full_avg_ms=%" PRIu64
+                       " resumed=%" PRIu64 " resumed_avg_ms=%" PRIu64
+                       " resumption_rate=%" PRIu64 "%% offered=%" PRIu64 " failed=%" PRIu64
+                       " tls13=%" PRIu64 " cached_sessions=%u",
+                       full, full ? g_tls_session.full.sum_us / full / 1000 : 0, resumed,
+                       resumed ? g_tls_session.resumed.sum_us / resumed / 1000 : 0,
+                       resumed * 100 / (full + resumed), g_tls_session.offered,
+                       g_tls_session.failed, g_tls_session.tls13, g_tls_session.n_sessions);
+    }
+    pthread_mutex_unlock(&g_tls_session.lock);
+}
+
+int evp_agent_tls_session_init(void)
+{
+    const char *size = getenv("EVP_TLS_SESSION_CACHE_SIZE");
+    psa_status_t status;
+
+    g_tls_session.size = TLS_SESSION_CACHE_SIZE_DEFAULT;
+    if (size != NULL) {
+        g_tls_session.size = strtoul(size, NULL, 10);
+    }
+
+    /* TLS 1.3 runs on PSA crypto, which has to be set up first */
+    status = psa_crypto_init();
+    if (status != PSA_SUCCESS) {
+        EVP_AGENT_ERR("psa_crypto_init failed: %d", (int)status);
+        return -EIO;
+    }
+
+    return evp_agent_metrics_register("tls_session", NULL, tls_session_report, NULL);
+}
+
+void evp_agent_tls_session_deinit(void)
+{
+    struct tls_session_entry *entry, *tmp;
+
+    pthread_mutex_lock(&g_tls_session.lock);
+    TAILQ_FOREACH_SAFE(entry, &g_tls_session.sessions, q, tmp)
+    {
+        session_drop(entry);
+    }
+    g_tls_session.size = 0;
+    pthread_mutex_unlock(&g_tls_session.lock);
+}
@@ -0,0 +1,37 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_TLS_SESSION_H__
+#define __EVP_TLS_SESSION_H__
+
+#include <mbedtls/ssl.h>
+
+/*
+ * TLS session resumption.
+ *
+ * The TLS connections of the agent (MQTT, blob and deployment HTTPS) are
+ * set up in the EVP agent library, which drives mbedtls through its public
+ * API: these entry points are wrapped at link time (see
+ * evp_agent_link_args). The last session negotiated with each server, a
+ * TLS 1.3 ticket or a TLS 1.2 session ID or ticket, is kept in a cache of
+ * EVP_TLS_SESSION_CACHE_SIZE sessions (8 by default, 0 disables it) and
+ * offered by the next connection to that server, so reconnects and repeated
+ * blob transfers skip the certificate exchange and the key exchange
+ * signatures. Servers are told apart by host name, port and TLS
+ * configuration: a session is only offered to connections of the
+ * configuration it was negotiated with, and dropped with it.
+ *
+ * Handshake times and the ratio of resumed handshakes are reported in the
+ * metrics.
+ */
+
+int evp_agent_tls_session_init(void);
+void evp_agent_tls_session_deinit(void);
+
+/* Sets up a client configuration to keep sessions, from mbedtls_ssl_config_defaults() */
+void evp_agent_tls_session_conf(mbedtls_ssl_config *conf);
+
+#endif /* __EVP_TLS_SESSION_H__ */
@@ -0,0 +1,202 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_ciphersuites.h>
+
+#include "log.h"
+#include "tls_session.h"
+#include "tls_suites.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+int __real_mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport,
+                                       int preset);
+
+/* TLS 1.3 first, the TLS 1.2 ones are ignored by TLS 1.3 handshakes */
+static const int g_gcm_suites[] = {
+    MBEDTLS_TLS1_3_AES_128_GCM_SHA256,
+    MBEDTLS_TLS1_3_AES_256_GCM_SHA384,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+};
+
+static const int g_chachapoly_suites[] = {
+    MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+};
+
+static struct {
+    /*
+     * Zero terminated, the preferred suites first. Configurations keep
+     * pointing at it after the agent deinitializes, so it lives as long as
+     * the process.
+     */
+    int *list;
+    size_t n;
+    const int *supported;
+} g_tls_suites;
+
+static void cpu_features(bool *aes, bool *clmul)
+{
+#if defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    *aes = (hwcap & HWCAP_AES) != 0;
+    *clmul = (hwcap & HWCAP_PMULL) != 0;
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    *aes = __builtin_cpu_supports("aes");
+    *clmul = __builtin_cpu_supports("pclmul");
+#else
+    *aes = false;
+    *clmul = false;
+#endif
+}
+
+static bool suite_in(const int *list, size_t n, int id)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (list[i] == id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Appends a suite mbedtls supports, once */
+static void suite_add(int id)
+{
+    if (id == 0 || suite_in(g_tls_suites.list, g_tls_suites.n, id)) {
+        return;
+    }
+    for (const int *s = g_tls_suites.supported; *s != 0; s++) {
+        if (*s == id) {
+            g_tls_suites.list[g_tls_suites.n++] = id;
+            return;
+        }
+    }
+}
+
+static void suites_add(const int *ids, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        suite_add(ids[i]);
+    }
+}
+
+static int suites_add_names(const char *names)
+{
+    char *copy = strdup(names);
+    char *saveptr;
+
+    if (copy == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for EVP_TLS_CIPHERSUITES");
+        return -ENOMEM;
+    }
+
+    for (char *name = strtok_r(copy, ",", &saveptr); name != NULL;
+         name = strtok_r(NULL, ",", &saveptr)) {
+        int id = mbedtls_ssl_get_ciphersuite_id(name);
+
+        if (id == 0) {
+            EVP_AGENT_WARN("unknown TLS cipher suite %s", name);
+            continue;
+        }
+        suite_add(id);
+    }
+
+    free(copy);
+    return 0;
+}
+
+int __wrap_mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport,
+                                       int preset)
+{
+    int ret;
+
+    ret = __real_mbedtls_ssl_config_defaults(conf, endpoint, transport, preset);
+    if (ret == 0 && endpoint == MBEDTLS_SSL_IS_CLIENT) {
+        evp_agent_tls_session_conf(conf);
+    }
+    /* Other presets restrict the suites on purpose */
+    if (ret == 0 && endpoint == MBEDTLS_SSL_IS_CLIENT && preset == MBEDTLS_SSL_PRESET_DEFAULT &&
+        g_tls_suites.n != 0) {
+        mbedtls_ssl_conf_ciphersuites(conf, g_tls_suites.list);
+    }
+
+    return ret;
+}
+
+int evp_agent_tls_suites_init(void)
+{
+    const char *names = getenv("EVP_TLS_CIPHERSUITES");
+    bool aes, clmul;
+    size_t n = 0;
+    int ret;
+
+    g_tls_suites.supported = mbedtls_ssl_list_ciphersuites();
+    while (g_tls_suites.supported[n] != 0) {
+        n++;
+    }
+    if (g_tls_suites.list != NULL) {
+        /* Set up by a previous run of the agent */
+        return 0;
+    }
+    g_tls_suites.list = calloc(n + 1, sizeof(*g_tls_suites.list));
+    if (g_tls_suites.list == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for the TLS cipher suites");
+        return -ENOMEM;
+    }
+    g_tls_suites.n = 0;
+
+    cpu_features(&aes, &clmul);
+    if (names != NULL) {
+        ret = suites_add_names(names);
+        if (ret) {
+            free(g_tls_suites.list);
+            g_tls_suites.list = NULL;
+            g_tls_suites.n = 0;
+            return ret;
+        }
+    }
+    else if (aes && clmul) {
+        suites_add(g_gcm_suites, ARRAY_SIZE(g_gcm_suites));
+        suites_add(g_chachapoly_suites, ARRAY_SIZE(g_chachapoly_suites));
+    }
+    else {
+        suites_add(g_chachapoly_suites, ARRAY_SIZE(g_chachapoly_suites));
+        suites_add(g_gcm_suites, ARRAY_SIZE(g_gcm_suites));
+    }
+    suites_add(g_tls_suites.supported, n);
+
+    EVP_AGENT_INFO("tls suites: cpu_aes=%d cpu_clmul=%d first=%s", aes, clmul,
+                   g_tls_suites.n ? mbedtls_ssl_get_ciphersuite_name(g_tls_suites.list[0])
+                                  : "none");
+    return 0;
+}
+
+void evp_agent_tls_suites_deinit(void)
+{
+    /*
+     * The list is not freed: configurations set up meanwhile, by the EVP
+     * agent library or by modules, may not be freed yet.
+     */
+}
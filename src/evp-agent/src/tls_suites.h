@@ -0,0 +1,29 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_TLS_SUITES_H__
+#define __EVP_TLS_SUITES_H__
+
+/*
+ * TLS cipher suite preference.
+ *
+ * The client configurations of the agent, set up by the EVP agent library
+ * with mbedtls_ssl_config_defaults() (wrapped at link time, see
+ * evp_agent_link_args), offer the AEAD suites the CPU runs fastest first:
+ * AES-GCM when it has AES and carry-less multiply instructions (AES-NI and
+ * PCLMULQDQ, or the Armv8 AES and PMULL extensions), ChaCha20-Poly1305
+ * otherwise. The other suites mbedtls supports follow, in its own order.
+ *
+ * EVP_TLS_CIPHERSUITES, a comma separated list of mbedtls suite names (such
+ * as "TLS1-3-AES-128-GCM-SHA256"), replaces the suites offered first. The
+ * preference is computed by the first initialization and kept, with the
+ * configurations using it, for the life of the process.
+ */
+
+int evp_agent_tls_suites_init(void);
+void evp_agent_tls_suites_deinit(void);
+
+#endif /* __EVP_TLS_SUITES_H__ */
@@ -0,0 +1,371 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wasm_export.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasi_nn_bind.h"
+
+struct bound_tensor {
+    struct evp_wasi_nn_tensor t;
+    /* Region of the linear memory, resolved to t.data at compute time */
+    uint64_t app_offset;
+};
+
+struct bound_context {
+    TAILQ_ENTRY(bound_context) q;
+    wasm_module_inst_t inst;
+    uint32_t exec_ctx;
+    /* Backend that created the execution context */
+    const struct evp_wasi_nn_bind_ops *ops;
+    struct bound_tensor inputs[WASI_NN_BOUND_MAX_TENSORS];
+    uint32_t n_inputs;
+    struct bound_tensor outputs[WASI_NN_BOUND_MAX_TENSORS];
+    uint32_t n_outputs;
+    /* Native copies of the bindings handed to the backend */
+    struct evp_wasi_nn_tensor in[WASI_NN_BOUND_MAX_TENSORS];
+    struct evp_wasi_nn_tensor out[WASI_NN_BOUND_MAX_TENSORS];
+};
+
+TAILQ_HEAD(bound_context_head, bound_context);
+
+struct bound_instance {
+    TAILQ_ENTRY(bound_instance) q;
+    wasm_module_inst_t inst;
+};
+
+TAILQ_HEAD(bound_instance_head, bound_instance);
+
+static struct {
+    /* Execution contexts, recorded as the backends create them */
+    struct bound_context_head contexts;
+    /* Live module instances, for the backends to find theirs */
+    struct bound_instance_head instances;
+    uint64_t inferences;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    pthread_mutex_t lock;
+} g_wasi_nn_bind = {.contexts = TAILQ_HEAD_INITIALIZER(g_wasi_nn_bind.contexts),
+                    .instances = TAILQ_HEAD_INITIALIZER(g_wasi_nn_bind.instances),
+                    .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* Called with the lock held */
+static struct bound_context *context_lookup(wasm_module_inst_t inst, uint32_t exec_ctx)
+{
+    struct bound_context *c;
+
+    TAILQ_FOREACH(c, &g_wasi_nn_bind.contexts, q)
+    {
+        if (c->inst == inst && c->exec_ctx == exec_ctx) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the lock held */
+static int context_get(wasm_module_inst_t inst, uint32_t exec_ctx, struct bound_context **cp)
+{
+    struct bound_context *c = context_lookup(inst, exec_ctx);
+
+    if (c == NULL) {
+        return -ENOENT;
+    }
+
+    *cp = c;
+    return 0;
+}
+
+/* The binding of an index, or a new one */
+static struct bound_tensor *bound_tensor_get(struct bound_tensor *tensors, uint32_t *n,
+                                             uint32_t index)
+{
+    for (uint32_t i = 0; i < *n; i++) {
+        if (tensors[i].t.index == index) {
+            return &tensors[i];
+        }
+    }
+    if (*n == WASI_NN_BOUND_MAX_TENSORS) {
+        return NULL;
+    }
+
+    return &tensors[(*n)++];
+}
+
+static int32_t native_bind_input(wasm_exec_env_t exec_env, uint32_t exec_ctx, uint32_t index,
+                                 uint32_t type, const uint32_t *dims, uint32_t dims_size,
+                                 uint32_t data, uint32_t size)
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+    uint32_t n_dims = dims_size / sizeof(uint32_t);
+    struct bound_context *c;
+    struct bound_tensor *b;
+    int32_t ret = 0;
+
+    if (n_dims == 0 || n_dims > WASI_NN_BOUND_MAX_DIMS || dims_size % sizeof(uint32_t) != 0) {
+        return -EINVAL;
+    }
+    if (!wasm_runtime_validate_app_addr(inst, data, size)) {
+        /* The check raised an exception: the caller gets an errno instead */
+        wasm_runtime_clear_exception(inst);
+        return -EFAULT;
+    }
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    ret = context_get(inst, exec_ctx, &c);
+    if (ret) {
+        goto out_unlock;
+    }
+    b = bound_tensor_get(c->inputs, &c->n_inputs, index);
+    if (b == NULL) {
+        ret = -ENOSPC;
+        goto out_unlock;
+    }
+
+    b->t.index = index;
+    b->t.type = type;
+    memcpy(b->t.dims, dims, dims_size);
+    b->t.n_dims = n_dims;
+    b->t.size = size;
+    b->app_offset = data;
+
+out_unlock:
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+    return ret;
+}
+
+static int32_t native_bind_output(wasm_exec_env_t exec_env, uint32_t exec_ctx, uint32_t index,
+                                  uint32_t data, uint32_t size)
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+    struct bound_context *c;
+    struct bound_tensor *b;
+    int32_t ret = 0;
+
+    if (!wasm_runtime_validate_app_addr(inst, data, size)) {
+        wasm_runtime_clear_exception(inst);
+        return -EFAULT;
+    }
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    ret = context_get(inst, exec_ctx, &c);
+    if (ret) {
+        goto out_unlock;
+    }
+    b = bound_tensor_get(c->outputs, &c->n_outputs, index);
+    if (b == NULL) {
+        ret = -ENOSPC;
+        goto out_unlock;
+    }
+
+    b->t.index = index;
+    b->t.size = size;
+    b->app_offset = data;
+
+out_unlock:
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+    return ret;
+}
+
+static void bound_tensors_resolve(wasm_module_inst_t inst, const struct bound_tensor *b,
+                                  uint32_t n, struct evp_wasi_nn_tensor *t)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        t[i] = b[i].t;
+        /* Linear memory may move on memory.grow: resolve on every inference */
+        t[i].data = wasm_runtime_addr_app_to_native(inst, b[i].app_offset);
+    }
+}
+
+static int32_t native_compute_bound(wasm_exec_env_t exec_env, uint32_t exec_ctx)
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+    struct bound_context *c;
+    uint64_t bytes_in = 0, bytes_out = 0;
+    int ret;
+
+    /*
+     * Only this instance, running on this thread, changes or removes its
+     * contexts, so the context can be used without the lock.
+     */
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    c = context_lookup(inst, exec_ctx);
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+    if (c == NULL || c->n_inputs == 0) {
+        return -EINVAL;
+    }
+
+    bound_tensors_resolve(inst, c->inputs, c->n_inputs, c->in);
+    bound_tensors_resolve(inst, c->outputs, c->n_outputs, c->out);
+
+    ret = c->ops->compute_bound(inst, exec_ctx, c->in, c->n_inputs, c->out, c->n_outputs);
+    if (ret) {
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < c->n_inputs; i++) {
+        bytes_in += c->in[i].size;
+    }
+    for (uint32_t i = 0; i < c->n_outputs; i++) {
+        bytes_out += c->out[i].size;
+    }
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    g_wasi_nn_bind.inferences++;
+    g_wasi_nn_bind.bytes_in += bytes_in;
+    g_wasi_nn_bind.bytes_out += bytes_out;
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+    return 0;
+}
+
+static NativeSymbol g_wasi_nn_bind_natives[] = {
+    {"wasi_nn_bind_input", native_bind_input, "(iii*~ii)i", NULL},
+    {"wasi_nn_bind_output", native_bind_output, "(iiii)i", NULL},
+    {"wasi_nn_compute_bound", native_compute_bound, "(i)i", NULL},
+};
+
+int evp_agent_wasi_nn_bind_context_created(wasm_module_inst_t inst, uint32_t exec_ctx,
+                                           const struct evp_wasi_nn_bind_ops *ops)
+{
+    struct bound_context *c;
+    int ret = 0;
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    c = context_lookup(inst, exec_ctx);
+    if (c != NULL) {
+        /* The module switched backends: the former context is gone */
+        TAILQ_REMOVE(&g_wasi_nn_bind.contexts, c, q);
+        memset(c, 0, sizeof(*c));
+    }
+    else {
+        c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for bound_context");
+            ret = -ENOMEM;
+            goto out_unlock;
+        }
+    }
+
+    c->inst = inst;
+    c->exec_ctx = exec_ctx;
+    c->ops = ops;
+    TAILQ_INSERT_TAIL(&g_wasi_nn_bind.contexts, c, q);
+
+out_unlock:
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+    return ret;
+}
+
+NativeSymbol *evp_agent_wasi_nn_bind_natives(uint32_t *n_native_symbols)
+{
+    *n_native_symbols = sizeof(g_wasi_nn_bind_natives) / sizeof(g_wasi_nn_bind_natives[0]);
+    return g_wasi_nn_bind_natives;
+}
+
+wasm_module_inst_t evp_agent_wasi_nn_bind_instance_of(const void *addr)
+{
+    struct bound_instance *i;
+    wasm_module_inst_t inst = NULL;
+
+    /* Unlike the validation functions, this raises no exception in the instance */
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    TAILQ_FOREACH(i, &g_wasi_nn_bind.instances, q)
+    {
+        if (wasm_runtime_get_native_addr_range(i->inst, (uint8_t *)addr, NULL, NULL)) {
+            inst = i->inst;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+
+    return inst;
+}
+
+void evp_agent_wasi_nn_bind_instance_created(wasm_module_inst_t inst)
+{
+    struct bound_instance *i = calloc(1, sizeof(*i));
+
+    if (i == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for bound_instance");
+        return;
+    }
+    i->inst = inst;
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    TAILQ_INSERT_TAIL(&g_wasi_nn_bind.instances, i, q);
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+}
+
+void evp_agent_wasi_nn_bind_instance_destroyed(wasm_module_inst_t inst)
+{
+    struct bound_context *c, *tmp;
+    struct bound_instance *i;
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    TAILQ_FOREACH(i, &g_wasi_nn_bind.instances, q)
+    {
+        if (i->inst == inst) {
+            TAILQ_REMOVE(&g_wasi_nn_bind.instances, i, q);
+            free(i);
+            break;
+        }
+    }
+    TAILQ_FOREACH_SAFE(c, &g_wasi_nn_bind.contexts, q, tmp)
+    {
+        if (c->inst == inst) {
+            TAILQ_REMOVE(&g_wasi_nn_bind.contexts, c, q);
+            free(c);
+        }
+    }
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+}
+
+static void wasi_nn_bind_report(void *user)
+{
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    if (g_wasi_nn_bind.inferences != 0) {
+        EVP_AGENT_INFO("wasi-nn bound tensors: inferences=%" PRIu64 " bytes_in=%" PRIu64
+                       " bytes_out=%" PRIu64,
+                       g_wasi_nn_bind.inferences, g_wasi_nn_bind.bytes_in,
+                       g_wasi_nn_bind.bytes_out);
+    }
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+}
+
+int evp_agent_wasi_nn_bind_init(void)
+{
+    return evp_agent_metrics_register("wasi_nn_bind", NULL, wasi_nn_bind_report, NULL);
+}
+
+/* Instances left behind by the agent, whose bindings were never dropped */
+void evp_agent_wasi_nn_bind_deinit(void)
+{
+    struct bound_context *c, *ctmp;
+    struct bound_instance *i, *itmp;
+
+    pthread_mutex_lock(&g_wasi_nn_bind.lock);
+    TAILQ_FOREACH_SAFE(c, &g_wasi_nn_bind.contexts, q, ctmp)
+    {
+        TAILQ_REMOVE(&g_wasi_nn_bind.contexts, c, q);
+        free(c);
+    }
+    TAILQ_FOREACH_SAFE(i, &g_wasi_nn_bind.instances, q, itmp)
+    {
+        TAILQ_REMOVE(&g_wasi_nn_bind.instances, i, q);
+        free(i);
+    }
+    pthread_mutex_unlock(&g_wasi_nn_bind.lock);
+}
@@ -0,0 +1,65 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASI_NN_BIND_H__
+#define __EVP_WASI_NN_BIND_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wasm_export.h>
+
+#include "evp_agent/wasi_nn_bound_tensors.h"
+
+/*
+ * Bound tensors for wasi-nn (evp_agent/wasi_nn_bound_tensors.h).
+ *
+ * The natives keep the bindings of every execution context in a table, and
+ * run inferences through the caching wasi-nn backend (src/evp-agent/wasi-nn)
+ * that created the context. WAMR only gives a backend its own context, so a
+ * backend finds the module instance it serves from the linear memory holding
+ * the model it loads (evp_agent_wasi_nn_bind_instance_of()), and records
+ * every execution context it creates for the instance, along with itself
+ * (evp_agent_wasi_nn_bind_context_created()): the numbers of the execution
+ * contexts of several backends overlap.
+ *
+ * The execution contexts a graph keeps across instances, and the tensors
+ * the backend allocated in them, are the pool of preallocated buffers of the
+ * graph: an inference copies every bound region once, straight to or from
+ * them.
+ */
+
+#define EVP_WASI_NN_BIND_MODULE_NAME "env"
+
+struct evp_wasi_nn_tensor {
+    uint32_t index;
+    uint32_t type;
+    uint32_t dims[WASI_NN_BOUND_MAX_DIMS];
+    uint32_t n_dims;
+    void *data;
+    uint32_t size;
+};
+
+struct evp_wasi_nn_bind_ops {
+    const char *backend;
+    /* 0, -errno, or a positive wasi-nn error of the backend */
+    int (*compute_bound)(wasm_module_inst_t inst, uint32_t exec_ctx,
+                         const struct evp_wasi_nn_tensor *inputs, uint32_t n_inputs,
+                         struct evp_wasi_nn_tensor *outputs, uint32_t n_outputs);
+};
+
+/* Replaces the bindings of a former execution context of the same number */
+int evp_agent_wasi_nn_bind_context_created(wasm_module_inst_t inst, uint32_t exec_ctx,
+                                           const struct evp_wasi_nn_bind_ops *ops);
+/* The module instance whose linear memory holds addr, NULL if none */
+wasm_module_inst_t evp_agent_wasi_nn_bind_instance_of(const void *addr);
+NativeSymbol *evp_agent_wasi_nn_bind_natives(uint32_t *n_native_symbols);
+int evp_agent_wasi_nn_bind_init(void);
+void evp_agent_wasi_nn_bind_deinit(void);
+void evp_agent_wasi_nn_bind_instance_created(wasm_module_inst_t inst);
+void evp_agent_wasi_nn_bind_instance_destroyed(wasm_module_inst_t inst);
+
+#endif /* __EVP_WASI_NN_BIND_H__ */
@@ -0,0 +1,619 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasi_threads_pool.h"
+
+#define WASI_THREADS_POOL_MAX_DEFAULT 4
+#define WASI_THREADS_POOL_MAX_LIMIT 32
+#define WASI_THREADS_POOL_IDLE_SEC_DEFAULT 60
+
+/*
+ * The WAMR thread manager creates, joins, detaches and exits the native
+ * threads of wasm apps through its platform layer: these are wrapped at link
+ * time (see evp_agent_link_args) to run them on pooled workers. Only calls
+ * from other objects than the platform layer go through the wrappers, so
+ * both of its thread creation functions are wrapped.
+ */
+typedef void *(*thread_start_routine_t)(void *);
+
+/* BH_THREAD_DEFAULT_PRIORITY, as os_thread_create() uses */
+#define WASI_THREADS_DEFAULT_PRIO 0
+
+int __real_os_thread_create(pthread_t *p_tid, thread_start_routine_t start, void *arg,
+                            unsigned int stack_size);
+int __real_os_thread_create_with_prio(pthread_t *p_tid, thread_start_routine_t start, void *arg,
+                                      unsigned int stack_size, int prio);
+int __real_os_thread_join(pthread_t thread, void **retval);
+int __real_os_thread_detach(pthread_t thread);
+void __real_os_thread_exit(void *retval);
+
+enum spawn_kind {
+    /* Run by a parked worker */
+    SPAWN_REUSED,
+    /* Run by a new worker */
+    SPAWN_CREATED,
+    /* Run by a thread of its own, the pool being full */
+    SPAWN_UNPOOLED,
+    SPAWN_KINDS,
+};
+
+static const char *const spawn_kind_names[SPAWN_KINDS] = {"reused", "created", "unpooled"};
+
+struct spawn_stats {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+};
+
+enum worker_state {
+    WORKER_PARKED,
+    WORKER_RUNNING,
+    /* Finished a joinable thread, waiting for the join */
+    WORKER_DONE,
+};
+
+struct wasi_threads_pool;
+
+struct pool_worker {
+    TAILQ_ENTRY(pool_worker) q;
+    TAILQ_ENTRY(pool_worker) parked_q;
+    struct wasi_threads_pool *pool;
+    pthread_t thread;
+    unsigned int stack_size;
+    pthread_cond_t cond;
+    enum worker_state state;
+    enum spawn_kind kind;
+    thread_start_routine_t start;
+    void *arg;
+    void *retval;
+    bool detached;
+    uint64_t submit_us;
+    uint64_t parked_us;
+};
+
+TAILQ_HEAD(pool_worker_head, pool_worker);
+
+struct wasi_threads_pool {
+    TAILQ_ENTRY(wasi_threads_pool) q;
+    wasm_module_inst_t inst;
+    /* Most recently parked first */
+    struct pool_worker_head parked;
+    unsigned int n_workers;
+    bool closing;
+};
+
+TAILQ_HEAD(wasi_threads_pool_head, wasi_threads_pool);
+
+struct unpooled_start {
+    wasm_module_inst_t inst;
+    thread_start_routine_t start;
+    void *arg;
+    uint64_t submit_us;
+};
+
+static struct {
+    struct wasi_threads_pool_head pools;
+    struct pool_worker_head workers;
+    unsigned int max;
+    unsigned int idle_sec;
+    struct spawn_stats stats[SPAWN_KINDS];
+    pthread_mutex_t lock;
+    /* Signaled when a worker finishes a thread */
+    pthread_cond_t done;
+} g_wasi_threads = {.pools = TAILQ_HEAD_INITIALIZER(g_wasi_threads.pools),
+                    .workers = TAILQ_HEAD_INITIALIZER(g_wasi_threads.workers),
+                    .lock = PTHREAD_MUTEX_INITIALIZER,
+                    .done = PTHREAD_COND_INITIALIZER};
+
+/* The instance running on this thread, whose pool serves its spawns */
+static __thread wasm_module_inst_t t_inst;
+/* The worker this thread is */
+static __thread struct pool_worker *t_worker;
+/* Spawned for an instance, as a worker or not */
+static __thread bool t_spawned;
+
+/* Called with the lock held */
+static void spawn_stats_add(enum spawn_kind kind, uint64_t latency_us)
+{
+    struct spawn_stats *stats = &g_wasi_threads.stats[kind];
+
+    stats->count++;
+    stats->sum_us += latency_us;
+    if (latency_us > stats->max_us) {
+        stats->max_us = latency_us;
+    }
+}
+
+/* Called with the lock held */
+static void pool_free_if_unused(struct wasi_threads_pool *pool)
+{
+    if (pool->closing && pool->n_workers == 0) {
+        free(pool);
+    }
+}
+
+/* Called with the lock held */
+static void worker_park(struct pool_worker *w)
+{
+    w->state = WORKER_PARKED;
+    w->start = NULL;
+    w->arg = NULL;
+    w->parked_us = evp_agent_now_us();
+    TAILQ_INSERT_HEAD(&w->pool->parked, w, parked_q);
+    pthread_cond_signal(&w->cond);
+}
+
+/* Called with the lock held, returns whether the parked worker should exit */
+static bool worker_wait(struct pool_worker *w, bool retire)
+{
+    struct timespec deadline;
+    uint64_t idle_us = (uint64_t)g_wasi_threads.idle_sec * 1000000;
+
+    while (w->state != WORKER_RUNNING) {
+        if (w->state == WORKER_DONE) {
+            pthread_cond_wait(&w->cond, &g_wasi_threads.lock);
+            continue;
+        }
+        if (retire || w->pool->closing || g_wasi_threads.max == 0 ||
+            evp_agent_now_us() - w->parked_us >= idle_us) {
+            return true;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += g_wasi_threads.idle_sec;
+        pthread_cond_timedwait(&w->cond, &g_wasi_threads.lock, &deadline);
+    }
+
+    return false;
+}
+
+static void *worker_main(void *arg)
+{
+    struct pool_worker *w = arg;
+    struct wasi_threads_pool *pool = w->pool;
+    /* The signal stack of the worker is kept between its threads */
+    bool env = wasm_runtime_init_thread_env();
+
+    if (!env) {
+        EVP_AGENT_ERR("wasm_runtime_init_thread_env failed");
+    }
+
+    t_worker = w;
+    t_inst = pool->inst;
+    t_spawned = true;
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    for (;;) {
+        thread_start_routine_t start = w->start;
+        void *start_arg = w->arg;
+
+        /*
+         * Without a thread environment, the thread is dropped as WAMR does
+         * when it fails to set up one for a new thread, and the worker exits.
+         */
+        if (env) {
+            spawn_stats_add(w->kind, evp_agent_now_us() - w->submit_us);
+            pthread_mutex_unlock(&g_wasi_threads.lock);
+
+            /* Returns, with its cleanup done, even if it ends the thread */
+            w->retval = start(start_arg);
+
+            pthread_mutex_lock(&g_wasi_threads.lock);
+        }
+
+        if (w->detached) {
+            worker_park(w);
+        }
+        else {
+            w->state = WORKER_DONE;
+            pthread_cond_broadcast(&g_wasi_threads.done);
+        }
+
+        if (worker_wait(w, !env)) {
+            break;
+        }
+    }
+
+    if (w->state == WORKER_PARKED) {
+        TAILQ_REMOVE(&pool->parked, w, parked_q);
+    }
+    TAILQ_REMOVE(&g_wasi_threads.workers, w, q);
+    pool->n_workers--;
+    pool_free_if_unused(pool);
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+
+    if (env) {
+        wasm_runtime_destroy_thread_env();
+    }
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    return NULL;
+}
+
+/* Called with the lock held */
+static struct pool_worker *worker_new(struct wasi_threads_pool *pool, unsigned int stack_size)
+{
+    pthread_condattr_t condattr;
+    pthread_attr_t attr;
+    struct pool_worker *w;
+    int ret;
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for pool_worker");
+        return NULL;
+    }
+    w->pool = pool;
+    w->stack_size = stack_size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : stack_size;
+    w->state = WORKER_RUNNING;
+
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &condattr);
+    pthread_condattr_destroy(&condattr);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, w->stack_size);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    /* The worker waits for the lock before reading its thread */
+    ret = pthread_create(&w->thread, &attr, worker_main, w);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        EVP_AGENT_WARN("failed to create a wasi-threads worker: %s", strerror(ret));
+        pthread_cond_destroy(&w->cond);
+        free(w);
+        return NULL;
+    }
+
+    TAILQ_INSERT_TAIL(&g_wasi_threads.workers, w, q);
+    pool->n_workers++;
+    return w;
+}
+
+/* Called with the lock held */
+static struct pool_worker *worker_take(struct wasi_threads_pool *pool, unsigned int stack_size)
+{
+    struct pool_worker *w;
+
+    TAILQ_FOREACH(w, &pool->parked, parked_q)
+    {
+        if (w->stack_size >= stack_size) {
+            TAILQ_REMOVE(&pool->parked, w, parked_q);
+            w->state = WORKER_RUNNING;
+            w->kind = SPAWN_REUSED;
+            return w;
+        }
+    }
+
+    if (pool->n_workers >= g_wasi_threads.max) {
+        return NULL;
+    }
+    w = worker_new(pool, stack_size);
+    if (w != NULL) {
+        w->kind = SPAWN_CREATED;
+    }
+    return w;
+}
+
+/* Called with the lock held */
+static struct pool_worker *worker_lookup(pthread_t thread)
+{
+    struct pool_worker *w;
+
+    TAILQ_FOREACH(w, &g_wasi_threads.workers, q)
+    {
+        if (w->state != WORKER_PARKED && pthread_equal(w->thread, thread)) {
+            return w;
+        }
+    }
+
+    return NULL;
+}
+
+static void *unpooled_main(void *arg)
+{
+    struct unpooled_start s = *(struct unpooled_start *)arg;
+
+    free(arg);
+    t_inst = s.inst;
+    t_spawned = true;
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    spawn_stats_add(SPAWN_UNPOOLED, evp_agent_now_us() - s.submit_us);
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+
+    return s.start(s.arg);
+}
+
+static int spawn_unpooled(struct wasi_threads_pool *pool, pthread_t *p_tid,
+                          thread_start_routine_t start, void *arg, unsigned int stack_size,
+                          int prio)
+{
+    struct unpooled_start *s = malloc(sizeof(*s));
+    int ret;
+
+    if (s == NULL) {
+        return __real_os_thread_create_with_prio(p_tid, start, arg, stack_size, prio);
+    }
+    s->inst = pool->inst;
+    s->start = start;
+    s->arg = arg;
+    s->submit_us = evp_agent_now_us();
+
+    ret = __real_os_thread_create_with_prio(p_tid, unpooled_main, s, stack_size, prio);
+    if (ret != 0) {
+        free(s);
+    }
+    return ret;
+}
+
+/* Called with the lock held */
+static struct wasi_threads_pool *pool_lookup(wasm_module_inst_t inst)
+{
+    struct wasi_threads_pool *pool;
+
+    TAILQ_FOREACH(pool, &g_wasi_threads.pools, q)
+    {
+        if (pool->inst == inst) {
+            return pool;
+        }
+    }
+
+    return NULL;
+}
+
+/* Threads of other callers than the instances are left alone: -ENOENT */
+static int pool_spawn(pthread_t *p_tid, thread_start_routine_t start, void *arg,
+                      unsigned int stack_size, int prio)
+{
+    struct wasi_threads_pool *pool;
+    struct pool_worker *w;
+
+    if (t_inst == NULL) {
+        return -ENOENT;
+    }
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    pool = pool_lookup(t_inst);
+    if (pool == NULL) {
+        pthread_mutex_unlock(&g_wasi_threads.lock);
+        return -ENOENT;
+    }
+    w = g_wasi_threads.max == 0 ? NULL : worker_take(pool, stack_size);
+    if (w == NULL) {
+        pthread_mutex_unlock(&g_wasi_threads.lock);
+        return spawn_unpooled(pool, p_tid, start, arg, stack_size, prio);
+    }
+
+    w->start = start;
+    w->arg = arg;
+    w->retval = NULL;
+    w->detached = false;
+    w->submit_us = evp_agent_now_us();
+    *p_tid = w->thread;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+
+    return 0;
+}
+
+int __wrap_os_thread_create(pthread_t *p_tid, thread_start_routine_t start, void *arg,
+                            unsigned int stack_size)
+{
+    int ret = pool_spawn(p_tid, start, arg, stack_size, WASI_THREADS_DEFAULT_PRIO);
+
+    if (ret == -ENOENT) {
+        return __real_os_thread_create(p_tid, start, arg, stack_size);
+    }
+    return ret;
+}
+
+int __wrap_os_thread_create_with_prio(pthread_t *p_tid, thread_start_routine_t start, void *arg,
+                                      unsigned int stack_size, int prio)
+{
+    int ret = pool_spawn(p_tid, start, arg, stack_size, prio);
+
+    if (ret == -ENOENT) {
+        return __real_os_thread_create_with_prio(p_tid, start, arg, stack_size, prio);
+    }
+    return ret;
+}
+
+int __wrap_os_thread_join(pthread_t thread, void **retval)
+{
+    struct pool_worker *w;
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    w = worker_lookup(thread);
+    if (w == NULL) {
+        pthread_mutex_unlock(&g_wasi_threads.lock);
+        return __real_os_thread_join(thread, retval);
+    }
+
+    while (w->state == WORKER_RUNNING) {
+        pthread_cond_wait(&g_wasi_threads.done, &g_wasi_threads.lock);
+    }
+    if (retval != NULL) {
+        *retval = w->retval;
+    }
+    worker_park(w);
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+
+    return 0;
+}
+
+int __wrap_os_thread_detach(pthread_t thread)
+{
+    struct pool_worker *w;
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    w = worker_lookup(thread);
+    if (w == NULL) {
+        pthread_mutex_unlock(&g_wasi_threads.lock);
+        return __real_os_thread_detach(thread);
+    }
+
+    if (w->state == WORKER_DONE) {
+        worker_park(w);
+    }
+    else {
+        w->detached = true;
+    }
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+
+    return 0;
+}
+
+/*
+ * The thread manager ends a wasi-threads thread with os_thread_exit() as the
+ * last call of its start routine, once it released the execution environment
+ * of the thread: on a worker, it returns instead, and the start routine
+ * returns to the worker loop with the same value.
+ */
+void __wrap_os_thread_exit(void *retval)
+{
+    if (t_worker == NULL) {
+        __real_os_thread_exit(retval);
+    }
+}
+
+static void wasi_threads_pool_report(void *user)
+{
+    unsigned int workers = 0, parked = 0;
+    struct pool_worker *w;
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    TAILQ_FOREACH(w, &g_wasi_threads.workers, q)
+    {
+        workers++;
+        parked += w->state == WORKER_PARKED;
+    }
+    for (int i = 0; i < SPAWN_KINDS; i++) {
+        struct spawn_stats *stats = &g_wasi_threads.stats[i];
+
+        if (stats->count == 0) {
+            continue;
+        }
+        EVP_AGENT_INFO("wasi-threads spawns %s: count=%" PRIu64 " avg_us=%" PRIu64
+                       " max_us=%" PRIu64,
+                       spawn_kind_names[i], stats->count, stats->sum_us / stats->count,
+                       stats->max_us);
+    }
+    if (workers != 0) {
+        EVP_AGENT_INFO("wasi-threads pool: workers=%u parked=%u", workers, parked);
+    }
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+}
+
+void evp_agent_wasi_threads_pool_instance_created(wasm_module_inst_t inst)
+{
+    struct wasi_threads_pool *pool;
+
+    if (g_wasi_threads.max == 0) {
+        return;
+    }
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for wasi_threads_pool");
+        return;
+    }
+    pool->inst = inst;
+    TAILQ_INIT(&pool->parked);
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    TAILQ_INSERT_TAIL(&g_wasi_threads.pools, pool, q);
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+}
+
+void evp_agent_wasi_threads_pool_instance_running(wasm_module_inst_t inst)
+{
+    /* Spawned threads run child instances, and spawn for the instance of their pool */
+    if (!t_spawned) {
+        t_inst = inst;
+    }
+}
+
+/* Called with the lock held */
+static void pool_close(struct wasi_threads_pool *pool)
+{
+    struct pool_worker *w;
+
+    TAILQ_REMOVE(&g_wasi_threads.pools, pool, q);
+    pool->closing = true;
+    /* Busy workers exit once their thread ends */
+    TAILQ_FOREACH(w, &pool->parked, parked_q)
+    {
+        pthread_cond_signal(&w->cond);
+    }
+    pool_free_if_unused(pool);
+}
+
+void evp_agent_wasi_threads_pool_instance_destroyed(wasm_module_inst_t inst)
+{
+    struct wasi_threads_pool *pool;
+
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    pool = pool_lookup(inst);
+    if (pool != NULL) {
+        pool_close(pool);
+    }
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+}
+
+int evp_agent_wasi_threads_pool_init(void)
+{
+    const char *max = getenv("EVP_WASI_THREADS_POOL_MAX");
+    const char *idle = getenv("EVP_WASI_THREADS_POOL_IDLE_SEC");
+    unsigned long n = WASI_THREADS_POOL_MAX_DEFAULT;
+
+    if (max != NULL) {
+        n = strtoul(max, NULL, 10);
+    }
+    if (n > WASI_THREADS_POOL_MAX_LIMIT) {
+        EVP_AGENT_WARN("EVP_WASI_THREADS_POOL_MAX %lu is above %d", n,
+                       WASI_THREADS_POOL_MAX_LIMIT);
+        n = WASI_THREADS_POOL_MAX_LIMIT;
+    }
+    g_wasi_threads.idle_sec = WASI_THREADS_POOL_IDLE_SEC_DEFAULT;
+    if (idle != NULL) {
+        g_wasi_threads.idle_sec = strtoul(idle, NULL, 10);
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    g_wasi_threads.max = n;
+    return evp_agent_metrics_register("wasi_threads_pool", NULL, wasi_threads_pool_report, NULL);
+}
+
+void evp_agent_wasi_threads_pool_deinit(void)
+{
+    struct wasi_threads_pool *pool, *tmp;
+
+    /* Parked workers exit, and no more are created */
+    pthread_mutex_lock(&g_wasi_threads.lock);
+    g_wasi_threads.max = 0;
+    TAILQ_FOREACH_SAFE(pool, &g_wasi_threads.pools, q, tmp)
+    {
+        pool_close(pool);
+    }
+    pthread_mutex_unlock(&g_wasi_threads.lock);
+}
@@ -0,0 +1,37 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASI_THREADS_POOL_H__
+#define __EVP_WASI_THREADS_POOL_H__
+
+#include <wasm_export.h>
+
+/*
+ * Reusable OS threads for wasi-threads.
+ *
+ * Each thread-spawn of a wasm app makes WAMR create a native thread with a
+ * wasm_thread_stack_size stack, and destroy it when the wasm thread ends.
+ * Instead, the threads WAMR creates for the threads of a module instance are
+ * taken from a pool of parked workers of that instance, which keep their
+ * stack and signal stack between spawns. An instance keeps at most
+ * EVP_WASI_THREADS_POOL_MAX workers (4 by default, 0 disables the pool),
+ * spawns beyond that get a thread of their own as before, and a worker
+ * parked for EVP_WASI_THREADS_POOL_IDLE_SEC seconds (60 by default) exits.
+ *
+ * A spawn is served by the pool of the instance running on the calling
+ * thread: the thread the agent calls into the instance on (see
+ * wasm_runtime_wrap.c), or a worker of its pool.
+ */
+
+int evp_agent_wasi_threads_pool_init(void);
+void evp_agent_wasi_threads_pool_deinit(void);
+
+void evp_agent_wasi_threads_pool_instance_created(wasm_module_inst_t inst);
+/* The calling thread runs the code of the instance */
+void evp_agent_wasi_threads_pool_instance_running(wasm_module_inst_t inst);
+void evp_agent_wasi_threads_pool_instance_destroyed(wasm_module_inst_t inst);
+
+#endif /* __EVP_WASI_THREADS_POOL_H__ */
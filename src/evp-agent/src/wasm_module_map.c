@@ -0,0 +1,232 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "module_cache.h"
+#include "wasm_module_map.h"
+#include "wasm_runtime_wrap.h"
+
+struct module_mapping {
+    TAILQ_ENTRY(module_mapping) q;
+    char digest[EVP_WASM_DIGEST_LEN];
+    void *addr;
+    size_t len;
+    /* From /proc/self/smaps, in kB */
+    size_t rss;
+    size_t shared;
+    size_t private;
+};
+
+TAILQ_HEAD(module_mapping_head, module_mapping);
+
+static struct {
+    struct module_mapping_head mappings;
+    bool enabled;
+    pthread_mutex_t lock;
+} g_module_map = {.mappings = TAILQ_HEAD_INITIALIZER(g_module_map.mappings),
+                  .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* AOT files, which the loader only reads */
+static bool image_is_aot(const uint8_t *buf, uint32_t size)
+{
+    return size >= 4 && memcmp(buf, "\0aot", 4) == 0;
+}
+
+/* A private mapping of the image at path, named after the digest of its contents */
+static void *image_map(const char *path, uint32_t size, bool aot)
+{
+    struct stat st;
+    void *addr;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)size) {
+        close(fd);
+        return NULL;
+    }
+
+    /* Not populated: only the pages the loader reads are faulted in */
+    addr = mmap(NULL, size, aot ? PROT_READ : PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        EVP_AGENT_ERR("failed to map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    return addr;
+}
+
+/* Whole pages of the buffer only: the allocator owns the edges */
+static void buffer_page_out(const uint8_t *buf, uint32_t size)
+{
+#ifdef MADV_PAGEOUT
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)buf + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)buf + size) & ~(page - 1);
+
+    if (end > start && madvise((void *)start, end - start, MADV_PAGEOUT) != 0) {
+        EVP_AGENT_DBG("madvise(MADV_PAGEOUT) failed: %s", strerror(errno));
+    }
+#endif
+}
+
+int evp_agent_wasm_module_map(const char *digest, const uint8_t *buf, uint32_t size,
+                              struct evp_agent_wasm_module_map *map)
+{
+    struct module_mapping *mapping;
+    size_t cached_size = 0;
+    char *path;
+    void *addr;
+
+    if (!g_module_map.enabled || digest[0] == '\0' || size == 0) {
+        return -ENOTSUP;
+    }
+
+    path = evp_agent_module_cache_path(digest, &cached_size);
+    if (path == NULL) {
+        return -ENOENT;
+    }
+    /* The cache unlinks files on eviction, which leaves mappings valid */
+    addr = cached_size == size ? image_map(path, size, image_is_aot(buf, size)) : NULL;
+    free(path);
+    if (addr == NULL) {
+        return -ENOENT;
+    }
+
+    mapping = calloc(1, sizeof(*mapping));
+    if (mapping == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for module_mapping");
+        munmap(addr, size);
+        return -ENOMEM;
+    }
+    snprintf(mapping->digest, sizeof(mapping->digest), "%s", digest);
+    mapping->addr = addr;
+    mapping->len = size;
+
+    pthread_mutex_lock(&g_module_map.lock);
+    TAILQ_INSERT_TAIL(&g_module_map.mappings, mapping, q);
+    pthread_mutex_unlock(&g_module_map.lock);
+
+    map->addr = addr;
+    map->len = size;
+    buffer_page_out(buf, size);
+    return 0;
+}
+
+void evp_agent_wasm_module_unmap(struct evp_agent_wasm_module_map *map)
+{
+    struct module_mapping *mapping;
+
+    if (map->addr == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_module_map.lock);
+    TAILQ_FOREACH(mapping, &g_module_map.mappings, q)
+    {
+        if (mapping->addr == map->addr) {
+            TAILQ_REMOVE(&g_module_map.mappings, mapping, q);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_module_map.lock);
+
+    munmap(map->addr, map->len);
+    map->addr = NULL;
+    free(mapping);
+}
+
+/* Called with the lock held */
+static void smaps_sample(void)
+{
+    struct module_mapping *mapping = NULL, *m;
+    char line[256];
+    FILE *fp;
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start, end;
+        size_t kb;
+
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            mapping = NULL;
+            TAILQ_FOREACH(m, &g_module_map.mappings, q)
+            {
+                if ((uintptr_t)m->addr == start) {
+                    mapping = m;
+                    mapping->rss = mapping->shared = mapping->private = 0;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (mapping == NULL) {
+            continue;
+        }
+        if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            mapping->rss = kb;
+        }
+        else if (sscanf(line, "Shared_Clean: %zu kB", &kb) == 1 ||
+                 sscanf(line, "Shared_Dirty: %zu kB", &kb) == 1) {
+            mapping->shared += kb;
+        }
+        else if (sscanf(line, "Private_Clean: %zu kB", &kb) == 1 ||
+                 sscanf(line, "Private_Dirty: %zu kB", &kb) == 1) {
+            mapping->private += kb;
+        }
+    }
+
+    fclose(fp);
+}
+
+static void wasm_module_map_report(void *user)
+{
+    struct module_mapping *mapping;
+
+    pthread_mutex_lock(&g_module_map.lock);
+    smaps_sample();
+    TAILQ_FOREACH(mapping, &g_module_map.mappings, q)
+    {
+        EVP_AGENT_INFO("wasm module %.12s: mapped_kb=%zu rss_kb=%zu shared_kb=%zu private_kb=%zu",
+                       mapping->digest, mapping->len / 1024, mapping->rss, mapping->shared,
+                       mapping->private);
+    }
+    pthread_mutex_unlock(&g_module_map.lock);
+}
+
+int evp_agent_wasm_module_map_init(void)
+{
+    const char *enabled = getenv("EVP_WASM_MODULE_MAP");
+
+    if (enabled != NULL && strcmp(enabled, "0") == 0) {
+        return 0;
+    }
+
+    g_module_map.enabled = true;
+    return evp_agent_metrics_register("wasm_module_map", NULL, wasm_module_map_report, NULL);
+}
@@ -0,0 +1,46 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASM_MODULE_MAP_H__
+#define __EVP_WASM_MODULE_MAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * File-backed module images.
+ *
+ * The agent reads module binaries into heap buffers, and WAMR keeps
+ * referencing the buffer it loaded a module from (bytecode, data segments),
+ * so every loaded copy of a module holds its own anonymous copy of the code.
+ * Instead, a module held by the module cache (see module_cache.h) is loaded
+ * from a private mapping of its file there, which the digest of the buffer
+ * names: the cache only holds modules verified against their digest. Pages
+ * stay shared between the copies of a module, and clean, so the kernel can
+ * evict them. AOT files are mapped read-only; bytecode is mapped writable,
+ * as the loader of the classic interpreter rewrites some of its opcodes,
+ * which copies the pages it patches only.
+ *
+ * The heap buffer stays allocated by the agent until it unloads the module,
+ * but WAMR no longer reads it: its pages are paged out (MADV_PAGEOUT), which
+ * keeps their contents and gives them back wherever there is swap or zram.
+ * Modules the cache does not hold are loaded from the heap buffers.
+ *
+ * Set EVP_WASM_MODULE_MAP=0 to always load from the heap buffers.
+ */
+
+struct evp_agent_wasm_module_map {
+    void *addr;
+    size_t len;
+};
+
+int evp_agent_wasm_module_map_init(void);
+
+int evp_agent_wasm_module_map(const char *digest, const uint8_t *buf, uint32_t size,
+                              struct evp_agent_wasm_module_map *map);
+void evp_agent_wasm_module_unmap(struct evp_agent_wasm_module_map *map);
+
+#endif /* __EVP_WASM_MODULE_MAP_H__ */
@@ -0,0 +1,613 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wasm_export.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasm_pool.h"
+
+#define WASM_POOL_SIZE_DEFAULT 0
+#define WASM_POOL_SIZE_MAX 8
+#define WASM_POOL_ERROR_BUF_SIZE 128
+
+/* The pool creates and drops its instances behind the wrappers */
+wasm_module_inst_t __real_wasm_runtime_instantiate(const wasm_module_t module,
+                                                   uint32_t default_stack_size,
+                                                   uint32_t host_managed_heap_size,
+                                                   char *error_buf, uint32_t error_buf_size);
+void __real_wasm_runtime_deinstantiate(wasm_module_inst_t module_inst);
+void __real_wasm_runtime_set_wasi_args_ex(wasm_module_t module, const char *dir_list[],
+                                          uint32_t dir_count, const char *map_dir_list[],
+                                          uint32_t map_dir_count, const char *env[],
+                                          uint32_t env_count, char *argv[], int argc,
+                                          int64_t stdinfd, int64_t stdoutfd, int64_t stderrfd);
+
+struct pool_spare {
+    wasm_module_inst_t inst;
+    uint64_t instantiate_us;
+};
+
+struct pool_entry {
+    TAILQ_ENTRY(pool_entry) q;
+    wasm_module_t module;
+    uint32_t stack_size;
+    uint32_t heap_size;
+    /* Instantiating the module runs some of its code: no spares */
+    bool runs_code;
+    /* Instantiated by the agent, with stack_size and heap_size */
+    bool sized;
+    /* Copy of the WASI arguments of the module, which point to it */
+    struct evp_wasm_wasi_args args;
+    bool has_args;
+    /* The module points to the WASI arguments of the agent: no spares */
+    bool foreign_args;
+    struct pool_spare spares[WASM_POOL_SIZE_MAX];
+    unsigned int n_spares;
+    /* The worker is instantiating the module */
+    bool busy;
+    /* Instantiation failed: not retried until the agent instantiates again */
+    bool failed;
+};
+
+TAILQ_HEAD(pool_entry_head, pool_entry);
+
+static struct {
+    struct pool_entry_head entries;
+    unsigned int size;
+    pthread_t worker;
+    bool running;
+    bool stop;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t saved_us;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} g_wasm_pool = {.entries = TAILQ_HEAD_INITIALIZER(g_wasm_pool.entries),
+                 .lock = PTHREAD_MUTEX_INITIALIZER,
+                 .cond = PTHREAD_COND_INITIALIZER};
+
+/* Called with the lock held */
+static struct pool_entry *pool_lookup(wasm_module_t module)
+{
+    struct pool_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_wasm_pool.entries, q)
+    {
+        if (entry->module == module) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t leb128_read(const uint8_t **p, const uint8_t *end, bool *ok)
+{
+    uint32_t value = 0;
+
+    for (unsigned int shift = 0; shift < 35 && *p < end; shift += 7) {
+        uint8_t byte = *(*p)++;
+
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+
+    *ok = false;
+    return 0;
+}
+
+/* The exports WAMR calls on instantiation, besides the start function */
+static bool export_runs_on_instantiation(const uint8_t *name, uint32_t len)
+{
+    static const char *const names[] = {"_initialize", "__post_instantiate",
+                                        "__wasm_call_ctors"};
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i]) == len && memcmp(names[i], name, len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* AOT or malformed modules are assumed to run code */
+bool evp_agent_wasm_pool_runs_code(const uint8_t *buf, uint32_t size)
+{
+    const uint8_t *p = buf + 8, *end = buf + size;
+    bool ok = true;
+
+    if (size < 8 || memcmp(buf, "\0asm", 4) != 0) {
+        return true;
+    }
+
+    while (p < end) {
+        uint8_t id = *p++;
+        uint32_t len = leb128_read(&p, end, &ok);
+        const uint8_t *next = p + len;
+
+        if (!ok || len > (uint32_t)(end - p)) {
+            return true;
+        }
+        /* Start section */
+        if (id == 8) {
+            return true;
+        }
+        /* Export section */
+        if (id == 7) {
+            uint32_t count = leb128_read(&p, next, &ok);
+
+            for (uint32_t i = 0; ok && i < count; i++) {
+                uint32_t name_len = leb128_read(&p, next, &ok);
+
+                if (!ok || name_len >= (uint32_t)(next - p)) {
+                    return true;
+                }
+                const uint8_t *name = p;
+                p += name_len;
+                /* Function exports only */
+                if (*p++ == 0 && export_runs_on_instantiation(name, name_len)) {
+                    return true;
+                }
+                leb128_read(&p, next, &ok);
+            }
+            if (!ok) {
+                return true;
+            }
+        }
+        p = next;
+    }
+
+    return false;
+}
+
+static void strv_free(char **v, uint32_t n)
+{
+    for (uint32_t i = 0; v != NULL && i < n; i++) {
+        free(v[i]);
+    }
+    free(v);
+}
+
+static char **strv_dup(const char *const *v, uint32_t n)
+{
+    char **copy;
+
+    if (n == 0) {
+        return NULL;
+    }
+
+    copy = calloc(n, sizeof(*copy));
+    if (copy == NULL) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        copy[i] = strdup(v[i]);
+        if (copy[i] == NULL) {
+            strv_free(copy, i);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+static bool strv_equal(const char *const *a, const char *const *b, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        if (strcmp(a[i], b[i]) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void args_free(struct evp_wasm_wasi_args *args)
+{
+    strv_free((char **)args->dir_list, args->dir_count);
+    strv_free((char **)args->map_dir_list, args->map_dir_count);
+    strv_free((char **)args->env, args->env_count);
+    strv_free(args->argv, args->argc);
+    memset(args, 0, sizeof(*args));
+}
+
+static int args_dup(struct evp_wasm_wasi_args *copy, const struct evp_wasm_wasi_args *args)
+{
+    *copy = *args;
+    copy->dir_list = (const char **)strv_dup(args->dir_list, args->dir_count);
+    copy->map_dir_list = (const char **)strv_dup(args->map_dir_list, args->map_dir_count);
+    copy->env = (const char **)strv_dup(args->env, args->env_count);
+    copy->argv = strv_dup((const char *const *)args->argv, args->argc);
+
+    if ((args->dir_count != 0 && copy->dir_list == NULL) ||
+        (args->map_dir_count != 0 && copy->map_dir_list == NULL) ||
+        (args->env_count != 0 && copy->env == NULL) || (args->argc != 0 && copy->argv == NULL)) {
+        args_free(copy);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static bool args_equal(const struct evp_wasm_wasi_args *a, const struct evp_wasm_wasi_args *b)
+{
+    return a->dir_count == b->dir_count && a->map_dir_count == b->map_dir_count &&
+           a->env_count == b->env_count && a->argc == b->argc && a->stdinfd == b->stdinfd &&
+           a->stdoutfd == b->stdoutfd && a->stderrfd == b->stderrfd &&
+           strv_equal(a->dir_list, b->dir_list, a->dir_count) &&
+           strv_equal(a->map_dir_list, b->map_dir_list, a->map_dir_count) &&
+           strv_equal(a->env, b->env, a->env_count) &&
+           strv_equal((const char *const *)a->argv, (const char *const *)b->argv, a->argc);
+}
+
+static void args_set(wasm_module_t module, const struct evp_wasm_wasi_args *args)
+{
+    __real_wasm_runtime_set_wasi_args_ex(module, args->dir_list, args->dir_count,
+                                         args->map_dir_list, args->map_dir_count, args->env,
+                                         args->env_count, args->argv, args->argc,
+                                         args->stdinfd, args->stdoutfd, args->stderrfd);
+}
+
+/* Whether spares of the entry can be created at all */
+static bool pool_entry_poolable(const struct pool_entry *entry)
+{
+    if (entry->runs_code || entry->foreign_args || !entry->sized) {
+        return false;
+    }
+
+    /* Stdio descriptors are closed with the instance */
+    return !entry->has_args || (entry->args.stdinfd == -1 && entry->args.stdoutfd == -1 &&
+                                entry->args.stderrfd == -1);
+}
+
+/* Called with the lock held */
+static struct pool_entry *pool_next_to_fill(void)
+{
+    struct pool_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_wasm_pool.entries, q)
+    {
+        if (!entry->busy && !entry->failed && pool_entry_poolable(entry) &&
+            entry->n_spares < g_wasm_pool.size) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/* Removes the spares of an entry into spares, called with the lock held */
+static unsigned int pool_entry_drain(struct pool_entry *entry, struct pool_spare *spares)
+{
+    unsigned int n = entry->n_spares;
+
+    memcpy(spares, entry->spares, n * sizeof(*spares));
+    entry->n_spares = 0;
+    return n;
+}
+
+static void spares_destroy(struct pool_spare *spares, unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++) {
+        __real_wasm_runtime_deinstantiate(spares[i].inst);
+    }
+}
+
+static void *pool_worker(void *arg)
+{
+    char error_buf[WASM_POOL_ERROR_BUF_SIZE];
+
+    /* Instances are created here and run on the threads of the agent */
+    if (!wasm_runtime_init_thread_env()) {
+        EVP_AGENT_ERR("wasm_runtime_init_thread_env failed, disabling the instance pool");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    while (!g_wasm_pool.stop) {
+        struct pool_entry *entry = pool_next_to_fill();
+
+        if (entry == NULL) {
+            pthread_cond_wait(&g_wasm_pool.cond, &g_wasm_pool.lock);
+            continue;
+        }
+
+        wasm_module_t module = entry->module;
+        uint32_t stack_size = entry->stack_size;
+        uint32_t heap_size = entry->heap_size;
+
+        entry->busy = true;
+        pthread_mutex_unlock(&g_wasm_pool.lock);
+
+        uint64_t t0 = evp_agent_now_us();
+        wasm_module_inst_t inst = __real_wasm_runtime_instantiate(module, stack_size, heap_size,
+                                                                  error_buf, sizeof(error_buf));
+        uint64_t elapsed = evp_agent_now_us() - t0;
+
+        pthread_mutex_lock(&g_wasm_pool.lock);
+        /* Unloading waits for the instantiation to finish */
+        entry->busy = false;
+        pthread_cond_broadcast(&g_wasm_pool.cond);
+
+        if (inst == NULL) {
+            EVP_AGENT_WARN("failed to instantiate a spare of wasm module %p: %s", (void *)module,
+                           error_buf);
+            entry->failed = true;
+            continue;
+        }
+        if (entry->stack_size != stack_size || entry->heap_size != heap_size ||
+            entry->n_spares >= g_wasm_pool.size) {
+            /* Resized meanwhile */
+            pthread_mutex_unlock(&g_wasm_pool.lock);
+            __real_wasm_runtime_deinstantiate(inst);
+            pthread_mutex_lock(&g_wasm_pool.lock);
+            continue;
+        }
+
+        entry->spares[entry->n_spares].inst = inst;
+        entry->spares[entry->n_spares].instantiate_us = elapsed;
+        entry->n_spares++;
+    }
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+
+    wasm_runtime_destroy_thread_env();
+    return NULL;
+}
+
+wasm_module_inst_t evp_agent_wasm_pool_take(wasm_module_t module, uint32_t stack_size,
+                                            uint32_t heap_size)
+{
+    wasm_module_inst_t inst = NULL;
+    struct pool_entry *entry;
+
+    if (g_wasm_pool.size == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    entry = pool_lookup(module);
+    if (entry != NULL && entry->n_spares > 0 && entry->stack_size == stack_size &&
+        entry->heap_size == heap_size) {
+        struct pool_spare *spare = &entry->spares[--entry->n_spares];
+
+        inst = spare->inst;
+        g_wasm_pool.hits++;
+        g_wasm_pool.saved_us += spare->instantiate_us;
+        /* Refill */
+        pthread_cond_broadcast(&g_wasm_pool.cond);
+    }
+    else {
+        g_wasm_pool.misses++;
+    }
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+
+    return inst;
+}
+
+void evp_agent_wasm_pool_module_loaded(wasm_module_t module, bool runs_code)
+{
+    struct pool_entry *entry;
+
+    if (g_wasm_pool.size == 0) {
+        return;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for pool_entry");
+        return;
+    }
+    entry->module = module;
+    entry->runs_code = runs_code;
+    if (runs_code) {
+        EVP_AGENT_DBG("wasm module %p runs code on instantiation, no spares", (void *)module);
+    }
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    TAILQ_INSERT_TAIL(&g_wasm_pool.entries, entry, q);
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+}
+
+void evp_agent_wasm_pool_set_wasi_args(wasm_module_t module,
+                                       const struct evp_wasm_wasi_args *args)
+{
+    struct pool_spare stale[WASM_POOL_SIZE_MAX];
+    unsigned int n_stale = 0;
+    struct evp_wasm_wasi_args copy;
+    struct pool_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    entry = pool_lookup(module);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&g_wasm_pool.lock);
+        args_set(module, args);
+        return;
+    }
+
+    /* The worker reads the arguments of the module while instantiating it */
+    while (entry->busy) {
+        pthread_cond_wait(&g_wasm_pool.cond, &g_wasm_pool.lock);
+    }
+    if (entry->has_args && args_equal(&entry->args, args)) {
+        goto out_unlock;
+    }
+
+    /* The arguments of the agent may not outlive this call */
+    n_stale = pool_entry_drain(entry, stale);
+    if (args_dup(&copy, args) != 0) {
+        EVP_AGENT_ERR("failed to allocate memory for the WASI arguments, disabling spares");
+        entry->foreign_args = true;
+        args_set(module, args);
+        goto out_unlock;
+    }
+    args_set(module, &copy);
+    if (entry->has_args) {
+        args_free(&entry->args);
+    }
+    entry->args = copy;
+    entry->has_args = true;
+    entry->foreign_args = false;
+
+out_unlock:
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+    spares_destroy(stale, n_stale);
+}
+
+void evp_agent_wasm_pool_instantiated(wasm_module_t module, uint32_t stack_size,
+                                      uint32_t heap_size, uint64_t instantiate_us)
+{
+    struct pool_spare stale[WASM_POOL_SIZE_MAX];
+    unsigned int n_stale = 0;
+    struct pool_entry *entry;
+
+    if (g_wasm_pool.size == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    entry = pool_lookup(module);
+    if (entry == NULL) {
+        goto out_unlock;
+    }
+    if (entry->stack_size != stack_size || entry->heap_size != heap_size) {
+        /* The sizing profile of the module changed */
+        n_stale = pool_entry_drain(entry, stale);
+    }
+
+    EVP_AGENT_DBG("wasm module %p instantiated in %" PRIu64 " us", (void *)module,
+                  instantiate_us);
+    entry->stack_size = stack_size;
+    entry->heap_size = heap_size;
+    entry->sized = true;
+    entry->failed = false;
+    pthread_cond_broadcast(&g_wasm_pool.cond);
+
+out_unlock:
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+    spares_destroy(stale, n_stale);
+}
+
+void evp_agent_wasm_pool_module_unloading(wasm_module_t module)
+{
+    struct pool_spare spares[WASM_POOL_SIZE_MAX];
+    unsigned int n = 0;
+    struct pool_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    entry = pool_lookup(module);
+    if (entry != NULL) {
+        while (entry->busy) {
+            pthread_cond_wait(&g_wasm_pool.cond, &g_wasm_pool.lock);
+        }
+        TAILQ_REMOVE(&g_wasm_pool.entries, entry, q);
+        n = pool_entry_drain(entry, spares);
+    }
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+
+    spares_destroy(spares, n);
+    if (entry != NULL && entry->has_args) {
+        args_free(&entry->args);
+    }
+    free(entry);
+}
+
+static void wasm_pool_report(void *user)
+{
+    unsigned int spares = 0;
+    struct pool_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    TAILQ_FOREACH(entry, &g_wasm_pool.entries, q)
+    {
+        spares += entry->n_spares;
+    }
+    if (g_wasm_pool.hits + g_wasm_pool.misses != 0) {
+        EVP_AGENT_INFO("wasm instance pool: spares=%u hits=%" PRIu64 " misses=%" PRIu64
+                       " hit_rate=%" PRIu64 "%% saved_ms=%" PRIu64,
+                       spares, g_wasm_pool.hits, g_wasm_pool.misses,
+                       g_wasm_pool.hits * 100 / (g_wasm_pool.hits + g_wasm_pool.misses),
+                       g_wasm_pool.saved_us / 1000);
+    }
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+}
+
+int evp_agent_wasm_pool_init(void)
+{
+    const char *env = getenv("EVP_WASM_INSTANCE_POOL_SIZE");
+    unsigned long size = WASM_POOL_SIZE_DEFAULT;
+    int ret;
+
+    if (env != NULL) {
+        size = strtoul(env, NULL, 10);
+    }
+    if (size > WASM_POOL_SIZE_MAX) {
+        EVP_AGENT_WARN("EVP_WASM_INSTANCE_POOL_SIZE %lu is above %d", size, WASM_POOL_SIZE_MAX);
+        size = WASM_POOL_SIZE_MAX;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    ret = evp_agent_metrics_register("wasm_pool", NULL, wasm_pool_report, NULL);
+    if (ret) {
+        return ret;
+    }
+
+    g_wasm_pool.stop = false;
+    g_wasm_pool.size = size;
+    ret = pthread_create(&g_wasm_pool.worker, NULL, pool_worker, NULL);
+    if (ret) {
+        EVP_AGENT_ERR("failed to create the instance pool thread: %s", strerror(ret));
+        g_wasm_pool.size = 0;
+        return -ret;
+    }
+
+    g_wasm_pool.running = true;
+    return 0;
+}
+
+void evp_agent_wasm_pool_deinit(void)
+{
+    struct pool_entry *entry, *tmp;
+
+    if (!g_wasm_pool.running) {
+        return;
+    }
+
+    pthread_mutex_lock(&g_wasm_pool.lock);
+    g_wasm_pool.stop = true;
+    g_wasm_pool.size = 0;
+    pthread_cond_broadcast(&g_wasm_pool.cond);
+    pthread_mutex_unlock(&g_wasm_pool.lock);
+
+    pthread_join(g_wasm_pool.worker, NULL);
+    g_wasm_pool.running = false;
+
+    /* Modules still loaded keep no spares */
+    TAILQ_FOREACH_SAFE(entry, &g_wasm_pool.entries, q, tmp)
+    {
+        TAILQ_REMOVE(&g_wasm_pool.entries, entry, q);
+        spares_destroy(entry->spares, entry->n_spares);
+        if (entry->has_args) {
+            args_free(&entry->args);
+        }
+        free(entry);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASM_POOL_H__
+#define __EVP_WASM_POOL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wasm_export.h>
+
+/*
+ * Warm pool of module instances.
+ *
+ * Instantiating a module (linear memory, globals, tables, WASI context) is
+ * on the critical path of every instance restart and scale-up. Once a module
+ * of the deployment has been instantiated, spare instances with the same
+ * stack and heap sizes are created in the background, up to
+ * EVP_WASM_INSTANCE_POOL_SIZE per module (0 by default, which disables the
+ * pool), and handed out to its next instantiations. Every spare costs the
+ * memory of an instance. The spares of a module are dropped when it is
+ * unloaded, that is when it leaves the deployment.
+ *
+ * Only modules that run no code on instantiation (no start function, no
+ * _initialize, __post_instantiate or __wasm_call_ctors export) get spares,
+ * as that code would run early and on the thread of the pool. So do modules
+ * with stdio file descriptors in their WASI arguments, which belong to a
+ * single instance. The pool keeps a copy of the WASI arguments the agent
+ * sets, and a spare is only handed out while they are the ones it was
+ * created with.
+ */
+
+struct evp_wasm_wasi_args {
+    const char **dir_list;
+    uint32_t dir_count;
+    const char **map_dir_list;
+    uint32_t map_dir_count;
+    const char **env;
+    uint32_t env_count;
+    char **argv;
+    int argc;
+    int64_t stdinfd;
+    int64_t stdoutfd;
+    int64_t stderrfd;
+};
+
+int evp_agent_wasm_pool_init(void);
+void evp_agent_wasm_pool_deinit(void);
+
+/* Whether instantiating the module binary runs any of its code */
+bool evp_agent_wasm_pool_runs_code(const uint8_t *buf, uint32_t size);
+void evp_agent_wasm_pool_module_loaded(wasm_module_t module, bool runs_code);
+/* Sets the WASI arguments of the module, see wasm_runtime_set_wasi_args_ex() */
+void evp_agent_wasm_pool_set_wasi_args(wasm_module_t module,
+                                       const struct evp_wasm_wasi_args *args);
+
+/* A spare instance of the module, or NULL */
+wasm_module_inst_t evp_agent_wasm_pool_take(wasm_module_t module, uint32_t stack_size,
+                                            uint32_t heap_size);
+/* The module was instantiated without the pool, in instantiate_us */
+void evp_agent_wasm_pool_instantiated(wasm_module_t module, uint32_t stack_size,
+                                      uint32_t heap_size, uint64_t instantiate_us);
+/* Drops the spares of the module, before it is unloaded */
+void evp_agent_wasm_pool_module_unloading(wasm_module_t module);
+
+#endif /* __EVP_WASM_POOL_H__ */
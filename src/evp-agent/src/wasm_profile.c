@@ -0,0 +1,609 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for process_vm_readv */
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <parson.h>
+#include <wasm_export.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasm_profile.h"
+#include "wasm_runtime_wrap.h"
+
+#define WASM_PROFILES_DEFAULT_PATH "/etc/evp/wasm_profiles.json"
+
+/* Recommendations keep 25% of headroom above the observed high-water mark */
+#define PROFILE_HEADROOM(x) ((x) + (x) / 4)
+#define PROFILE_MIN_HEAP_SIZE 4096
+#define PROFILE_MIN_STACK_SIZE 8192
+#define PROFILE_SCAN_CHUNK 4096
+/* A high-water mark above 90% of the limit means the limit is too tight */
+#define PROFILE_NEAR_LIMIT(hwm, limit) ((hwm) >= (size_t)(limit) / 10 * 9)
+
+/*
+ * Of the WAMR runtime, not in wasm_export.h: the aux stack of the module in
+ * its linear memory, which grows down from start_offset
+ */
+bool wasm_exec_env_get_aux_stack(wasm_exec_env_t exec_env, uint64_t *start_offset,
+                                 uint32_t *size);
+
+struct profile_entry {
+    TAILQ_ENTRY(profile_entry) q;
+    char digest[EVP_WASM_DIGEST_LEN];
+    struct evp_agent_wasm_profile profile;
+};
+
+/* Usage of a module, aggregated over all its instances and restarts */
+struct usage_entry {
+    TAILQ_ENTRY(usage_entry) q;
+    char digest[EVP_WASM_DIGEST_LEN];
+    uint32_t heap_size;
+    uint32_t stack_size;
+    size_t heap_hwm;
+    size_t aux_stack_hwm;
+    uint32_t aux_stack_size;
+    size_t linear_memory_peak;
+    bool heap_measured;
+    bool stack_measured;
+    unsigned int instances;
+    unsigned int live;
+};
+
+struct instance_entry {
+    TAILQ_ENTRY(instance_entry) q;
+    wasm_module_inst_t inst;
+    struct usage_entry *usage;
+    /* Aux stack in the linear memory, if the module has one */
+    uint64_t aux_stack_top;
+    uint32_t aux_stack_size;
+    /* Lowest offset of the aux stack written so far */
+    uint64_t aux_stack_low;
+    /* Host-managed heap inside the linear memory, if any */
+    uint64_t heap_start;
+    size_t heap_len;
+    size_t heap_hwm;
+    size_t linear_memory_peak;
+};
+
+TAILQ_HEAD(profile_entry_head, profile_entry);
+TAILQ_HEAD(usage_entry_head, usage_entry);
+TAILQ_HEAD(instance_entry_head, instance_entry);
+
+static struct {
+    struct profile_entry_head profiles;
+    struct usage_entry_head usages;
+    struct instance_entry_head instances;
+    pthread_mutex_t lock;
+} g_wasm_profile = {.profiles = TAILQ_HEAD_INITIALIZER(g_wasm_profile.profiles),
+                    .usages = TAILQ_HEAD_INITIALIZER(g_wasm_profile.usages),
+                    .instances = TAILQ_HEAD_INITIALIZER(g_wasm_profile.instances),
+                    .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static size_t round_up(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+/*
+ * Pages of anonymous mappings only become resident once touched, so the
+ * resident part of a stack or heap is its high-water mark.
+ */
+static size_t resident_bytes(const void *addr, size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    uintptr_t end = round_up((uintptr_t)addr + len, page);
+    size_t pages = (end - start) / page;
+    size_t resident = 0;
+    unsigned char *vec;
+
+    if (addr == NULL || len == 0) {
+        return 0;
+    }
+
+    vec = malloc(pages);
+    if (vec == NULL) {
+        return 0;
+    }
+    if (mincore((void *)start, end - start, vec) == 0) {
+        for (size_t i = 0; i < pages; i++) {
+            resident += vec[i] & 1;
+        }
+    }
+    free(vec);
+
+    return resident * page;
+}
+
+static struct profile_entry *profile_lookup(const char *digest)
+{
+    struct profile_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_wasm_profile.profiles, q)
+    {
+        if (strcmp(entry->digest, digest) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct usage_entry *usage_get(const char *digest)
+{
+    struct usage_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_wasm_profile.usages, q)
+    {
+        if (strcmp(entry->digest, digest) == 0) {
+            return entry;
+        }
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for wasm usage");
+        return NULL;
+    }
+    snprintf(entry->digest, sizeof(entry->digest), "%s", digest);
+    TAILQ_INSERT_TAIL(&g_wasm_profile.usages, entry, q);
+
+    return entry;
+}
+
+static int load_profiles(const char *path)
+{
+    JSON_Value *value;
+    JSON_Object *root;
+    size_t count;
+
+    if (access(path, R_OK) != 0) {
+        EVP_AGENT_INFO("No wasm profiles at %s, using the default sizes", path);
+        return 0;
+    }
+
+    value = json_parse_file(path);
+    root = json_value_get_object(value);
+    if (root == NULL) {
+        EVP_AGENT_WARN("Ignoring malformed wasm profiles %s", path);
+        json_value_free(value);
+        return 0;
+    }
+
+    count = json_object_get_count(root);
+    for (size_t i = 0; i < count; i++) {
+        const char *digest = json_object_get_name(root, i);
+        JSON_Object *obj = json_value_get_object(json_object_get_value_at(root, i));
+
+        if (obj == NULL || strlen(digest) != EVP_WASM_DIGEST_LEN - 1) {
+            EVP_AGENT_WARN("Ignoring malformed wasm profile %s", digest);
+            continue;
+        }
+
+        struct profile_entry *entry = calloc(1, sizeof(*entry));
+        if (entry == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for wasm profile");
+            json_value_free(value);
+            return -ENOMEM;
+        }
+        snprintf(entry->digest, sizeof(entry->digest), "%s", digest);
+        entry->profile.heap_size = (uint32_t)json_object_get_number(obj, "heapSize");
+        entry->profile.stack_size = (uint32_t)json_object_get_number(obj, "stackSize");
+        TAILQ_INSERT_TAIL(&g_wasm_profile.profiles, entry, q);
+    }
+
+    EVP_AGENT_INFO("Loaded %zu wasm profiles from %s", count, path);
+    json_value_free(value);
+    return 0;
+}
+
+void evp_agent_wasm_profile_apply(const char *digest, uint32_t *stack_size, uint32_t *heap_size)
+{
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    struct profile_entry *entry = profile_lookup(digest);
+    if (entry != NULL) {
+        /* A zero size in the profile keeps the agent default */
+        if (entry->profile.stack_size != 0) {
+            *stack_size = entry->profile.stack_size;
+        }
+        if (entry->profile.heap_size != 0) {
+            *heap_size = entry->profile.heap_size;
+        }
+        EVP_AGENT_INFO("wasm module %.12s: profile stack %u heap %u", digest, *stack_size,
+                       *heap_size);
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
+
+static void recommend(const struct usage_entry *usage, struct evp_agent_wasm_profile *profile)
+{
+    /*
+     * The stack of WAMR, which the interpreter runs the module on, is not
+     * measured: the aux stack is another one, in the linear memory
+     */
+    profile->stack_size = usage->stack_size;
+    profile->heap_size = usage->heap_size;
+    profile->aux_stack_size = 0;
+
+    if (usage->stack_measured) {
+        profile->aux_stack_size = round_up(PROFILE_HEADROOM(usage->aux_stack_hwm), 4096);
+        if (profile->aux_stack_size < PROFILE_MIN_STACK_SIZE) {
+            profile->aux_stack_size = PROFILE_MIN_STACK_SIZE;
+        }
+    }
+
+    if (!usage->heap_measured) {
+        return;
+    }
+
+    if (PROFILE_NEAR_LIMIT(usage->heap_hwm, usage->heap_size)) {
+        profile->heap_size = round_up(PROFILE_HEADROOM(usage->heap_size), 4096);
+    }
+    else {
+        profile->heap_size = round_up(PROFILE_HEADROOM(usage->heap_hwm), 4096);
+        if (profile->heap_size < PROFILE_MIN_HEAP_SIZE) {
+            profile->heap_size = PROFILE_MIN_HEAP_SIZE;
+        }
+    }
+}
+
+int evp_agent_wasm_profile_recommend(const char *digest, struct evp_agent_wasm_profile *profile)
+{
+    int ret = -ENOENT;
+    struct usage_entry *usage;
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH(usage, &g_wasm_profile.usages, q)
+    {
+        if (strcmp(usage->digest, digest) == 0 && usage->instances > 0) {
+            recommend(usage, profile);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+
+    return ret;
+}
+
+/*
+ * The aux stack is zero until first written, so its lowest non-zero byte is
+ * how deep the module has been. It is read with process_vm_readv(), which
+ * fails rather than faults on a linear memory that memory.grow just moved.
+ */
+static void instance_sample_aux_stack(struct instance_entry *entry)
+{
+    uint64_t start = entry->aux_stack_top - entry->aux_stack_size;
+    uint8_t buf[PROFILE_SCAN_CHUNK];
+    size_t len;
+
+    for (uint64_t off = start; off < entry->aux_stack_low; off += len) {
+        struct iovec local = {.iov_base = buf};
+        struct iovec remote;
+
+        len = entry->aux_stack_low - off < sizeof(buf) ? entry->aux_stack_low - off : sizeof(buf);
+        if (!wasm_runtime_validate_app_addr(entry->inst, off, len)) {
+            return;
+        }
+        remote.iov_base = wasm_runtime_addr_app_to_native(entry->inst, off);
+        remote.iov_len = local.iov_len = len;
+        if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) != (ssize_t)len) {
+            return;
+        }
+        for (size_t i = 0; i < len; i++) {
+            if (buf[i] != 0) {
+                entry->aux_stack_low = off + i;
+                return;
+            }
+        }
+    }
+}
+
+static void instance_sample(struct instance_entry *entry)
+{
+    struct usage_entry *usage = entry->usage;
+    size_t v;
+
+    if (entry->aux_stack_size != 0) {
+        instance_sample_aux_stack(entry);
+    }
+
+    /* Looked up again, as memory.grow may have moved the linear memory */
+    if (entry->heap_len != 0 &&
+        wasm_runtime_validate_app_addr(entry->inst, entry->heap_start, entry->heap_len)) {
+        v = resident_bytes(wasm_runtime_addr_app_to_native(entry->inst, entry->heap_start),
+                           entry->heap_len);
+        if (v > entry->heap_hwm) {
+            entry->heap_hwm = v;
+        }
+    }
+
+    wasm_memory_inst_t memory = wasm_runtime_get_default_memory(entry->inst);
+    if (memory != NULL) {
+        v = wasm_memory_get_cur_page_count(memory) * wasm_memory_get_bytes_per_page(memory);
+        if (v > entry->linear_memory_peak) {
+            entry->linear_memory_peak = v;
+        }
+    }
+
+    if (usage == NULL) {
+        return;
+    }
+    if (entry->aux_stack_size != 0) {
+        usage->stack_measured = true;
+        usage->aux_stack_size = entry->aux_stack_size;
+        if (entry->aux_stack_top - entry->aux_stack_low > usage->aux_stack_hwm) {
+            usage->aux_stack_hwm = entry->aux_stack_top - entry->aux_stack_low;
+        }
+    }
+    if (entry->heap_len != 0) {
+        usage->heap_measured = true;
+        if (entry->heap_hwm > usage->heap_hwm) {
+            usage->heap_hwm = entry->heap_hwm;
+        }
+    }
+    if (entry->linear_memory_peak > usage->linear_memory_peak) {
+        usage->linear_memory_peak = entry->linear_memory_peak;
+    }
+}
+
+/*
+ * Locate the host-managed heap without calling into the module, whose start
+ * function has not run yet: WAMR inserts the heap right below the
+ * __heap_base the module exports, and moves that global past it. A module
+ * that exports its own malloc gets no such heap, WAMR disables it.
+ */
+static void instance_find_heap(struct instance_entry *entry, uint32_t heap_size)
+{
+    wasm_global_inst_t heap_base;
+    uint32_t end;
+
+    if (heap_size == 0 || wasm_runtime_lookup_function(entry->inst, "malloc") != NULL ||
+        !wasm_runtime_get_export_global_inst(entry->inst, "__heap_base", &heap_base) ||
+        heap_base.kind != WASM_I32) {
+        return;
+    }
+    end = *(const uint32_t *)heap_base.global_data;
+    if (end < heap_size) {
+        return;
+    }
+    entry->heap_start = end - heap_size;
+    entry->heap_len = heap_size;
+}
+
+/*
+ * The aux stack is known to the runtime from the module, through an
+ * execution environment: the singleton one, which the main function of the
+ * module is run with.
+ */
+static void instance_find_aux_stack(struct instance_entry *entry)
+{
+    wasm_exec_env_t exec_env = wasm_runtime_get_exec_env_singleton(entry->inst);
+    uint64_t top = 0;
+    uint32_t size = 0;
+
+    if (exec_env == NULL || !wasm_exec_env_get_aux_stack(exec_env, &top, &size) || size == 0 ||
+        top < size) {
+        return;
+    }
+    entry->aux_stack_top = top;
+    entry->aux_stack_size = size;
+    entry->aux_stack_low = top;
+}
+
+void evp_agent_wasm_profile_instance_created(wasm_module_inst_t inst, const char *digest,
+                                             uint32_t stack_size, uint32_t heap_size)
+{
+    struct instance_entry *entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for wasm instance entry");
+        return;
+    }
+    entry->inst = inst;
+
+    instance_find_aux_stack(entry);
+    instance_find_heap(entry, heap_size);
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    if (digest[0] != '\0') {
+        entry->usage = usage_get(digest);
+        if (entry->usage != NULL) {
+            entry->usage->stack_size = stack_size;
+            entry->usage->heap_size = heap_size;
+            entry->usage->instances++;
+            entry->usage->live++;
+        }
+    }
+    instance_sample(entry);
+    TAILQ_INSERT_TAIL(&g_wasm_profile.instances, entry, q);
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
+
+void evp_agent_wasm_profile_instance_destroyed(wasm_module_inst_t inst)
+{
+    struct instance_entry *entry;
+    struct evp_agent_wasm_profile profile;
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH(entry, &g_wasm_profile.instances, q)
+    {
+        if (entry->inst == inst) {
+            break;
+        }
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&g_wasm_profile.lock);
+        return;
+    }
+
+    instance_sample(entry);
+    TAILQ_REMOVE(&g_wasm_profile.instances, entry, q);
+
+    if (entry->usage != NULL) {
+        entry->usage->live--;
+        recommend(entry->usage, &profile);
+        EVP_AGENT_INFO("wasm module %.12s: aux stack hwm %" PRIu64 "/%u, heap hwm %zu/%u, "
+                       "linear memory peak %zu; recommended heapSize %u auxStackSize %u",
+                       entry->usage->digest, entry->aux_stack_top - entry->aux_stack_low,
+                       entry->aux_stack_size, entry->heap_hwm, entry->usage->heap_size,
+                       entry->linear_memory_peak, profile.heap_size, profile.aux_stack_size);
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+
+    free(entry);
+}
+
+void evp_agent_wasm_profile_module_unloaded(const char *digest)
+{
+    struct usage_entry *usage;
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH(usage, &g_wasm_profile.usages, q)
+    {
+        if (strcmp(usage->digest, digest) == 0) {
+            break;
+        }
+    }
+    /* The binary may still be loaded for other instances */
+    if (usage != NULL && usage->live == 0) {
+        TAILQ_REMOVE(&g_wasm_profile.usages, usage, q);
+        free(usage);
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
+
+static void wasm_profile_sample(void *user)
+{
+    struct instance_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH(entry, &g_wasm_profile.instances, q)
+    {
+        instance_sample(entry);
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
+
+static void write_recommendations(const char *path)
+{
+    struct usage_entry *usage;
+    struct evp_agent_wasm_profile profile;
+    JSON_Value *value = json_value_init_object();
+    JSON_Object *root = json_value_get_object(value);
+
+    if (root == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for wasm recommendations");
+        json_value_free(value);
+        return;
+    }
+
+    TAILQ_FOREACH(usage, &g_wasm_profile.usages, q)
+    {
+        JSON_Value *obj = json_value_init_object();
+
+        recommend(usage, &profile);
+        json_object_set_number(json_value_get_object(obj), "heapSize", profile.heap_size);
+        json_object_set_number(json_value_get_object(obj), "stackSize", profile.stack_size);
+        if (profile.aux_stack_size != 0) {
+            json_object_set_number(json_value_get_object(obj), "auxStackSize",
+                                   profile.aux_stack_size);
+        }
+        json_object_set_value(root, usage->digest, obj);
+    }
+
+    if (json_serialize_to_file_pretty(value, path) != JSONSuccess) {
+        EVP_AGENT_WARN("failed to write wasm recommendations to %s", path);
+    }
+    json_value_free(value);
+}
+
+static void wasm_profile_report(void *user)
+{
+    struct usage_entry *usage;
+    struct evp_agent_wasm_profile profile;
+    const char *path = getenv("EVP_WASM_PROFILES_RECOMMEND_PATH");
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH(usage, &g_wasm_profile.usages, q)
+    {
+        recommend(usage, &profile);
+        EVP_AGENT_INFO("wasm module %.12s: %u instances, aux stack hwm %zu/%u, heap hwm "
+                       "%zu/%u, linear memory peak %zu; recommended heapSize %u auxStackSize %u",
+                       usage->digest, usage->instances, usage->aux_stack_hwm,
+                       usage->aux_stack_size, usage->heap_hwm, usage->heap_size,
+                       usage->linear_memory_peak, profile.heap_size, profile.aux_stack_size);
+        if (usage->heap_measured && PROFILE_NEAR_LIMIT(usage->heap_hwm, usage->heap_size)) {
+            EVP_AGENT_WARN("wasm module %.12s: heap is close to its %u bytes limit",
+                           usage->digest, usage->heap_size);
+        }
+        if (usage->stack_measured &&
+            PROFILE_NEAR_LIMIT(usage->aux_stack_hwm, usage->aux_stack_size)) {
+            EVP_AGENT_WARN("wasm module %.12s: aux stack is close to the %u bytes it was "
+                           "linked with",
+                           usage->digest, usage->aux_stack_size);
+        }
+    }
+    if (path != NULL) {
+        write_recommendations(path);
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
+
+int evp_agent_wasm_profile_init(void)
+{
+    int ret;
+    const char *path = getenv("EVP_WASM_PROFILES_PATH");
+
+    if (path == NULL) {
+        path = WASM_PROFILES_DEFAULT_PATH;
+    }
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    ret = load_profiles(path);
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+    if (ret) {
+        return ret;
+    }
+
+    return evp_agent_metrics_register("wasm_profile", wasm_profile_sample, wasm_profile_report,
+                                      NULL);
+}
+
+void evp_agent_wasm_profile_deinit(void)
+{
+    struct profile_entry *profile, *ptmp;
+    struct usage_entry *usage, *utmp;
+
+    pthread_mutex_lock(&g_wasm_profile.lock);
+    TAILQ_FOREACH_SAFE(profile, &g_wasm_profile.profiles, q, ptmp)
+    {
+        TAILQ_REMOVE(&g_wasm_profile.profiles, profile, q);
+        free(profile);
+    }
+    /* Usages are still referenced by live instances, which keep them */
+    TAILQ_FOREACH_SAFE(usage, &g_wasm_profile.usages, q, utmp)
+    {
+        if (usage->live == 0) {
+            TAILQ_REMOVE(&g_wasm_profile.usages, usage, q);
+            free(usage);
+        }
+    }
+    pthread_mutex_unlock(&g_wasm_profile.lock);
+}
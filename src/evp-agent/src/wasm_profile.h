@@ -0,0 +1,54 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASM_PROFILE_H__
+#define __EVP_WASM_PROFILE_H__
+
+#include <stdint.h>
+
+#include <wasm_export.h>
+
+/*
+ * Per-module wasm sizing profiles.
+ *
+ * Profiles are keyed by the module hash of the deployment manifest (the
+ * SHA-256 of the module binary) and override the default WAMR stack and
+ * heap sizes (CONFIG_EVP_MODULE_IMPL_WASM_DEFAULT_{STACK,HEAP}SIZE) when the
+ * module is instantiated. They are read from EVP_WASM_PROFILES_PATH, by
+ * default /etc/evp/wasm_profiles.json:
+ *
+ *   { "<sha256>": { "heapSize": 65536, "stackSize": 16384 }, ... }
+ *
+ * The high-water marks of every instance, of the aux stack the module keeps
+ * its frames in and of its host-managed heap, both in its linear memory, are
+ * sampled while it runs and a right-sized heapSize is recommended from them,
+ * along with an auxStackSize to link the module with (-z stack-size). The
+ * stack of WAMR the module runs on is not measured, so the recommended
+ * stackSize stays the one it ran with. The usage of a module is forgotten
+ * once it is unloaded. When EVP_WASM_PROFILES_RECOMMEND_PATH is set, the
+ * recommendations are written there in the same format at every metrics
+ * report.
+ */
+
+struct evp_agent_wasm_profile {
+    uint32_t heap_size;
+    uint32_t stack_size;
+    /* Linked into the module, only recommended */
+    uint32_t aux_stack_size;
+};
+
+int evp_agent_wasm_profile_init(void);
+void evp_agent_wasm_profile_deinit(void);
+
+void evp_agent_wasm_profile_apply(const char *digest, uint32_t *stack_size, uint32_t *heap_size);
+int evp_agent_wasm_profile_recommend(const char *digest, struct evp_agent_wasm_profile *profile);
+
+void evp_agent_wasm_profile_instance_created(wasm_module_inst_t inst, const char *digest,
+                                             uint32_t stack_size, uint32_t heap_size);
+void evp_agent_wasm_profile_instance_destroyed(wasm_module_inst_t inst);
+void evp_agent_wasm_profile_module_unloaded(const char *digest);
+
+#endif /* __EVP_WASM_PROFILE_H__ */
@@ -0,0 +1,418 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for MADV_FREE and MADV_PAGEOUT */
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wasm_export.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasm_reclaim.h"
+
+#define RECLAIM_IDLE_SEC_DEFAULT 30
+#define RECLAIM_AVAIL_PCT_DEFAULT 25
+
+struct reclaim_entry {
+    TAILQ_ENTRY(reclaim_entry) q;
+    wasm_module_inst_t inst;
+    /* CPU clock of the thread running the instance, once it ran */
+    pthread_t thread;
+    clockid_t cpu_clock;
+    bool has_cpu_clock;
+    uint64_t cpu_ns;
+    uint64_t idle_since_ms;
+    /* Already reclaimed since it went idle */
+    bool reclaimed;
+    /* To be scanned, and being scanned without the lock */
+    bool pending;
+    bool scanning;
+};
+
+TAILQ_HEAD(reclaim_entry_head, reclaim_entry);
+
+static struct {
+    struct reclaim_entry_head entries;
+    bool enabled;
+    unsigned int idle_sec;
+    unsigned int avail_pct;
+    size_t page;
+    uint8_t *zero_page;
+    /* Kernels before 4.5 have no MADV_FREE */
+    bool has_free;
+    /* Only used by the scans, which the metrics run one at a time */
+    unsigned char *vec;
+    size_t vec_len;
+    uint64_t scans;
+    uint64_t reclaimed_bytes;
+    unsigned int last_avail_pct;
+    pthread_mutex_t lock;
+    /* Signaled when a scan ends */
+    pthread_cond_t scanned;
+} g_wasm_reclaim = {.entries = TAILQ_HEAD_INITIALIZER(g_wasm_reclaim.entries),
+                    .lock = PTHREAD_MUTEX_INITIALIZER,
+                    .scanned = PTHREAD_COND_INITIALIZER};
+
+/* Instance the calling thread was last found running */
+static __thread wasm_module_inst_t t_running;
+
+/* Available memory in percent of the total, or -1 */
+static int mem_available_pct(void)
+{
+    unsigned long total = 0, avail = 0, v;
+    char line[128];
+    FILE *fp;
+
+    fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL && (total == 0 || avail == 0)) {
+        if (sscanf(line, "MemTotal: %lu kB", &v) == 1) {
+            total = v;
+        }
+        else if (sscanf(line, "MemAvailable: %lu kB", &v) == 1) {
+            avail = v;
+        }
+    }
+    fclose(fp);
+
+    if (total == 0) {
+        return -1;
+    }
+    return (int)(avail * 100 / total);
+}
+
+/* MADV_FREE on a page of our own */
+static bool madv_free_supported(size_t page)
+{
+    void *probe = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool supported;
+
+    if (probe == MAP_FAILED) {
+        return false;
+    }
+    supported = madvise(probe, page, MADV_FREE) == 0;
+    munmap(probe, page);
+
+    return supported;
+}
+
+static bool page_is_zero(const uint8_t *p)
+{
+    return memcmp(p, g_wasm_reclaim.zero_page, g_wasm_reclaim.page) == 0;
+}
+
+/*
+ * Frees a run of zero pages, returns the bytes given. MADV_FREE drops the
+ * dirty bits of the pages, which would lose a write of the instance landing
+ * between the zero check and the call: a page no longer zero once freed is
+ * made dirty again by an atomic add of zero, which keeps what the instance
+ * wrote. The check follows the call by the time to compare the run only.
+ * Paging out keeps the contents of the pages anyway.
+ */
+static size_t free_zero_run(uint8_t *start, size_t n_pages)
+{
+    size_t page = g_wasm_reclaim.page;
+    size_t len = n_pages * page;
+
+    if (!g_wasm_reclaim.has_free) {
+        /* Frame windows mapped in the linear memory are not anonymous */
+        return madvise(start, len, MADV_PAGEOUT) == 0 ? len : 0;
+    }
+
+    if (madvise(start, len, MADV_FREE) != 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < n_pages; i++) {
+        uint8_t *p = start + i * page;
+
+        if (!page_is_zero(p)) {
+            __atomic_fetch_add((uint32_t *)p, 0, __ATOMIC_RELAXED);
+            len -= page;
+        }
+    }
+
+    return len;
+}
+
+/* Called without the lock, returns the bytes given */
+static size_t instance_reclaim(wasm_module_inst_t inst)
+{
+    wasm_memory_inst_t memory = wasm_runtime_get_default_memory(inst);
+    size_t page = g_wasm_reclaim.page;
+    size_t run = 0, freed = 0;
+    uint8_t *base;
+    size_t len, n;
+
+    if (memory == NULL) {
+        return 0;
+    }
+    base = wasm_memory_get_base_address(memory);
+    len = wasm_memory_get_cur_page_count(memory) * wasm_memory_get_bytes_per_page(memory);
+    n = len / page;
+    if (base == NULL || n == 0) {
+        return 0;
+    }
+
+    if (n > g_wasm_reclaim.vec_len) {
+        unsigned char *vec = realloc(g_wasm_reclaim.vec, n);
+
+        if (vec == NULL) {
+            EVP_AGENT_ERR("failed to allocate memory for the residency vector");
+            return 0;
+        }
+        g_wasm_reclaim.vec = vec;
+        g_wasm_reclaim.vec_len = n;
+    }
+    if (mincore(base, n * page, g_wasm_reclaim.vec) != 0) {
+        EVP_AGENT_WARN("mincore failed: %s", strerror(errno));
+        return 0;
+    }
+
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && (g_wasm_reclaim.vec[i] & 1) && page_is_zero(base + i * page)) {
+            run++;
+            continue;
+        }
+        if (run > 0) {
+            freed += free_zero_run(base + (i - run) * page, run);
+            run = 0;
+        }
+    }
+
+    if (freed > 0) {
+        EVP_AGENT_INFO("wasm instance %p idle: reclaimed %zu kB of linear memory", (void *)inst,
+                       freed / 1024);
+    }
+    return freed;
+}
+
+/* The CPU time of a thread that exited no longer moves */
+static uint64_t instance_cpu_ns(struct reclaim_entry *entry)
+{
+    struct timespec ts;
+
+    if (clock_gettime(entry->cpu_clock, &ts) != 0) {
+        return entry->cpu_ns;
+    }
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void wasm_reclaim_sample(void *user)
+{
+    uint64_t now = evp_agent_now_us() / 1000;
+    int pct = mem_available_pct();
+    struct reclaim_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    if (pct >= 0) {
+        g_wasm_reclaim.last_avail_pct = pct;
+    }
+
+    TAILQ_FOREACH(entry, &g_wasm_reclaim.entries, q)
+    {
+        if (!entry->has_cpu_clock) {
+            /* Not running yet */
+            continue;
+        }
+
+        uint64_t cpu_ns = instance_cpu_ns(entry);
+
+        if (cpu_ns != entry->cpu_ns) {
+            entry->cpu_ns = cpu_ns;
+            entry->idle_since_ms = now;
+            entry->reclaimed = false;
+            continue;
+        }
+        if (entry->reclaimed || pct < 0 || (unsigned int)pct >= g_wasm_reclaim.avail_pct) {
+            continue;
+        }
+        /* Under heavy pressure, do not wait for the idle time */
+        if ((unsigned int)pct >= g_wasm_reclaim.avail_pct / 2 &&
+            now - entry->idle_since_ms < (uint64_t)g_wasm_reclaim.idle_sec * 1000) {
+            continue;
+        }
+
+        entry->pending = true;
+    }
+
+    /*
+     * A scan reads the whole linear memory: the lock is dropped meanwhile,
+     * and an instance going away waits for the scan of its memory to end
+     */
+    for (;;) {
+        size_t freed;
+
+        TAILQ_FOREACH(entry, &g_wasm_reclaim.entries, q)
+        {
+            if (entry->pending) {
+                break;
+            }
+        }
+        if (entry == NULL) {
+            break;
+        }
+        entry->pending = false;
+        entry->reclaimed = true;
+        entry->scanning = true;
+        pthread_mutex_unlock(&g_wasm_reclaim.lock);
+
+        freed = instance_reclaim(entry->inst);
+
+        pthread_mutex_lock(&g_wasm_reclaim.lock);
+        entry->scanning = false;
+        g_wasm_reclaim.scans++;
+        g_wasm_reclaim.reclaimed_bytes += freed;
+        pthread_cond_broadcast(&g_wasm_reclaim.scanned);
+    }
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+}
+
+static void wasm_reclaim_report(void *user)
+{
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    if (g_wasm_reclaim.scans != 0) {
+        EVP_AGENT_INFO("wasm reclaim: available=%u%% scans=%" PRIu64 " reclaimed_kb=%" PRIu64,
+                       g_wasm_reclaim.last_avail_pct, g_wasm_reclaim.scans,
+                       g_wasm_reclaim.reclaimed_bytes / 1024);
+    }
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+}
+
+void evp_agent_wasm_reclaim_instance_created(wasm_module_inst_t inst)
+{
+    struct reclaim_entry *entry;
+
+    if (!g_wasm_reclaim.enabled) {
+        return;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for reclaim_entry");
+        return;
+    }
+    entry->inst = inst;
+
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    TAILQ_INSERT_TAIL(&g_wasm_reclaim.entries, entry, q);
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+}
+
+void evp_agent_wasm_reclaim_instance_running(wasm_module_inst_t inst)
+{
+    struct reclaim_entry *entry;
+
+    if (!g_wasm_reclaim.enabled || t_running == inst) {
+        return;
+    }
+    t_running = inst;
+
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    TAILQ_FOREACH(entry, &g_wasm_reclaim.entries, q)
+    {
+        if (entry->inst != inst) {
+            continue;
+        }
+        if (entry->has_cpu_clock && pthread_equal(entry->thread, pthread_self())) {
+            break;
+        }
+        entry->thread = pthread_self();
+        entry->has_cpu_clock = pthread_getcpuclockid(entry->thread, &entry->cpu_clock) == 0;
+        if (entry->has_cpu_clock) {
+            entry->cpu_ns = instance_cpu_ns(entry);
+        }
+        entry->idle_since_ms = evp_agent_now_us() / 1000;
+        entry->reclaimed = false;
+        break;
+    }
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+}
+
+void evp_agent_wasm_reclaim_instance_destroyed(wasm_module_inst_t inst)
+{
+    struct reclaim_entry *entry;
+
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    TAILQ_FOREACH(entry, &g_wasm_reclaim.entries, q)
+    {
+        if (entry->inst == inst) {
+            TAILQ_REMOVE(&g_wasm_reclaim.entries, entry, q);
+            break;
+        }
+    }
+    while (entry != NULL && entry->scanning) {
+        pthread_cond_wait(&g_wasm_reclaim.scanned, &g_wasm_reclaim.lock);
+    }
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+
+    free(entry);
+}
+
+int evp_agent_wasm_reclaim_init(void)
+{
+    const char *idle = getenv("EVP_WASM_RECLAIM_IDLE_SEC");
+    const char *avail = getenv("EVP_WASM_RECLAIM_AVAIL_PCT");
+
+    g_wasm_reclaim.idle_sec = RECLAIM_IDLE_SEC_DEFAULT;
+    if (idle != NULL) {
+        g_wasm_reclaim.idle_sec = strtoul(idle, NULL, 10);
+    }
+    g_wasm_reclaim.avail_pct = RECLAIM_AVAIL_PCT_DEFAULT;
+    if (avail != NULL) {
+        g_wasm_reclaim.avail_pct = strtoul(avail, NULL, 10);
+    }
+    if (g_wasm_reclaim.avail_pct == 0) {
+        return 0;
+    }
+
+    g_wasm_reclaim.page = (size_t)sysconf(_SC_PAGESIZE);
+    g_wasm_reclaim.has_free = madv_free_supported(g_wasm_reclaim.page);
+    if (!g_wasm_reclaim.has_free) {
+        EVP_AGENT_INFO("no MADV_FREE: idle linear memory is paged out, only with swap");
+    }
+    g_wasm_reclaim.zero_page = calloc(1, g_wasm_reclaim.page);
+    if (g_wasm_reclaim.zero_page == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for the zero page");
+        return -ENOMEM;
+    }
+
+    g_wasm_reclaim.enabled = true;
+    return evp_agent_metrics_register("wasm_reclaim", wasm_reclaim_sample, wasm_reclaim_report,
+                                      NULL);
+}
+
+void evp_agent_wasm_reclaim_deinit(void)
+{
+    struct reclaim_entry *entry, *tmp;
+
+    pthread_mutex_lock(&g_wasm_reclaim.lock);
+    g_wasm_reclaim.enabled = false;
+    TAILQ_FOREACH_SAFE(entry, &g_wasm_reclaim.entries, q, tmp)
+    {
+        TAILQ_REMOVE(&g_wasm_reclaim.entries, entry, q);
+        free(entry);
+    }
+    free(g_wasm_reclaim.vec);
+    g_wasm_reclaim.vec = NULL;
+    g_wasm_reclaim.vec_len = 0;
+    free(g_wasm_reclaim.zero_page);
+    g_wasm_reclaim.zero_page = NULL;
+    pthread_mutex_unlock(&g_wasm_reclaim.lock);
+}
@@ -0,0 +1,39 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASM_RECLAIM_H__
+#define __EVP_WASM_RECLAIM_H__
+
+#include <wasm_export.h>
+
+/*
+ * Reclamation of idle linear memory.
+ *
+ * Linear memory never shrinks, so an instance that grew it for a burst keeps
+ * the pages resident while it waits for its next trigger. When available
+ * memory drops below EVP_WASM_RECLAIM_AVAIL_PCT percent of the total (25 by
+ * default), the zero-filled pages of the linear memory of instances idle for
+ * EVP_WASM_RECLAIM_IDLE_SEC seconds (30 by default) are freed with MADV_FREE,
+ * with or without swap, and read back as zero pages. Below half that
+ * threshold, any idle instance is reclaimed. An instance is idle while the
+ * thread running its code, the last one to call into it, uses no CPU time.
+ *
+ * The pages freed are checked again once freed, and a page the instance
+ * wrote to meanwhile is made dirty again, so that the kernel keeps it. On
+ * kernels without MADV_FREE, the pages are paged out with MADV_PAGEOUT,
+ * which keeps their contents. The linear memory is scanned without holding
+ * the lock the instances take as they run.
+ */
+
+int evp_agent_wasm_reclaim_init(void);
+void evp_agent_wasm_reclaim_deinit(void);
+
+void evp_agent_wasm_reclaim_instance_created(wasm_module_inst_t inst);
+/* The calling thread runs the code of the instance */
+void evp_agent_wasm_reclaim_instance_running(wasm_module_inst_t inst);
+void evp_agent_wasm_reclaim_instance_destroyed(wasm_module_inst_t inst);
+
+#endif /* __EVP_WASM_RECLAIM_H__ */
@@ -0,0 +1,264 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mbedtls/sha256.h>
+#include <wasm_export.h>
+
+#include "deployment_fetch.h"
+#include "frame_share.h"
+#include "log.h"
+#include "metrics.h"
+#include "wasi_nn_bind.h"
+#include "wasi_threads_pool.h"
+#include "wasm_module_map.h"
+#include "wasm_pool.h"
+#include "wasm_profile.h"
+#include "wasm_reclaim.h"
+#include "wasm_runtime_wrap.h"
+
+wasm_module_t __real_wasm_runtime_load(uint8_t *buf, uint32_t size, char *error_buf,
+                                       uint32_t error_buf_size);
+void __real_wasm_runtime_unload(wasm_module_t module);
+wasm_module_inst_t __real_wasm_runtime_instantiate(const wasm_module_t module,
+                                                   uint32_t default_stack_size,
+                                                   uint32_t host_managed_heap_size,
+                                                   char *error_buf, uint32_t error_buf_size);
+void __real_wasm_runtime_deinstantiate(wasm_module_inst_t module_inst);
+bool __real_wasm_application_execute_main(wasm_module_inst_t module_inst, int32_t argc,
+                                          char *argv[]);
+bool __real_wasm_runtime_call_wasm(wasm_exec_env_t exec_env, wasm_function_inst_t function,
+                                   uint32_t argc, uint32_t argv[]);
+bool __real_wasm_runtime_register_natives(const char *module_name, NativeSymbol *native_symbols,
+                                          uint32_t n_native_symbols);
+
+struct wasm_module_entry {
+    TAILQ_ENTRY(wasm_module_entry) q;
+    wasm_module_t module;
+    char digest[EVP_WASM_DIGEST_LEN];
+    struct evp_agent_wasm_module_map map;
+};
+
+TAILQ_HEAD(wasm_module_entry_head, wasm_module_entry);
+
+static struct {
+    struct wasm_module_entry_head queue;
+    pthread_mutex_t lock;
+} g_wasm_modules = {.queue = TAILQ_HEAD_INITIALIZER(g_wasm_modules.queue),
+                    .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void module_digest(const uint8_t *buf, uint32_t size, char *digest)
+{
+    unsigned char hash[32];
+
+    if (mbedtls_sha256(buf, size, hash, 0) != 0) {
+        digest[0] = '\0';
+        return;
+    }
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        snprintf(&digest[i * 2], 3, "%02x", hash[i]);
+    }
+}
+
+static struct wasm_module_entry *module_lookup(wasm_module_t module)
+{
+    struct wasm_module_entry *entry;
+
+    TAILQ_FOREACH(entry, &g_wasm_modules.queue, q)
+    {
+        if (entry->module == module) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+int evp_agent_wasm_module_digest(wasm_module_t module, char *digest, size_t len)
+{
+    int ret = -ENOENT;
+
+    pthread_mutex_lock(&g_wasm_modules.lock);
+    struct wasm_module_entry *entry = module_lookup(module);
+    if (entry != NULL && entry->digest[0] != '\0') {
+        snprintf(digest, len, "%s", entry->digest);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_wasm_modules.lock);
+
+    return ret;
+}
+
+wasm_module_t __wrap_wasm_runtime_load(uint8_t *buf, uint32_t size, char *error_buf,
+                                       uint32_t error_buf_size)
+{
+    struct wasm_module_entry *entry = calloc(1, sizeof(*entry));
+    uint8_t *image = buf;
+    bool runs_code;
+
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for wasm_module_entry");
+        snprintf(error_buf, error_buf_size, "out of memory");
+        return NULL;
+    }
+
+    /* Digest the pristine image: the loader may patch the bytecode */
+    module_digest(buf, size, entry->digest);
+    runs_code = evp_agent_wasm_pool_runs_code(buf, size);
+    evp_agent_deployment_fetch_loading(entry->digest);
+
+    if (evp_agent_wasm_module_map(entry->digest, buf, size, &entry->map) == 0) {
+        image = entry->map.addr;
+    }
+
+    entry->module = __real_wasm_runtime_load(image, size, error_buf, error_buf_size);
+    if (entry->module == NULL) {
+        evp_agent_wasm_module_unmap(&entry->map);
+        free(entry);
+        return NULL;
+    }
+    evp_agent_wasm_pool_module_loaded(entry->module, runs_code);
+
+    pthread_mutex_lock(&g_wasm_modules.lock);
+    TAILQ_INSERT_TAIL(&g_wasm_modules.queue, entry, q);
+    pthread_mutex_unlock(&g_wasm_modules.lock);
+
+    return entry->module;
+}
+
+void __wrap_wasm_runtime_unload(wasm_module_t module)
+{
+    pthread_mutex_lock(&g_wasm_modules.lock);
+    struct wasm_module_entry *entry = module_lookup(module);
+    if (entry != NULL) {
+        TAILQ_REMOVE(&g_wasm_modules.queue, entry, q);
+    }
+    pthread_mutex_unlock(&g_wasm_modules.lock);
+
+    evp_agent_wasm_pool_module_unloading(module);
+    __real_wasm_runtime_unload(module);
+    if (entry != NULL) {
+        evp_agent_wasm_profile_module_unloaded(entry->digest);
+        evp_agent_wasm_module_unmap(&entry->map);
+        free(entry);
+    }
+}
+
+wasm_module_inst_t __wrap_wasm_runtime_instantiate(const wasm_module_t module,
+                                                   uint32_t default_stack_size,
+                                                   uint32_t host_managed_heap_size,
+                                                   char *error_buf, uint32_t error_buf_size)
+{
+    char digest[EVP_WASM_DIGEST_LEN];
+    wasm_module_inst_t inst;
+
+    if (evp_agent_wasm_module_digest(module, digest, sizeof(digest)) != 0) {
+        digest[0] = '\0';
+    }
+
+    evp_agent_wasm_profile_apply(digest, &default_stack_size, &host_managed_heap_size);
+
+    inst = evp_agent_wasm_pool_take(module, default_stack_size, host_managed_heap_size);
+    if (inst == NULL) {
+        uint64_t t0 = evp_agent_now_us();
+
+        inst = __real_wasm_runtime_instantiate(module, default_stack_size, host_managed_heap_size,
+                                               error_buf, error_buf_size);
+        if (inst == NULL) {
+            evp_agent_deployment_fetch_instantiated(digest, false);
+            return NULL;
+        }
+        evp_agent_wasm_pool_instantiated(module, default_stack_size, host_managed_heap_size,
+                                         evp_agent_now_us() - t0);
+    }
+
+    evp_agent_wasm_profile_instance_created(inst, digest, default_stack_size,
+                                            host_managed_heap_size);
+    evp_agent_wasm_reclaim_instance_created(inst);
+    evp_agent_wasi_nn_bind_instance_created(inst);
+    evp_agent_wasi_threads_pool_instance_created(inst);
+    evp_agent_deployment_fetch_instantiated(digest, true);
+    return inst;
+}
+
+void __wrap_wasm_runtime_deinstantiate(wasm_module_inst_t module_inst)
+{
+    evp_agent_frame_share_instance_destroyed(module_inst);
+    evp_agent_wasi_nn_bind_instance_destroyed(module_inst);
+    evp_agent_wasm_profile_instance_destroyed(module_inst);
+    evp_agent_wasm_reclaim_instance_destroyed(module_inst);
+    evp_agent_wasi_threads_pool_instance_destroyed(module_inst);
+    __real_wasm_runtime_deinstantiate(module_inst);
+}
+
+/* The threads running the code of the instances, see wasm_reclaim.h and wasi_threads_pool.h */
+bool __wrap_wasm_application_execute_main(wasm_module_inst_t module_inst, int32_t argc,
+                                          char *argv[])
+{
+    evp_agent_wasm_reclaim_instance_running(module_inst);
+    evp_agent_wasi_threads_pool_instance_running(module_inst);
+    return __real_wasm_application_execute_main(module_inst, argc, argv);
+}
+
+bool __wrap_wasm_runtime_call_wasm(wasm_exec_env_t exec_env, wasm_function_inst_t function,
+                                   uint32_t argc, uint32_t argv[])
+{
+    wasm_module_inst_t inst = wasm_runtime_get_module_inst(exec_env);
+
+    evp_agent_wasm_reclaim_instance_running(inst);
+    evp_agent_wasi_threads_pool_instance_running(inst);
+    return __real_wasm_runtime_call_wasm(exec_env, function, argc, argv);
+}
+
+/* Spares of the instance pool get the same arguments, see wasm_pool.h */
+void __wrap_wasm_runtime_set_wasi_args_ex(wasm_module_t module, const char *dir_list[],
+                                          uint32_t dir_count, const char *map_dir_list[],
+                                          uint32_t map_dir_count, const char *env[],
+                                          uint32_t env_count, char *argv[], int argc,
+                                          int64_t stdinfd, int64_t stdoutfd, int64_t stderrfd)
+{
+    struct evp_wasm_wasi_args args = {
+        .dir_list = dir_list,
+        .dir_count = dir_count,
+        .map_dir_list = map_dir_list,
+        .map_dir_count = map_dir_count,
+        .env = env,
+        .env_count = env_count,
+        .argv = argv,
+        .argc = argc,
+        .stdinfd = stdinfd,
+        .stdoutfd = stdoutfd,
+        .stderrfd = stderrfd,
+    };
+
+    evp_agent_wasm_pool_set_wasi_args(module, &args);
+}
+
+void __wrap_wasm_runtime_set_wasi_args(wasm_module_t module, const char *dir_list[],
+                                       uint32_t dir_count, const char *map_dir_list[],
+                                       uint32_t map_dir_count, const char *env[],
+                                       uint32_t env_count, char *argv[], int argc)
+{
+    __wrap_wasm_runtime_set_wasi_args_ex(module, dir_list, dir_count, map_dir_list,
+                                         map_dir_count, env, env_count, argv, argc, -1, -1, -1);
+}
+
+/* Native libraries are registered by the agent, see frame_share.h */
+bool __wrap_wasm_runtime_register_natives(const char *module_name, NativeSymbol *native_symbols,
+                                          uint32_t n_native_symbols)
+{
+    return __real_wasm_runtime_register_natives(
+        module_name, evp_agent_frame_share_senscord_natives(native_symbols, n_native_symbols),
+        n_native_symbols);
+}
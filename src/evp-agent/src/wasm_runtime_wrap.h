@@ -0,0 +1,26 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __EVP_WASM_RUNTIME_WRAP_H__
+#define __EVP_WASM_RUNTIME_WRAP_H__
+
+#include <stddef.h>
+
+#include <wasm_export.h>
+
+/*
+ * The module and instance lifecycle of the EVP Agent library goes through
+ * the public WAMR API. The agent is linked with --wrap for those entry points
+ * (see evp_agent_link_args) so that the runtime policies implemented here
+ * apply to every module it loads.
+ */
+
+/* SHA-256 of the module binary as a hex string, as in the deployment manifest */
+#define EVP_WASM_DIGEST_LEN 65
+
+int evp_agent_wasm_module_digest(wasm_module_t module, char *digest, size_t len);
+
+#endif /* __EVP_WASM_RUNTIME_WRAP_H__ */
@@ -0,0 +1,190 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <webclient/webclient.h>
+
+#include "blob_download.h"
+#include "blob_upload.h"
+#include "compress.h"
+#include "deployment_fetch.h"
+#include "http_pool.h"
+#include "http_upload.h"
+#include "log.h"
+
+/*
+ * Every HTTP request of the EVP Agent library goes through webclient_perform(),
+ * which the agent is linked to wrap (see evp_agent_link_args). Each request
+ * goes to the first policy that takes it:
+ *
+ * - an upload to compress (see compress.h), read in whole and sent as one
+ *   request with a Content-Encoding header if it shrinks, or else as below,
+ * - a block blob upload to split (see blob_upload.h),
+ * - a module download of a deployment fetched ahead (see deployment_fetch.h),
+ * - a download to resume (see blob_download.h),
+ * - a plain HTTP upload (see http_upload.h),
+ * - anything else, on a pooled connection (see http_pool.h).
+ */
+
+#define WEBCLIENT_HEADERS_MAX 32
+#define CONTENT_ENCODING_HEADER "Content-Encoding:"
+#define CONTENT_ENCODING_SIZE 32
+
+struct memory_body {
+    const uint8_t *data;
+    size_t size;
+    size_t off;
+};
+
+static int memory_body(void *buffer, size_t *sizep, const void **datap, size_t reqsize, void *arg)
+{
+    struct memory_body *body = arg;
+    size_t n = body->size - body->off;
+
+    if (n > reqsize) {
+        n = reqsize;
+    }
+    *datap = body->data + body->off;
+    *sizep = n;
+    body->off += n;
+    return 0;
+}
+
+static bool request_is_encoded(const struct webclient_context *ctx)
+{
+    if (ctx->method == NULL ||
+        (strcmp(ctx->method, "PUT") != 0 && strcmp(ctx->method, "POST") != 0) ||
+        ctx->body_callback == NULL || ctx->nheaders >= WEBCLIENT_HEADERS_MAX ||
+        !evp_agent_compress_wants(EVP_AGENT_COMPRESS_BLOB, ctx->bodylen)) {
+        return false;
+    }
+    for (unsigned int i = 0; i < ctx->nheaders; i++) {
+        if (strncasecmp(ctx->headers[i], CONTENT_ENCODING_HEADER,
+                        strlen(CONTENT_ENCODING_HEADER)) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Blocks only for a body sent as is: Put Block List would not keep its encoding */
+static int request_perform(struct webclient_context *ctx, bool blocks)
+{
+    int ret;
+
+    if (blocks && evp_agent_blob_upload_is(ctx)) {
+        return evp_agent_blob_upload(ctx);
+    }
+    if (evp_agent_deployment_fetch_is(ctx)) {
+        ret = evp_agent_deployment_fetch_serve(ctx);
+        if (ret != -ENOENT) {
+            return ret;
+        }
+    }
+    if (evp_agent_blob_download_is(ctx)) {
+        return evp_agent_blob_download(ctx);
+    }
+    if (evp_agent_http_upload_is(ctx)) {
+        return evp_agent_http_upload(ctx);
+    }
+
+    return evp_agent_http_pool_perform(ctx);
+}
+
+static int request_read_all(struct webclient_context *ctx, uint8_t *data)
+{
+    size_t off = 0;
+    int ret;
+
+    while (off < ctx->bodylen) {
+        const void *piece = data + off;
+        size_t size = ctx->bodylen - off;
+
+        ret = ctx->body_callback(data + off, &size, &piece, ctx->bodylen - off,
+                                 ctx->body_callback_arg);
+        if (ret) {
+            return ret;
+        }
+        if (size == 0 || size > ctx->bodylen - off) {
+            return -EIO;
+        }
+        if (piece != data + off) {
+            memcpy(data + off, piece, size);
+        }
+        off += size;
+    }
+    return 0;
+}
+
+/* The body is read in whole to be compressed, and sent from memory either way */
+static int request_encoded(struct webclient_context *ctx)
+{
+    const char *headers[WEBCLIENT_HEADERS_MAX];
+    char header[CONTENT_ENCODING_SIZE];
+    struct webclient_context c = *ctx;
+    struct memory_body body = {0};
+    const char *encoding;
+    void *compressed = NULL;
+    uint8_t *data;
+    size_t size;
+    int ret;
+
+    data = malloc(ctx->bodylen);
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+    ret = request_read_all(ctx, data);
+    if (ret) {
+        EVP_AGENT_ERR("failed to read the blob to compress: %d", ret);
+        goto out;
+    }
+
+    c.body_callback = memory_body;
+    c.body_callback_arg = &body;
+    if (evp_agent_compress(EVP_AGENT_COMPRESS_BLOB, data, ctx->bodylen, &compressed, &size,
+                           &encoding)) {
+        for (unsigned int i = 0; i < ctx->nheaders; i++) {
+            headers[i] = ctx->headers[i];
+        }
+        snprintf(header, sizeof(header), CONTENT_ENCODING_HEADER " %s", encoding);
+        headers[c.nheaders++] = header;
+        c.headers = headers;
+        c.bodylen = size;
+        body.data = compressed;
+        body.size = size;
+        ret = request_perform(&c, false);
+    }
+    else {
+        body.data = data;
+        body.size = ctx->bodylen;
+        ret = request_perform(&c, true);
+    }
+    ctx->http_status = c.http_status;
+
+out:
+    free(compressed);
+    free(data);
+    return ret;
+}
+
+int __wrap_webclient_perform(struct webclient_context *ctx)
+{
+    /* The stats of a block upload are those of the request that did it */
+    evp_agent_blob_upload_take_stats(NULL);
+
+    if (request_is_encoded(ctx)) {
+        return request_encoded(ctx);
+    }
+
+    return request_perform(ctx, true);
+}
@@ -0,0 +1,304 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Tests of the download resume of blob_download.h, against a fake of the
+ * pooled connections of http_pool.h serving one blob: a broken transfer
+ * resumed in memory with a Range request, a server that ignores the range,
+ * a blob that changes between the attempts, a partial file resumed by a
+ * later download of the same blob, and the partial files given up on
+ * removed at start.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <webclient/webclient.h>
+
+#include "blob_download.h"
+#include "http_pool.h"
+#include "test_util.h"
+
+#define TEST_URL "https://blob.example/modules/detector.wasm?sig=1"
+/* The same blob, presigned anew */
+#define TEST_URL_RESIGNED "https://blob.example/modules/detector.wasm?sig=2"
+#define TEST_BLOB_SIZE (300 * 1024)
+#define TEST_PIECE 1000
+#define TEST_REQUESTS_MAX 8
+
+static struct {
+    uint8_t blob[TEST_BLOB_SIZE];
+    const char *etag;
+    /* The ETag once a response broke, NULL to keep it */
+    const char *next_etag;
+    /* Bytes each response sends before breaking, 0 for none */
+    size_t break_after;
+    /* Only the next response breaks */
+    bool break_once;
+    bool ignore_range;
+    unsigned int requests;
+    size_t from[TEST_REQUESTS_MAX];
+    bool if_range[TEST_REQUESTS_MAX];
+} g_server;
+
+/* What the agent got */
+static struct {
+    uint8_t data[TEST_BLOB_SIZE];
+    size_t len;
+    size_t content_length;
+} g_agent;
+
+static int agent_header(const char *line, bool truncated, void *arg)
+{
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+        g_agent.content_length = strtoull(line + 15, NULL, 10);
+    }
+    return 0;
+}
+
+static int agent_sink(char **buffer, int offset, int datend, int *buflen, void *arg)
+{
+    size_t len = datend - offset;
+
+    CHECK(g_agent.len + len <= sizeof(g_agent.data));
+    memcpy(g_agent.data + g_agent.len, *buffer + offset, len);
+    g_agent.len += len;
+    return 0;
+}
+
+static int header(struct webclient_context *ctx, const char *line)
+{
+    return ctx->header_callback(line, false, ctx->header_callback_arg);
+}
+
+int evp_agent_http_pool_perform(struct webclient_context *ctx)
+{
+    unsigned int n = g_server.requests++;
+    char line[128], buf[TEST_PIECE];
+    char *bufp = buf;
+    size_t from = 0, sent = 0;
+    bool changed = false;
+    int buflen, ret;
+
+    CHECK(n < TEST_REQUESTS_MAX);
+    CHECK(strncmp(ctx->url, TEST_URL, strcspn(TEST_URL, "?")) == 0);
+    for (unsigned int i = 0; i < ctx->nheaders; i++) {
+        if (strncmp(ctx->headers[i], "Range: bytes=", 13) == 0) {
+            g_server.from[n] = strtoull(ctx->headers[i] + 13, NULL, 10);
+        }
+        else if (strncmp(ctx->headers[i], "If-Range: ", 10) == 0) {
+            g_server.if_range[n] = true;
+            /* Another blob now: all of it */
+            changed = strcmp(ctx->headers[i] + 10, g_server.etag) != 0;
+        }
+    }
+    if (!changed && !g_server.ignore_range) {
+        from = g_server.from[n];
+    }
+
+    ctx->http_status = from > 0 ? 206 : 200;
+    snprintf(line, sizeof(line), "ETag: %s", g_server.etag);
+    ret = header(ctx, line);
+    if (ret == 0) {
+        snprintf(line, sizeof(line), "Content-Length: %zu", (size_t)TEST_BLOB_SIZE - from);
+        ret = header(ctx, line);
+    }
+    if (ret == 0 && from > 0) {
+        snprintf(line, sizeof(line), "Content-Range: bytes %zu-%zu/%zu", from,
+                 (size_t)TEST_BLOB_SIZE - 1, (size_t)TEST_BLOB_SIZE);
+        ret = header(ctx, line);
+    }
+
+    for (size_t off = from; ret == 0 && off < TEST_BLOB_SIZE; off += TEST_PIECE) {
+        size_t len = TEST_BLOB_SIZE - off < TEST_PIECE ? TEST_BLOB_SIZE - off : TEST_PIECE;
+
+        if (g_server.break_after != 0 && sent + len > g_server.break_after) {
+            if (g_server.next_etag != NULL) {
+                g_server.etag = g_server.next_etag;
+                g_server.next_etag = NULL;
+            }
+            if (g_server.break_once) {
+                g_server.break_after = 0;
+            }
+            return -ECONNRESET;
+        }
+        memcpy(buf, g_server.blob + off, len);
+        buflen = sizeof(buf);
+        ret = ctx->sink_callback(&bufp, 0, len, &buflen, ctx->sink_callback_arg);
+        sent += len;
+    }
+    return ret;
+}
+
+static int download_url(const char *url)
+{
+    struct webclient_context ctx = {
+        .method = "GET",
+        .url = url,
+        .sink_callback = agent_sink,
+        .header_callback = agent_header,
+    };
+    int ret;
+
+    memset(&g_agent, 0, sizeof(g_agent));
+    memset(g_server.from, 0, sizeof(g_server.from));
+    memset(g_server.if_range, 0, sizeof(g_server.if_range));
+    g_server.requests = 0;
+    CHECK(evp_agent_blob_download_is(&ctx));
+    ret = evp_agent_blob_download(&ctx);
+    if (ret == 0) {
+        CHECK(ctx.http_status == 200);
+    }
+    return ret;
+}
+
+static int download(void)
+{
+    return download_url(TEST_URL);
+}
+
+static bool agent_got_blob(void)
+{
+    return g_agent.len == TEST_BLOB_SIZE &&
+           memcmp(g_agent.data, g_server.blob, TEST_BLOB_SIZE) == 0;
+}
+
+static void test_resume(void)
+{
+    g_server.etag = "\"v1\"";
+    g_server.break_after = 110 * TEST_PIECE;
+    CHECK(download() == 0);
+    CHECK(agent_got_blob());
+    CHECK(g_agent.content_length == TEST_BLOB_SIZE);
+    CHECK(g_server.requests == 3);
+    CHECK(g_server.from[0] == 0 && !g_server.if_range[0]);
+    CHECK(g_server.from[1] == 110 * TEST_PIECE && g_server.if_range[1]);
+    CHECK(g_server.from[2] == 220 * TEST_PIECE && g_server.if_range[2]);
+}
+
+static void test_range_ignored(void)
+{
+    g_server.etag = "\"v1\"";
+    g_server.break_after = 250 * TEST_PIECE;
+    g_server.break_once = true;
+    g_server.ignore_range = true;
+    CHECK(download() == 0);
+    /* The bytes the agent has are skipped */
+    CHECK(agent_got_blob());
+    CHECK(g_server.requests == 2);
+    g_server.break_once = false;
+    g_server.ignore_range = false;
+}
+
+static void test_changed(const char *dir)
+{
+    g_server.etag = "\"v1\"";
+    g_server.next_etag = "\"v2\"";
+    g_server.break_after = 100 * TEST_PIECE;
+    CHECK(download() == -ESTALE);
+    /* Not two blobs spliced together */
+    CHECK(g_agent.len == 100 * TEST_PIECE);
+    CHECK(g_server.requests == 2);
+    CHECK(g_server.from[1] == 100 * TEST_PIECE && g_server.if_range[1]);
+    CHECK(test_count_files(dir, ".part") == 0);
+    CHECK(test_count_files(dir, ".meta") == 0);
+}
+
+static void test_persisted(const char *dir)
+{
+    g_server.etag = "\"v2\"";
+    /* Every attempt breaks: the partial file stays */
+    g_server.break_after = 50 * TEST_PIECE;
+    CHECK(download() == -ECONNRESET);
+    CHECK(g_agent.len == 150 * TEST_PIECE);
+    CHECK(test_count_files(dir, ".part") == 1);
+
+    /* A later download of the blob starts from there, whatever its query */
+    g_server.break_after = 0;
+    CHECK(download_url(TEST_URL_RESIGNED) == 0);
+    CHECK(agent_got_blob());
+    CHECK(g_server.requests == 1);
+    CHECK(g_server.from[0] == 150 * TEST_PIECE && g_server.if_range[0]);
+    CHECK(test_count_files(dir, ".part") == 0);
+    CHECK(test_count_files(dir, ".meta") == 0);
+}
+
+/* A partial file and its metadata file, last written age seconds ago */
+static void make_partial(const char *dir, const char *key, size_t size, time_t age)
+{
+    struct timespec times[2] = {{.tv_sec = time(NULL) - age}, {.tv_sec = time(NULL) - age}};
+    static const char *const suffixes[] = {".part", ".meta"};
+    char path[PATH_MAX];
+    FILE *fp;
+
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s%s", dir, key, suffixes[i]);
+        fp = fopen(path, "w");
+        CHECK(fp != NULL);
+        for (size_t n = 0; i == 0 && n < size; n++) {
+            fputc('x', fp);
+        }
+        CHECK(fclose(fp) == 0);
+        CHECK(utimensat(AT_FDCWD, path, times, 0) == 0);
+    }
+}
+
+static void test_cleaned(const char *dir)
+{
+    char path[PATH_MAX];
+
+    /* The old one, then the oldest of those over the size cap */
+    CHECK(test_count_files(dir, ".part") == 1);
+    CHECK(test_count_files(dir, ".meta") == 1);
+    snprintf(path, sizeof(path), "%s/recent.part", dir);
+    CHECK(unlink(path) == 0);
+    snprintf(path, sizeof(path), "%s/recent.meta", dir);
+    CHECK(unlink(path) == 0);
+}
+
+int main(void)
+{
+    char *dir = test_mkdtemp();
+    char lone[PATH_MAX];
+
+    for (size_t i = 0; i < TEST_BLOB_SIZE; i++) {
+        g_server.blob[i] = i * 2654435761u >> 24;
+    }
+    setenv("EVP_BLOB_DOWNLOAD_DIR", dir, 1);
+    setenv("EVP_BLOB_DOWNLOAD_RETRIES", "2", 1);
+    setenv("EVP_BLOB_RESUME_MIN_BYTES", "4096", 1);
+    setenv("EVP_BLOB_DOWNLOAD_PROGRESS_SEC", "0", 1);
+    setenv("EVP_BLOB_PARTIAL_MAX_AGE_SEC", "86400", 1);
+    setenv("EVP_BLOB_PARTIAL_MAX_BYTES", "4096", 1);
+    make_partial(dir, "old", 1000, 2 * 86400);
+    make_partial(dir, "older_recent", 3000, 7200);
+    make_partial(dir, "recent", 3000, 3600);
+    make_partial(dir, "lone", 0, 0);
+    snprintf(lone, sizeof(lone), "%s/lone.part", dir);
+    CHECK(unlink(lone) == 0);
+    CHECK(evp_agent_blob_download_init() == 0);
+
+    test_cleaned(dir);
+    test_resume();
+    test_range_ignored();
+    test_changed(dir);
+    test_persisted(dir);
+
+    evp_agent_blob_download_deinit();
+    test_rmtree(dir);
+    free(dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Tests of the payload compression of compress.h: the classes and the size
+ * limits, the round trip of what is compressed, and the payloads that are
+ * sent as they are.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+#if defined(EDC_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+#include "test_util.h"
+
+#define TEST_PAYLOAD_SIZE 4096
+
+/* Telemetry as the modules send it: the same keys over and over */
+static char *json_payload(size_t size)
+{
+    char *buf = malloc(size + 1);
+    size_t len = 0;
+    unsigned int i = 0;
+
+    CHECK(buf != NULL);
+    buf[len++] = '[';
+    while (len < size - 64) {
+        len += snprintf(buf + len, size + 1 - len, "{\"instance\":\"detector\",\"score\":%u},",
+                        i++ % 100);
+    }
+    memset(buf + len, ' ', size - 1 - len);
+    buf[size - 1] = ']';
+    buf[size] = '\0';
+    return buf;
+}
+
+static void test_classes(void)
+{
+    CHECK(evp_agent_compress_topic_class("v1/devices/me/telemetry") ==
+          EVP_AGENT_COMPRESS_TELEMETRY);
+    CHECK(evp_agent_compress_topic_class("v1/devices/me/attributes") == EVP_AGENT_COMPRESS_STATE);
+    CHECK(evp_agent_compress_topic_class("v1/devices/me/rpc/request/1") ==
+          EVP_AGENT_COMPRESS_CLASSES);
+
+    /* EVP_COMPRESS_MIN_BYTES and EVP_COMPRESS_BLOB_MAX_BYTES, as set in main() */
+    CHECK(!evp_agent_compress_wants(EVP_AGENT_COMPRESS_TELEMETRY, 63));
+    CHECK(evp_agent_compress_wants(EVP_AGENT_COMPRESS_TELEMETRY, 64));
+    CHECK(evp_agent_compress_wants(EVP_AGENT_COMPRESS_BLOB, 65536));
+    CHECK(!evp_agent_compress_wants(EVP_AGENT_COMPRESS_BLOB, 65537));
+    CHECK(!evp_agent_compress_wants(EVP_AGENT_COMPRESS_CLASSES, TEST_PAYLOAD_SIZE));
+}
+
+static void test_deflate(void)
+{
+    char *json = json_payload(TEST_PAYLOAD_SIZE);
+    uLongf len = TEST_PAYLOAD_SIZE;
+    const char *encoding = NULL;
+    char out[TEST_PAYLOAD_SIZE];
+    size_t size;
+    void *data;
+
+    CHECK(evp_agent_compress(EVP_AGENT_COMPRESS_TELEMETRY, json, TEST_PAYLOAD_SIZE, &data, &size,
+                             &encoding));
+    CHECK(strcmp(encoding, "deflate") == 0);
+    CHECK(size < TEST_PAYLOAD_SIZE / 2);
+    /* Told from JSON by its first byte */
+    CHECK(((const uint8_t *)data)[0] == 0x78);
+    CHECK(uncompress((Bytef *)out, &len, data, size) == Z_OK);
+    CHECK(len == TEST_PAYLOAD_SIZE && memcmp(out, json, len) == 0);
+
+    free(data);
+    free(json);
+}
+
+static void test_zstd(void)
+{
+    char *json = json_payload(TEST_PAYLOAD_SIZE);
+    const char *encoding = NULL;
+    size_t size;
+    void *data;
+
+    CHECK(evp_agent_compress(EVP_AGENT_COMPRESS_STATE, json, TEST_PAYLOAD_SIZE, &data, &size,
+                             &encoding));
+#if defined(EDC_HAVE_ZSTD)
+    char out[TEST_PAYLOAD_SIZE];
+
+    CHECK(strcmp(encoding, "zstd") == 0);
+    CHECK(memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0);
+    CHECK(ZSTD_decompress(out, sizeof(out), data, size) == TEST_PAYLOAD_SIZE);
+    CHECK(memcmp(out, json, TEST_PAYLOAD_SIZE) == 0);
+#else
+    /* Builds without libzstd fall back to deflate */
+    CHECK(strcmp(encoding, "deflate") == 0);
+#endif
+
+    free(data);
+    free(json);
+}
+
+static void test_as_is(void)
+{
+    char *json = json_payload(TEST_PAYLOAD_SIZE);
+    uint8_t noise[TEST_PAYLOAD_SIZE];
+    uint32_t x = 2463534242u;
+    size_t size;
+    void *data;
+
+    /* Does not shrink */
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        noise[i] = x;
+    }
+    CHECK(!evp_agent_compress(EVP_AGENT_COMPRESS_TELEMETRY, noise, sizeof(noise), &data, &size,
+                              NULL));
+
+    /* Too small */
+    CHECK(!evp_agent_compress(EVP_AGENT_COMPRESS_TELEMETRY, json, 32, &data, &size, NULL));
+
+    /* An image, whatever follows its magic */
+    memcpy(json, "\xff\xd8\xff", 3);
+    CHECK(!evp_agent_compress(EVP_AGENT_COMPRESS_BLOB, json, TEST_PAYLOAD_SIZE, &data, &size,
+                              NULL));
+    /* Only blobs are looked at */
+    CHECK(evp_agent_compress(EVP_AGENT_COMPRESS_TELEMETRY, json, TEST_PAYLOAD_SIZE, &data, &size,
+                             NULL));
+    free(data);
+
+    free(json);
+}
+
+int main(void)
+{
+    setenv("EVP_COMPRESS_TELEMETRY", "deflate", 1);
+    setenv("EVP_COMPRESS_STATE", "zstd", 1);
+    setenv("EVP_COMPRESS_BLOB", "deflate", 1);
+    setenv("EVP_COMPRESS_MIN_BYTES", "64", 1);
+    setenv("EVP_COMPRESS_BLOB_MAX_BYTES", "65536", 1);
+    unsetenv("EVP_COMPRESS_ZSTD_DICT");
+    CHECK(evp_agent_compress_init() == 0);
+
+    test_classes();
+    test_deflate();
+    test_zstd();
+    test_as_is();
+
+    evp_agent_compress_deinit();
+    CHECK(!evp_agent_compress_wants(EVP_AGENT_COMPRESS_TELEMETRY, TEST_PAYLOAD_SIZE));
+    return EXIT_SUCCESS;
+}
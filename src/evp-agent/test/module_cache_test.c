@@ -0,0 +1,173 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Tests of the index of module_cache.h: the entries kept across a restart,
+ * those dropped for a file cut short or a key that is not a digest, which
+ * is never used as a path, the files the index does not list, and the
+ * modules moved in.
+ */
+
+#define _GNU_SOURCE /* for asprintf */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "module_cache.h"
+#include "test_util.h"
+#include "wasm_runtime_wrap.h"
+
+#define TEST_SIZE 1000
+
+static char g_digest_kept[EVP_WASM_DIGEST_LEN];
+static char g_digest_short[EVP_WASM_DIGEST_LEN];
+static char g_digest_new[EVP_WASM_DIGEST_LEN];
+
+static void digest_fill(char *digest, char c)
+{
+    memset(digest, c, EVP_WASM_DIGEST_LEN - 1);
+    digest[EVP_WASM_DIGEST_LEN - 1] = '\0';
+}
+
+static char *path_of(const char *dir, const char *name)
+{
+    char *path;
+
+    CHECK(asprintf(&path, "%s/%s", dir, name) >= 0);
+    return path;
+}
+
+static void file_write(const char *dir, const char *name, size_t size)
+{
+    char *path = path_of(dir, name), *data = calloc(1, size + 1);
+    FILE *fp = fopen(path, "w");
+
+    CHECK(fp != NULL && data != NULL);
+    CHECK(fwrite(data, 1, size, fp) == size);
+    CHECK(fclose(fp) == 0);
+    free(data);
+    free(path);
+}
+
+static bool file_exists(const char *dir, const char *name)
+{
+    char *path = path_of(dir, name);
+    bool exists = access(path, F_OK) == 0;
+
+    free(path);
+    return exists;
+}
+
+static char *file_read(const char *dir, const char *name)
+{
+    char *path = path_of(dir, name), *text = calloc(1, 4096);
+    FILE *fp = fopen(path, "r");
+
+    CHECK(fp != NULL && text != NULL);
+    CHECK(fread(text, 1, 4095, fp) > 0);
+    fclose(fp);
+    free(path);
+    return text;
+}
+
+static bool cached(const char *digest, size_t size)
+{
+    size_t got = 0;
+    char *path = evp_agent_module_cache_path(digest, &got);
+
+    free(path);
+    return path != NULL && got == size;
+}
+
+/* An index left by a previous run, and a power cut */
+static void test_load(const char *base, const char *dir)
+{
+    char index[2048], *path;
+    FILE *fp;
+
+    file_write(dir, g_digest_kept, TEST_SIZE);
+    file_write(dir, g_digest_short, TEST_SIZE / 2);
+    file_write(dir, "stray", 10);
+    file_write(base, "victim", TEST_SIZE);
+    snprintf(index, sizeof(index),
+             "{\"%s\":{\"size\":%d,\"lastUsed\":1},"
+             "\"%s\":{\"size\":%d,\"lastUsed\":2},"
+             "\"../victim\":{\"size\":%d,\"lastUsed\":3},"
+             "\"%.63s/\":{\"size\":%d,\"lastUsed\":4},"
+             "\"%.63sA\":{\"size\":%d,\"lastUsed\":5},"
+             "\"stray\":10}",
+             g_digest_kept, TEST_SIZE, g_digest_short, TEST_SIZE, TEST_SIZE, g_digest_new,
+             TEST_SIZE, g_digest_new, TEST_SIZE);
+    path = path_of(dir, "index.json");
+    fp = fopen(path, "w");
+    CHECK(fp != NULL && fputs(index, fp) >= 0 && fclose(fp) == 0);
+    free(path);
+
+    CHECK(evp_agent_module_cache_init() == 0);
+    CHECK(cached(g_digest_kept, TEST_SIZE));
+    /* Cut short */
+    CHECK(!cached(g_digest_short, TEST_SIZE));
+    CHECK(!file_exists(dir, g_digest_short));
+    /* Not a digest: never looked up, nor removed, outside the cache */
+    CHECK(!cached("../victim", TEST_SIZE));
+    CHECK(file_exists(base, "victim"));
+    CHECK(!file_exists(dir, "stray"));
+    evp_agent_module_cache_deinit();
+}
+
+static void test_insert(const char *base, const char *dir)
+{
+    char *path = path_of(base, "fetched"), *into = NULL, *index;
+
+    CHECK(evp_agent_module_cache_init() == 0);
+    file_write(base, "fetched", TEST_SIZE);
+    CHECK(evp_agent_module_cache_insert("../fetched", path, TEST_SIZE, &into) != 0);
+    CHECK(file_exists(base, "fetched"));
+
+    evp_agent_module_cache_ref(g_digest_new);
+    CHECK(evp_agent_module_cache_insert(g_digest_new, path, TEST_SIZE, &into) == 0);
+    CHECK(into != NULL && strncmp(into, dir, strlen(dir)) == 0);
+    CHECK(!file_exists(base, "fetched"));
+    free(into);
+    evp_agent_module_cache_unref(g_digest_new);
+    evp_agent_module_cache_deinit();
+
+    /* Listed with its size and last use only */
+    index = file_read(dir, "index.json");
+    CHECK(strstr(index, g_digest_new) != NULL);
+    CHECK(strstr(index, "verified") == NULL);
+    free(index);
+
+    /* Across a restart */
+    CHECK(evp_agent_module_cache_init() == 0);
+    CHECK(cached(g_digest_new, TEST_SIZE));
+    CHECK(cached(g_digest_kept, TEST_SIZE));
+    evp_agent_module_cache_deinit();
+    free(path);
+}
+
+int main(void)
+{
+    char *base = test_mkdtemp(), *dir = path_of(base, "cache");
+
+    digest_fill(g_digest_kept, 'a');
+    digest_fill(g_digest_short, 'b');
+    digest_fill(g_digest_new, 'c');
+    CHECK(mkdir(dir, 0700) == 0);
+    setenv("EVP_MODULE_CACHE_DIR", dir, 1);
+    setenv("EVP_MODULE_CACHE_MAX_BYTES", "65536", 1);
+
+    test_load(base, dir);
+    test_insert(base, dir);
+
+    test_rmtree(base);
+    free(dir);
+    free(base);
+    return EXIT_SUCCESS;
+}
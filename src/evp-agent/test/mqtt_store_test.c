@@ -0,0 +1,187 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * Tests of the store-and-forward of mqtt_store.h, against a fake of the
+ * backlog of mqtt_buffers.h: the order of the replay, the records handed
+ * again until delivered, the recovery of a queue left by a previous run and
+ * of one with a torn record.
+ */
+
+#define _GNU_SOURCE /* for memmem */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mqtt.h>
+
+#include "mqtt_buffers.h"
+#include "mqtt_store.h"
+#include "test_util.h"
+
+#define TEST_TOPIC "v1/devices/me/telemetry"
+#define TEST_PUBLISHES_MAX 16
+
+/* What the agent would have sent, in order */
+static struct {
+    char payloads[TEST_PUBLISHES_MAX][32];
+    unsigned int n;
+    bool sent;
+} g_fake;
+
+bool evp_agent_mqtt_congested(void)
+{
+    return false;
+}
+
+bool evp_agent_mqtt_sent(struct mqtt_client *client)
+{
+    return g_fake.sent;
+}
+
+enum MQTTErrors evp_agent_mqtt_send(struct mqtt_client *client, const char *topic_name,
+                                    const void *application_message,
+                                    size_t application_message_size, uint8_t publish_flags)
+{
+    CHECK(strcmp(topic_name, TEST_TOPIC) == 0);
+    CHECK(g_fake.n < TEST_PUBLISHES_MAX);
+    CHECK(application_message_size < sizeof(g_fake.payloads[0]));
+    memcpy(g_fake.payloads[g_fake.n], application_message, application_message_size);
+    g_fake.payloads[g_fake.n][application_message_size] = '\0';
+    g_fake.n++;
+    return MQTT_OK;
+}
+
+static void store(struct mqtt_client *client, const char *msg)
+{
+    CHECK(evp_agent_mqtt_store_add(client, TEST_TOPIC, msg, strlen(msg), MQTT_PUBLISH_QOS_1));
+}
+
+static void replay(struct mqtt_client *client, bool sent)
+{
+    g_fake.n = 0;
+    g_fake.sent = sent;
+    evp_agent_mqtt_store_replay(client);
+}
+
+/* Flips a byte of the stored copy of msg, as a power loss would leave it */
+static void tear(const char *dir, const char *msg)
+{
+    struct dirent *de;
+    char path[512];
+    struct stat st;
+    char *data, *p;
+    DIR *d;
+    int fd;
+
+    d = opendir(dir);
+    CHECK(d != NULL);
+    while ((de = readdir(d)) != NULL) {
+        if (strstr(de->d_name, ".seg") == NULL) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        fd = open(path, O_RDWR);
+        CHECK(fd >= 0 && fstat(fd, &st) == 0);
+        data = malloc(st.st_size);
+        CHECK(data != NULL && pread(fd, data, st.st_size, 0) == st.st_size);
+        p = memmem(data, st.st_size, msg, strlen(msg));
+        if (p != NULL) {
+            *p ^= 0xff;
+            CHECK(pwrite(fd, data, st.st_size, 0) == st.st_size);
+        }
+        free(data);
+        close(fd);
+    }
+    closedir(d);
+}
+
+static void test_replay(const char *dir)
+{
+    struct mqtt_client client = {.error = MQTT_ERROR_CONNECTION_CLOSED};
+
+    CHECK(evp_agent_mqtt_store_init() == 0);
+
+    /* Offline: stored, but only telemetry and state */
+    store(&client, "one");
+    store(&client, "two");
+    CHECK(!evp_agent_mqtt_store_add(&client, "v1/devices/me/rpc/request/1", "x", 1, 0));
+    CHECK(!evp_agent_mqtt_store_spill("v1/devices/me/rpc/request/1", "x", 1, 0));
+    /* Online, behind the stored ones */
+    client.error = MQTT_OK;
+    store(&client, "three");
+
+    replay(&client, false);
+    CHECK(g_fake.n == 3);
+    CHECK(strcmp(g_fake.payloads[0], "one") == 0);
+    CHECK(strcmp(g_fake.payloads[1], "two") == 0);
+    CHECK(strcmp(g_fake.payloads[2], "three") == 0);
+
+    /* A reconnect dropped them before they were delivered */
+    evp_agent_mqtt_store_rewind();
+    replay(&client, false);
+    CHECK(g_fake.n == 3);
+    CHECK(strcmp(g_fake.payloads[0], "one") == 0);
+
+    /* Not delivered: a restart replays them again */
+    evp_agent_mqtt_store_deinit();
+    CHECK(evp_agent_mqtt_store_init() == 0);
+    replay(&client, false);
+    CHECK(g_fake.n == 3);
+    CHECK(strcmp(g_fake.payloads[2], "three") == 0);
+
+    /* Delivered: gone, from the disk too */
+    replay(&client, true);
+    CHECK(g_fake.n == 0);
+    CHECK(!evp_agent_mqtt_store_add(&client, TEST_TOPIC, "four", 4, 0));
+    evp_agent_mqtt_store_deinit();
+    CHECK(test_count_files(dir, ".seg") == 0);
+}
+
+static void test_torn(const char *dir)
+{
+    struct mqtt_client client = {.error = MQTT_ERROR_CONNECTION_CLOSED};
+
+    CHECK(evp_agent_mqtt_store_init() == 0);
+    store(&client, "one");
+    store(&client, "two");
+    store(&client, "three");
+    evp_agent_mqtt_store_deinit();
+
+    /* Recovered up to the torn record */
+    tear(dir, "three");
+    CHECK(evp_agent_mqtt_store_init() == 0);
+    client.error = MQTT_OK;
+    replay(&client, false);
+    CHECK(g_fake.n == 2);
+    CHECK(strcmp(g_fake.payloads[0], "one") == 0);
+    CHECK(strcmp(g_fake.payloads[1], "two") == 0);
+    replay(&client, true);
+    evp_agent_mqtt_store_deinit();
+}
+
+int main(void)
+{
+    char *dir = test_mkdtemp();
+
+    setenv("EVP_MQTT_STORE_DIR", dir, 1);
+    setenv("EVP_MQTT_STORE_MAX_BYTES", "65536", 1);
+    setenv("EVP_MQTT_STORE_SEGMENT_BYTES", "4096", 1);
+    setenv("EVP_MQTT_STORE_REPLAY_RATE", "0", 1);
+
+    test_replay(dir);
+    test_torn(dir);
+
+    test_rmtree(dir);
+    free(dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#define _GNU_SOURCE /* for asprintf */
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test_util.h"
+
+char *test_mkdtemp(void)
+{
+    const char *tmp = getenv("TMPDIR");
+    char *dir;
+
+    if (asprintf(&dir, "%s/evp-agent-test.XXXXXX", tmp != NULL ? tmp : "/tmp") < 0) {
+        fprintf(stderr, "asprintf failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "failed to create %s: %s\n", dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    return dir;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+void test_rmtree(const char *dir)
+{
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+unsigned int test_count_files(const char *dir, const char *suffix)
+{
+    size_t suffix_len = strlen(suffix);
+    unsigned int n = 0;
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+
+        if (len >= suffix_len && strcmp(de->d_name + len - suffix_len, suffix) == 0 &&
+            strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            n++;
+        }
+    }
+    closedir(d);
+    return n;
+}
@@ -0,0 +1,33 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+/*
+ * Helpers shared by the unit tests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Fails the test at the first check that does not hold */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE);                                                      \
+        }                                                                            \
+    } while (0)
+
+/* Creates an empty directory under TMPDIR, to be freed, exits on error */
+char *test_mkdtemp(void);
+/* Removes a directory and what it holds */
+void test_rmtree(const char *dir);
+/* The number of entries of a directory whose name ends with suffix */
+unsigned int test_count_files(const char *dir, const char *suffix);
+
+#endif /* __TEST_UTIL_H__ */
@@ -0,0 +1,785 @@
+/*
+* SPDX-FileCopyrightText: 2024-2025 Sony Semiconductor Solutions Corporation
+*
+* SPDX-License-Identifier: Apache-2.0
+*/
+
+/*
+ * wasi-nn backend caching the graphs of another backend.
+ *
+ * The wasi-nn library of WAMR dlopen()s its backends by name
+ * (libwasi_nn_<backend>.so) and gives every module instance its own backend
+ * context, so every instance restart loads its models again. This backend is
+ * installed under the same name, ahead of the real one in the library path,
+ * and forwards to the real backend found in EVP_WASI_NN_BACKEND_DIR
+ * (/opt/senscord/lib by default).
+ *
+ * Graphs are kept in a process-wide cache keyed by model digest, encoding and
+ * execution target, each in a backend context of its own that outlives the
+ * instances using it. A graph is used by one instance at a time, since the
+ * backends share one interpreter per graph between execution contexts; an
+ * instance loading a model that is in use elsewhere gets another copy.
+ * Instances hold references to graphs and leave their execution contexts to
+ * the graph when they go away, so the next instance gets a warm interpreter
+ * or session. Graphs nobody references are evicted in LRU order once the
+ * cached models exceed EVP_WASI_NN_CACHE_BUDGET_MB (64 MB by default).
+ * Models are loaded without holding the cache lock, in an entry marked
+ * loading that other threads of the instance wait for.
+ *
+ * The backend also runs the inferences on bound tensors of the agent
+ * (wasi_nn_bind.h). The agent natives name the module instance, which a
+ * backend context learns from the linear memory holding the first model it
+ * loads, and records the execution contexts it creates with the agent. An
+ * inference pins the backend context, so that the instance can go away
+ * meanwhile.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <bsd/sys/queue.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <mbedtls/sha256.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "wasi_nn_backend.h"
+#include "wasi_nn_bind.h"
+
+#ifndef WASI_NN_CACHE_BACKEND
+#error "WASI_NN_CACHE_BACKEND must name the backend to cache"
+#endif
+
+#define NN_CACHE_BACKEND_LIB "libwasi_nn_" WASI_NN_CACHE_BACKEND ".so"
+#define NN_CACHE_BACKEND_DIR_DEFAULT "/opt/senscord/lib"
+#define NN_CACHE_BUDGET_MB_DEFAULT 64
+
+/* Same limits as the WAMR backends */
+#define NN_CACHE_MAX_GRAPHS 10
+#define NN_CACHE_MAX_EXEC_CONTEXTS 10
+
+#define NN_CACHE_DIGEST_LEN 65
+
+struct nn_backend_api {
+    __typeof__(init_backend) *init_backend;
+    __typeof__(deinit_backend) *deinit_backend;
+    __typeof__(load) *load;
+    __typeof__(load_by_name) *load_by_name;
+    __typeof__(init_execution_context) *init_execution_context;
+    __typeof__(set_input) *set_input;
+    __typeof__(compute) *compute;
+    __typeof__(get_output) *get_output;
+};
+
+struct nn_instance;
+
+struct nn_graph_entry {
+    TAILQ_ENTRY(nn_graph_entry) q;
+    char digest[NN_CACHE_DIGEST_LEN];
+    /* -1 for graphs loaded by name, whose backend picks both */
+    int encoding;
+    int target;
+    /* Backend context owning the graph */
+    void *ctx;
+    graph g;
+    /* Instance using the graph, and its number of references to it */
+    struct nn_instance *owner;
+    unsigned int refs;
+    size_t bytes;
+    uint64_t load_us;
+    uint64_t last_used;
+    /* Being loaded by its owner, the lock dropped */
+    bool loading;
+    /* Execution contexts of former instances, ready for reuse */
+    graph_execution_context idle[NN_CACHE_MAX_EXEC_CONTEXTS];
+    unsigned int n_idle;
+};
+
+struct nn_exec_slot {
+    struct nn_graph_entry *entry;
+    graph_execution_context ctx;
+};
+
+/* Backend context of a module instance */
+struct nn_instance {
+    TAILQ_ENTRY(nn_instance) q;
+    /* Module instance served, known once it loaded a model */
+    wasm_module_inst_t module_inst;
+    /* Inferences on bound tensors in progress */
+    unsigned int busy;
+    struct nn_graph_entry *graphs[NN_CACHE_MAX_GRAPHS];
+    unsigned int n_graphs;
+    struct nn_exec_slot execs[NN_CACHE_MAX_EXEC_CONTEXTS];
+    unsigned int n_execs;
+};
+
+TAILQ_HEAD(nn_graph_entry_head, nn_graph_entry);
+TAILQ_HEAD(nn_instance_head, nn_instance);
+
+static struct {
+    struct nn_backend_api api;
+    void *handle;
+    struct nn_graph_entry_head entries;
+    struct nn_instance_head instances;
+    size_t bytes;
+    size_t budget;
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t saved_us;
+    pthread_mutex_t lock;
+    /* Signaled when an inference on bound tensors ends */
+    pthread_cond_t idle;
+    /* Signaled when a model is loaded, or failed to */
+    pthread_cond_t loaded;
+} g_nn_cache = {.entries = TAILQ_HEAD_INITIALIZER(g_nn_cache.entries),
+                .instances = TAILQ_HEAD_INITIALIZER(g_nn_cache.instances),
+                .lock = PTHREAD_MUTEX_INITIALIZER,
+                .idle = PTHREAD_COND_INITIALIZER,
+                .loaded = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t g_nn_cache_once = PTHREAD_ONCE_INIT;
+
+static int nn_compute_bound(wasm_module_inst_t module_inst, uint32_t exec_ctx,
+                            const struct evp_wasi_nn_tensor *inputs, uint32_t n_inputs,
+                            struct evp_wasi_nn_tensor *outputs, uint32_t n_outputs);
+
+static const struct evp_wasi_nn_bind_ops g_nn_bind_ops = {
+    .backend = WASI_NN_CACHE_BACKEND,
+    .compute_bound = nn_compute_bound,
+};
+
+static void digest_hex(const unsigned char *hash, char *digest)
+{
+    for (size_t i = 0; i < 32; i++) {
+        snprintf(&digest[i * 2], 3, "%02x", hash[i]);
+    }
+}
+
+static void nn_cache_report(void *user)
+{
+    unsigned int graphs = 0;
+    struct nn_graph_entry *entry;
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    TAILQ_FOREACH(entry, &g_nn_cache.entries, q)
+    {
+        if (!entry->loading) {
+            graphs++;
+        }
+    }
+    if (g_nn_cache.hits + g_nn_cache.misses != 0) {
+        EVP_AGENT_INFO("wasi-nn %s cache: graphs=%u bytes=%zu hits=%" PRIu64 " misses=%" PRIu64
+                       " evictions=%" PRIu64 " saved_ms=%" PRIu64,
+                       WASI_NN_CACHE_BACKEND, graphs, g_nn_cache.bytes, g_nn_cache.hits,
+                       g_nn_cache.misses, g_nn_cache.evictions, g_nn_cache.saved_us / 1000);
+    }
+    pthread_mutex_unlock(&g_nn_cache.lock);
+}
+
+static void nn_cache_init(void)
+{
+    const char *dir = getenv("EVP_WASI_NN_BACKEND_DIR");
+    const char *budget = getenv("EVP_WASI_NN_CACHE_BUDGET_MB");
+    char path[PATH_MAX];
+    void *handle;
+
+    g_nn_cache.budget = (size_t)NN_CACHE_BUDGET_MB_DEFAULT << 20;
+    if (budget != NULL) {
+        g_nn_cache.budget = (size_t)strtoul(budget, NULL, 10) << 20;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir != NULL ? dir : NN_CACHE_BACKEND_DIR_DEFAULT,
+             NN_CACHE_BACKEND_LIB);
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        EVP_AGENT_ERR("failed to load the wasi-nn backend %s: %s", path, dlerror());
+        return;
+    }
+
+    g_nn_cache.api.init_backend = dlsym(handle, "init_backend");
+    g_nn_cache.api.deinit_backend = dlsym(handle, "deinit_backend");
+    g_nn_cache.api.load = dlsym(handle, "load");
+    g_nn_cache.api.load_by_name = dlsym(handle, "load_by_name");
+    g_nn_cache.api.init_execution_context = dlsym(handle, "init_execution_context");
+    g_nn_cache.api.set_input = dlsym(handle, "set_input");
+    g_nn_cache.api.compute = dlsym(handle, "compute");
+    g_nn_cache.api.get_output = dlsym(handle, "get_output");
+
+    if (g_nn_cache.api.init_backend == NULL || g_nn_cache.api.deinit_backend == NULL ||
+        g_nn_cache.api.load == NULL || g_nn_cache.api.init_execution_context == NULL ||
+        g_nn_cache.api.set_input == NULL || g_nn_cache.api.compute == NULL ||
+        g_nn_cache.api.get_output == NULL) {
+        EVP_AGENT_ERR("%s is not a wasi-nn backend", path);
+        memset(&g_nn_cache.api, 0, sizeof(g_nn_cache.api));
+        dlclose(handle);
+        return;
+    }
+
+    g_nn_cache.handle = handle;
+    evp_agent_metrics_register("wasi_nn_cache_" WASI_NN_CACHE_BACKEND, NULL, nn_cache_report,
+                               NULL);
+}
+
+/* Called with the lock held */
+static void nn_cache_evict(void)
+{
+    while (g_nn_cache.bytes > g_nn_cache.budget) {
+        struct nn_graph_entry *entry, *lru = NULL;
+
+        TAILQ_FOREACH(entry, &g_nn_cache.entries, q)
+        {
+            if (entry->refs == 0 && (lru == NULL || entry->last_used < lru->last_used)) {
+                lru = entry;
+            }
+        }
+        if (lru == NULL) {
+            /* Everything left is in use */
+            return;
+        }
+
+        EVP_AGENT_INFO("wasi-nn %s cache: evicting graph %.12s (%zu bytes)",
+                       WASI_NN_CACHE_BACKEND, lru->digest, lru->bytes);
+        TAILQ_REMOVE(&g_nn_cache.entries, lru, q);
+        g_nn_cache.bytes -= lru->bytes;
+        g_nn_cache.evictions++;
+        /* Frees the graph and its execution contexts */
+        g_nn_cache.api.deinit_backend(lru->ctx);
+        free(lru);
+    }
+}
+
+/* A graph already used by the instance, or else an unused one */
+static struct nn_graph_entry *nn_cache_lookup(struct nn_instance *inst, const char *digest,
+                                              int encoding, int target)
+{
+    struct nn_graph_entry *entry, *found = NULL;
+
+    TAILQ_FOREACH(entry, &g_nn_cache.entries, q)
+    {
+        if (entry->encoding != encoding || entry->target != target ||
+            strcmp(entry->digest, digest) != 0) {
+            continue;
+        }
+        if (entry->owner == inst) {
+            return entry;
+        }
+        if (entry->refs == 0 && found == NULL) {
+            found = entry;
+        }
+    }
+
+    return found;
+}
+
+static void nn_cache_hit(struct nn_instance *inst, struct nn_graph_entry *entry)
+{
+    entry->owner = inst;
+    entry->refs++;
+    entry->last_used = ++g_nn_cache.tick;
+    g_nn_cache.hits++;
+    g_nn_cache.saved_us += entry->load_us;
+
+    EVP_AGENT_INFO("wasi-nn %s cache: hit for graph %.12s target %d, saved %" PRIu64 " ms",
+                   WASI_NN_CACHE_BACKEND, entry->digest, entry->target, entry->load_us / 1000);
+}
+
+/*
+ * The graph of the instance for a model, or else an entry marked loading
+ * that the caller loads the model into, then hands to nn_cache_loaded().
+ * Another thread of the instance loading the same model is waited for, and
+ * the lookup done again once it is through, as its load may have failed.
+ */
+static struct nn_graph_entry *nn_cache_get(struct nn_instance *inst, const char *digest,
+                                           int encoding, int target, bool *miss)
+{
+    struct nn_graph_entry *entry;
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    while ((entry = nn_cache_lookup(inst, digest, encoding, target)) != NULL &&
+           entry->loading) {
+        pthread_cond_wait(&g_nn_cache.loaded, &g_nn_cache.lock);
+    }
+
+    if (entry != NULL) {
+        nn_cache_hit(inst, entry);
+        *miss = false;
+        goto out_unlock;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for nn_graph_entry");
+        goto out_unlock;
+    }
+
+    snprintf(entry->digest, sizeof(entry->digest), "%s", digest);
+    entry->encoding = encoding;
+    entry->target = target;
+    /* Held by the instance, so that no one else picks it nor evicts it */
+    entry->owner = inst;
+    entry->refs = 1;
+    entry->loading = true;
+    TAILQ_INSERT_TAIL(&g_nn_cache.entries, entry, q);
+    *miss = true;
+
+out_unlock:
+    pthread_mutex_unlock(&g_nn_cache.lock);
+    return entry;
+}
+
+/* Called with the lock held, frees the entry if the load failed */
+static void nn_cache_loaded(struct nn_graph_entry *entry, wasi_nn_error ret, void *ctx, graph g,
+                            size_t bytes, uint64_t load_us)
+{
+    entry->loading = false;
+    pthread_cond_broadcast(&g_nn_cache.loaded);
+
+    if (ret != success) {
+        TAILQ_REMOVE(&g_nn_cache.entries, entry, q);
+        free(entry);
+        return;
+    }
+
+    entry->ctx = ctx;
+    entry->g = g;
+    entry->bytes = bytes;
+    entry->load_us = load_us;
+    entry->last_used = ++g_nn_cache.tick;
+    g_nn_cache.bytes += bytes;
+    g_nn_cache.misses++;
+
+    EVP_AGENT_INFO("wasi-nn %s cache: loaded graph %.12s target %d in %" PRIu64 " ms",
+                   WASI_NN_CACHE_BACKEND, entry->digest, entry->target, load_us / 1000);
+
+    nn_cache_evict();
+}
+
+static wasi_nn_error nn_instance_add_graph(struct nn_instance *inst,
+                                           struct nn_graph_entry *entry, graph *g)
+{
+    if (inst->n_graphs == NN_CACHE_MAX_GRAPHS) {
+        if (--entry->refs == 0) {
+            entry->owner = NULL;
+        }
+        return too_large;
+    }
+
+    *g = inst->n_graphs;
+    inst->graphs[inst->n_graphs++] = entry;
+    return success;
+}
+
+/* Backends may hand out the same execution context several times */
+static void nn_graph_entry_put_exec(struct nn_graph_entry *entry, graph_execution_context ctx)
+{
+    for (unsigned int i = 0; i < entry->n_idle; i++) {
+        if (entry->idle[i] == ctx) {
+            return;
+        }
+    }
+    if (entry->n_idle < NN_CACHE_MAX_EXEC_CONTEXTS) {
+        entry->idle[entry->n_idle++] = ctx;
+    }
+}
+
+static struct nn_exec_slot *nn_instance_exec(void *ctx, graph_execution_context exec_ctx)
+{
+    struct nn_instance *inst = ctx;
+
+    if (inst == NULL || exec_ctx >= inst->n_execs) {
+        return NULL;
+    }
+
+    return &inst->execs[exec_ctx];
+}
+
+/* Model data and names are in the linear memory of the instance loading them */
+static void nn_instance_learn(struct nn_instance *inst, const void *addr)
+{
+    if (inst->module_inst != NULL) {
+        return;
+    }
+
+    wasm_module_inst_t module_inst = evp_agent_wasi_nn_bind_instance_of(addr);
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    inst->module_inst = module_inst;
+    pthread_mutex_unlock(&g_nn_cache.lock);
+}
+
+/* The backend context of a module instance, pinned until nn_instance_put() */
+static struct nn_instance *nn_instance_get(wasm_module_inst_t module_inst)
+{
+    struct nn_instance *inst;
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    TAILQ_FOREACH(inst, &g_nn_cache.instances, q)
+    {
+        if (module_inst != NULL && inst->module_inst == module_inst) {
+            inst->busy++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_nn_cache.lock);
+
+    return inst;
+}
+
+static void nn_instance_put(struct nn_instance *inst)
+{
+    pthread_mutex_lock(&g_nn_cache.lock);
+    if (--inst->busy == 0) {
+        pthread_cond_broadcast(&g_nn_cache.idle);
+    }
+    pthread_mutex_unlock(&g_nn_cache.lock);
+}
+
+static void tensor_bind(tensor *t, tensor_dimensions *dims, const struct evp_wasi_nn_tensor *b)
+{
+    dims->buf = (uint32_t *)b->dims;
+    dims->size = b->n_dims;
+    t->dimensions = dims;
+    t->type = (tensor_type)b->type;
+    t->data.buf = b->data;
+    t->data.size = b->size;
+}
+
+static int nn_compute_bound(wasm_module_inst_t module_inst, uint32_t exec_ctx,
+                            const struct evp_wasi_nn_tensor *inputs, uint32_t n_inputs,
+                            struct evp_wasi_nn_tensor *outputs, uint32_t n_outputs)
+{
+    struct nn_instance *inst = nn_instance_get(module_inst);
+    struct nn_exec_slot *slot;
+    int ret;
+
+    if (inst == NULL) {
+        return -ENOENT;
+    }
+    if (exec_ctx >= inst->n_execs) {
+        ret = -ENOENT;
+        goto out_put;
+    }
+    slot = &inst->execs[exec_ctx];
+
+    /* The backend copies straight between the bound regions and its tensors */
+    for (uint32_t i = 0; i < n_inputs; i++) {
+        tensor_dimensions dims;
+        tensor t;
+
+        tensor_bind(&t, &dims, &inputs[i]);
+        ret = g_nn_cache.api.set_input(slot->entry->ctx, slot->ctx, inputs[i].index, &t);
+        if (ret != success) {
+            goto out_put;
+        }
+    }
+
+    ret = g_nn_cache.api.compute(slot->entry->ctx, slot->ctx);
+    if (ret != success) {
+        goto out_put;
+    }
+
+    for (uint32_t i = 0; i < n_outputs; i++) {
+        tensor_data data = {.buf = outputs[i].data, .size = outputs[i].size};
+        uint32_t size = outputs[i].size;
+
+        ret = g_nn_cache.api.get_output(slot->entry->ctx, slot->ctx, outputs[i].index, &data,
+                                        &size);
+        if (ret != success) {
+            goto out_put;
+        }
+        outputs[i].size = size;
+    }
+
+out_put:
+    nn_instance_put(inst);
+    return ret;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error init_backend(void **ctx)
+{
+    struct nn_instance *inst;
+
+    pthread_once(&g_nn_cache_once, nn_cache_init);
+    if (g_nn_cache.handle == NULL) {
+        return runtime_error;
+    }
+
+    inst = calloc(1, sizeof(*inst));
+    if (inst == NULL) {
+        EVP_AGENT_ERR("failed to allocate memory for nn_instance");
+        return runtime_error;
+    }
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    TAILQ_INSERT_TAIL(&g_nn_cache.instances, inst, q);
+    pthread_mutex_unlock(&g_nn_cache.lock);
+
+    *ctx = inst;
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error deinit_backend(void *ctx)
+{
+    struct nn_instance *inst = ctx;
+
+    if (inst == NULL) {
+        return invalid_argument;
+    }
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    TAILQ_REMOVE(&g_nn_cache.instances, inst, q);
+    while (inst->busy != 0) {
+        pthread_cond_wait(&g_nn_cache.idle, &g_nn_cache.lock);
+    }
+    for (unsigned int i = 0; i < inst->n_execs; i++) {
+        nn_graph_entry_put_exec(inst->execs[i].entry, inst->execs[i].ctx);
+    }
+    for (unsigned int i = 0; i < inst->n_graphs; i++) {
+        struct nn_graph_entry *entry = inst->graphs[i];
+
+        if (--entry->refs == 0) {
+            entry->owner = NULL;
+        }
+        entry->last_used = ++g_nn_cache.tick;
+    }
+    nn_cache_evict();
+    pthread_mutex_unlock(&g_nn_cache.lock);
+
+    free(inst);
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error load(void *ctx, graph_builder_array *builder,
+                                                          graph_encoding encoding,
+                                                          execution_target target, graph *g)
+{
+    struct nn_instance *inst = ctx;
+    struct nn_graph_entry *entry;
+    mbedtls_sha256_context sha;
+    unsigned char hash[32];
+    char digest[NN_CACHE_DIGEST_LEN];
+    size_t bytes = 0;
+    bool miss;
+    wasi_nn_error ret;
+
+    if (inst == NULL || builder == NULL) {
+        return invalid_argument;
+    }
+    if (builder->size > 0) {
+        nn_instance_learn(inst, builder->buf[0].buf);
+    }
+
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    for (uint32_t i = 0; i < builder->size; i++) {
+        mbedtls_sha256_update(&sha, builder->buf[i].buf, builder->buf[i].size);
+        bytes += builder->buf[i].size;
+    }
+    mbedtls_sha256_finish(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    digest_hex(hash, digest);
+
+    entry = nn_cache_get(inst, digest, encoding, target, &miss);
+    if (entry == NULL) {
+        return runtime_error;
+    }
+
+    if (miss) {
+        void *backend_ctx = NULL;
+        graph backend_g = 0;
+        uint64_t t0 = 0;
+
+        ret = g_nn_cache.api.init_backend(&backend_ctx);
+        if (ret == success) {
+            t0 = evp_agent_now_us();
+            ret = g_nn_cache.api.load(backend_ctx, builder, encoding, target, &backend_g);
+            if (ret != success) {
+                g_nn_cache.api.deinit_backend(backend_ctx);
+            }
+        }
+
+        pthread_mutex_lock(&g_nn_cache.lock);
+        nn_cache_loaded(entry, ret, backend_ctx, backend_g, bytes, evp_agent_now_us() - t0);
+        if (ret != success) {
+            goto out_unlock;
+        }
+    }
+    else {
+        pthread_mutex_lock(&g_nn_cache.lock);
+    }
+
+    ret = nn_instance_add_graph(inst, entry, g);
+
+out_unlock:
+    pthread_mutex_unlock(&g_nn_cache.lock);
+    return ret;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error load_by_name(void *ctx, const char *filename,
+                                                                  uint32_t filename_len, graph *g)
+{
+    struct nn_instance *inst = ctx;
+    struct nn_graph_entry *entry;
+    unsigned char hash[32];
+    char digest[NN_CACHE_DIGEST_LEN];
+    char key[PATH_MAX + 64];
+    struct stat st;
+    int len;
+    bool miss;
+    wasi_nn_error ret;
+
+    if (inst == NULL || filename == NULL) {
+        return invalid_argument;
+    }
+    nn_instance_learn(inst, filename);
+    if (g_nn_cache.api.load_by_name == NULL) {
+        return unsupported_operation;
+    }
+
+    /* A model file is identified by its path and version on disk */
+    if (stat(filename, &st) != 0) {
+        return not_found;
+    }
+    len = snprintf(key, sizeof(key), "%.*s:%lld:%lld", (int)filename_len, filename,
+                   (long long)st.st_size, (long long)st.st_mtime);
+    if (len < 0 || (size_t)len >= sizeof(key)) {
+        return too_large;
+    }
+    if (mbedtls_sha256((const unsigned char *)key, len, hash, 0) != 0) {
+        return runtime_error;
+    }
+    digest_hex(hash, digest);
+
+    entry = nn_cache_get(inst, digest, -1, -1, &miss);
+    if (entry == NULL) {
+        return runtime_error;
+    }
+
+    if (miss) {
+        void *backend_ctx = NULL;
+        graph backend_g = 0;
+        uint64_t t0 = 0;
+
+        ret = g_nn_cache.api.init_backend(&backend_ctx);
+        if (ret == success) {
+            t0 = evp_agent_now_us();
+            ret = g_nn_cache.api.load_by_name(backend_ctx, filename, filename_len, &backend_g);
+            if (ret != success) {
+                g_nn_cache.api.deinit_backend(backend_ctx);
+            }
+        }
+
+        pthread_mutex_lock(&g_nn_cache.lock);
+        nn_cache_loaded(entry, ret, backend_ctx, backend_g, (size_t)st.st_size,
+                        evp_agent_now_us() - t0);
+        if (ret != success) {
+            goto out_unlock;
+        }
+    }
+    else {
+        pthread_mutex_lock(&g_nn_cache.lock);
+    }
+
+    ret = nn_instance_add_graph(inst, entry, g);
+
+out_unlock:
+    pthread_mutex_unlock(&g_nn_cache.lock);
+    return ret;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error
+init_execution_context(void *ctx, graph g, graph_execution_context *exec_ctx)
+{
+    struct nn_instance *inst = ctx;
+    struct nn_graph_entry *entry;
+    struct nn_exec_slot *slot;
+    wasm_module_inst_t module_inst;
+    wasi_nn_error ret = success;
+
+    if (inst == NULL || g >= inst->n_graphs) {
+        return invalid_argument;
+    }
+    if (inst->n_execs == NN_CACHE_MAX_EXEC_CONTEXTS) {
+        return too_large;
+    }
+
+    entry = inst->graphs[g];
+    slot = &inst->execs[inst->n_execs];
+
+    pthread_mutex_lock(&g_nn_cache.lock);
+    if (entry->n_idle > 0) {
+        slot->ctx = entry->idle[--entry->n_idle];
+    }
+    else {
+        ret = g_nn_cache.api.init_execution_context(entry->ctx, entry->g, &slot->ctx);
+    }
+    module_inst = inst->module_inst;
+    pthread_mutex_unlock(&g_nn_cache.lock);
+
+    if (ret != success) {
+        return ret;
+    }
+
+    slot->entry = entry;
+    *exec_ctx = inst->n_execs++;
+
+    /* Without its instance, the context is not one the natives can bind */
+    if (module_inst != NULL) {
+        evp_agent_wasi_nn_bind_context_created(module_inst, *exec_ctx, &g_nn_bind_ops);
+    }
+    return success;
+}
+
+__attribute__((visibility("default"))) wasi_nn_error set_input(void *ctx,
+                                                               graph_execution_context exec_ctx,
+                                                               uint32_t index, tensor *input_tensor)
+{
+    struct nn_exec_slot *slot = nn_instance_exec(ctx, exec_ctx);
+
+    if (slot == NULL) {
+        return invalid_argument;
+    }
+
+    return g_nn_cache.api.set_input(slot->entry->ctx, slot->ctx, index, input_tensor);
+}
+
+__attribute__((visibility("default"))) wasi_nn_error compute(void *ctx,
+                                                             graph_execution_context exec_ctx)
+{
+    struct nn_exec_slot *slot = nn_instance_exec(ctx, exec_ctx);
+
+    if (slot == NULL) {
+        return invalid_argument;
+    }
+
+    return g_nn_cache.api.compute(slot->entry->ctx, slot->ctx);
+}
+
+__attribute__((visibility("default"))) wasi_nn_error get_output(void *ctx,
+                                                                graph_execution_context exec_ctx,
+                                                                uint32_t index,
+                                                                tensor_data *output_tensor,
+                                                                uint32_t *output_tensor_size)
+{
+    struct nn_exec_slot *slot = nn_instance_exec(ctx, exec_ctx);
+
+    if (slot == NULL) {
+        return invalid_argument;
+    }
+
+    return g_nn_cache.api.get_output(slot->entry->ctx, slot->ctx, index, output_tensor,
+                                     output_tensor_size);
+}
@@ -14,7 +14,35 @@
 #define MBEDTLS_THREADING_C       1
 #define MBEDTLS_THREADING_PTHREAD 1
 
-#undef MBEDTLS_SSL_PROTO_TLS1_3
+/* Generated from the crypto_profile build option */
+#include "edc_mbedtls_profile.h"
+
+/*
+ * Crypto profile, see the crypto_profile build option. The accelerated one
+ * builds the AES, GCM and SHA code paths using the AES-NI and PCLMULQDQ
+ * instructions or the Armv8 cryptography extensions, each picked at runtime
+ * when the CPU has them, and uses larger ECC precomputation windows. The
+ * portable one is plain C.
+ */
+#if defined(EDC_MBEDTLS_ACCELERATED)
+#if defined(__x86_64__)
+#define MBEDTLS_AESNI_C
+#endif
+#if defined(__aarch64__)
+#define MBEDTLS_AESCE_C
+#define MBEDTLS_SHA256_USE_ARMV8_A_CRYPTO_IF_PRESENT
+#define MBEDTLS_SHA512_USE_A64_CRYPTO_IF_PRESENT
+#endif
+#define MBEDTLS_ECP_WINDOW_SIZE 6
+#else
+#undef MBEDTLS_AESNI_C
+#undef MBEDTLS_AESCE_C
+#endif
+
+/*
+ * TLS 1.3 is negotiated when the server supports it, with session tickets
+ * (MBEDTLS_SSL_SESSION_TICKETS) for resumption across reconnects.
+ */
 #undef MBEDTLS_DEBUG_C
 
 #endif /* MBEDTLS_USER_CONFIG_H */